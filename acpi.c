@@ -0,0 +1,107 @@
+#include "kernel.h"
+#include "acpi.h"
+#include "paging.h"
+
+struct acpi_rsdp {
+    char signature[8];                  // "RSD PTR "
+    unsigned char checksum;
+    char oem_id[6];
+    unsigned char revision;
+    unsigned int rsdt_address;
+    // ACPI 2.0+
+    unsigned int length;
+    unsigned long long xsdt_address;
+    unsigned char extended_checksum;
+    unsigned char reserved[3];
+} __attribute__((packed));
+
+static struct acpi_rsdp *rsdp = 0;
+static struct acpi_sdt_header *root_table = 0;
+static int root_is_xsdt = 0;
+
+static int checksum_ok(const void *data, unsigned int length) {
+    const unsigned char *bytes = data;
+    unsigned char sum = 0;
+    for (unsigned int i = 0; i < length; i++) sum += bytes[i];
+    return sum == 0;
+}
+
+static int signature_matches(const char *a, const char *b, int length) {
+    for (int i = 0; i < length; i++) if (a[i] != b[i]) return 0;
+    return 1;
+}
+
+// The RSDP sits on a 16-byte boundary in the first KB of the EBDA or in
+// the BIOS area 0xE0000-0xFFFFF.
+static struct acpi_rsdp *scan_for_rsdp(unsigned int start, unsigned int length) {
+    for (unsigned int addr = start & ~15; addr < start + length; addr += 16) {
+        struct acpi_rsdp *candidate = (struct acpi_rsdp *)addr;
+        if (signature_matches(candidate->signature, "RSD PTR ", 8) && checksum_ok(candidate, 20))
+            return candidate;
+    }
+    return 0;
+}
+
+void acpi_init() {
+    // EBDA segment from the BIOS data area (word at 0x40E); read through asm
+    // because GCC treats constant low addresses as null-pointer arithmetic
+    unsigned int ebda;
+    asm volatile("movzwl 0x40E, %0" : "=r"(ebda));
+    ebda <<= 4;
+    if (ebda) rsdp = scan_for_rsdp(ebda, 1024);
+    if (!rsdp) rsdp = scan_for_rsdp(0xE0000, 0x20000);
+    if (!rsdp) return;
+
+    // Prefer the XSDT when it exists and is reachable from 32-bit code
+    if (rsdp->revision >= 2 && rsdp->xsdt_address && !(rsdp->xsdt_address >> 32)) {
+        root_table = (struct acpi_sdt_header *)(unsigned int)rsdp->xsdt_address;
+        root_is_xsdt = 1;
+    } else {
+        root_table = (struct acpi_sdt_header *)rsdp->rsdt_address;
+    }
+    if (!checksum_ok(root_table, root_table->length)) root_table = 0;
+}
+
+int acpi_available() {
+    return root_table != 0;
+}
+
+unsigned char acpi_revision() {
+    return rsdp ? rsdp->revision : 0;
+}
+
+struct acpi_sdt_header *acpi_find_table(const char *signature) {
+    if (!root_table) return 0;
+
+    unsigned int entry_size = root_is_xsdt ? 8 : 4;
+    unsigned int count = (root_table->length - sizeof(struct acpi_sdt_header)) / entry_size;
+    unsigned char *entries = (unsigned char *)(root_table + 1);
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int *entry = (unsigned int *)(entries + i * entry_size);
+        if (root_is_xsdt && entry[1]) continue;     // above 4 GB
+        struct acpi_sdt_header *table = (struct acpi_sdt_header *)entry[0];
+        if (signature_matches(table->signature, signature, 4) && checksum_ok(table, table->length))
+            return table;
+    }
+    return 0;
+}
+
+// Tables usually sit in reserved memory near the top of RAM. Map each
+// header first so its length can be read once paging is on.
+static void map_table(unsigned int addr) {
+    paging_map_identity(addr, sizeof(struct acpi_sdt_header), PAGE_CACHE_WB);
+    paging_map_identity(addr, ((struct acpi_sdt_header *)addr)->length, PAGE_CACHE_WB);
+}
+
+void acpi_map_tables() {
+    if (!root_table) return;
+    map_table((unsigned int)root_table);
+
+    unsigned int entry_size = root_is_xsdt ? 8 : 4;
+    unsigned int count = (root_table->length - sizeof(struct acpi_sdt_header)) / entry_size;
+    unsigned char *entries = (unsigned char *)(root_table + 1);
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int *entry = (unsigned int *)(entries + i * entry_size);
+        if (!(root_is_xsdt && entry[1])) map_table(entry[0]);
+    }
+}
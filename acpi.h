@@ -0,0 +1,92 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+// ACPI table discovery: the RSDP is located once at boot and the RSDT (or
+// XSDT) is used to look tables up by signature.
+
+struct acpi_sdt_header {
+    char signature[4];
+    unsigned int length;
+    unsigned char revision;
+    unsigned char checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    unsigned int oem_revision;
+    unsigned int creator_id;
+    unsigned int creator_revision;
+} __attribute__((packed));
+
+// PCI Express memory-mapped configuration space ("MCFG")
+struct acpi_mcfg_entry {
+    unsigned long long base;
+    unsigned short segment;
+    unsigned char start_bus;
+    unsigned char end_bus;
+    unsigned int reserved;
+} __attribute__((packed));
+
+struct acpi_mcfg {
+    struct acpi_sdt_header header;
+    unsigned long long reserved;
+    struct acpi_mcfg_entry entries[];
+} __attribute__((packed));
+
+// Multiple APIC Description Table ("APIC"): one variable-length entry per
+// local APIC, I/O APIC and ISA interrupt override
+struct acpi_madt {
+    struct acpi_sdt_header header;
+    unsigned int lapic_address;
+    unsigned int flags;                 // bit 0: legacy 8259 PICs present
+    unsigned char entries[];
+} __attribute__((packed));
+
+#define MADT_LAPIC          0
+#define MADT_IOAPIC         1
+#define MADT_OVERRIDE       2
+#define MADT_LAPIC_ADDRESS  5
+
+struct acpi_madt_entry {
+    unsigned char type;
+    unsigned char length;
+} __attribute__((packed));
+
+struct acpi_madt_lapic {
+    struct acpi_madt_entry header;
+    unsigned char acpi_id;
+    unsigned char apic_id;
+    unsigned int flags;                 // bit 0: enabled, bit 1: can be enabled
+} __attribute__((packed));
+
+struct acpi_madt_ioapic {
+    struct acpi_madt_entry header;
+    unsigned char id;
+    unsigned char reserved;
+    unsigned int address;
+    unsigned int gsi_base;
+} __attribute__((packed));
+
+struct acpi_madt_override {
+    struct acpi_madt_entry header;
+    unsigned char bus;                  // always 0 (ISA)
+    unsigned char source;               // ISA IRQ
+    unsigned int gsi;
+    unsigned short flags;               // polarity bits 0-1, trigger mode bits 2-3
+} __attribute__((packed));
+
+struct acpi_madt_lapic_address {
+    struct acpi_madt_entry header;
+    unsigned short reserved;
+    unsigned long long address;
+} __attribute__((packed));
+
+void acpi_init();
+int acpi_available();
+unsigned char acpi_revision();
+
+// Returns the first table with a matching signature and valid checksum, or 0
+struct acpi_sdt_header *acpi_find_table(const char *signature);
+
+// Identity-map the root table and every table it lists (called by paging_init)
+void acpi_map_tables();
+
+#endif
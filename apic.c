@@ -0,0 +1,288 @@
+#include "kernel.h"
+#include "interrupts.h"
+#include "timer.h"
+#include "acpi.h"
+#include "pmm.h"
+#include "paging.h"
+#include "apic.h"
+#include "cpufeature.h"
+
+// Local APIC registers (offsets from the MMIO base)
+#define LAPIC_ID        0x020
+#define LAPIC_TPR       0x080
+#define LAPIC_EOI       0x0B0
+#define LAPIC_SVR       0x0F0
+#define LAPIC_ESR       0x280
+#define LAPIC_ICR_LO    0x300
+#define LAPIC_ICR_HI    0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_LINT1 0x360
+#define LAPIC_LVT_ERROR 0x370
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CUR 0x390
+#define LAPIC_TIMER_DIV 0x3E0
+
+#define LVT_MASKED      0x10000
+#define LVT_NMI         0x00400
+#define LVT_PERIODIC    0x20000
+#define LVT_TSC_DEADLINE 0x40000
+#define ICR_PENDING     0x01000
+#define ICR_INIT        0x04500         // INIT, level assert
+#define ICR_STARTUP     0x04600
+#define APIC_BASE_MSR   0x1B
+#define APIC_BASE_ENABLE 0x800
+#define TSC_DEADLINE_MSR 0x6E0
+
+#define IOAPIC_REGSEL   0x00
+#define IOAPIC_WINDOW   0x10
+#define IOAPIC_VER      0x01
+#define IOAPIC_REDTBL   0x10
+
+#define CALIBRATE_MS    10
+
+static volatile unsigned int *lapic = 0;
+static volatile unsigned int *ioapic = 0;
+static struct apic_info info;
+static int active = 0;
+
+static unsigned int cpu_apic_ids[APIC_MAX_CPUS];
+static unsigned int cpu_count = 0;
+
+// ISA IRQ -> I/O APIC input, with the MADT polarity/trigger flags
+static unsigned int isa_gsi[IRQ_COUNT];
+static unsigned short isa_flags[IRQ_COUNT];
+
+// ============================================================================
+// REGISTER ACCESS
+// ============================================================================
+
+static inline unsigned int lapic_read(unsigned int reg) {
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(unsigned int reg, unsigned int value) {
+    lapic[reg / 4] = value;
+}
+
+static unsigned int ioapic_read(unsigned int reg) {
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    return ioapic[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(unsigned int reg, unsigned int value) {
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    ioapic[IOAPIC_WINDOW / 4] = value;
+}
+
+static void delay_us(unsigned int us) {
+    unsigned long long end = now_ns() + us * 1000ULL;
+    while (now_ns() < end) asm volatile("pause");
+}
+
+// ============================================================================
+// LOCAL APIC
+// ============================================================================
+
+unsigned int lapic_id() {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi() {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+// Software-enable with the spurious vector, accept every priority, and
+// take LINT0 (the 8259's ExtINT line) out of the picture
+static void lapic_setup() {
+    lapic_write(LAPIC_SVR, 0x100 | VECTOR_APIC_SPURIOUS);
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_LINT0, LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, LVT_NMI);
+    lapic_write(LAPIC_LVT_ERROR, LVT_MASKED);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ESR, 0);
+    lapic_eoi();
+}
+
+void lapic_init_ap() {
+    lapic_setup();
+}
+
+// The ICR is one register pair per CPU; a thread switch between the two
+// writes would let another thread's IPI clobber the destination.
+static void send_icr(unsigned int apic_id, unsigned int command) {
+    unsigned int flags = irq_save();
+    while (lapic_read(LAPIC_ICR_LO) & ICR_PENDING) asm volatile("pause");
+    lapic_write(LAPIC_ICR_HI, apic_id << 24);
+    lapic_write(LAPIC_ICR_LO, command);
+    while (lapic_read(LAPIC_ICR_LO) & ICR_PENDING) asm volatile("pause");
+    irq_restore(flags);
+}
+
+void lapic_send_ipi(unsigned int apic_id, unsigned char vector) {
+    send_icr(apic_id, vector);
+}
+
+void lapic_start_ap(unsigned int apic_id, unsigned int trampoline) {
+    send_icr(apic_id, ICR_INIT);
+    delay_us(10000);
+    for (int i = 0; i < 2; i++) {
+        send_icr(apic_id, ICR_STARTUP | (trampoline >> 12));
+        delay_us(200);
+    }
+}
+
+// One-shot countdown from the maximum across CALIBRATE_MS of now_ns().
+// Once only: every CPU's timer runs off the same bus clock.
+void lapic_timer_calibrate() {
+    if (info.lapic_timer_khz) return;
+    lapic_write(LAPIC_TIMER_DIV, 0x3);                  // divide by 16
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    delay_us(CALIBRATE_MS * 1000);
+    unsigned int elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CUR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    info.lapic_timer_khz = elapsed / CALIBRATE_MS;
+}
+
+int lapic_timer_start(unsigned int hz) {
+    if (!info.lapic_timer_khz) return 0;
+    lapic_write(LAPIC_TIMER_DIV, 0x3);
+    lapic_write(LAPIC_LVT_TIMER, LVT_PERIODIC | VECTOR_APIC_TIMER);
+    lapic_write(LAPIC_TIMER_INIT, info.lapic_timer_khz * 1000 / hz);
+    return 1;
+}
+
+// The switch to TSC-deadline mode must land before the first deadline
+// write, which an MMIO store alone does not guarantee (SDM 10.5.4.1)
+void lapic_timer_oneshot(int tsc_deadline) {
+    lapic_write(LAPIC_TIMER_DIV, 0x3);
+    lapic_write(LAPIC_LVT_TIMER, (tsc_deadline ? LVT_TSC_DEADLINE : 0) | VECTOR_APIC_TIMER);
+    if (tsc_deadline) asm volatile("mfence" : : : "memory");
+}
+
+void lapic_timer_arm(unsigned int ns) {
+    unsigned long long count = div_u64_rem((unsigned long long)ns * info.lapic_timer_khz, 1000000, 0);
+    lapic_write(LAPIC_TIMER_INIT, !count ? 1 : (count >> 32) ? 0xFFFFFFFF : (unsigned int)count);
+}
+
+void lapic_timer_arm_deadline(unsigned long long tsc) {
+    asm volatile("wrmsr" : : "a"((unsigned int)tsc), "d"((unsigned int)(tsc >> 32)), "c"(TSC_DEADLINE_MSR));
+}
+
+// ============================================================================
+// I/O APIC
+// ============================================================================
+
+// Edge/high unless the MADT says otherwise (ISA defaults)
+static void ioapic_route(unsigned char irq, unsigned int dest_apic_id) {
+    unsigned int entry = isa_gsi[irq] - info.ioapic_gsi_base;
+    if (entry >= info.ioapic_inputs) return;
+    unsigned int low = (IRQ_BASE + irq) | LVT_MASKED;
+    if ((isa_flags[irq] & 0x3) == 0x3) low |= 1 << 13;          // active low
+    if (((isa_flags[irq] >> 2) & 0x3) == 0x3) low |= 1 << 15;   // level triggered
+    ioapic_write(IOAPIC_REDTBL + entry * 2 + 1, dest_apic_id << 24);
+    ioapic_write(IOAPIC_REDTBL + entry * 2, low);
+}
+
+void ioapic_set_masked(unsigned char irq, int masked) {
+    if (!active || irq >= IRQ_COUNT) return;
+    unsigned int entry = isa_gsi[irq] - info.ioapic_gsi_base;
+    if (entry >= info.ioapic_inputs) return;
+    unsigned int flags = irq_save();
+    unsigned int low = ioapic_read(IOAPIC_REDTBL + entry * 2);
+    ioapic_write(IOAPIC_REDTBL + entry * 2, masked ? (low | LVT_MASKED) : (low & ~LVT_MASKED));
+    irq_restore(flags);
+}
+
+// ============================================================================
+// INITIALIZATION
+// ============================================================================
+
+static void parse_madt(struct acpi_madt *madt) {
+    unsigned long long lapic_base = madt->lapic_address;
+    for (unsigned int i = 0; i < IRQ_COUNT; i++) isa_gsi[i] = i;
+
+    unsigned char *p = madt->entries, *end = (unsigned char *)madt + madt->header.length;
+    while (p + sizeof(struct acpi_madt_entry) <= end) {
+        struct acpi_madt_entry *entry = (struct acpi_madt_entry *)p;
+        if (entry->length < sizeof(*entry)) break;
+        if (entry->type == MADT_LAPIC) {
+            struct acpi_madt_lapic *cpu = (struct acpi_madt_lapic *)entry;
+            if ((cpu->flags & 1) && cpu_count < APIC_MAX_CPUS) cpu_apic_ids[cpu_count++] = cpu->apic_id;
+        } else if (entry->type == MADT_IOAPIC && !info.ioapic_base) {
+            struct acpi_madt_ioapic *io = (struct acpi_madt_ioapic *)entry;
+            info.ioapic_base = io->address;
+            info.ioapic_gsi_base = io->gsi_base;
+        } else if (entry->type == MADT_OVERRIDE) {
+            struct acpi_madt_override *o = (struct acpi_madt_override *)entry;
+            if (o->bus == 0 && o->source < IRQ_COUNT) {
+                isa_gsi[o->source] = o->gsi;
+                isa_flags[o->source] = o->flags;
+                if (o->gsi != o->source) info.overrides++;
+            }
+        } else if (entry->type == MADT_LAPIC_ADDRESS) {
+            lapic_base = ((struct acpi_madt_lapic_address *)entry)->address;
+        }
+        p += entry->length;
+    }
+    if (!(lapic_base >> 32)) info.lapic_base = (unsigned int)lapic_base;
+
+    // An ISA IRQ whose own input was taken by an override (IRQ 0 on GSI 2
+    // displaces the cascade) has nowhere to go
+    for (unsigned int i = 0; i < IRQ_COUNT; i++)
+        for (unsigned int j = 0; j < IRQ_COUNT; j++)
+            if (j != i && isa_gsi[j] == i && isa_gsi[i] == i) isa_gsi[i] = 0xFFFFFFFF;
+}
+
+int apic_init() {
+    if (!cpu_has(CPU_FEATURE_APIC)) return 0;
+    struct acpi_madt *madt = (struct acpi_madt *)acpi_find_table("APIC");
+    if (!madt) return 0;
+    parse_madt(madt);
+    if (!info.lapic_base || !info.ioapic_base || !cpu_count) return 0;
+
+    lapic = paging_map_identity(info.lapic_base, PAGE_SIZE, PAGE_CACHE_UC);
+    ioapic = paging_map_identity(info.ioapic_base, PAGE_SIZE, PAGE_CACHE_UC);
+    if (!lapic || !ioapic) return 0;
+
+    unsigned int lo, hi;
+    asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(APIC_BASE_MSR));
+    asm volatile("wrmsr" : : "a"(lo | APIC_BASE_ENABLE), "d"(hi), "c"(APIC_BASE_MSR));
+    lapic_setup();
+
+    // Boot CPU first, so CPU index 0 is always the one running now
+    unsigned int bsp = lapic_id();
+    for (unsigned int i = 1; i < cpu_count; i++) {
+        if (cpu_apic_ids[i] != bsp) continue;
+        cpu_apic_ids[i] = cpu_apic_ids[0];
+        cpu_apic_ids[0] = bsp;
+    }
+
+    // Every input masked; the ISA IRQs go to the boot CPU on the vectors
+    // the PICs used and are unmasked as handlers register
+    info.ioapic_inputs = ((ioapic_read(IOAPIC_VER) >> 16) & 0xFF) + 1;
+    for (unsigned int i = 0; i < info.ioapic_inputs; i++) ioapic_write(IOAPIC_REDTBL + i * 2, LVT_MASKED);
+    for (unsigned char irq = 0; irq < IRQ_COUNT; irq++) ioapic_route(irq, bsp);
+
+    active = 1;
+    return 1;
+}
+
+int apic_active() {
+    return active;
+}
+
+unsigned int apic_cpu_count() {
+    return active ? cpu_count : 1;
+}
+
+unsigned int apic_cpu_apic_id(unsigned int index) {
+    return index < cpu_count ? cpu_apic_ids[index] : 0;
+}
+
+void apic_get_info(struct apic_info *out) {
+    *out = info;
+}
@@ -0,0 +1,53 @@
+#ifndef APIC_H
+#define APIC_H
+
+// Local APIC and I/O APIC. The MADT names every CPU's APIC ID, where the
+// I/O APIC lives and how ISA IRQs map onto its inputs. Once apic_init()
+// has routed the ISA IRQs through the I/O APIC (to the boot CPU, on the
+// same vectors the 8259s used), the PICs are masked for good and EOIs go
+// to the local APIC.
+
+#define APIC_MAX_CPUS 16
+
+// Returns 1 if the I/O APIC now delivers the legacy IRQs; 0 leaves the
+// kernel on the 8259 PICs and a single CPU
+int apic_init();
+int apic_active();
+
+// CPUs listed as enabled in the MADT, boot CPU first
+unsigned int apic_cpu_count();
+unsigned int apic_cpu_apic_id(unsigned int index);
+
+// Local APIC of the calling CPU
+unsigned int lapic_id();
+void lapic_init_ap();
+void lapic_eoi();
+void lapic_send_ipi(unsigned int apic_id, unsigned char vector);
+
+// INIT, then two STARTUP IPIs pointing at the real-mode page 'trampoline'
+void lapic_start_ap(unsigned int apic_id, unsigned int trampoline);
+
+// Local timer on the calling CPU; the rate is calibrated once against
+// now_ns() on the boot CPU. lapic_timer_start() runs it periodically (0 if
+// it was never calibrated). lapic_timer_oneshot() switches it to one-shot
+// mode, counting down from each lapic_timer_arm(), or with 'tsc_deadline'
+// firing when the TSC reaches each lapic_timer_arm_deadline().
+void lapic_timer_calibrate();
+int lapic_timer_start(unsigned int hz);
+void lapic_timer_oneshot(int tsc_deadline);
+void lapic_timer_arm(unsigned int ns);
+void lapic_timer_arm_deadline(unsigned long long tsc);
+
+// Mask or unmask an ISA IRQ at its I/O APIC input
+void ioapic_set_masked(unsigned char irq, int masked);
+
+struct apic_info {
+    unsigned int lapic_base;
+    unsigned int ioapic_base, ioapic_gsi_base, ioapic_inputs;
+    unsigned int overrides;             // ISA IRQs not on the matching GSI
+    unsigned int lapic_timer_khz;       // local timer input clock / 16
+};
+
+void apic_get_info(struct apic_info *info);
+
+#endif
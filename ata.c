@@ -0,0 +1,317 @@
+#include "kernel.h"
+#include "interrupts.h"
+#include "timer.h"
+#include "pmm.h"
+#include "pci.h"
+#include "block.h"
+#include "ata.h"
+
+// Command block registers (offsets from the channel base)
+#define ATA_DATA      0
+#define ATA_ERROR     1
+#define ATA_COUNT     2
+#define ATA_LBA0      3
+#define ATA_LBA1      4
+#define ATA_LBA2      5
+#define ATA_DRIVE     6
+#define ATA_STATUS    7                 // read
+#define ATA_COMMAND   7                 // write
+
+// Control block: alternate status (read) / device control (write)
+#define ATA_CTRL_NIEN 0x02
+
+#define ATA_SR_ERR    0x01
+#define ATA_SR_DRQ    0x08
+#define ATA_SR_DF     0x20
+#define ATA_SR_BSY    0x80
+
+#define ATA_CMD_READ_DMA      0xC8
+#define ATA_CMD_READ_DMA_EXT  0x25
+#define ATA_CMD_WRITE_DMA     0xCA
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_IDENTIFY      0xEC
+
+// Bus master registers (offsets from BAR4 + 8 * channel)
+#define BM_COMMAND    0
+#define BM_STATUS     2
+#define BM_PRDT       4
+#define BM_START      0x01
+#define BM_READ       0x08              // device to memory
+#define BM_ST_ERROR   0x02
+#define BM_ST_IRQ     0x04
+#define BM_ST_DMA_CAPABLE 0x60          // both drives; set for the BIOS's benefit
+
+#define PRD_EOT       0x8000
+
+#define ATA_MAX_SECTORS  256            // LBA28's largest count
+#define ATA_MAX_SEGMENTS 16
+#define ATA_LBA28_LIMIT  0x10000000ULL
+#define ATA_PROBE_NS     500000000ULL
+
+// Physical Region Descriptor: one contiguous piece of the transfer
+struct prd {
+    unsigned int addr;
+    unsigned short bytes;               // 0 means 64 KB
+    unsigned short flags;
+} __attribute__((packed));
+
+struct ata_drive;
+
+struct ata_channel {
+    unsigned short base, ctrl, bm;
+    unsigned char irq;
+    struct spinlock lock;               // everything below
+    struct prd *prdt;                   // identity mapped: also its physical address
+    struct block_request *active;       // the channel runs one command at a time
+    struct ata_drive *active_drive;
+    int selected;                       // drive in the drive register, -1 if unknown
+    struct ata_drive *drives[2];
+};
+
+struct ata_drive {
+    struct block_device dev;
+    struct ata_channel *channel;
+    unsigned int slave;
+};
+
+static struct ata_channel channels[ATA_CHANNELS];
+static struct ata_drive drives[ATA_CHANNELS * 2];
+
+// ============================================================================
+// COMMANDS
+// ============================================================================
+
+// Reading the alternate status four times gives the 400 ns a newly
+// selected drive needs before its status means anything
+static void ata_delay(struct ata_channel *ch) {
+    for (int i = 0; i < 4; i++) inb(ch->ctrl);
+}
+
+static void ata_select(struct ata_channel *ch, unsigned int slave, unsigned char bits) {
+    outb(ch->base + ATA_DRIVE, bits | (slave << 4));
+    if (ch->selected != (int)slave) {
+        ata_delay(ch);
+        ch->selected = slave;
+    }
+}
+
+// A PRD entry may not cross a 64 KB boundary
+static void build_prdt(struct ata_channel *ch, const struct block_request *req) {
+    unsigned int n = 0;
+    for (; req; req = req->merged) {
+        unsigned int addr = (unsigned int)req->buffer, left = req->count * BLOCK_SECTOR_SIZE;
+        while (left) {
+            unsigned int chunk = 0x10000 - (addr & 0xFFFF);
+            if (chunk > left) chunk = left;
+            ch->prdt[n].addr = addr;
+            ch->prdt[n].bytes = chunk & 0xFFFF;
+            ch->prdt[n].flags = 0;
+            n++;
+            addr += chunk;
+            left -= chunk;
+        }
+    }
+    ch->prdt[n - 1].flags = PRD_EOT;
+}
+
+// Called by the block layer with the device lock held, interrupts off.
+// LBA28 is used whenever it reaches: it is four port writes fewer, and
+// every port write is a VM exit under emulation.
+static int ata_start(struct block_device *dev, struct block_request *req) {
+    struct ata_drive *drive = dev->driver_data;
+    struct ata_channel *ch = drive->channel;
+    spin_lock(&ch->lock);
+    if (ch->active) {
+        spin_unlock(&ch->lock);
+        return BLOCK_BUSY;
+    }
+    ch->active = req;
+    ch->active_drive = drive;
+
+    unsigned long long lba = req->lba;
+    unsigned int count = 0;
+    for (const struct block_request *r = req; r; r = r->merged) count += r->count;
+    unsigned char direction = req->write ? 0 : BM_READ;
+
+    build_prdt(ch, req);
+    outl(ch->bm + BM_PRDT, (unsigned int)ch->prdt);
+    outb(ch->bm + BM_COMMAND, direction);
+    outb(ch->bm + BM_STATUS, inb(ch->bm + BM_STATUS) | BM_ST_IRQ | BM_ST_ERROR);
+
+    if (lba + count > ATA_LBA28_LIMIT) {
+        ata_select(ch, drive->slave, 0x40);
+        outb(ch->base + ATA_COUNT, count >> 8);
+        outb(ch->base + ATA_LBA0, lba >> 24);
+        outb(ch->base + ATA_LBA1, lba >> 32);
+        outb(ch->base + ATA_LBA2, lba >> 40);
+        outb(ch->base + ATA_COUNT, count);
+        outb(ch->base + ATA_LBA0, lba);
+        outb(ch->base + ATA_LBA1, lba >> 8);
+        outb(ch->base + ATA_LBA2, lba >> 16);
+        outb(ch->base + ATA_COMMAND, req->write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT);
+    } else {
+        ata_select(ch, drive->slave, 0xE0 | ((lba >> 24) & 0x0F));
+        outb(ch->base + ATA_COUNT, count);      // 256 is written as 0
+        outb(ch->base + ATA_LBA0, lba);
+        outb(ch->base + ATA_LBA1, lba >> 8);
+        outb(ch->base + ATA_LBA2, lba >> 16);
+        outb(ch->base + ATA_COMMAND, req->write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+    }
+    outb(ch->bm + BM_COMMAND, direction | BM_START);
+    spin_unlock(&ch->lock);
+    return 0;
+}
+
+static const struct block_ops ata_ops = { ata_start, 0 };
+
+// The bus master status says whether the drive raised the interrupt;
+// reading the drive's status register then acknowledges it
+static void channel_irq(struct ata_channel *ch) {
+    spin_lock(&ch->lock);
+    unsigned char bm_status = inb(ch->bm + BM_STATUS);
+    if (!(bm_status & BM_ST_IRQ) || !ch->active) {
+        inb(ch->base + ATA_STATUS);
+        spin_unlock(&ch->lock);
+        return;
+    }
+    outb(ch->bm + BM_COMMAND, 0);
+    unsigned char status = inb(ch->base + ATA_STATUS);
+    outb(ch->bm + BM_STATUS, bm_status | BM_ST_IRQ | BM_ST_ERROR);
+    struct block_request *req = ch->active;
+    struct ata_drive *drive = ch->active_drive;
+    ch->active = 0;
+    spin_unlock(&ch->lock);
+
+    int error = (bm_status & BM_ST_ERROR) || (status & (ATA_SR_ERR | ATA_SR_DF));
+    block_complete(req, error ? BLOCK_ERROR : BLOCK_OK);
+
+    // The other drive's commands were turned away while this one ran
+    struct ata_drive *other = ch->drives[!drive->slave];
+    if (other) block_kick(&other->dev);
+}
+
+static void ata_irq_primary(struct interrupt_frame *frame) {
+    channel_irq(&channels[0]);
+}
+
+static void ata_irq_secondary(struct interrupt_frame *frame) {
+    channel_irq(&channels[1]);
+}
+
+// ============================================================================
+// PROBE
+// ============================================================================
+
+static int wait_not_busy(struct ata_channel *ch) {
+    unsigned long long deadline = now_ns() + ATA_PROBE_NS;
+    while (inb(ch->base + ATA_STATUS) & ATA_SR_BSY)
+        if (now_ns() > deadline) return 0;
+    return 1;
+}
+
+// IDENTIFY by PIO, with the channel's interrupt disabled. A missing drive
+// reads as 0 (or 0xFF on a floating bus); ATAPI and SATA drives abort
+// with their signature in the LBA registers.
+static int identify(struct ata_channel *ch, unsigned int slave, unsigned short *id) {
+    ata_select(ch, slave, 0xA0);
+    outb(ch->base + ATA_COUNT, 0);
+    outb(ch->base + ATA_LBA0, 0);
+    outb(ch->base + ATA_LBA1, 0);
+    outb(ch->base + ATA_LBA2, 0);
+    outb(ch->base + ATA_COMMAND, ATA_CMD_IDENTIFY);
+    ata_delay(ch);
+    unsigned char status = inb(ch->base + ATA_STATUS);
+    if (status == 0 || status == 0xFF) return 0;
+    if (!wait_not_busy(ch)) return 0;
+    if (inb(ch->base + ATA_LBA1) || inb(ch->base + ATA_LBA2)) return 0;
+
+    unsigned long long deadline = now_ns() + ATA_PROBE_NS;
+    while (!((status = inb(ch->base + ATA_STATUS)) & (ATA_SR_DRQ | ATA_SR_ERR)))
+        if (now_ns() > deadline) return 0;
+    if (status & ATA_SR_ERR) return 0;
+    for (int i = 0; i < 256; i++) id[i] = inw(ch->base + ATA_DATA);
+    return 1;
+}
+
+// Words 27-46, two characters per word with the first in the high byte
+static void copy_model(char *out, const unsigned short *id) {
+    for (int i = 0; i < 20; i++) {
+        out[i * 2] = id[27 + i] >> 8;
+        out[i * 2 + 1] = id[27 + i] & 0xFF;
+    }
+    int len = 40;
+    while (len > 0 && out[len - 1] == ' ') len--;
+    out[len] = '\0';
+}
+
+static void probe_drive(struct ata_channel *ch, unsigned int index, unsigned int slave) {
+    unsigned short id[256];
+    if (!identify(ch, slave, id)) return;
+    if (!(id[49] & (1 << 9)) || !(id[49] & (1 << 8))) return;   // no LBA or no DMA
+
+    struct ata_drive *drive = &drives[index * 2 + slave];
+    struct block_device *dev = &drive->dev;
+    drive->channel = ch;
+    drive->slave = slave;
+    if (id[83] & (1 << 10)) {
+        dev->sectors = id[100] | ((unsigned int)id[101] << 16) |
+                       ((unsigned long long)id[102] << 32) | ((unsigned long long)id[103] << 48);
+    } else {
+        dev->sectors = id[60] | ((unsigned int)id[61] << 16);
+    }
+    if (!dev->sectors) return;
+
+    dev->name[0] = 'h';
+    dev->name[1] = 'd';
+    dev->name[2] = 'a' + index * 2 + slave;
+    dev->name[3] = '\0';
+    dev->driver = "ata";
+    copy_model(dev->model, id);
+    dev->max_sectors = ATA_MAX_SECTORS;
+    dev->max_segments = ATA_MAX_SEGMENTS;
+    dev->queue_depth = 1;
+    dev->ops = &ata_ops;
+    dev->driver_data = drive;
+    ch->drives[slave] = drive;
+    block_register(dev);
+}
+
+static void probe_channel(struct pci_device *pci, unsigned int index) {
+    struct ata_channel *ch = &channels[index];
+    // prog_if bit 0 (primary) / bit 2 (secondary): native mode, ports in the BARs
+    if (pci->prog_if & (1 << (index * 2))) {
+        if (!pci->bars[index * 2].is_io || !pci->bars[index * 2 + 1].is_io) return;
+        ch->base = pci->bars[index * 2].base;
+        ch->ctrl = pci->bars[index * 2 + 1].base + 2;
+        ch->irq = pci->irq_line;
+    } else {
+        ch->base = index ? 0x170 : 0x1F0;
+        ch->ctrl = index ? 0x376 : 0x3F6;
+        ch->irq = index ? 15 : 14;
+    }
+    ch->bm = pci->bars[4].base + index * 8;
+    ch->lock = (struct spinlock)SPINLOCK_INIT;
+    ch->selected = -1;
+
+    ch->prdt = (struct prd *)pmm_alloc_frame();
+    if (!ch->prdt) return;
+
+    outb(ch->ctrl, ATA_CTRL_NIEN);
+    probe_drive(ch, index, 0);
+    probe_drive(ch, index, 1);
+    if (!ch->drives[0] && !ch->drives[1]) {
+        pmm_free_frame((unsigned int)ch->prdt);
+        return;
+    }
+    outb(ch->bm + BM_STATUS, BM_ST_DMA_CAPABLE | BM_ST_IRQ | BM_ST_ERROR);
+    irq_register(ch->irq, index ? ata_irq_secondary : ata_irq_primary);
+    outb(ch->ctrl, 0);
+}
+
+void ata_init() {
+    struct pci_device *pci = pci_find_class(0x01, 0x01, 0);
+    // prog_if bit 7: the controller can bus master
+    if (!pci || !(pci->prog_if & 0x80) || !pci->bars[4].is_io || !pci->bars[4].base) return;
+    pci_enable(pci, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+    for (unsigned int i = 0; i < ATA_CHANNELS; i++) probe_channel(pci, i);
+}
@@ -0,0 +1,15 @@
+#ifndef ATA_H
+#define ATA_H
+
+// IDE disks on the PCI IDE controller (PIIX3/PIIX4 in QEMU and on old
+// chipsets), in compatibility mode: the primary channel at 0x1F0/0x3F6 on
+// IRQ 14 and the secondary at 0x170/0x376 on IRQ 15. Transfers use the
+// controller's bus-master DMA engine (BAR4) with a PRD table per channel;
+// the drive interrupts once the whole command is done. ATAPI drives are
+// skipped. Disks are registered as hda-hdd.
+
+#define ATA_CHANNELS 2
+
+void ata_init();
+
+#endif
@@ -0,0 +1,345 @@
+#include "kernel.h"
+#include "pmm.h"
+#include "heap.h"
+#include "commands.h"
+#include "bcache.h"
+
+#define BCACHE_MAX_PAGES (BCACHE_MAX_MB * (1024 * 1024 / BCACHE_PAGE_SIZE))
+#define BCACHE_RA_DEVICES 8
+
+// Read-ahead stream of one device: 'last' is the newest page the stream
+// reached, 'end' the first page not yet read ahead
+struct ra_state {
+    struct block_device *dev;
+    unsigned long long last, end;
+    unsigned int window;                // pages; 0 while access looks random
+};
+
+// The wait queue's lock guards the whole cache, so a reader can sleep on
+// a loading page without a window for the completion to slip through
+static struct wait_queue cache_wait = WAIT_QUEUE_INIT;
+static struct bcache_page *hash[BCACHE_HASH_SIZE];
+static struct bcache_page **slots;      // every page, in CLOCK order
+static unsigned int slot_count = 0, hand = 0;
+static unsigned int budget = 0;
+static struct kmem_cache *page_cache;
+static struct ra_state ra_states[BCACHE_RA_DEVICES];
+static struct bcache_stats stats;
+
+// ============================================================================
+// HASH
+// ============================================================================
+
+static struct bcache_page **hash_bucket(struct block_device *dev, unsigned long long index) {
+    unsigned int key = ((unsigned int)index ^ (unsigned int)(index >> 32)) * 2654435761u ^ ((unsigned int)dev >> 4);
+    return &hash[(key >> 12) & (BCACHE_HASH_SIZE - 1)];
+}
+
+static struct bcache_page *hash_find(struct block_device *dev, unsigned long long index) {
+    struct bcache_page *page = *hash_bucket(dev, index);
+    while (page && (page->dev != dev || page->index != index)) page = page->hash_next;
+    return page;
+}
+
+static void hash_remove(struct bcache_page *page) {
+    struct bcache_page **link = hash_bucket(page->dev, page->index);
+    while (*link && *link != page) link = &(*link)->hash_next;
+    if (*link) *link = page->hash_next;
+    page->hash_next = 0;
+}
+
+// ============================================================================
+// REPLACEMENT
+// ============================================================================
+
+// Caller holds the cache lock. Drops whatever the page held.
+static void page_forget(struct bcache_page *page) {
+    if (page->state == BCACHE_FREE) return;
+    hash_remove(page);
+    if (page->readahead) stats.ra_wasted++;
+    page->state = BCACHE_FREE;
+    page->readahead = 0;
+}
+
+static int page_busy(const struct bcache_page *page) {
+    return page->refs || page->state == BCACHE_LOADING;
+}
+
+// CLOCK: sweep from the hand, giving referenced pages a second chance
+static struct bcache_page *evict() {
+    for (unsigned int scanned = 0; scanned < slot_count * 2; scanned++) {
+        struct bcache_page *page = slots[hand];
+        if (++hand == slot_count) hand = 0;
+        if (page_busy(page)) continue;
+        if (page->referenced) {
+            page->referenced = 0;
+            continue;
+        }
+        if (page->state != BCACHE_FREE) stats.evictions++;
+        page_forget(page);
+        return page;
+    }
+    return 0;
+}
+
+// Below the budget a new page is allocated; at it, one is evicted
+static struct bcache_page *page_alloc() {
+    if (slot_count < budget) {
+        struct bcache_page *page = kmem_cache_alloc(page_cache);
+        unsigned int frame = page ? pmm_alloc_frame() : 0;
+        if (frame) {
+            memset(page, 0, sizeof(*page));
+            page->data = (unsigned char *)frame;
+            slots[slot_count++] = page;
+            return page;
+        }
+        if (page) kmem_cache_free(page_cache, page);
+    }
+    return slot_count ? evict() : 0;
+}
+
+// Free unused pages until at most 'target' remain
+static void release(unsigned int target) {
+    for (unsigned int i = slot_count; i-- > 0 && slot_count > target;) {
+        struct bcache_page *page = slots[i];
+        if (page_busy(page)) continue;
+        page_forget(page);
+        pmm_free_frame((unsigned int)page->data);
+        kmem_cache_free(page_cache, page);
+        slots[i] = slots[--slot_count];
+    }
+    if (hand >= slot_count) hand = 0;
+}
+
+// ============================================================================
+// READING
+// ============================================================================
+
+static void read_done(struct block_request *req) {
+    struct bcache_page *page = req->private;
+    unsigned int flags = spin_lock_irqsave(&cache_wait.lock);
+    page->state = req->status == BLOCK_OK ? BCACHE_VALID : BCACHE_ERROR;
+    if (page->state == BCACHE_ERROR) stats.errors++;
+    spin_unlock_irqrestore(&cache_wait.lock, flags);
+    wait_queue_wake_all(&cache_wait);
+}
+
+static unsigned long long device_pages(const struct block_device *dev) {
+    return (dev->sectors + BCACHE_PAGE_SECTORS - 1) / BCACHE_PAGE_SECTORS;
+}
+
+// Caller holds the cache lock
+static void start_read(struct bcache_page *page, struct block_device *dev, unsigned long long index, int readahead) {
+    page->dev = dev;
+    page->index = index;
+    page->state = BCACHE_LOADING;
+    page->referenced = 1;
+    page->readahead = readahead;
+    struct bcache_page **bucket = hash_bucket(dev, index);
+    page->hash_next = *bucket;
+    *bucket = page;
+
+    // The device's last page may be partial
+    unsigned long long lba = index * BCACHE_PAGE_SECTORS;
+    unsigned int count = dev->sectors - lba < BCACHE_PAGE_SECTORS ? dev->sectors - lba : BCACHE_PAGE_SECTORS;
+    if (count < BCACHE_PAGE_SECTORS)
+        memset(page->data + count * BLOCK_SECTOR_SIZE, 0, (BCACHE_PAGE_SECTORS - count) * BLOCK_SECTOR_SIZE);
+    page->req.dev = dev;
+    page->req.lba = lba;
+    page->req.count = count;
+    page->req.buffer = page->data;
+    page->req.write = 0;
+    page->req.done = read_done;
+    page->req.private = page;
+    if (block_submit(&page->req) != BLOCK_OK) page->state = BCACHE_ERROR;
+}
+
+static struct ra_state *ra_state(struct block_device *dev) {
+    for (unsigned int i = 0; i < BCACHE_RA_DEVICES; i++) {
+        struct ra_state *ra = &ra_states[i];
+        if (ra->dev == dev) return ra;
+        if (!ra->dev) {
+            ra->dev = dev;
+            ra->last = ra->end = ~0ULL;
+            return ra;
+        }
+    }
+    return 0;
+}
+
+// Caller holds the cache lock. An access moving forward through the
+// window (or just past it) continues the stream; a miss anywhere else
+// starts a new one with no read-ahead. Hits elsewhere are left alone,
+// since they are mostly metadata between the data pages. The window is
+// topped up once half of it has been consumed, so read-ahead goes out
+// in batches the block layer can merge into large commands.
+static void readahead(struct block_device *dev, unsigned long long index, int miss, int ra_hit) {
+    struct ra_state *ra = ra_state(dev);
+    if (!ra) return;
+    int sequential = ra->last != ~0ULL && index > ra->last && index <= ra->end;
+    if (!sequential) {
+        if (miss) {
+            ra->last = index;
+            ra->end = index + 1;
+            ra->window = 0;
+        }
+        return;
+    }
+    ra->last = index;
+    if (!ra->window) ra->window = BCACHE_RA_MIN;
+    else if ((miss || ra_hit) && ra->window < BCACHE_RA_MAX) ra->window *= 2;
+    if (ra->end <= index) ra->end = index + 1;
+    if (ra->end - index - 1 > ra->window / 2) return;
+
+    unsigned long long limit = index + 1 + ra->window, pages = device_pages(dev);
+    if (limit > pages) limit = pages;
+    for (; ra->end < limit; ra->end++) {
+        if (hash_find(dev, ra->end)) continue;
+        struct bcache_page *page = page_alloc();
+        if (!page) break;
+        start_read(page, dev, ra->end, 1);
+        stats.ra_pages++;
+    }
+}
+
+struct bcache_page *bcache_get(struct block_device *dev, unsigned long long index) {
+    if (index >= device_pages(dev)) return 0;
+    unsigned int flags = spin_lock_irqsave(&cache_wait.lock);
+    stats.lookups++;
+    struct bcache_page *page = hash_find(dev, index);
+    // A failed read nobody waited for (read-ahead, mostly) stays hashed
+    // until a lookup finds it; that lookup retries the device instead of
+    // counting a hit and returning the stale error
+    if (page && page->state == BCACHE_ERROR && !page->refs) {
+        page_forget(page);
+        page = 0;
+    }
+    int miss = !page, ra_hit = 0;
+    if (page) {
+        stats.hits++;
+        if (page->readahead) {
+            page->readahead = 0;
+            stats.ra_hits++;
+            ra_hit = 1;
+        }
+    } else {
+        stats.misses++;
+        page = page_alloc();
+        if (!page) {
+            spin_unlock_irqrestore(&cache_wait.lock, flags);
+            return 0;
+        }
+        start_read(page, dev, index, 0);
+    }
+    page->refs++;
+    page->referenced = 1;
+    readahead(dev, index, miss, ra_hit);
+
+    while (page->state == BCACHE_LOADING) wait_queue_sleep(&cache_wait);
+    if (page->state != BCACHE_VALID) {
+        // The first reader to see the error unhashes the page so the next
+        // lookup retries the device
+        page_forget(page);
+        page->refs--;
+        page = 0;
+    }
+    spin_unlock_irqrestore(&cache_wait.lock, flags);
+    return page;
+}
+
+void bcache_put(struct bcache_page *page) {
+    unsigned int flags = spin_lock_irqsave(&cache_wait.lock);
+    page->refs--;
+    spin_unlock_irqrestore(&cache_wait.lock, flags);
+}
+
+int bcache_read(struct block_device *dev, unsigned long long offset, void *buffer, unsigned int len) {
+    unsigned char *out = buffer;
+    while (len) {
+        unsigned int in_page = offset & (BCACHE_PAGE_SIZE - 1);
+        unsigned int chunk = BCACHE_PAGE_SIZE - in_page < len ? BCACHE_PAGE_SIZE - in_page : len;
+        struct bcache_page *page = bcache_get(dev, offset / BCACHE_PAGE_SIZE);
+        if (!page) return BLOCK_ERROR;
+        memcpy(out, page->data + in_page, chunk);
+        bcache_put(page);
+        out += chunk;
+        offset += chunk;
+        len -= chunk;
+    }
+    return BLOCK_OK;
+}
+
+// ============================================================================
+// CONTROL
+// ============================================================================
+
+void bcache_set_budget(unsigned int pages) {
+    if (pages > BCACHE_MAX_PAGES) pages = BCACHE_MAX_PAGES;
+    unsigned int flags = spin_lock_irqsave(&cache_wait.lock);
+    budget = pages;
+    release(budget);
+    spin_unlock_irqrestore(&cache_wait.lock, flags);
+}
+
+void bcache_drop() {
+    unsigned int flags = spin_lock_irqsave(&cache_wait.lock);
+    release(0);
+    for (unsigned int i = 0; i < BCACHE_RA_DEVICES; i++) {
+        ra_states[i].last = ra_states[i].end = ~0ULL;
+        ra_states[i].window = 0;
+    }
+    spin_unlock_irqrestore(&cache_wait.lock, flags);
+}
+
+void bcache_get_stats(struct bcache_stats *out) {
+    unsigned int flags = spin_lock_irqsave(&cache_wait.lock);
+    *out = stats;
+    out->pages = slot_count;
+    out->budget_pages = budget;
+    spin_unlock_irqrestore(&cache_wait.lock, flags);
+}
+
+void bcache_init() {
+    page_cache = kmem_cache_create("bcache", sizeof(struct bcache_page));
+    slots = kmalloc(BCACHE_MAX_PAGES * sizeof(struct bcache_page *));
+    if (page_cache && slots) budget = BCACHE_DEFAULT_MB * (1024 * 1024 / BCACHE_PAGE_SIZE);
+}
+
+// ============================================================================
+// CACHESTAT
+// ============================================================================
+
+static void print_ratio(const char *label, unsigned int part, unsigned int whole) {
+    unsigned int pct = whole ? (unsigned int)div_u64_rem((unsigned long long)part * 10000, whole, 0) : 0;
+    kprintf("%s%u.%02u%%", label, pct / 100, pct % 100);
+}
+
+void cmd_cachestat(int argc, char **argv) {
+    if (argc == 2) {
+        if (strcmp(argv[1], "drop") == 0) {
+            bcache_drop();
+            print("\nPage cache dropped");
+            return;
+        }
+        int mb = atoi(argv[1]);
+        if (mb <= 0 || mb > BCACHE_MAX_MB) { print("\nBudget must be 1-256 MB, or 'drop'"); return; }
+        bcache_set_budget(mb * (1024 * 1024 / BCACHE_PAGE_SIZE));
+    }
+
+    struct bcache_stats s;
+    bcache_get_stats(&s);
+    kprintf("\n=== PAGE CACHE ===\nBudget: %u KB (%u pages), %u pages in use (%u KB)",
+            s.budget_pages * 4, s.budget_pages, s.pages, s.pages * 4);
+    kprintf("\nLookups: %u, hits: %u, misses: %u", s.lookups, s.hits, s.misses);
+    print_ratio(", hit rate: ", s.hits, s.lookups);
+    kprintf("\nEvictions: %u, I/O errors: %u", s.evictions, s.errors);
+    kprintf("\nRead-ahead: %u pages, %u used, %u evicted unused", s.ra_pages, s.ra_hits, s.ra_wasted);
+    print_ratio(", efficiency: ", s.ra_hits, s.ra_pages);
+
+    unsigned int flags = spin_lock_irqsave(&cache_wait.lock);
+    struct ra_state streams[BCACHE_RA_DEVICES];
+    memcpy(streams, ra_states, sizeof(streams));
+    spin_unlock_irqrestore(&cache_wait.lock, flags);
+    for (unsigned int i = 0; i < BCACHE_RA_DEVICES && streams[i].dev; i++)
+        kprintf("\n  %-4s window %u pages", streams[i].dev->name, streams[i].window);
+}
@@ -0,0 +1,61 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "block.h"
+
+// Page cache for block devices. Device contents are cached in 4 KB pages
+// keyed by (device, page index) and found through a hash table; pages
+// are replaced by CLOCK (second chance) once the memory budget is used
+// up. Misses that continue a sequential stream start asynchronous
+// read-ahead of the following pages; the window doubles while the
+// stream keeps hitting read-ahead pages and collapses on a random miss.
+// Filesystems read through bcache_get()/bcache_read() and never touch
+// the block layer directly. Read-only: nothing is ever written back.
+
+#define BCACHE_PAGE_SIZE 4096
+#define BCACHE_PAGE_SECTORS (BCACHE_PAGE_SIZE / BLOCK_SECTOR_SIZE)
+#define BCACHE_HASH_SIZE 1024
+#define BCACHE_DEFAULT_MB 8
+#define BCACHE_MAX_MB 256
+#define BCACHE_RA_MIN 4                 // pages
+#define BCACHE_RA_MAX 32
+
+#define BCACHE_FREE    0                // holds nothing
+#define BCACHE_LOADING 1
+#define BCACHE_VALID   2
+#define BCACHE_ERROR   3
+
+struct bcache_page {
+    struct block_device *dev;
+    unsigned long long index;           // device offset / BCACHE_PAGE_SIZE
+    unsigned char *data;
+    unsigned int refs;
+    unsigned char state;
+    unsigned char referenced;           // CLOCK bit
+    unsigned char readahead;            // read ahead and not used yet
+    struct bcache_page *hash_next;
+    struct block_request req;
+};
+
+struct bcache_stats {
+    unsigned int pages, budget_pages;
+    unsigned int lookups, hits, misses;
+    unsigned int evictions, errors;
+    unsigned int ra_pages, ra_hits, ra_wasted;
+};
+
+void bcache_init();
+
+// Page holding 'index', read and waited for if needed, with a reference
+// the caller drops with bcache_put(); 0 on I/O error or out of range
+struct bcache_page *bcache_get(struct block_device *dev, unsigned long long index);
+void bcache_put(struct bcache_page *page);
+
+// Copy 'len' bytes at byte 'offset' of the device; BLOCK_OK or BLOCK_ERROR
+int bcache_read(struct block_device *dev, unsigned long long offset, void *buffer, unsigned int len);
+
+void bcache_set_budget(unsigned int pages);
+void bcache_drop();                     // forget every unused page
+void bcache_get_stats(struct bcache_stats *stats);
+
+#endif
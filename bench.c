@@ -0,0 +1,354 @@
+#include "kernel.h"
+#include "interrupts.h"
+#include "timer.h"
+#include "pmm.h"
+#include "heap.h"
+#include "pci.h"
+#include "commands.h"
+#include "bench.h"
+#include "cpufeature.h"
+
+#define HIST_BUCKETS 10
+#define HIST_WIDTH 40
+
+static int tsc_state = 0;               // 0 = not probed, 1 = usable, -1 = none
+static int have_lfence = 0, have_rdtscp = 0;
+static unsigned int harness_overhead = 0;
+
+// ============================================================================
+// TIMING
+// ============================================================================
+
+// LFENCE keeps RDTSC from starting before earlier instructions finish;
+// without SSE2 the fully serializing (and much slower) CPUID is used.
+static inline unsigned long long tsc_begin() {
+    unsigned int lo, hi;
+    if (have_lfence) {
+        asm volatile("lfence\n\trdtsc" : "=a"(lo), "=d"(hi) : : "memory");
+    } else {
+        asm volatile("cpuid\n\trdtsc" : "=a"(lo), "=d"(hi) : "a"(0) : "ebx", "ecx", "memory");
+    }
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+// RDTSCP waits for the measured code to retire; the trailing LFENCE keeps
+// later instructions from being hoisted above the read.
+static inline unsigned long long tsc_end() {
+    unsigned int lo, hi;
+    if (have_rdtscp) {
+        asm volatile("rdtscp\n\tlfence" : "=a"(lo), "=d"(hi) : : "ecx", "memory");
+    } else if (have_lfence) {
+        asm volatile("lfence\n\trdtsc\n\tlfence" : "=a"(lo), "=d"(hi) : : "memory");
+    } else {
+        asm volatile("cpuid\n\trdtsc" : "=a"(lo), "=d"(hi) : "a"(0) : "ebx", "ecx", "memory");
+    }
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+static unsigned int take_sample(const struct bench *bench) {
+    if (bench->setup) bench->setup();
+    unsigned int flags = irq_save();
+    unsigned long long start = tsc_begin();
+    bench->run();
+    unsigned long long cycles = tsc_end() - start;
+    irq_restore(flags);
+
+    if (cycles > 0xFFFFFFFF) cycles = 0xFFFFFFFF;
+    return (unsigned int)cycles > harness_overhead ? (unsigned int)cycles - harness_overhead : 0;
+}
+
+// ============================================================================
+// STATISTICS
+// ============================================================================
+
+// Elements compare by key[element], or by their own value without a key
+static inline unsigned int sort_key(const unsigned int *key, unsigned int v) {
+    return key ? key[v] : v;
+}
+
+static void sift_down(unsigned int *a, unsigned int root, unsigned int n, const unsigned int *key) {
+    for (;;) {
+        unsigned int child = root * 2 + 1;
+        if (child >= n) return;
+        if (child + 1 < n && sort_key(key, a[child + 1]) > sort_key(key, a[child])) child++;
+        if (sort_key(key, a[root]) >= sort_key(key, a[child])) return;
+        unsigned int temp = a[root];
+        a[root] = a[child];
+        a[child] = temp;
+        root = child;
+    }
+}
+
+// Heapsort: no recursion and no scratch memory
+void bench_sort_by(unsigned int *a, unsigned int n, const unsigned int *key) {
+    for (unsigned int i = n / 2; i-- > 0;) sift_down(a, i, n, key);
+    for (unsigned int end = n; end-- > 1;) {
+        unsigned int temp = a[0];
+        a[0] = a[end];
+        a[end] = temp;
+        sift_down(a, 0, end, key);
+    }
+}
+
+void bench_sort(unsigned int *a, unsigned int n) {
+    bench_sort_by(a, n, 0);
+}
+
+static void empty_body() {
+}
+
+int bench_available() {
+    if (tsc_state) return tsc_state > 0;
+    tsc_state = -1;
+    if (!cpu_has(CPU_FEATURE_TSC)) return 0;
+    have_lfence = cpu_has(CPU_FEATURE_SSE2);
+    have_rdtscp = cpu_has(CPU_FEATURE_RDTSCP);
+    tsc_state = 1;
+
+    // Calibrate with an empty body run through the same path
+    static const struct bench empty = { "empty", "", 0, empty_body, 1000, 0 };
+    unsigned int min = 0xFFFFFFFF;
+    for (int i = 0; i < 1000; i++) {
+        unsigned int cycles = take_sample(&empty);
+        if (cycles < min) min = cycles;
+    }
+    harness_overhead = min;
+    return 1;
+}
+
+void bench_run(const struct bench *bench, unsigned int iterations, unsigned int *samples, struct bench_result *result) {
+    for (unsigned int i = 0; i < iterations / 10 + 1; i++) take_sample(bench);
+    for (unsigned int i = 0; i < iterations; i++) samples[i] = take_sample(bench);
+    bench_sort(samples, iterations);
+
+    unsigned int p99 = iterations * 99 / 100;
+    result->iterations = iterations;
+    result->min = samples[0];
+    result->median = samples[iterations / 2];
+    result->p99 = samples[p99 < iterations ? p99 : iterations - 1];
+    result->max = samples[iterations - 1];
+}
+
+// Linear buckets from min to p99; everything slower goes in the last row
+void bench_print_histogram(const unsigned int *samples, const struct bench_result *result) {
+    unsigned int counts[HIST_BUCKETS + 1] = { 0 };
+    unsigned int width = (result->p99 - result->min) / HIST_BUCKETS + 1;
+    for (unsigned int i = 0; i < result->iterations; i++) {
+        unsigned int bucket = HIST_BUCKETS;
+        if (samples[i] <= result->p99) {
+            bucket = (samples[i] - result->min) / width;
+            if (bucket >= HIST_BUCKETS) bucket = HIST_BUCKETS - 1;
+        }
+        counts[bucket]++;
+    }
+
+    unsigned int peak = 1;
+    for (int i = 0; i <= HIST_BUCKETS; i++) if (counts[i] > peak) peak = counts[i];
+
+    static const char hashes[HIST_WIDTH + 1] = "########################################";
+    for (int i = 0; i <= HIST_BUCKETS; i++) {
+        if (i == HIST_BUCKETS && !counts[i]) break;
+        if (i < HIST_BUCKETS) kprintf("\n%10u |", result->min + i * width);
+        else print("\n     > p99 |");
+        unsigned int bar = (unsigned int)div_u64_rem((unsigned long long)counts[i] * HIST_WIDTH, peak, 0);
+        if (counts[i] && !bar) bar = 1;
+        kprintf("%.*s %u", (int)bar, hashes, counts[i]);
+    }
+}
+
+// ============================================================================
+// BUILT-IN BENCHMARKS
+// ============================================================================
+
+static char scratch[20];
+static volatile unsigned int bench_sink;   // keeps results of pure loops alive
+static unsigned int bench_row;
+static const char *dispatch_name = "heapstat";
+
+static void setup_print() { console_set_cursor(bench_row, 0); }
+static void run_print() { print("0123456789abcdef"); }
+static void setup_scroll() { console_set_cursor(console_rows() - 1, 0); }
+static void run_scroll() { print("\n"); }
+static void run_clear() { clear_screen(); }
+
+static void run_pci_read() { pci_config_read(0, 0, 0, 0); }
+
+// What devlist cost before the device table: a vendor ID read for
+// function 0 of every device on every bus
+static void run_pci_scan() {
+    for (unsigned int bus = 0; bus < 256; bus++)
+        for (unsigned char device = 0; device < 32; device++)
+            pci_config_read(bus, device, 0, 0);
+}
+
+static void run_pci_table() {
+    unsigned int count = pci_device_count();
+    for (unsigned int i = 0; i < count; i++) bench_sink = pci_get_device(i)->vendor_id;
+}
+
+static void run_rtc() {
+    unsigned char hour, minute, second;
+    get_rtc_time(&hour, &minute, &second);
+}
+
+static void run_pmm() {
+    unsigned int frame = pmm_alloc_frame();
+    if (frame) pmm_free_frame(frame);
+}
+
+static void run_kmalloc() { kfree(kmalloc(64)); }
+static void run_itoa() { itoa(-1234567890, scratch); }
+static void run_hex() { uint_to_hex(0xDEADBEEF, scratch); }
+
+static char format_line[CONSOLE_COLS + 1];
+static void run_ksnprintf() {
+    ksnprintf(format_line, sizeof(format_line), "%4u %-16s%-5s%5u%4u%8llu%10u",
+              12, "shell", "run", 1, 0, 1234567890123ULL, 4567);
+}
+static void run_dispatch() { command_lookup(dispatch_name); }
+
+// The baseline it replaced: execute_command()'s if/else chain, one strcmp
+// per command in the order it tested them (echo and the math commands
+// were prefix matches there; the cost per miss is the same)
+static const char *const chain_names[] = {
+    "clear", "echo", "add", "sub", "mul", "div", "info", "cpuinfo", "meminfo",
+    "memstat", "heapstat", "kbdstat", "vgainfo", "devlist", "uptime", "sysinfo", "portlist",
+};
+
+static void run_dispatch_chain() {
+    unsigned int i = 0;
+    while (i < sizeof(chain_names) / sizeof(chain_names[0]) && strcmp(dispatch_name, chain_names[i]) != 0) i++;
+    bench_sink = i;
+}
+
+// 4 KB, a page: the size that page zeroing and buffer copies deal in
+static unsigned char copy_src[4096] __attribute__((aligned(16)));
+static unsigned char copy_dst[4096] __attribute__((aligned(4096)));
+static const char *bench_string = "the quick brown fox jumps over the lazy dog, twice: the quick";
+
+static void run_memcpy_rep() { memcpy_rep(copy_dst, copy_src, sizeof(copy_dst)); }
+static void run_memset_rep() { memset_rep(copy_dst, 0, sizeof(copy_dst)); }
+
+// Benchmarks run with interrupts off, where memcpy() never takes the bulk
+// path, so call the variants directly
+static void run_memcpy_sse2() {
+    if (cpu_has(CPU_FEATURE_SSE2)) memcpy_sse2(copy_dst, copy_src, sizeof(copy_dst));
+    else memcpy_rep(copy_dst, copy_src, sizeof(copy_dst));
+}
+
+static void run_memset_sse2() {
+    if (cpu_has(CPU_FEATURE_SSE2)) memset_sse2(copy_dst, 0, sizeof(copy_dst));
+    else memset_rep(copy_dst, 0, sizeof(copy_dst));
+}
+
+static void run_zero_page() { zero_page_bulk(copy_dst); }
+
+// A full Ethernet payload
+static void run_csum() { bench_sink = csum_fold(csum_bulk(copy_src, 1500, 0)); }
+static void run_csum_adc() { bench_sink = csum_fold(csum_partial_adc(copy_src, 1500, 0)); }
+
+static void run_strlen() { bench_sink = strlen(bench_string); }
+static void run_strcmp() { bench_sink = strcmp(bench_string, "the quick brown fox jumps over the lazy dog, twice: the quicK"); }
+
+static const struct bench builtin_benches[] = {
+    { "print",      "print 16 chars, no scrolling",      setup_print,  run_print,       1000, 1 },
+    { "scroll",     "print a newline on the bottom row", setup_scroll, run_scroll,      1000, 1 },
+    { "clear",      "clear_screen",                      0,            run_clear,       200,  1 },
+    { "pci-read",   "one pci_config_read",               0,            run_pci_read,    1000, 0 },
+    { "pci-scan",   "brute-force scan of 256 buses",     0,            run_pci_scan,    10,   0 },
+    { "pci-table",  "walk the cached device table",      0,            run_pci_table,   1000, 0 },
+    { "rtc",        "get_rtc_time",                      0,            run_rtc,         200,  0 },
+    { "pmm",        "pmm_alloc_frame + pmm_free_frame",  0,            run_pmm,         1000, 0 },
+    { "kmalloc",    "kmalloc(64) + kfree",               0,            run_kmalloc,     1000, 0 },
+    { "itoa",       "itoa of a 10-digit number",         0,            run_itoa,        1000, 0 },
+    { "hex",        "uint_to_hex",                       0,            run_hex,         1000, 0 },
+    { "ksnprintf",  "format a ps row, 64-bit column",    0,            run_ksnprintf,   1000, 0 },
+    { "dispatch",   "command lookup by name",            0,            run_dispatch,    1000, 0 },
+    { "if-chain",   "same lookup, old 17-way strcmp chain", 0,         run_dispatch_chain, 1000, 0 },
+    { "memcpy",     "4 KB memcpy, REP MOVSD",            0,            run_memcpy_rep,  1000, 0 },
+    { "memcpy-sse", "4 KB memcpy, SSE2",                 0,            run_memcpy_sse2, 1000, 0 },
+    { "memset",     "4 KB memset, REP STOSD",            0,            run_memset_rep,  1000, 0 },
+    { "memset-sse", "4 KB memset, SSE2",                 0,            run_memset_sse2, 1000, 0 },
+    { "zero-page",  "4 KB page zeroing, bound variant",  0,            run_zero_page,   1000, 0 },
+    { "csum",       "1500-byte checksum, bound variant", 0,            run_csum,        1000, 0 },
+    { "csum-adc",   "1500-byte checksum, ADC chain",     0,            run_csum_adc,    1000, 0 },
+    { "strlen",     "strlen of a 61-char string",        0,            run_strlen,      1000, 0 },
+    { "strcmp",     "strcmp differing in the last char", 0,            run_strcmp,      1000, 0 },
+};
+
+#define BENCH_COUNT (sizeof(builtin_benches) / sizeof(builtin_benches[0]))
+
+// ============================================================================
+// COMMAND
+// ============================================================================
+
+static void print_result_row(const char *name, const struct bench_result *result) {
+    kprintf("\n%-10s%7u%10u%10u%10u%11u", name, result->iterations, result->min,
+            result->median, result->p99, result->max);
+
+    unsigned int khz = timer_tsc_khz();
+    if (khz) kprintf("%11llu", div_u64_rem((unsigned long long)result->median * 1000000, khz, 0));
+}
+
+void cmd_bench(int argc, char **argv) {
+    if (argc == 1) {
+        print("\nUsage: bench <name|all> [iterations]\n");
+        for (unsigned int i = 0; i < BENCH_COUNT; i++) {
+            kprintf("\n%-11s%s", builtin_benches[i].name, builtin_benches[i].help);
+        }
+        return;
+    }
+    if (!bench_available()) { print("\nNo time stamp counter on this CPU"); return; }
+
+    unsigned int iterations = 0;
+    if (argc == 3) {
+        int n = atoi(argv[2]);
+        if (n <= 0) { print("\nIterations must be a positive number"); return; }
+        iterations = n > BENCH_MAX_ITERATIONS ? BENCH_MAX_ITERATIONS : n;
+    }
+
+    unsigned int first = 0, last = BENCH_COUNT;
+    if (strcmp(argv[1], "all") != 0) {
+        while (first < BENCH_COUNT && strcmp(builtin_benches[first].name, argv[1]) != 0) first++;
+        if (first == BENCH_COUNT) { kprintf("\nUnknown benchmark: %s", argv[1]); return; }
+        last = first + 1;
+    }
+
+    unsigned int most = iterations;
+    int draws = 0;
+    for (unsigned int i = first; i < last; i++) {
+        if (!iterations && builtin_benches[i].iterations > most) most = builtin_benches[i].iterations;
+        draws |= builtin_benches[i].uses_console;
+    }
+    unsigned int *samples = kmalloc(most * sizeof(unsigned int));
+    if (!samples) { print("\nOut of memory"); return; }
+
+    print("\nRunning...\n");
+    unsigned int col;
+    console_get_cursor(&bench_row, &col);
+    // Time the VGA path alone; the serial mirror is paced by the baud rate
+    if (draws) console_set_mirror(0);
+
+    struct bench_result results[BENCH_COUNT];
+    for (unsigned int i = first; i < last; i++)
+        bench_run(&builtin_benches[i], iterations ? iterations : builtin_benches[i].iterations, samples, &results[i]);
+
+    // Console benchmarks scribble over the screen; report on a fresh one
+    if (draws) {
+        clear_screen();
+        console_set_mirror(1);
+    }
+    print("\n=== BENCHMARK RESULTS (cycles) ===\n");
+    print("\nName        Iters       Min    Median       P99        Max");
+    if (timer_tsc_khz()) print("  Median ns");
+    for (unsigned int i = first; i < last; i++) print_result_row(builtin_benches[i].name, &results[i]);
+
+    if (last - first == 1) {
+        print("\n");
+        bench_print_histogram(samples, &results[first]);
+    }
+
+    kprintf("\n\nHarness overhead subtracted: %u cycles (%s)", harness_overhead,
+            have_rdtscp ? "RDTSCP" : have_lfence ? "LFENCE+RDTSC" : "CPUID+RDTSC");
+    kfree(samples);
+}
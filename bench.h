@@ -0,0 +1,39 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Cycle-accurate microbenchmarks. Every sample brackets one call of the
+// benchmark body with serialized TSC reads (LFENCE/RDTSCP where the CPU
+// has them, CPUID otherwise) and runs with interrupts off, so timer ticks
+// land between samples rather than inside them. The harness cost measured
+// at first use is subtracted from every sample.
+
+#define BENCH_MAX_ITERATIONS 100000
+
+struct bench {
+    const char *name;
+    const char *help;
+    void (*setup)();                    // untimed, before every sample (may be 0)
+    void (*run)();
+    unsigned int iterations;            // default sample count
+    int uses_console;                   // draws on the screen while it runs
+};
+
+struct bench_result {
+    unsigned int iterations;
+    unsigned int min, median, p99, max; // cycles
+};
+
+// Returns 0 when the CPU has no usable TSC
+int bench_available();
+
+// Warm up, take 'iterations' samples into 'samples' (left sorted), summarize
+void bench_run(const struct bench *bench, unsigned int iterations, unsigned int *samples, struct bench_result *result);
+
+void bench_print_histogram(const unsigned int *samples, const struct bench_result *result);
+
+// Ascending, in place; for other latency samples too (timerstat).
+// bench_sort_by() sorts indices into 'key' by key[index] (prof report).
+void bench_sort(unsigned int *a, unsigned int n);
+void bench_sort_by(unsigned int *a, unsigned int n, const unsigned int *key);
+
+#endif
@@ -0,0 +1,333 @@
+#include "kernel.h"
+#include "interrupts.h"
+#include "timer.h"
+#include "pmm.h"
+#include "commands.h"
+#include "block.h"
+#include "ata.h"
+#include "virtio_blk.h"
+
+#define BLOCK_SYNC_BATCH 8              // block_read/write commands queued at once
+
+#define BLKBENCH_BLOCK 4096
+#define BLKBENCH_SECTORS (BLKBENCH_BLOCK / BLOCK_SECTOR_SIZE)
+#define BLKBENCH_DEPTH 32               // requests kept queued
+#define BLKBENCH_MAX_MB 256
+
+static struct block_device *devices = 0, *devices_tail = 0;
+static unsigned int device_count = 0;
+
+// ============================================================================
+// QUEUE
+// ============================================================================
+
+static unsigned int chain_sectors(const struct block_request *req, unsigned int *segments) {
+    unsigned int sectors = 0, n = 0;
+    for (; req; req = req->merged, n++) sectors += req->count;
+    if (segments) *segments = n;
+    return sectors;
+}
+
+// Caller holds dev->lock. The queue is sorted by LBA, so the scan stops
+// at the first request starting past the end of the new one.
+static int try_merge(struct block_device *dev, struct block_request *req) {
+    struct block_request **link = &dev->queue;
+    for (struct block_request *r = dev->queue; r; link = &r->next, r = r->next) {
+        if (r->lba > req->lba + req->count) break;
+        if (r->write != req->write) continue;
+        unsigned int segments, sectors = chain_sectors(r, &segments);
+        if (segments >= dev->max_segments || sectors + req->count > dev->max_sectors) continue;
+        if (r->lba + sectors == req->lba) {
+            // Back merge: req continues r's command
+            struct block_request *tail = r;
+            while (tail->merged) tail = tail->merged;
+            tail->merged = req;
+            return 1;
+        }
+        if (req->lba + req->count == r->lba) {
+            // Front merge: req takes r's place and leads the command
+            req->merged = r;
+            req->next = r->next;
+            r->next = 0;
+            *link = req;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void insert_sorted(struct block_device *dev, struct block_request *req) {
+    struct block_request **link = &dev->queue;
+    while (*link && (*link)->lba <= req->lba) link = &(*link)->next;
+    req->next = *link;
+    *link = req;
+}
+
+// C-SCAN: the first command at or past where the last one ended, wrapping
+// to the lowest LBA when nothing is left ahead
+static struct block_request **elevator_next(struct block_device *dev) {
+    struct block_request **link = &dev->queue;
+    while (*link && (*link)->lba < dev->next_lba) link = &(*link)->next;
+    return *link ? link : &dev->queue;
+}
+
+// Caller holds dev->lock
+static void dispatch(struct block_device *dev) {
+    int started = 0;
+    while (dev->queue && dev->in_flight < dev->queue_depth) {
+        struct block_request **link = elevator_next(dev);
+        struct block_request *req = *link;
+        if (dev->ops->start(dev, req) == BLOCK_BUSY) break;
+        *link = req->next;
+        req->next = 0;
+        dev->in_flight++;
+        dev->next_lba = req->lba + chain_sectors(req, 0);
+        dev->stats.commands++;
+        started = 1;
+    }
+    if (started && dev->ops->commit) dev->ops->commit(dev);
+}
+
+int block_submit(struct block_request *req) {
+    struct block_device *dev = req->dev;
+    if (!req->count || req->count > dev->max_sectors ||
+        req->lba >= dev->sectors || req->count > dev->sectors - req->lba) return BLOCK_ERROR;
+    req->status = BLOCK_PENDING;
+    req->next = req->merged = 0;
+
+    unsigned int flags = spin_lock_irqsave(&dev->lock);
+    dev->stats.requests++;
+    if (try_merge(dev, req)) dev->stats.merges++;
+    else insert_sorted(dev, req);
+    dispatch(dev);
+    spin_unlock_irqrestore(&dev->lock, flags);
+    return BLOCK_OK;
+}
+
+// IRQ context: 'req' is a command as passed to ops->start
+void block_complete(struct block_request *req, int status) {
+    struct block_device *dev = req->dev;
+    unsigned int flags = spin_lock_irqsave(&dev->lock);
+    dev->in_flight--;
+    unsigned int sectors = chain_sectors(req, 0);
+    if (req->write) dev->stats.sectors_written += sectors;
+    else dev->stats.sectors_read += sectors;
+    if (status != BLOCK_OK) dev->stats.errors++;
+    dispatch(dev);
+    spin_unlock_irqrestore(&dev->lock, flags);
+
+    // A waiter may reuse its request the moment the status changes, so
+    // nothing in it is touched afterwards unless it has a callback
+    while (req) {
+        struct block_request *next = req->merged;
+        block_done_t done = req->done;
+        req->merged = 0;
+        req->status = status;
+        if (done) done(req);
+        req = next;
+    }
+    wait_queue_wake_all(&dev->wait);
+}
+
+// For drivers whose device shares hardware with another (two ATA drives
+// on one channel): retry commands that start() turned away as busy
+void block_kick(struct block_device *dev) {
+    unsigned int flags = spin_lock_irqsave(&dev->lock);
+    dispatch(dev);
+    spin_unlock_irqrestore(&dev->lock, flags);
+}
+
+// ============================================================================
+// SYNCHRONOUS I/O
+// ============================================================================
+
+static int block_rw(struct block_device *dev, unsigned long long lba, unsigned int count,
+                    unsigned char *buffer, int write) {
+    if (lba >= dev->sectors || count > dev->sectors - lba) return BLOCK_ERROR;
+    struct block_request reqs[BLOCK_SYNC_BATCH];
+    int result = BLOCK_OK;
+    while (count) {
+        unsigned int n = 0;
+        for (; n < BLOCK_SYNC_BATCH && count; n++) {
+            unsigned int chunk = count < dev->max_sectors ? count : dev->max_sectors;
+            struct block_request *req = &reqs[n];
+            req->dev = dev;
+            req->lba = lba;
+            req->count = chunk;
+            req->buffer = buffer;
+            req->write = write;
+            req->done = 0;
+            req->private = 0;
+            block_submit(req);
+            lba += chunk;
+            buffer += chunk * BLOCK_SECTOR_SIZE;
+            count -= chunk;
+        }
+        unsigned int flags = spin_lock_irqsave(&dev->wait.lock);
+        for (unsigned int i = 0; i < n; i++) {
+            while (reqs[i].status == BLOCK_PENDING) wait_queue_sleep(&dev->wait);
+            if (reqs[i].status != BLOCK_OK) result = BLOCK_ERROR;
+        }
+        spin_unlock_irqrestore(&dev->wait.lock, flags);
+    }
+    return result;
+}
+
+int block_read(struct block_device *dev, unsigned long long lba, unsigned int count, void *buffer) {
+    return block_rw(dev, lba, count, buffer, 0);
+}
+
+int block_write(struct block_device *dev, unsigned long long lba, unsigned int count, const void *buffer) {
+    return block_rw(dev, lba, count, (unsigned char *)buffer, 1);
+}
+
+// ============================================================================
+// REGISTRY
+// ============================================================================
+
+void block_register(struct block_device *dev) {
+    dev->lock = (struct spinlock)SPINLOCK_INIT;
+    dev->wait = (struct wait_queue)WAIT_QUEUE_INIT;
+    dev->queue = 0;
+    dev->next_lba = 0;
+    dev->in_flight = 0;
+    memset(&dev->stats, 0, sizeof(dev->stats));
+    dev->next = 0;
+    if (devices_tail) devices_tail->next = dev;
+    else devices = dev;
+    devices_tail = dev;
+    device_count++;
+}
+
+unsigned int block_device_count() {
+    return device_count;
+}
+
+struct block_device *block_get_device(unsigned int index) {
+    struct block_device *dev = devices;
+    while (dev && index--) dev = dev->next;
+    return dev;
+}
+
+struct block_device *block_find(const char *name) {
+    for (struct block_device *dev = devices; dev; dev = dev->next)
+        if (strcmp(dev->name, name) == 0) return dev;
+    return 0;
+}
+
+void block_init() {
+    ata_init();
+    virtio_blk_init();
+}
+
+// ============================================================================
+// BLKBENCH
+// ============================================================================
+
+// 4 KB reads with BLKBENCH_DEPTH requests outstanding: each completion
+// queues the next read straight from the IRQ, so the device never idles
+// waiting for the shell thread
+struct blkbench {
+    struct block_device *dev;
+    struct spinlock lock;
+    int random;
+    unsigned int blocks;                // 4 KB blocks on the device
+    unsigned int seed;
+    unsigned int issued, total, errors;
+    unsigned int completed;             // atomic; see blkbench_done()
+};
+
+static void blkbench_issue(struct blkbench *b, struct block_request *req) {
+    unsigned int flags = spin_lock_irqsave(&b->lock);
+    unsigned int block = b->issued++;
+    if (b->random) {
+        // xorshift32
+        b->seed ^= b->seed << 13;
+        b->seed ^= b->seed >> 17;
+        b->seed ^= b->seed << 5;
+        block = b->seed;
+    }
+    spin_unlock_irqrestore(&b->lock, flags);
+    req->lba = (unsigned long long)(block % b->blocks) * BLKBENCH_SECTORS;
+    block_submit(req);
+}
+
+// 'b' is on the waiting thread's stack and gone once the last completion
+// is counted, so the count comes last, after any reissue, and is the
+// release the waiter's acquire pairs with
+static void blkbench_done(struct block_request *req) {
+    struct blkbench *b = req->private;
+    unsigned int flags = spin_lock_irqsave(&b->lock);
+    if (req->status != BLOCK_OK) b->errors++;
+    int more = b->issued < b->total;
+    spin_unlock_irqrestore(&b->lock, flags);
+    if (more) blkbench_issue(b, req);
+    __atomic_add_fetch(&b->completed, 1, __ATOMIC_RELEASE);
+}
+
+static void blkbench_pass(struct block_device *dev, int random, unsigned int total,
+                          struct block_request *reqs, unsigned char *buffers) {
+    unsigned long long blocks = dev->sectors / BLKBENCH_SECTORS;
+    struct blkbench b = { dev, SPINLOCK_INIT, random, blocks > 0xFFFFFFFF ? 0xFFFFFFFF : (unsigned int)blocks,
+                          0x2545F491, 0, total, 0, 0 };
+
+    unsigned int flags = spin_lock_irqsave(&dev->lock);
+    struct block_stats before = dev->stats;
+    spin_unlock_irqrestore(&dev->lock, flags);
+
+    unsigned long long start = now_ns();
+    unsigned int depth = total < BLKBENCH_DEPTH ? total : BLKBENCH_DEPTH;
+    for (unsigned int i = 0; i < depth; i++) {
+        reqs[i].dev = dev;
+        reqs[i].count = BLKBENCH_SECTORS;
+        reqs[i].buffer = buffers + i * BLKBENCH_BLOCK;
+        reqs[i].write = 0;
+        reqs[i].done = blkbench_done;
+        reqs[i].private = &b;
+        blkbench_issue(&b, &reqs[i]);
+    }
+    flags = spin_lock_irqsave(&dev->wait.lock);
+    while (__atomic_load_n(&b.completed, __ATOMIC_ACQUIRE) < total) wait_queue_sleep(&dev->wait);
+    spin_unlock_irqrestore(&dev->wait.lock, flags);
+    unsigned int us = (unsigned int)div_u64_rem(now_ns() - start, 1000, 0);
+
+    flags = spin_lock_irqsave(&dev->lock);
+    struct block_stats after = dev->stats;
+    spin_unlock_irqrestore(&dev->lock, flags);
+
+    if (!us) us = 1;
+    unsigned int iops = (unsigned int)div_u64_rem((unsigned long long)total * 1000000, us, 0);
+    // 4096 bytes * 100 * 10^6 us/s / 2^20 bytes/MB = 390625
+    unsigned int mb100 = (unsigned int)div_u64_rem((unsigned long long)total * 390625, us, 0);
+    kprintf("\n  %-10s %8u IOPS %5u.%02u MB/s %6u cmds %6u merged", random ? "random" : "sequential",
+            iops, mb100 / 100, mb100 % 100, after.commands - before.commands, after.merges - before.merges);
+    if (b.errors) kprintf(" %u errors", b.errors);
+}
+
+void cmd_blkbench(int argc, char **argv) {
+    unsigned int mb = 8;
+    if (argc == 2) {
+        int n = atoi(argv[1]);
+        if (n <= 0 || n > BLKBENCH_MAX_MB) { print("\nSize must be 1-256 MB"); return; }
+        mb = n;
+    }
+    if (!device_count) {
+        print("\nNo block devices (attach a disk with -drive file=disk.img,if=ide or if=virtio)");
+        return;
+    }
+
+    unsigned int buffers = pmm_alloc_frames(BLKBENCH_DEPTH * BLKBENCH_BLOCK / PAGE_SIZE);
+    if (!buffers) { print("\nOut of memory"); return; }
+    struct block_request reqs[BLKBENCH_DEPTH];
+    unsigned int total = mb * (1024 * 1024 / BLKBENCH_BLOCK);
+
+    kprintf("\n=== BLOCK BENCHMARK (%u MB per pass, 4 KB reads, %u queued) ===", mb, BLKBENCH_DEPTH);
+    for (struct block_device *dev = devices; dev; dev = dev->next) {
+        kprintf("\n%-4s %-10s %6llu MB  %s", dev->name, dev->driver,
+                dev->sectors >> 11, dev->model);
+        if (dev->sectors < BLKBENCH_SECTORS) { print("\n  too small"); continue; }
+        blkbench_pass(dev, 0, total, reqs, (unsigned char *)buffers);
+        blkbench_pass(dev, 1, total, reqs, (unsigned char *)buffers);
+    }
+    pmm_free_frames(buffers, BLKBENCH_DEPTH * BLKBENCH_BLOCK / PAGE_SIZE);
+}
@@ -0,0 +1,99 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include "spinlock.h"
+#include "sched.h"
+
+// Block layer. Drivers register a block_device; callers hand it
+// block_requests, which wait in a per-device queue kept sorted by LBA.
+// A request that continues (or is continued by) a queued one of the same
+// direction is merged into it, so one hardware command can cover several
+// callers' buffers, and commands are issued in one-way elevator order
+// (C-SCAN) from where the last one ended. Completions arrive from the
+// driver's IRQ handler through block_complete(); nothing polls.
+//
+// Buffers are handed to the device as physical addresses: any kernel
+// memory works since RAM is identity mapped, but a buffer must be
+// physically contiguous (one kmalloc or frame run) and 2-byte aligned.
+
+#define BLOCK_SECTOR_SIZE 512
+#define BLOCK_NAME_LEN 8
+
+#define BLOCK_OK       0
+#define BLOCK_ERROR   -1
+#define BLOCK_PENDING  1
+
+#define BLOCK_BUSY    -1                // ops->start: cannot take a command now
+
+struct block_device;
+struct block_request;
+
+typedef void (*block_done_t)(struct block_request *req);
+
+struct block_request {
+    struct block_device *dev;
+    unsigned long long lba;
+    unsigned int count;                 // sectors
+    void *buffer;
+    int write;
+    volatile int status;                // BLOCK_PENDING until completed
+    block_done_t done;                  // IRQ context, device lock not held; may be 0
+    void *private;                      // for 'done'
+    struct block_request *next;         // queue, sorted by LBA
+    struct block_request *merged;       // following segments of the same command
+};
+
+struct block_ops {
+    // Issue 'req' and the segments merged behind it as one command. Called
+    // with the device lock held and interrupts off; returns 0 or BLOCK_BUSY.
+    int (*start)(struct block_device *dev, struct block_request *req);
+    // Optional: after a batch of starts, e.g. to ring a doorbell once
+    void (*commit)(struct block_device *dev);
+};
+
+struct block_stats {
+    unsigned int requests, merges, commands, errors;
+    unsigned long long sectors_read, sectors_written;
+};
+
+struct block_device {
+    char name[BLOCK_NAME_LEN];
+    const char *driver;
+    char model[41];
+    unsigned long long sectors;
+    unsigned int max_sectors;           // per command
+    unsigned int max_segments;          // buffers per command
+    unsigned int queue_depth;           // commands in flight at once
+    const struct block_ops *ops;
+    void *driver_data;
+
+    struct spinlock lock;               // queue, in_flight, stats
+    struct block_request *queue;
+    unsigned long long next_lba;        // elevator position
+    unsigned int in_flight;
+    struct block_stats stats;
+    struct wait_queue wait;             // woken after every completion
+    struct block_device *next;
+};
+
+// Probe the disk controllers (after pci_init and interrupts_init)
+void block_init();
+
+// Drivers: fill name, driver, sectors, limits and ops, then register
+void block_register(struct block_device *dev);
+void block_complete(struct block_request *req, int status);
+void block_kick(struct block_device *dev);
+
+unsigned int block_device_count();
+struct block_device *block_get_device(unsigned int index);
+struct block_device *block_find(const char *name);
+
+// Queue a request (count <= max_sectors); returns BLOCK_ERROR if it is
+// out of range. req->done runs when it completes.
+int block_submit(struct block_request *req);
+
+// Synchronous I/O of any length; sleeps until done
+int block_read(struct block_device *dev, unsigned long long lba, unsigned int count, void *buffer);
+int block_write(struct block_device *dev, unsigned long long lba, unsigned int count, const void *buffer);
+
+#endif
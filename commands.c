@@ -0,0 +1,124 @@
+#include "kernel.h"
+#include "heap.h"
+#include "sched.h"
+#include "commands.h"
+#include "cmd_hash.h"
+
+static const struct command command_table[] = {
+#define COMMAND(name, handler, min_args, max_args, category, usage, help) \
+    { name, handler, min_args, max_args, category, usage, help },
+#include "commands.def"
+#undef COMMAND
+};
+
+#define COMMAND_COUNT (sizeof(command_table) / sizeof(command_table[0]))
+
+// Must match command_hash() in gen_cmdhash.py
+static inline unsigned int command_hash(const char *name) {
+    unsigned int h = 2166136261u ^ CMD_HASH_SEED;
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h ^ (h >> 16);
+}
+
+int command_tokenize(char *line, char **argv, int max_args) {
+    int argc = 0;
+    while (*line) {
+        while (*line == ' ') *line++ = '\0';
+        if (!*line) break;
+        if (argc == max_args) break;
+        argv[argc++] = line;
+        while (*line && *line != ' ') line++;
+    }
+    argv[argc] = 0;
+    return argc;
+}
+
+// One hash, one slot load and one strcmp to reject names outside the set
+const struct command *command_lookup(const char *name) {
+    unsigned int slot = cmd_hash_slots[command_hash(name) & ((1 << CMD_HASH_BITS) - 1)];
+    if (!slot) return 0;
+    const struct command *cmd = &command_table[slot - 1];
+    return strcmp(cmd->name, name) == 0 ? cmd : 0;
+}
+
+// ============================================================================
+// BACKGROUND JOBS
+// ============================================================================
+
+// Entry point of a "cmd &" thread; owns its copy of the line
+static void run_job(void *arg) {
+    char *line = arg;
+    command_execute(line);
+    kfree(line);
+    kprintf("\n[%u] Done\n> ", thread_current()->id);
+}
+
+// Strip a trailing '&' and start the rest as a thread below the shell's
+// priority. Returns 0 if the line is not a background job.
+static int spawn_job(char *line) {
+    int len = 0;
+    while (line[len]) len++;
+    while (len && line[len - 1] == ' ') len--;
+    if (!len || line[len - 1] != '&') return 0;
+    line[--len] = '\0';
+
+    char name[THREAD_NAME_LEN];
+    const char *p = line;
+    while (*p == ' ') p++;
+    int n = 0;
+    for (; p[n] && p[n] != ' ' && n < THREAD_NAME_LEN - 1; n++) name[n] = p[n];
+    name[n] = '\0';
+    if (!n) return 1;
+
+    char *copy = kmalloc(len + 1);
+    if (copy) memcpy(copy, line, len + 1);
+    struct thread *job = copy ? thread_create(name, run_job, copy, PRIO_JOB) : 0;
+    if (!job) {
+        if (copy) kfree(copy);
+        print("\nCannot start job: out of memory");
+        return 1;
+    }
+    kprintf("\n[%u] %s", job->id, name);
+    return 1;
+}
+
+// ============================================================================
+// DISPATCH
+// ============================================================================
+
+void command_execute(char *line) {
+    if (spawn_job(line)) return;
+
+    char *argv[CMD_MAX_ARGS + 1];
+    int argc = command_tokenize(line, argv, CMD_MAX_ARGS);
+    if (!argc) return;
+
+    const struct command *cmd = command_lookup(argv[0]);
+    if (!cmd) {
+        kprintf("\nUnknown command: %s\nType 'info' for available commands", argv[0]);
+        return;
+    }
+    if (argc - 1 < cmd->min_args || argc - 1 > cmd->max_args) {
+        kprintf("\nUsage: %s", cmd->usage);
+        return;
+    }
+    cmd->handler(argc, argv);
+}
+
+// Help text comes from the same table as dispatch
+void cmd_info(int argc, char **argv) {
+    static const char *category_names[CMD_CAT_COUNT] = {
+        "Basic Commands", "System Monitoring", "Device Management", "Hardware Detection"
+    };
+    print("\n=== Available Commands ===");
+    for (int category = 0; category < CMD_CAT_COUNT; category++) {
+        kprintf("\n\n[%s]", category_names[category]);
+        for (unsigned int i = 0; i < COMMAND_COUNT; i++) {
+            if (command_table[i].category != category) continue;
+            kprintf("\n%-14s - %s", command_table[i].usage, command_table[i].help);
+        }
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+// Shell command registry. The table is expanded from commands.def and
+// looked up through the build-time perfect hash in cmd_hash.h.
+
+#define CMD_MAX_ARGS 16                 // including argv[0]
+
+enum command_category {
+    CMD_CAT_BASIC,
+    CMD_CAT_SYSTEM,
+    CMD_CAT_DEVICE,
+    CMD_CAT_HARDWARE,
+    CMD_CAT_COUNT
+};
+
+typedef void (*command_handler_t)(int argc, char **argv);
+
+struct command {
+    const char *name;
+    command_handler_t handler;
+    unsigned char min_args, max_args;   // not counting argv[0]
+    unsigned char category;
+    const char *usage;
+    const char *help;
+};
+
+// Handler prototypes for every entry in commands.def
+#define COMMAND(name, handler, min_args, max_args, category, usage, help) \
+    void handler(int argc, char **argv);
+#include "commands.def"
+#undef COMMAND
+
+// Split 'line' in place on spaces; returns argc
+int command_tokenize(char *line, char **argv, int max_args);
+
+const struct command *command_lookup(const char *name);
+
+// Tokenize, look up, check the argument count and run a command line
+void command_execute(char *line);
+
+#endif
@@ -0,0 +1,352 @@
+#include "kernel.h"
+#include "spinlock.h"
+#include "heap.h"
+#include "sched.h"
+#include "console.h"
+#include "fbcon.h"
+#include "serial.h"
+#include "trace.h"
+
+// Text memory at 0xB8000-0xBFFFF holds VGA_TOTAL_ROWS full rows. Output
+// advances top_row one row at a time; when the live window reaches the end
+// of memory, the newest WRAP_KEEP_ROWS rows are copied back to the start.
+// That is the only copy, so the per-line cost is a 160-byte row clear.
+//
+// On a framebuffer console the same cells live in RAM (FB_BUFFER_BYTES,
+// however many rows that holds at the mode's width) and the CRTC steps
+// become bookkeeping: writers only update cells and grow a dirty
+// rectangle in screen coordinates. The "fbcon" thread copies that
+// rectangle out under the lock and has fbcon.c draw it with interrupts
+// on, where it may use SSE2; a burst of output costs one redraw, not one
+// per line. Before the thread exists, and on the panic path, drawing is
+// done in place.
+#define VGA_TOTAL_ROWS (0x8000 / (CONSOLE_COLS * 2))
+#define WRAP_KEEP_ROWS 100
+#define FB_BUFFER_BYTES (256 * 1024)
+#define BLANK_CELL ((CONSOLE_ATTR << 8) | ' ')
+
+#define CRTC_INDEX 0x3D4
+#define CRTC_DATA  0x3D5
+
+static volatile unsigned short *cells = (volatile unsigned short *)0xB8000;
+static unsigned int cols = CONSOLE_COLS, rows = CONSOLE_ROWS;
+static unsigned int total_rows = VGA_TOTAL_ROWS, keep_rows = WRAP_KEEP_ROWS;
+
+static unsigned int top_row = 0;        // memory row shown at the top of the live screen
+static unsigned int oldest_row = 0;     // first row that still holds history
+static unsigned int view_row = 0;       // row currently programmed into the CRTC
+static unsigned int cursor_row = 0, cursor_col = 0;
+static int mirror = 1;
+static struct spinlock console_lock = SPINLOCK_INIT;
+
+// Framebuffer console: the damaged screen rectangle [top, bottom) x
+// [left, right), empty when top == bottom
+static int fb = 0;
+static struct { unsigned int top, left, bottom, right; } dirty;
+static unsigned short *snapshot;        // one screen, handed to fbcon_draw
+static unsigned int scrolls = 0;
+static volatile int render_pending = 0;
+static int renderer = 0;                // "fbcon" thread running
+static struct wait_queue render_wait = WAIT_QUEUE_INIT;
+
+// ============================================================================
+// FRAMEBUFFER
+// ============================================================================
+
+// Called with console_lock held
+static void damage(unsigned int top, unsigned int left, unsigned int bottom, unsigned int right) {
+    render_pending = 1;
+    if (top >= bottom || left >= right) return;
+    if (dirty.top == dirty.bottom) {
+        dirty.top = top;
+        dirty.left = left;
+        dirty.bottom = bottom;
+        dirty.right = right;
+        return;
+    }
+    if (top < dirty.top) dirty.top = top;
+    if (left < dirty.left) dirty.left = left;
+    if (bottom > dirty.bottom) dirty.bottom = bottom;
+    if (right > dirty.right) dirty.right = right;
+}
+
+static void damage_all() {
+    damage(0, 0, rows, cols);
+}
+
+// The cursor is hidden while the view is scrolled back
+static void fb_render() {
+    unsigned int flags = spin_lock_irqsave(&console_lock);
+    unsigned int top = dirty.top, left = dirty.left, bottom = dirty.bottom, right = dirty.right;
+    dirty.top = dirty.bottom = 0;
+    render_pending = 0;
+    for (unsigned int row = top; row < bottom; row++)
+        memcpy(snapshot + row * cols + left, (const void *)(cells + (view_row + row) * cols + left),
+               (right - left) * sizeof(unsigned short));
+    unsigned int draw_row = view_row == top_row ? cursor_row : rows, draw_col = cursor_col;
+    spin_unlock_irqrestore(&console_lock, flags);
+    fbcon_draw(snapshot, top, left, bottom, right, draw_row, draw_col);
+}
+
+static void render_thread(void *arg) {
+    (void)arg;
+    for (;;) {
+        unsigned int flags = spin_lock_irqsave(&render_wait.lock);
+        while (!render_pending) wait_queue_sleep(&render_wait);
+        spin_unlock_irqrestore(&render_wait.lock, flags);
+        fb_render();
+    }
+}
+
+// After dropping console_lock; 'wake' is whether this change made the
+// screen dirty, so a burst of writes wakes the thread once
+static void fb_kick(int wake) {
+    if (renderer) {
+        if (wake) wait_queue_wake_one(&render_wait);
+    } else {
+        fb_render();
+    }
+}
+
+// ============================================================================
+// CRTC
+// ============================================================================
+
+static void crtc_write(unsigned char index, unsigned char value) {
+    outb(CRTC_INDEX, index);
+    outb(CRTC_DATA, value);
+}
+
+static void set_start_row(unsigned int row) {
+    if (fb) {
+        view_row = row;
+        damage_all();
+        return;
+    }
+    unsigned int offset = row * CONSOLE_COLS;
+    crtc_write(0x0C, (offset >> 8) & 0xFF);
+    crtc_write(0x0D, offset & 0xFF);
+    view_row = row;
+}
+
+// The cursor location register is absolute within text memory, not
+// relative to the start address. fbcon draws its own cursor.
+static void update_cursor() {
+    if (fb) {
+        render_pending = 1;
+        return;
+    }
+    unsigned int offset = (top_row + cursor_row) * CONSOLE_COLS + cursor_col;
+    crtc_write(0x0E, (offset >> 8) & 0xFF);
+    crtc_write(0x0F, offset & 0xFF);
+}
+
+// ============================================================================
+// ROW OPERATIONS
+// ============================================================================
+
+static void clear_rows(unsigned int row, unsigned int count) {
+    memset32((void *)(cells + row * cols), (BLANK_CELL << 16) | BLANK_CELL, count * cols / 2);
+}
+
+static void wrap_memory() {
+    unsigned int first = top_row + rows - keep_rows;
+    memcpy((void *)cells, (const void *)(cells + first * cols), keep_rows * cols * 2);
+    top_row = keep_rows - rows;
+    oldest_row = 0;
+}
+
+static void scroll_one_row() {
+    if (top_row + rows == total_rows) wrap_memory();
+    top_row++;
+    clear_rows(top_row + rows - 1, 1);
+    scrolls++;
+}
+
+// ============================================================================
+// PUBLIC API
+// ============================================================================
+
+// Every entry point that moves the cursor holds console_lock, so output
+// from threads on different CPUs interleaves by whole writes. kprintf
+// hands over a line or more at a time, so the lock, the serial queueing
+// and the CRTC cursor update are paid once per line, not once per piece.
+void console_write(const char *buf, unsigned int len) {
+    unsigned int flags = spin_lock_irqsave(&console_lock);
+    if (mirror) serial_write_len(buf, len);
+    unsigned int first_row = cursor_row, first_col = cursor_col, first_scrolls = scrolls;
+    int was_pending = render_pending;
+    for (; len; len--, buf++) {
+        if (*buf == '\n') {
+            cursor_col = cols;
+        } else {
+            cells[(top_row + cursor_row) * cols + cursor_col] = (CONSOLE_ATTR << 8) | (unsigned char)*buf;
+            cursor_col++;
+        }
+        if (cursor_col == cols) {
+            cursor_col = 0;
+            if (cursor_row == rows - 1) scroll_one_row();
+            else cursor_row++;
+        }
+    }
+    if (fb) {
+        if (scrolls != first_scrolls) damage_all();
+        else if (cursor_row == first_row) damage(first_row, first_col, first_row + 1, cursor_col);
+        else damage(first_row, 0, cursor_row + 1, cols);
+    }
+    if (view_row != top_row) set_start_row(top_row);
+    update_cursor();
+    spin_unlock_irqrestore(&console_lock, flags);
+    if (fb) fb_kick(!was_pending);
+}
+
+void print(const char *str) {
+    unsigned long long t = trace_begin();
+    unsigned int len = strlen(str);
+    console_write(str, len);
+    trace_end("print", len, t);
+}
+
+// The old screen contents scroll up into the history instead of being lost
+void clear_screen() {
+    unsigned int flags = spin_lock_irqsave(&console_lock);
+    int was_pending = render_pending;
+    for (unsigned int i = 0; i < rows; i++) {
+        if (top_row + rows == total_rows) wrap_memory();
+        top_row++;
+    }
+    clear_rows(top_row, rows);
+    cursor_row = cursor_col = 0;
+    set_start_row(top_row);
+    update_cursor();
+    spin_unlock_irqrestore(&console_lock, flags);
+    if (fb) fb_kick(!was_pending);
+}
+
+void backspace() {
+    unsigned int flags = spin_lock_irqsave(&console_lock);
+    int was_pending = render_pending;
+    if (cursor_col > 0) {
+        cursor_col--;
+    } else if (cursor_row > 0) {
+        cursor_row--;
+        cursor_col = cols - 1;
+    } else {
+        spin_unlock_irqrestore(&console_lock, flags);
+        return;
+    }
+    cells[(top_row + cursor_row) * cols + cursor_col] = BLANK_CELL;
+    if (fb) damage(cursor_row, cursor_col, cursor_row + 1, cursor_col + 1);
+    update_cursor();
+    if (mirror) serial_write("\b \b");
+    spin_unlock_irqrestore(&console_lock, flags);
+    if (fb) fb_kick(!was_pending);
+}
+
+void console_scroll_view(int delta) {
+    unsigned int flags = spin_lock_irqsave(&console_lock);
+    int was_pending = render_pending;
+    int target = (int)view_row + delta;
+    if (target < (int)oldest_row) target = oldest_row;
+    if (target > (int)top_row) target = top_row;
+    if ((unsigned int)target != view_row) set_start_row(target);
+    spin_unlock_irqrestore(&console_lock, flags);
+    if (fb) fb_kick(!was_pending);
+}
+
+unsigned int console_scrollback_rows() {
+    return top_row - oldest_row;
+}
+
+void console_get_cursor(unsigned int *row, unsigned int *col) {
+    *row = cursor_row;
+    *col = cursor_col;
+}
+
+void console_set_cursor(unsigned int row, unsigned int col) {
+    unsigned int flags = spin_lock_irqsave(&console_lock);
+    int was_pending = render_pending;
+    cursor_row = row < rows ? row : rows - 1;
+    cursor_col = col < cols ? col : cols - 1;
+    update_cursor();
+    spin_unlock_irqrestore(&console_lock, flags);
+    if (fb) fb_kick(!was_pending);
+}
+
+unsigned int console_rows() {
+    return rows;
+}
+
+unsigned int console_cols() {
+    return cols;
+}
+
+int console_is_framebuffer() {
+    return fb;
+}
+
+unsigned char console_read_register(unsigned short index_port, unsigned char index) {
+    unsigned int flags = spin_lock_irqsave(&console_lock);
+    outb(index_port, index);
+    unsigned char value = inb(index_port + 1);
+    spin_unlock_irqrestore(&console_lock, flags);
+    return value;
+}
+
+void console_set_mirror(int enable) {
+    mirror = enable;
+}
+
+void console_init() {
+    clear_rows(0, total_rows);
+    top_row = oldest_row = 0;
+    cursor_row = cursor_col = 0;
+    set_start_row(0);
+    update_cursor();
+}
+
+// The live VGA screen is carried over, so boot messages stay visible
+void console_use_framebuffer(unsigned int magic, const struct multiboot_info *mbi) {
+    unsigned int fb_cols, fb_rows;
+    if (!fbcon_init(magic, mbi, &fb_cols, &fb_rows)) return;
+    unsigned int fb_total = FB_BUFFER_BYTES / (fb_cols * sizeof(unsigned short));
+    unsigned short *buffer = kmalloc(fb_total * fb_cols * sizeof(unsigned short));
+    snapshot = kmalloc(fb_rows * fb_cols * sizeof(unsigned short));
+    if (!buffer || !snapshot || fb_total < 2 * fb_rows) {
+        kfree(buffer);
+        kfree(snapshot);
+        return;
+    }
+
+    unsigned int flags = spin_lock_irqsave(&console_lock);
+    unsigned int keep = CONSOLE_ROWS < fb_rows ? CONSOLE_ROWS : fb_rows;
+    unsigned int width = CONSOLE_COLS < fb_cols ? CONSOLE_COLS : fb_cols;
+    unsigned int first = CONSOLE_ROWS - keep;
+    cells = buffer;
+    cols = fb_cols;
+    rows = fb_rows;
+    total_rows = fb_total;
+    keep_rows = fb_total / 2;
+    clear_rows(0, total_rows);
+    for (unsigned int row = 0; row < keep; row++)
+        for (unsigned int col = 0; col < width; col++)
+            buffer[row * cols + col] = ((volatile unsigned short *)0xB8000)[(top_row + first + row) * CONSOLE_COLS + col];
+    cursor_row = cursor_row >= first ? cursor_row - first : 0;
+    if (cursor_col >= width) cursor_col = width - 1;
+    top_row = oldest_row = 0;
+    fb = 1;
+    set_start_row(0);
+    spin_unlock_irqrestore(&console_lock, flags);
+    fb_render();
+}
+
+void console_start_renderer() {
+    if (!fb) return;
+    thread_create("fbcon", render_thread, 0, PRIO_SHELL);
+    renderer = 1;
+}
+
+// Draw whatever is pending right now, from this CPU (panic path)
+void console_flush() {
+    if (fb) fb_render();
+}
@@ -0,0 +1,60 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+// VGA text console. The 80x25 screen is a window into the full 32 KB of
+// text memory; scrolling moves the CRTC start address instead of copying,
+// and the rows above the window double as the scrollback buffer.
+// Output is mirrored to the serial port once serial_init() has found one.
+//
+// When GRUB sets up a linear framebuffer the console switches to it
+// (fbcon.h): the same cell layout moves to RAM, the screen grows to the
+// mode's size (128x48 at 1024x768), and a thread redraws what changed.
+
+#define CONSOLE_COLS 80                 // VGA text geometry
+#define CONSOLE_ROWS 25
+#define CONSOLE_ATTR 0x02               // green on black
+
+struct multiboot_info;
+
+void console_init();
+
+// After heap_init; stays on VGA text unless there is a usable framebuffer
+void console_use_framebuffer(unsigned int magic, const struct multiboot_info *mbi);
+
+// After sched_init: hand framebuffer drawing to the "fbcon" thread
+void console_start_renderer();
+
+// Draw pending framebuffer output now, from the calling CPU (panic path)
+void console_flush();
+
+// Current screen size in cells, and whether it is a framebuffer
+unsigned int console_rows();
+unsigned int console_cols();
+int console_is_framebuffer();
+
+// Formatted output goes through kprintf (kprintf.h), which buffers a
+// line and hands it to console_write in one piece
+void print(const char *str);
+void console_write(const char *buf, unsigned int len);
+void clear_screen();
+void backspace();
+
+// Page the view through scrollback; negative rows look further back.
+// Any new output snaps the view back to the live screen.
+void console_scroll_view(int rows);
+
+// Rows of history currently available above the live screen
+unsigned int console_scrollback_rows();
+
+// Cursor position within the live screen, for code that redraws in place
+void console_get_cursor(unsigned int *row, unsigned int *col);
+void console_set_cursor(unsigned int row, unsigned int col);
+
+// Read a VGA index/data register pair; serialized with the console's own
+// CRTC updates (cursor, start address)
+unsigned char console_read_register(unsigned short index_port, unsigned char index);
+
+// Turn the serial mirror off and on (bench uses this to time VGA alone)
+void console_set_mirror(int enable);
+
+#endif
@@ -0,0 +1,232 @@
+#include "kernel.h"
+#include "cpufeature.h"
+
+struct cpu_features cpu_features;
+
+// ============================================================================
+// CPUID
+// ============================================================================
+
+// CPUID exists iff the ID bit in EFLAGS can be toggled
+static int cpuid_supported() {
+    unsigned int before, after;
+    asm volatile(
+        "pushfl\n\t"
+        "popl %0\n\t"
+        "movl %0, %1\n\t"
+        "xorl $0x200000, %0\n\t"
+        "pushl %0\n\t"
+        "popfl\n\t"
+        "pushfl\n\t"
+        "popl %0\n\t"
+        : "=r"(after), "=r"(before)
+    );
+    return ((before ^ after) & 0x200000) != 0;
+}
+
+// regs[] is EAX, EBX, ECX, EDX
+static void cpuid(unsigned int leaf, unsigned int subleaf, unsigned int *regs) {
+    asm volatile("cpuid" : "=a"(regs[0]), "=b"(regs[1]), "=c"(regs[2]), "=d"(regs[3]) : "a"(leaf), "c"(subleaf));
+}
+
+static void read_identity() {
+    struct cpu_features *f = &cpu_features;
+    unsigned int r[4];
+    cpuid(0, 0, r);
+    f->max_leaf = r[0];
+    memcpy(f->vendor, &r[1], 4);
+    memcpy(f->vendor + 4, &r[3], 4);
+    memcpy(f->vendor + 8, &r[2], 4);
+    f->vendor[12] = '\0';
+
+    cpuid(0x80000000, 0, r);
+    f->max_ext_leaf = (r[0] & 0xFFFF0000) == 0x80000000 ? r[0] : 0;
+
+    f->brand[0] = '\0';
+    if (f->max_ext_leaf >= 0x80000004) {
+        for (unsigned int i = 0; i < 3; i++) {
+            cpuid(0x80000002 + i, 0, r);
+            memcpy(f->brand + i * 16, r, 16);
+        }
+        f->brand[48] = '\0';
+        // Intel pads the brand string on the left
+        unsigned int skip = 0;
+        while (f->brand[skip] == ' ') skip++;
+        memmove(f->brand, f->brand + skip, 49 - skip);
+    }
+}
+
+static void read_features() {
+    struct cpu_features *f = &cpu_features;
+    unsigned int r[4];
+    if (f->max_leaf >= 1) {
+        cpuid(1, 0, r);
+        f->words[CPU_WORD_1_EDX] = r[3];
+        f->words[CPU_WORD_1_ECX] = r[2];
+        f->stepping = r[0] & 0xF;
+        f->family = (r[0] >> 8) & 0xF;
+        f->model = (r[0] >> 4) & 0xF;
+        if (f->family == 0xF) f->family += (r[0] >> 20) & 0xFF;
+        if (f->family == 0x6 || f->family >= 0xF) f->model |= ((r[0] >> 16) & 0xF) << 4;
+        if (cpu_has(CPU_FEATURE_CLFLUSH)) f->clflush_size = ((r[1] >> 8) & 0xFF) * 8;
+        f->logical_per_package = cpu_has(CPU_FEATURE_HTT) ? (r[1] >> 16) & 0xFF : 1;
+    }
+    if (f->max_leaf >= 7) {
+        cpuid(7, 0, r);
+        f->words[CPU_WORD_7_EBX] = r[1];
+        f->words[CPU_WORD_7_ECX] = r[2];
+        f->words[CPU_WORD_7_EDX] = r[3];
+    }
+    if (f->max_ext_leaf >= 0x80000001) {
+        cpuid(0x80000001, 0, r);
+        f->words[CPU_WORD_E1_EDX] = r[3];
+        f->words[CPU_WORD_E1_ECX] = r[2];
+    }
+}
+
+// ============================================================================
+// CACHES AND TLBS
+// ============================================================================
+
+static void add_cache(unsigned int level, unsigned int type, unsigned int size,
+                      unsigned int line_size, unsigned int ways, unsigned int shared_by) {
+    if (!size || cpu_features.cache_count == CPU_MAX_CACHES) return;
+    struct cpu_cache *c = &cpu_features.caches[cpu_features.cache_count++];
+    c->level = level;
+    c->type = type;
+    c->size = size;
+    c->line_size = line_size;
+    c->ways = ways;
+    c->shared_by = shared_by;
+}
+
+// Leaf 4 (Intel) and 0x8000001D (AMD with TOPOEXT) share one layout: one
+// subleaf per cache until a null type
+static void read_deterministic_caches(unsigned int leaf) {
+    for (unsigned int i = 0; i < 16; i++) {
+        unsigned int r[4];
+        cpuid(leaf, i, r);
+        unsigned int type = r[0] & 0x1F;
+        if (!type) break;
+        unsigned int line = (r[1] & 0xFFF) + 1;
+        unsigned int partitions = ((r[1] >> 12) & 0x3FF) + 1;
+        unsigned int ways = (r[1] >> 22) + 1;
+        add_cache((r[0] >> 5) & 7, type, ways * partitions * line * (r[2] + 1), line, ways,
+                  ((r[0] >> 14) & 0xFFF) + 1);
+    }
+}
+
+// L1 associativity in the legacy AMD leaves is a count, 0xFF for fully
+// associative; L2/L3 associativity is a code
+static unsigned int amd_l1_ways(unsigned int ways) {
+    return ways == 0xFF ? 0 : ways;
+}
+
+static unsigned int amd_ways(unsigned int code) {
+    static const unsigned char ways[16] = { 0, 1, 2, 0, 4, 0, 8, 0, 16, 0, 32, 48, 64, 96, 128, 0 };
+    return ways[code & 0xF];
+}
+
+// AMD's older leaves, which QEMU's default models also fill in: L1 and L2
+// (and L3) geometry plus the 4 KB page TLB sizes. Intel returns zeros.
+static void read_legacy_leaves() {
+    struct cpu_features *f = &cpu_features;
+    unsigned int r[4];
+    int have_caches = f->cache_count != 0;
+    if (f->max_ext_leaf >= 0x80000005) {
+        cpuid(0x80000005, 0, r);
+        f->dtlb_entries = (r[1] >> 16) & 0xFF;
+        f->itlb_entries = r[1] & 0xFF;
+        if (!have_caches) {
+            add_cache(1, CPU_CACHE_DATA, (r[2] >> 24) * 1024, r[2] & 0xFF, amd_l1_ways((r[2] >> 16) & 0xFF), 0);
+            add_cache(1, CPU_CACHE_INSTRUCTION, (r[3] >> 24) * 1024, r[3] & 0xFF, amd_l1_ways((r[3] >> 16) & 0xFF), 0);
+        }
+    }
+    if (f->max_ext_leaf >= 0x80000006) {
+        cpuid(0x80000006, 0, r);
+        f->l2_tlb_entries = (r[1] >> 16) & 0xFFF;
+        if (!have_caches) {
+            add_cache(2, CPU_CACHE_UNIFIED, (r[2] >> 16) * 1024, r[2] & 0xFF, amd_ways(r[2] >> 12), 0);
+            add_cache(3, CPU_CACHE_UNIFIED, (r[3] >> 18) * 512 * 1024, r[3] & 0xFF, amd_ways(r[3] >> 12), 0);
+        }
+    }
+}
+
+static void read_caches() {
+    struct cpu_features *f = &cpu_features;
+    if (f->max_leaf >= 4) read_deterministic_caches(4);
+    if (!f->cache_count && cpu_has(CPU_FEATURE_TOPOEXT) && f->max_ext_leaf >= 0x8000001D)
+        read_deterministic_caches(0x8000001D);
+    read_legacy_leaves();
+}
+
+// ============================================================================
+// DISPATCH
+// ============================================================================
+
+struct cpu_impl {
+    const char *name;
+    int feature;                        // required CPU_FEATURE_*, or -1
+    void *fn;
+};
+
+// Implementations are listed best first; the last must need nothing
+struct cpu_dispatch {
+    const char *routine;
+    void **slot;
+    struct cpu_impl impls[3];
+    const char *bound;
+};
+
+static struct cpu_dispatch dispatch_table[] = {
+    { "memcpy", (void **)&memcpy_bulk, {
+        { "erms", CPU_FEATURE_ERMS, memcpy_erms },
+        { "sse2", CPU_FEATURE_SSE2, memcpy_sse2 },
+        { "rep movsd", -1, memcpy_rep } }, 0 },
+    { "memset", (void **)&memset_bulk, {
+        { "erms", CPU_FEATURE_ERMS, memset_erms },
+        { "sse2", CPU_FEATURE_SSE2, memset_sse2 },
+        { "rep stosd", -1, memset_rep } }, 0 },
+    { "zero_page", (void **)&zero_page_bulk, {
+        { "erms", CPU_FEATURE_ERMS, zero_page_erms },
+        { "sse2", CPU_FEATURE_SSE2, zero_page_sse2 },
+        { "rep stosd", -1, zero_page_rep } }, 0 },
+    { "checksum", (void **)&csum_bulk, {
+        { "sse2", CPU_FEATURE_SSE2, csum_partial_sse2 },
+        { "adc", -1, csum_partial_adc } }, 0 },
+};
+
+#define DISPATCH_COUNT (sizeof(dispatch_table) / sizeof(dispatch_table[0]))
+
+static void bind_routines() {
+    for (unsigned int i = 0; i < DISPATCH_COUNT; i++) {
+        struct cpu_dispatch *d = &dispatch_table[i];
+        const struct cpu_impl *impl = d->impls;
+        while (impl->feature >= 0 && !cpu_has(impl->feature)) impl++;
+        *d->slot = impl->fn;
+        d->bound = impl->name;
+    }
+}
+
+unsigned int cpu_dispatch_bindings(struct cpu_binding *out, unsigned int max) {
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < DISPATCH_COUNT && count < max; i++, count++) {
+        out[count].routine = dispatch_table[i].routine;
+        out[count].impl = dispatch_table[i].bound;
+    }
+    return count;
+}
+
+// ============================================================================
+// INIT
+// ============================================================================
+
+void cpu_features_init() {
+    cpu_features.cpuid = cpuid_supported();
+    if (cpu_features.cpuid) {
+        read_identity();
+        read_features();
+        read_caches();
+    }
+    bind_routines();
+}
@@ -0,0 +1,107 @@
+#ifndef CPUFEATURE_H
+#define CPUFEATURE_H
+
+// CPU identification, read once at boot. CPUID serializes the pipeline and
+// exits to the hypervisor under virtualization, so cpu_features_init()
+// runs every leaf the kernel cares about a single time and everything
+// afterwards (feature checks, cpuinfo) reads the cached copy. All CPUs
+// are assumed to match the boot CPU.
+//
+// The same pass binds the kernel's dispatched routines (memcpy, memset,
+// page zeroing, checksum bulk paths) to the best implementation the CPU
+// supports, much like an ELF ifunc resolved once at load time.
+
+// Feature bits: word * 32 + bit, one word per CPUID register kept
+#define CPU_WORD_1_EDX   0              // leaf 1
+#define CPU_WORD_1_ECX   1
+#define CPU_WORD_7_EBX   2              // leaf 7, subleaf 0
+#define CPU_WORD_7_ECX   3
+#define CPU_WORD_7_EDX   4
+#define CPU_WORD_E1_EDX  5              // leaf 0x80000001
+#define CPU_WORD_E1_ECX  6
+#define CPU_WORDS        7
+
+#define CPU_FEATURE(word, bit) ((CPU_WORD_##word) * 32 + (bit))
+
+#define CPU_FEATURE_FPU           CPU_FEATURE(1_EDX, 0)
+#define CPU_FEATURE_PSE           CPU_FEATURE(1_EDX, 3)
+#define CPU_FEATURE_TSC           CPU_FEATURE(1_EDX, 4)
+#define CPU_FEATURE_MSR           CPU_FEATURE(1_EDX, 5)
+#define CPU_FEATURE_APIC          CPU_FEATURE(1_EDX, 9)
+#define CPU_FEATURE_PAT           CPU_FEATURE(1_EDX, 16)
+#define CPU_FEATURE_CLFLUSH       CPU_FEATURE(1_EDX, 19)
+#define CPU_FEATURE_MMX           CPU_FEATURE(1_EDX, 23)
+#define CPU_FEATURE_FXSR          CPU_FEATURE(1_EDX, 24)
+#define CPU_FEATURE_SSE           CPU_FEATURE(1_EDX, 25)
+#define CPU_FEATURE_SSE2          CPU_FEATURE(1_EDX, 26)
+#define CPU_FEATURE_HTT           CPU_FEATURE(1_EDX, 28)
+#define CPU_FEATURE_SSE3          CPU_FEATURE(1_ECX, 0)
+#define CPU_FEATURE_SSSE3         CPU_FEATURE(1_ECX, 9)
+#define CPU_FEATURE_SSE41         CPU_FEATURE(1_ECX, 19)
+#define CPU_FEATURE_SSE42         CPU_FEATURE(1_ECX, 20)
+#define CPU_FEATURE_X2APIC        CPU_FEATURE(1_ECX, 21)
+#define CPU_FEATURE_POPCNT        CPU_FEATURE(1_ECX, 23)
+#define CPU_FEATURE_TSC_DEADLINE  CPU_FEATURE(1_ECX, 24)
+#define CPU_FEATURE_XSAVE         CPU_FEATURE(1_ECX, 26)
+#define CPU_FEATURE_AVX           CPU_FEATURE(1_ECX, 28)
+#define CPU_FEATURE_HYPERVISOR    CPU_FEATURE(1_ECX, 31)
+#define CPU_FEATURE_BMI1          CPU_FEATURE(7_EBX, 3)
+#define CPU_FEATURE_AVX2          CPU_FEATURE(7_EBX, 5)
+#define CPU_FEATURE_BMI2          CPU_FEATURE(7_EBX, 8)
+#define CPU_FEATURE_ERMS          CPU_FEATURE(7_EBX, 9)
+#define CPU_FEATURE_AVX512F       CPU_FEATURE(7_EBX, 16)
+#define CPU_FEATURE_ADX           CPU_FEATURE(7_EBX, 19)
+#define CPU_FEATURE_FSRM          CPU_FEATURE(7_EDX, 4)
+#define CPU_FEATURE_NX            CPU_FEATURE(E1_EDX, 20)
+#define CPU_FEATURE_RDTSCP        CPU_FEATURE(E1_EDX, 27)
+#define CPU_FEATURE_LM            CPU_FEATURE(E1_EDX, 29)
+#define CPU_FEATURE_TOPOEXT       CPU_FEATURE(E1_ECX, 22)
+
+#define CPU_CACHE_DATA        1
+#define CPU_CACHE_INSTRUCTION 2
+#define CPU_CACHE_UNIFIED     3
+#define CPU_MAX_CACHES        8
+
+struct cpu_cache {
+    unsigned int level;
+    unsigned int type;                  // CPU_CACHE_*
+    unsigned int size;                  // bytes
+    unsigned int line_size;
+    unsigned int ways;                  // 0 if fully associative or not reported
+    unsigned int shared_by;             // logical CPUs sharing it, 0 if unknown
+};
+
+struct cpu_features {
+    int cpuid;                          // 0 on a CPU without CPUID; nothing else is set
+    unsigned int max_leaf, max_ext_leaf;
+    char vendor[13];
+    char brand[49];                     // empty if the CPU has no brand string
+    unsigned int family, model, stepping;
+    unsigned int words[CPU_WORDS];
+    unsigned int clflush_size;          // bytes; 0 without CLFLUSH
+    unsigned int logical_per_package;
+    unsigned int cache_count;
+    struct cpu_cache caches[CPU_MAX_CACHES];
+    // 4 KB page TLB entries, from AMD's leaves 0x80000005/6; 0 if not reported
+    unsigned int itlb_entries, dtlb_entries, l2_tlb_entries;
+};
+
+extern struct cpu_features cpu_features;
+
+static inline int cpu_has(unsigned int feature) {
+    return (cpu_features.words[feature >> 5] >> (feature & 31)) & 1;
+}
+
+// Boot CPU, before anything checks a feature: fill cpu_features and bind
+// the dispatched routines
+void cpu_features_init();
+
+// A dispatched routine and the implementation it was bound to, for cpuinfo
+struct cpu_binding {
+    const char *routine;
+    const char *impl;
+};
+
+unsigned int cpu_dispatch_bindings(struct cpu_binding *out, unsigned int max);
+
+#endif
@@ -0,0 +1,312 @@
+#include "kernel.h"
+#include "interrupts.h"
+#include "pmm.h"
+#include "heap.h"
+#include "paging.h"
+#include "pci.h"
+#include "net.h"
+#include "e1000.h"
+
+#define E1000_VENDOR 0x8086
+
+// Registers (byte offsets into BAR0)
+#define E1000_CTRL   0x0000
+#define E1000_STATUS 0x0008
+#define E1000_EERD   0x0014
+#define E1000_ICR    0x00C0
+#define E1000_ITR    0x00C4
+#define E1000_IMS    0x00D0
+#define E1000_IMC    0x00D8
+#define E1000_RCTL   0x0100
+#define E1000_TCTL   0x0400
+#define E1000_TIPG   0x0410
+#define E1000_RDBAL  0x2800
+#define E1000_RDBAH  0x2804
+#define E1000_RDLEN  0x2808
+#define E1000_RDH    0x2810
+#define E1000_RDT    0x2818
+#define E1000_TDBAL  0x3800
+#define E1000_TDBAH  0x3804
+#define E1000_TDLEN  0x3808
+#define E1000_TDH    0x3810
+#define E1000_TDT    0x3818
+#define E1000_MTA    0x5200
+#define E1000_RAL    0x5400
+#define E1000_RAH    0x5404
+
+#define E1000_CTRL_ASDE  (1 << 5)
+#define E1000_CTRL_SLU   (1 << 6)
+#define E1000_CTRL_RST   (1 << 26)
+#define E1000_STATUS_LU  (1 << 1)
+#define E1000_EERD_START (1 << 0)
+#define E1000_EERD_DONE  (1 << 4)
+#define E1000_RAH_AV     (1u << 31)
+
+// Frames above 1522 bytes are dropped (no LPE), so with the CRC stripped
+// a frame always fits the 1984 bytes after the headroom; BSIZE stays at
+// its 2048 default
+#define E1000_RCTL_EN    (1 << 1)
+#define E1000_RCTL_BAM   (1 << 15)
+#define E1000_RCTL_SECRC (1 << 26)
+#define E1000_TCTL_EN    (1 << 1)
+#define E1000_TCTL_PSP   (1 << 3)
+#define E1000_TCTL_CT    (0x10 << 4)
+#define E1000_TCTL_COLD  (0x40 << 12)
+#define E1000_TIPG_VALUE (10 | (8 << 10) | (6 << 20))
+
+#define E1000_ICR_RXDMT0 (1 << 4)       // receive ring running low
+#define E1000_ICR_RXO    (1 << 6)       // receive overrun
+#define E1000_ICR_RXT0   (1 << 7)       // receive timer
+#define E1000_IMS_MASK   (E1000_ICR_RXDMT0 | E1000_ICR_RXO | E1000_ICR_RXT0)
+
+// Minimum gap between interrupts, in 256 ns units: about 8000 per second
+#define E1000_ITR_VALUE 488
+
+#define E1000_RXD_DD  (1 << 0)
+#define E1000_RXD_EOP (1 << 1)
+#define E1000_TXD_EOP  (1 << 0)
+#define E1000_TXD_IFCS (1 << 1)
+#define E1000_TXD_RS   (1 << 3)
+#define E1000_TXD_DD   (1 << 0)
+
+#define RING_MASK (E1000_RING_SIZE - 1)
+
+struct e1000_rx_desc {
+    unsigned long long addr;
+    unsigned short length;
+    unsigned short checksum;
+    unsigned char status;
+    unsigned char errors;
+    unsigned short special;
+};
+
+struct e1000_tx_desc {
+    unsigned long long addr;
+    unsigned short length;
+    unsigned char cso;
+    unsigned char cmd;
+    unsigned char status;
+    unsigned char css;
+    unsigned short special;
+};
+
+struct e1000 {
+    struct net_device dev;
+    volatile unsigned int *regs;
+    unsigned char irq;
+    volatile struct e1000_rx_desc *rx;
+    volatile struct e1000_tx_desc *tx;
+    struct net_buf *rx_bufs[E1000_RING_SIZE];
+    struct net_buf *tx_bufs[E1000_RING_SIZE];
+    unsigned int rx_next;               // next descriptor the device fills
+    unsigned int tx_tail, tx_clean;     // next free slot, oldest in flight
+    unsigned int tx_committed;          // tail last written to TDT
+};
+
+static struct e1000 *nics[E1000_MAX_DEVICES];
+static unsigned int nic_count = 0;
+
+static inline unsigned int reg_read(struct e1000 *nic, unsigned int reg) {
+    return nic->regs[reg / 4];
+}
+
+static inline void reg_write(struct e1000 *nic, unsigned int reg, unsigned int value) {
+    nic->regs[reg / 4] = value;
+}
+
+// ============================================================================
+// NET OPS
+// ============================================================================
+
+// Called from the net thread only, like the rest of the ops
+static int e1000_transmit(struct net_device *dev, struct net_buf *buf) {
+    struct e1000 *nic = dev->driver_data;
+    unsigned int next = (nic->tx_tail + 1) & RING_MASK;
+    if (next == nic->tx_clean) return NET_BUSY;
+    volatile struct e1000_tx_desc *d = &nic->tx[nic->tx_tail];
+    d->addr = (unsigned int)buf->data;
+    d->length = buf->len;
+    d->cmd = E1000_TXD_EOP | E1000_TXD_IFCS | E1000_TXD_RS;
+    d->status = 0;
+    nic->tx_bufs[nic->tx_tail] = buf;
+    nic->tx_tail = next;
+    return 0;
+}
+
+// x86 keeps the descriptor stores ahead of the uncached tail write
+static void e1000_commit(struct net_device *dev) {
+    struct e1000 *nic = dev->driver_data;
+    if (nic->tx_committed == nic->tx_tail) return;
+    asm volatile("" ::: "memory");
+    reg_write(nic, E1000_TDT, nic->tx_tail);
+    nic->tx_committed = nic->tx_tail;
+}
+
+static void reclaim_tx(struct e1000 *nic) {
+    while (nic->tx_clean != nic->tx_committed && (nic->tx[nic->tx_clean].status & E1000_TXD_DD)) {
+        net_buf_free(nic->tx_bufs[nic->tx_clean]);
+        nic->tx_clean = (nic->tx_clean + 1) & RING_MASK;
+    }
+}
+
+// A filled buffer goes up the stack only if a fresh one can take its
+// slot; otherwise the frame is dropped and the buffer reposted, so the
+// ring never runs empty
+static int e1000_poll(struct net_device *dev, int budget) {
+    struct e1000 *nic = dev->driver_data;
+    reclaim_tx(nic);
+    int received = 0;
+    while (received < budget) {
+        volatile struct e1000_rx_desc *d = &nic->rx[nic->rx_next];
+        if (!(d->status & E1000_RXD_DD)) break;
+        asm volatile("" ::: "memory");
+        struct net_buf *buf = nic->rx_bufs[nic->rx_next];
+        struct net_buf *fresh = net_buf_alloc();
+        if (!fresh) {
+            dev->stats.rx_dropped++;
+        } else if (d->errors || !(d->status & E1000_RXD_EOP)) {
+            dev->stats.rx_dropped++;
+            net_buf_free(fresh);
+        } else {
+            buf->len = d->length;
+            nic->rx_bufs[nic->rx_next] = fresh;
+            d->addr = (unsigned int)fresh->data;
+            net_receive(dev, buf);
+        }
+        d->status = 0;
+        nic->rx_next = (nic->rx_next + 1) & RING_MASK;
+        received++;
+    }
+    // Hand the cleaned descriptors back in one tail update
+    if (received) reg_write(nic, E1000_RDT, (nic->rx_next - 1) & RING_MASK);
+    return received;
+}
+
+static int e1000_irq_enable(struct net_device *dev) {
+    struct e1000 *nic = dev->driver_data;
+    reg_write(nic, E1000_IMS, E1000_IMS_MASK);
+    return nic->rx[nic->rx_next].status & E1000_RXD_DD;
+}
+
+static const struct net_ops e1000_ops = { e1000_transmit, e1000_commit, e1000_poll, e1000_irq_enable };
+
+// Reading ICR acknowledges the interrupt; masking everything leaves the
+// device quiet until the net thread has drained it
+static void e1000_irq(struct interrupt_frame *frame) {
+    for (unsigned int i = 0; i < nic_count; i++) {
+        struct e1000 *nic = nics[i];
+        if (nic->irq != frame->int_no - IRQ_BASE || !reg_read(nic, E1000_ICR)) continue;
+        reg_write(nic, E1000_IMC, 0xFFFFFFFF);
+        net_schedule(&nic->dev);
+    }
+}
+
+// ============================================================================
+// PROBE
+// ============================================================================
+
+static unsigned short eeprom_read(struct e1000 *nic, unsigned char word) {
+    reg_write(nic, E1000_EERD, ((unsigned int)word << 8) | E1000_EERD_START);
+    for (unsigned int i = 0; i < 100000; i++) {
+        unsigned int value = reg_read(nic, E1000_EERD);
+        if (value & E1000_EERD_DONE) return value >> 16;
+    }
+    return 0;
+}
+
+// The receive address registers are loaded from the EEPROM at reset;
+// read the EEPROM directly only if they came up empty
+static void read_mac(struct e1000 *nic) {
+    unsigned int low = reg_read(nic, E1000_RAL), high = reg_read(nic, E1000_RAH);
+    if (!(high & E1000_RAH_AV)) {
+        low = eeprom_read(nic, 0) | ((unsigned int)eeprom_read(nic, 1) << 16);
+        high = eeprom_read(nic, 2);
+        reg_write(nic, E1000_RAL, low);
+        reg_write(nic, E1000_RAH, high | E1000_RAH_AV);
+    }
+    for (int i = 0; i < 4; i++) nic->dev.mac[i] = low >> (i * 8);
+    nic->dev.mac[4] = high;
+    nic->dev.mac[5] = high >> 8;
+}
+
+static int setup_rings(struct e1000 *nic) {
+    unsigned int rx = pmm_alloc_frame(), tx = pmm_alloc_frame();
+    nic->rx = (struct e1000_rx_desc *)rx;
+    nic->tx = (struct e1000_tx_desc *)tx;
+    if (!rx || !tx) return 0;
+    memset((void *)rx, 0, PAGE_SIZE);
+    memset((void *)tx, 0, PAGE_SIZE);
+    for (unsigned int i = 0; i < E1000_RING_SIZE; i++) {
+        struct net_buf *buf = net_buf_alloc();
+        if (!buf) return 0;
+        nic->rx_bufs[i] = buf;
+        nic->rx[i].addr = (unsigned int)buf->data;
+    }
+
+    reg_write(nic, E1000_RDBAL, rx);
+    reg_write(nic, E1000_RDBAH, 0);
+    reg_write(nic, E1000_RDLEN, E1000_RING_SIZE * sizeof(struct e1000_rx_desc));
+    reg_write(nic, E1000_RDH, 0);
+    reg_write(nic, E1000_RDT, E1000_RING_SIZE - 1);
+    reg_write(nic, E1000_RCTL, E1000_RCTL_EN | E1000_RCTL_BAM | E1000_RCTL_SECRC);
+
+    reg_write(nic, E1000_TDBAL, tx);
+    reg_write(nic, E1000_TDBAH, 0);
+    reg_write(nic, E1000_TDLEN, E1000_RING_SIZE * sizeof(struct e1000_tx_desc));
+    reg_write(nic, E1000_TDH, 0);
+    reg_write(nic, E1000_TDT, 0);
+    reg_write(nic, E1000_TIPG, E1000_TIPG_VALUE);
+    reg_write(nic, E1000_TCTL, E1000_TCTL_EN | E1000_TCTL_PSP | E1000_TCTL_CT | E1000_TCTL_COLD);
+    return 1;
+}
+
+static void probe_device(struct pci_device *pci) {
+    if (nic_count == E1000_MAX_DEVICES || pci->bars[0].is_io || !pci->bars[0].base) return;
+    if (!pci->irq_pin || pci->irq_line >= IRQ_COUNT) return;
+    struct e1000 *nic = kmalloc(sizeof(struct e1000));
+    if (!nic) return;
+    memset(nic, 0, sizeof(*nic));
+    nic->regs = paging_map_identity(pci->bars[0].base, pci->bars[0].size, PAGE_CACHE_UC);
+    nic->irq = pci->irq_line;
+    pci_enable(pci, PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER);
+
+    reg_write(nic, E1000_IMC, 0xFFFFFFFF);
+    reg_write(nic, E1000_CTRL, reg_read(nic, E1000_CTRL) | E1000_CTRL_RST);
+    for (unsigned int i = 0; i < 100000 && (reg_read(nic, E1000_CTRL) & E1000_CTRL_RST); i++)
+        asm volatile("pause");
+    reg_write(nic, E1000_IMC, 0xFFFFFFFF);
+    reg_read(nic, E1000_ICR);
+    reg_write(nic, E1000_CTRL, reg_read(nic, E1000_CTRL) | E1000_CTRL_SLU | E1000_CTRL_ASDE);
+
+    read_mac(nic);
+    for (unsigned int i = 0; i < 128; i++) reg_write(nic, E1000_MTA + i * 4, 0);
+    if (!setup_rings(nic)) {
+        for (unsigned int i = 0; i < E1000_RING_SIZE && nic->rx_bufs[i]; i++) net_buf_free(nic->rx_bufs[i]);
+        if (nic->rx) pmm_free_frame((unsigned int)nic->rx);
+        if (nic->tx) pmm_free_frame((unsigned int)nic->tx);
+        kfree(nic);
+        return;
+    }
+
+    struct net_device *dev = &nic->dev;
+    dev->driver = "e1000";
+    ksnprintf(dev->model, sizeof(dev->model), "%s %02X:%02X.%X, link %s",
+              pci->device_id == 0x100E ? "82540EM" : "82545EM", pci->bus, pci->device, pci->func,
+              reg_read(nic, E1000_STATUS) & E1000_STATUS_LU ? "up" : "down");
+    dev->ops = &e1000_ops;
+    dev->driver_data = nic;
+
+    nics[nic_count++] = nic;
+    net_register(dev);
+    irq_register(nic->irq, e1000_irq);
+    reg_write(nic, E1000_ITR, E1000_ITR_VALUE);
+    reg_write(nic, E1000_IMS, E1000_IMS_MASK);
+}
+
+void e1000_init() {
+    for (unsigned int i = 0; i < pci_device_count(); i++) {
+        struct pci_device *pci = pci_get_device(i);
+        if (pci->vendor_id == E1000_VENDOR && (pci->device_id == 0x100E || pci->device_id == 0x100F))
+            probe_device(pci);
+    }
+}
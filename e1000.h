@@ -0,0 +1,16 @@
+#ifndef E1000_H
+#define E1000_H
+
+// Intel 8254x gigabit Ethernet (82540EM as emulated by QEMU, device
+// 8086:100E, and the 82545EM 8086:100F). Registers are in the memory BAR0,
+// mapped uncached. Receive and transmit use one descriptor ring each of
+// E1000_RING_SIZE legacy descriptors pointing straight at packet buffers.
+// Interrupts are moderated by ITR and only signal received frames; sent
+// buffers are reclaimed at the next poll.
+
+#define E1000_MAX_DEVICES 2
+#define E1000_RING_SIZE 256             // 16-byte descriptors: one page per ring
+
+void e1000_init();
+
+#endif
@@ -0,0 +1,317 @@
+#include "kernel.h"
+#include "heap.h"
+#include "bcache.h"
+#include "vfs.h"
+#include "ext2.h"
+
+#define EXT2_SUPERBLOCK_OFFSET 1024
+#define EXT2_DIRECT_BLOCKS 12
+#define EXT2_FAST_SYMLINK_MAX 60        // target kept in i_block
+
+// Incompatible features this driver can read past: directory entry file
+// types, a journal needing recovery (ignored, read-only) and flexible
+// block groups (only moves the tables)
+#define EXT2_INCOMPAT_FILETYPE 0x0002
+#define EXT2_INCOMPAT_RECOVER  0x0004
+#define EXT2_INCOMPAT_FLEX_BG  0x0200
+#define EXT2_INCOMPAT_SUPPORTED (EXT2_INCOMPAT_FILETYPE | EXT2_INCOMPAT_RECOVER | EXT2_INCOMPAT_FLEX_BG)
+
+#define EXT2_S_IFMT  0xF000
+#define EXT2_S_IFDIR 0x4000
+#define EXT2_S_IFREG 0x8000
+#define EXT2_S_IFLNK 0xA000
+
+struct ext2_superblock {
+    unsigned int inodes_count, blocks_count, r_blocks_count;
+    unsigned int free_blocks_count, free_inodes_count;
+    unsigned int first_data_block, log_block_size, log_frag_size;
+    unsigned int blocks_per_group, frags_per_group, inodes_per_group;
+    unsigned int mtime, wtime;
+    unsigned short mnt_count, max_mnt_count, magic, state, errors, minor_rev_level;
+    unsigned int lastcheck, checkinterval, creator_os, rev_level;
+    unsigned short def_resuid, def_resgid;
+    // Revision 1 and later
+    unsigned int first_ino;
+    unsigned short inode_size, block_group_nr;
+    unsigned int feature_compat, feature_incompat, feature_ro_compat;
+    unsigned char uuid[16];
+    char volume_name[16];
+} __attribute__((packed));
+
+struct ext2_group_desc {
+    unsigned int block_bitmap, inode_bitmap, inode_table;
+    unsigned short free_blocks_count, free_inodes_count, used_dirs_count, pad;
+    unsigned int reserved[3];
+};
+
+struct ext2_inode {
+    unsigned short mode, uid;
+    unsigned int size, atime, ctime, mtime, dtime;
+    unsigned short gid, links_count;
+    unsigned int blocks, flags, osd1;
+    unsigned int block[15];
+    unsigned int generation, file_acl, size_high, faddr;
+    unsigned char osd2[12];
+};
+
+struct ext2_dirent {
+    unsigned int inode;
+    unsigned short rec_len;
+    unsigned char name_len, file_type;
+    char name[];
+};
+
+struct ext2_fs {
+    struct block_device *dev;
+    unsigned int block_size, block_shift;
+    unsigned int inodes_count, inodes_per_group, inode_size;
+    unsigned int groups;
+    int filetype;                       // directory entries carry the type
+    unsigned int *inode_tables;         // first block of each group's inode table
+};
+
+// ============================================================================
+// BLOCKS AND INODES
+// ============================================================================
+
+static unsigned long long block_offset(const struct ext2_fs *fs, unsigned int block) {
+    return (unsigned long long)block << fs->block_shift;
+}
+
+// A filesystem block inside its cache page; the caller puts the page
+static const unsigned char *get_block(const struct ext2_fs *fs, unsigned int block, struct bcache_page **page) {
+    unsigned long long offset = block_offset(fs, block);
+    *page = bcache_get(fs->dev, offset / BCACHE_PAGE_SIZE);
+    return *page ? (*page)->data + (offset & (BCACHE_PAGE_SIZE - 1)) : 0;
+}
+
+static int read_inode(const struct ext2_fs *fs, unsigned int ino, struct ext2_inode *out) {
+    if (!ino || ino > fs->inodes_count) return -VFS_EINVAL;
+    unsigned int group = (ino - 1) / fs->inodes_per_group, index = (ino - 1) % fs->inodes_per_group;
+    if (group >= fs->groups) return -VFS_EINVAL;
+    unsigned long long offset = block_offset(fs, fs->inode_tables[group]) + index * fs->inode_size;
+    return bcache_read(fs->dev, offset, out, sizeof(*out)) == BLOCK_OK ? 0 : -VFS_EIO;
+}
+
+// size_high is the directory ACL on revision 0 and for directories
+static unsigned long long inode_size(const struct ext2_inode *inode) {
+    if ((inode->mode & EXT2_S_IFMT) == EXT2_S_IFREG) return inode->size | ((unsigned long long)inode->size_high << 32);
+    return inode->size;
+}
+
+static unsigned int inode_type(const struct ext2_inode *inode) {
+    switch (inode->mode & EXT2_S_IFMT) {
+    case EXT2_S_IFREG: return VFS_TYPE_FILE;
+    case EXT2_S_IFDIR: return VFS_TYPE_DIR;
+    case EXT2_S_IFLNK: return VFS_TYPE_SYMLINK;
+    default: return VFS_TYPE_OTHER;
+    }
+}
+
+// File block 'n' to a device block through the direct, indirect, double
+// and triple indirect pointers; 0 for a hole
+static int map_block(const struct ext2_fs *fs, const struct ext2_inode *inode, unsigned int n, unsigned int *out) {
+    unsigned int per = fs->block_size / 4, block, span;
+    if (n < EXT2_DIRECT_BLOCKS) {
+        *out = inode->block[n];
+        return 0;
+    }
+    n -= EXT2_DIRECT_BLOCKS;
+    if (n < per) {
+        block = inode->block[12];
+        span = 1;
+    } else if (n - per < per * per) {
+        n -= per;
+        block = inode->block[13];
+        span = per;
+    } else {
+        n -= per + per * per;
+        block = inode->block[14];
+        span = per * per;
+    }
+    for (; span && block; span /= per) {
+        struct bcache_page *page;
+        const unsigned int *table = (const unsigned int *)get_block(fs, block, &page);
+        if (!table) return -VFS_EIO;
+        block = table[n / span];
+        bcache_put(page);
+        n %= span;
+    }
+    *out = block;
+    return 0;
+}
+
+// ============================================================================
+// VFS OPERATIONS
+// ============================================================================
+
+static int ext2_get(struct vfs_mount *mount, unsigned int ino, struct vfs_node *out) {
+    struct ext2_inode inode;
+    int err = read_inode(mount->fs, ino, &inode);
+    if (err) return err;
+    out->mount = mount;
+    out->ino = ino;
+    out->type = inode_type(&inode);
+    out->size = inode_size(&inode);
+    out->data = 0;
+    return 0;
+}
+
+static int ext2_root(struct vfs_mount *mount, struct vfs_node *out) {
+    return ext2_get(mount, EXT2_ROOT_INO, out);
+}
+
+static int ext2_read(const struct vfs_node *node, unsigned long long offset, void *buffer, unsigned int len) {
+    const struct ext2_fs *fs = node->mount->fs;
+    struct ext2_inode inode;
+    int err = read_inode(fs, node->ino, &inode);
+    if (err) return err;
+    unsigned long long size = inode_size(&inode);
+    if (offset >= size) return 0;
+    if (len > size - offset) len = size - offset;
+
+    // Fast symlinks keep the target in the block pointers
+    if (node->type == VFS_TYPE_SYMLINK && size < EXT2_FAST_SYMLINK_MAX && !inode.blocks) {
+        memcpy(buffer, (const char *)inode.block + offset, len);
+        return len;
+    }
+
+    unsigned char *out = buffer;
+    unsigned int left = len;
+    while (left) {
+        unsigned int in_block = offset & (fs->block_size - 1);
+        unsigned int chunk = fs->block_size - in_block < left ? fs->block_size - in_block : left;
+        unsigned int block;
+        err = map_block(fs, &inode, offset >> fs->block_shift, &block);
+        if (err) return err;
+        if (!block) memset(out, 0, chunk);
+        else if (bcache_read(fs->dev, block_offset(fs, block) + in_block, out, chunk) != BLOCK_OK) return -VFS_EIO;
+        out += chunk;
+        offset += chunk;
+        left -= chunk;
+    }
+    return len;
+}
+
+static const unsigned char dirent_types[8] = {
+    0, VFS_TYPE_FILE, VFS_TYPE_DIR, VFS_TYPE_OTHER, VFS_TYPE_OTHER, VFS_TYPE_OTHER, VFS_TYPE_OTHER, VFS_TYPE_SYMLINK
+};
+
+// Entries are walked in place in the cached directory blocks
+static int ext2_readdir(const struct vfs_node *dir, vfs_dir_fn fn, void *arg) {
+    const struct ext2_fs *fs = dir->mount->fs;
+    struct ext2_inode inode;
+    int err = read_inode(fs, dir->ino, &inode);
+    if (err) return err;
+    unsigned int blocks = (inode.size + fs->block_size - 1) >> fs->block_shift;
+    for (unsigned int n = 0; n < blocks; n++) {
+        unsigned int block;
+        err = map_block(fs, &inode, n, &block);
+        if (err) return err;
+        if (!block) continue;
+        struct bcache_page *page;
+        const unsigned char *p = get_block(fs, block, &page), *end = p + fs->block_size;
+        if (!p) return -VFS_EIO;
+        while (p + sizeof(struct ext2_dirent) <= end) {
+            const struct ext2_dirent *de = (const struct ext2_dirent *)p;
+            if (de->rec_len < sizeof(struct ext2_dirent) || p + de->rec_len > end ||
+                sizeof(struct ext2_dirent) + de->name_len > de->rec_len) break;
+            if (de->inode) {
+                struct vfs_dirent entry = { de->name, de->name_len, de->inode,
+                                            fs->filetype ? dirent_types[de->file_type & 7] : 0 };
+                if (fn(arg, &entry)) {
+                    bcache_put(page);
+                    return 0;
+                }
+            }
+            p += de->rec_len;
+        }
+        bcache_put(page);
+    }
+    return 0;
+}
+
+struct lookup_arg {
+    const char *name;
+    unsigned int len;
+    unsigned int ino;
+};
+
+static int lookup_match(void *arg, const struct vfs_dirent *entry) {
+    struct lookup_arg *l = arg;
+    if (entry->name_len != l->len || memcmp(entry->name, l->name, l->len) != 0) return 0;
+    l->ino = entry->ino;
+    return 1;
+}
+
+static int ext2_lookup(const struct vfs_node *dir, const char *name, unsigned int len, struct vfs_node *out) {
+    struct lookup_arg l = { name, len, 0 };
+    int err = ext2_readdir(dir, lookup_match, &l);
+    if (err) return err;
+    if (!l.ino) return -VFS_ENOENT;
+    return ext2_get(dir->mount, l.ino, out);
+}
+
+static int ext2_stat(const struct vfs_node *node, struct vfs_stat *out) {
+    struct ext2_inode inode;
+    int err = read_inode(node->mount->fs, node->ino, &inode);
+    if (err) return err;
+    out->ino = node->ino;
+    out->type = inode_type(&inode);
+    out->mode = inode.mode;
+    out->links = inode.links_count;
+    out->uid = inode.uid;
+    out->gid = inode.gid;
+    out->size = inode_size(&inode);
+    out->blocks = inode.blocks;
+    out->atime = inode.atime;
+    out->mtime = inode.mtime;
+    out->ctime = inode.ctime;
+    return 0;
+}
+
+static const struct vfs_ops ext2_ops = {
+    ext2_root, ext2_get, ext2_lookup, ext2_read, ext2_readdir, ext2_stat
+};
+
+// ============================================================================
+// MOUNT
+// ============================================================================
+
+int ext2_mount(struct block_device *dev, const char *path) {
+    struct ext2_superblock sb;
+    if (bcache_read(dev, EXT2_SUPERBLOCK_OFFSET, &sb, sizeof(sb)) != BLOCK_OK) return 0;
+    if (sb.magic != EXT2_MAGIC || sb.log_block_size > 2 || !sb.inodes_per_group || !sb.blocks_per_group) return 0;
+    if (sb.rev_level >= 1 && (sb.feature_incompat & ~EXT2_INCOMPAT_SUPPORTED)) return 0;
+
+    struct ext2_fs *fs = kmalloc(sizeof(struct ext2_fs));
+    if (!fs) return 0;
+    fs->dev = dev;
+    fs->block_shift = 10 + sb.log_block_size;
+    fs->block_size = 1 << fs->block_shift;
+    fs->inodes_count = sb.inodes_count;
+    fs->inodes_per_group = sb.inodes_per_group;
+    fs->inode_size = sb.rev_level >= 1 ? sb.inode_size : 128;
+    fs->filetype = sb.rev_level >= 1 && (sb.feature_incompat & EXT2_INCOMPAT_FILETYPE);
+    fs->groups = (sb.blocks_count - sb.first_data_block + sb.blocks_per_group - 1) / sb.blocks_per_group;
+    fs->inode_tables = 0;
+    // Every inode number read_inode() accepts must land in a group
+    if (sb.blocks_count <= sb.first_data_block || !sb.inodes_count ||
+        (sb.inodes_count - 1) / sb.inodes_per_group >= fs->groups) goto fail;
+    fs->inode_tables = kmalloc(fs->groups * sizeof(unsigned int));
+    if (fs->inode_size < sizeof(struct ext2_inode) || !fs->inode_tables) goto fail;
+
+    // The descriptor table starts in the block after the superblock's
+    unsigned long long table = block_offset(fs, sb.first_data_block + 1);
+    for (unsigned int g = 0; g < fs->groups; g++) {
+        struct ext2_group_desc desc;
+        if (bcache_read(dev, table + g * sizeof(desc), &desc, sizeof(desc)) != BLOCK_OK) goto fail;
+        fs->inode_tables[g] = desc.inode_table;
+    }
+    if (vfs_mount(path, "ext2", dev->name, &ext2_ops, fs) == 0) return 1;
+
+fail:
+    kfree(fs->inode_tables);
+    kfree(fs);
+    return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef EXT2_H
+#define EXT2_H
+
+#include "block.h"
+
+// Read-only ext2 (and ext3 without journal replay; ext4 extents are not
+// supported). Block sizes of 1, 2 and 4 KB, so every filesystem block
+// lies within one page-cache page: directory blocks and indirect blocks
+// are used in place in the cache, file data is copied straight out of it.
+
+#define EXT2_MAGIC 0xEF53
+#define EXT2_ROOT_INO 2
+
+// Probe 'dev' for an ext2 superblock and mount it at 'path'; 1 if mounted
+int ext2_mount(struct block_device *dev, const char *path);
+
+#endif
@@ -0,0 +1,262 @@
+#include "kernel.h"
+#include "heap.h"
+#include "paging.h"
+#include "timer.h"
+#include "cpufeature.h"
+#include "console.h"
+#include "fbcon.h"
+
+#define GLYPH_PIXELS (FBCON_GLYPH_WIDTH * FBCON_GLYPH_HEIGHT)
+#define GLYPH_ROW_BYTES (FBCON_GLYPH_WIDTH * 4)
+#define GLYPH_COUNT 256
+#define CURSOR_LINES 2                  // underline at the bottom of the cell
+#define BLANK_CELL ((CONSOLE_ATTR << 8) | ' ')
+#define NO_ROW 0xFFFFFFFF
+
+// The video BIOS option ROM: 55 AA, then its size in 512-byte blocks
+#define VIDEO_ROM 0xC0000
+#define VIDEO_ROM_MAX 0x10000
+
+// The kernel is built without -msse; as in string.c
+#define SSE2_FN __attribute__((target("sse2")))
+
+// Glyphs 0-2 of the IBM VGA 8x16 font (blank, smiley, inverse smiley),
+// which every VGA-compatible BIOS carries for INT 10h function 11h
+static const unsigned char font_signature[3 * FBCON_GLYPH_HEIGHT] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0x00, 0x00, 0x7E, 0x81, 0xA5, 0x81, 0x81, 0xBD, 0x99, 0x81, 0x81, 0x7E, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x7E, 0xFF, 0xDB, 0xFF, 0xFF, 0xC3, 0xE7, 0xFF, 0xFF, 0x7E, 0x00, 0x00, 0x00, 0x00,
+};
+
+// The 16 text-mode colours as 0xRRGGBB
+static const unsigned int vga_palette[16] = {
+    0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+    0x555555, 0x5555FF, 0x55FF55, 0x55FFFF, 0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF,
+};
+
+static struct {
+    unsigned char *base;                // 0 while inactive
+    unsigned int width, height, pitch;
+    unsigned int cols, rows;
+    unsigned int fg, bg;                // console colours as pixels
+    int simd;
+} fb;
+
+static unsigned int *glyphs;            // GLYPH_COUNT * GLYPH_PIXELS, 16-byte aligned
+// The blits load glyph rows with MOVDQA; a large kmalloc() block gives
+// HEAP_LARGE_ALIGN, and each glyph is a multiple of 16 bytes
+_Static_assert(GLYPH_COUNT * GLYPH_PIXELS * 4 > HEAP_MAX_SMALL && HEAP_LARGE_ALIGN % 16 == 0 &&
+               (GLYPH_PIXELS * 4) % 16 == 0, "glyph cache must be 16-byte aligned");
+static unsigned short *shown;           // cells as they are on screen
+static unsigned int cursor_row = NO_ROW, cursor_col;
+static unsigned int font_address;
+static struct fbcon_stats stats;
+
+// ============================================================================
+// BLITS
+// ============================================================================
+
+// XMM registers only with interrupts on (see string.h); the early boot
+// and panic paths draw with REP MOVSD instead
+static inline int simd_allowed() {
+    unsigned int flags;
+    asm volatile("pushfl\n\tpopl %0" : "=r"(flags));
+    return fb.simd && (flags & 0x200);
+}
+
+// One glyph: 16 rows of 32 bytes from the cache, non-temporal since the
+// framebuffer is never read
+SSE2_FN static void blit_sse2(unsigned char *dst, const unsigned int *src, unsigned int pitch) {
+    unsigned int lines = FBCON_GLYPH_HEIGHT;
+    asm volatile("1:\n\t"
+                 "movdqa (%1), %%xmm0\n\tmovdqa 16(%1), %%xmm1\n\t"
+                 "movntdq %%xmm0, (%0)\n\tmovntdq %%xmm1, 16(%0)\n\t"
+                 "add $32, %1\n\tadd %3, %0\n\tdec %2\n\tjnz 1b"
+                 : "+r"(dst), "+r"(src), "+r"(lines) : "r"(pitch) : "xmm0", "xmm1", "memory");
+}
+
+static void blit_rep(unsigned char *dst, const unsigned int *src, unsigned int pitch) {
+    for (unsigned int y = 0; y < FBCON_GLYPH_HEIGHT; y++, dst += pitch, src += FBCON_GLYPH_WIDTH) {
+        void *d = dst;
+        const void *s = src;
+        unsigned int words = FBCON_GLYPH_WIDTH;
+        asm volatile("rep movsl" : "+D"(d), "+S"(s), "+c"(words) : : "memory");
+    }
+}
+
+// 'bytes' per line, a multiple of 32. The broadcast shares the asm
+// statement with the loop, as in memset_sse2.
+SSE2_FN static void fill_sse2(unsigned char *dst, unsigned int pixel, unsigned int bytes,
+                              unsigned int lines, unsigned int pitch) {
+    for (; lines; lines--, dst += pitch) {
+        unsigned char *d = dst;
+        unsigned int blocks = bytes / 32;
+        asm volatile("movd %2, %%xmm0\n\tpshufd $0, %%xmm0, %%xmm0\n"
+                     "1:\n\t"
+                     "movntdq %%xmm0, (%0)\n\tmovntdq %%xmm0, 16(%0)\n\t"
+                     "add $32, %0\n\tdec %1\n\tjnz 1b"
+                     : "+r"(d), "+r"(blocks) : "r"(pixel) : "xmm0", "memory");
+    }
+}
+
+static void fill_rep(unsigned char *dst, unsigned int pixel, unsigned int bytes,
+                     unsigned int lines, unsigned int pitch) {
+    for (; lines; lines--, dst += pitch) memset32(dst, pixel, bytes / 4);
+}
+
+static inline unsigned char *cell_address(unsigned int row, unsigned int col) {
+    return fb.base + row * FBCON_GLYPH_HEIGHT * fb.pitch + col * GLYPH_ROW_BYTES;
+}
+
+static void draw_cell(unsigned int row, unsigned int col, unsigned short cell, int simd) {
+    const unsigned int *glyph = glyphs + (cell & 0xFF) * GLYPH_PIXELS;
+    if (simd) blit_sse2(cell_address(row, col), glyph, fb.pitch);
+    else blit_rep(cell_address(row, col), glyph, fb.pitch);
+}
+
+static void draw_cursor(unsigned int row, unsigned int col) {
+    unsigned char *line = cell_address(row, col) + (FBCON_GLYPH_HEIGHT - CURSOR_LINES) * fb.pitch;
+    fill_rep(line, fb.fg, GLYPH_ROW_BYTES, CURSOR_LINES, fb.pitch);
+}
+
+// ============================================================================
+// DRAWING
+// ============================================================================
+
+static unsigned int count_changed(const unsigned short *cells, const unsigned short *seen) {
+    unsigned int changed = 0;
+    for (unsigned int col = 0; col < fb.cols; col++) changed += cells[col] != seen[col];
+    return changed;
+}
+
+static int row_blank(const unsigned short *cells) {
+    for (unsigned int col = 0; col < fb.cols; col++)
+        if (cells[col] != BLANK_CELL) return 0;
+    return 1;
+}
+
+// A row that became blank is one fill of whole cache lines when more
+// than half of it changed; otherwise only the changed cells are drawn
+void fbcon_draw(const unsigned short *cells, unsigned int top, unsigned int left,
+                unsigned int bottom, unsigned int right, unsigned int new_row, unsigned int new_col) {
+    if (!fb.base) return;
+    unsigned long long start = rdtsc();
+    int simd = simd_allowed();
+    if (cursor_row < fb.rows) draw_cell(cursor_row, cursor_col, shown[cursor_row * fb.cols + cursor_col], simd);
+
+    for (unsigned int row = top; row < bottom && row < fb.rows; row++) {
+        const unsigned short *src = cells + row * fb.cols;
+        unsigned short *seen = shown + row * fb.cols;
+        if (left == 0 && right == fb.cols && row_blank(src) && count_changed(src, seen) * 2 > fb.cols) {
+            unsigned char *dst = cell_address(row, 0);
+            if (simd) fill_sse2(dst, fb.bg, fb.cols * GLYPH_ROW_BYTES, FBCON_GLYPH_HEIGHT, fb.pitch);
+            else fill_rep(dst, fb.bg, fb.cols * GLYPH_ROW_BYTES, FBCON_GLYPH_HEIGHT, fb.pitch);
+            memset32(seen, (BLANK_CELL << 16) | BLANK_CELL, fb.cols / 2);
+            stats.row_fills++;
+            continue;
+        }
+        for (unsigned int col = left; col < right && col < fb.cols; col++) {
+            if (src[col] == seen[col]) {
+                stats.unchanged++;
+                continue;
+            }
+            seen[col] = src[col];
+            draw_cell(row, col, src[col], simd);
+            stats.glyphs++;
+        }
+    }
+
+    cursor_row = new_row < fb.rows && new_col < fb.cols ? new_row : NO_ROW;
+    cursor_col = new_col;
+    if (cursor_row != NO_ROW) draw_cursor(cursor_row, cursor_col);
+    if (simd) asm volatile("sfence" ::: "memory");
+    stats.frames++;
+    stats.cycles += rdtsc() - start;
+}
+
+// ============================================================================
+// SETUP
+// ============================================================================
+
+static const unsigned char *find_font() {
+    const unsigned char *rom = (const unsigned char *)VIDEO_ROM;
+    if (rom[0] != 0x55 || rom[1] != 0xAA) return 0;
+    unsigned int size = rom[2] * 512;
+    if (size > VIDEO_ROM_MAX) size = VIDEO_ROM_MAX;
+    for (unsigned int i = 0; i + GLYPH_COUNT * FBCON_GLYPH_HEIGHT <= size; i++)
+        if (rom[i] == 0 && memcmp(rom + i, font_signature, sizeof(font_signature)) == 0) return rom + i;
+    return 0;
+}
+
+static unsigned int rgb_pixel(const unsigned char *info, unsigned int rgb) {
+    unsigned int r = (rgb >> 16) & 0xFF, g = (rgb >> 8) & 0xFF, b = rgb & 0xFF;
+    return ((r >> (8 - info[1])) << info[0]) | ((g >> (8 - info[3])) << info[2]) | ((b >> (8 - info[5])) << info[4]);
+}
+
+static void render_glyphs(const unsigned char *font) {
+    unsigned int *pixel = glyphs;
+    for (unsigned int c = 0; c < GLYPH_COUNT; c++)
+        for (unsigned int y = 0; y < FBCON_GLYPH_HEIGHT; y++) {
+            unsigned char bits = font[c * FBCON_GLYPH_HEIGHT + y];
+            for (unsigned int x = 0; x < FBCON_GLYPH_WIDTH; x++) *pixel++ = (bits & (0x80 >> x)) ? fb.fg : fb.bg;
+        }
+}
+
+int fbcon_init(unsigned int magic, const struct multiboot_info *mbi, unsigned int *cols, unsigned int *rows) {
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC || !(mbi->flags & MULTIBOOT_INFO_FRAMEBUFFER)) return 0;
+    if (mbi->framebuffer_type != MULTIBOOT_FRAMEBUFFER_RGB || mbi->framebuffer_bpp != 32) return 0;
+    if (mbi->framebuffer_addr >> 32) return 0;
+    const unsigned char *info = mbi->color_info;
+    if (info[1] > 8 || info[3] > 8 || info[5] > 8) return 0;
+    const unsigned char *font = find_font();
+    if (!font) return 0;
+
+    fb.width = mbi->framebuffer_width;
+    fb.height = mbi->framebuffer_height;
+    fb.pitch = mbi->framebuffer_pitch;
+    fb.cols = (fb.width / FBCON_GLYPH_WIDTH) & ~1;      // cells are cleared in pairs
+    fb.rows = fb.height / FBCON_GLYPH_HEIGHT;
+    if (!fb.cols || !fb.rows) return 0;
+    glyphs = kmalloc(GLYPH_COUNT * GLYPH_PIXELS * 4);
+    shown = kmalloc(fb.cols * fb.rows * sizeof(unsigned short));
+    if (!glyphs || !shown) {
+        kfree(glyphs);
+        kfree(shown);
+        return 0;
+    }
+
+    fb.fg = rgb_pixel(info, vga_palette[CONSOLE_ATTR & 0x0F]);
+    fb.bg = rgb_pixel(info, vga_palette[CONSOLE_ATTR >> 4]);
+    fb.simd = cpu_has(CPU_FEATURE_SSE2) && !((unsigned int)mbi->framebuffer_addr & 15) && !(fb.pitch & 15);
+    render_glyphs(font);
+    font_address = (unsigned int)font;
+
+    // Paging is still off here; paging_init maps the framebuffer
+    fb.base = (unsigned char *)(unsigned int)mbi->framebuffer_addr;
+    fill_rep(fb.base, fb.bg, fb.width * 4, fb.height, fb.pitch);
+    memset32(shown, (BLANK_CELL << 16) | BLANK_CELL, fb.cols * fb.rows / 2);
+    *cols = fb.cols;
+    *rows = fb.rows;
+    return 1;
+}
+
+int fbcon_active() {
+    return fb.base != 0;
+}
+
+void fbcon_map() {
+    if (fb.base) paging_map_identity((unsigned int)fb.base, fb.pitch * fb.height, PAGE_CACHE_WC);
+}
+
+void fbcon_get_stats(struct fbcon_stats *out) {
+    *out = stats;
+    out->width = fb.width;
+    out->height = fb.height;
+    out->pitch = fb.pitch;
+    out->bpp = 32;
+    out->address = (unsigned int)fb.base;
+    out->cols = fb.cols;
+    out->rows = fb.rows;
+    out->font_address = font_address;
+    out->simd = fb.simd;
+}
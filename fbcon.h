@@ -0,0 +1,56 @@
+#ifndef FBCON_H
+#define FBCON_H
+
+#include "multiboot.h"
+
+// Text rendering on a linear framebuffer set up by GRUB (the video mode
+// requested in kernel.asm's multiboot header). Only 32-bit RGB modes are
+// used; anything else leaves the console on VGA text.
+//
+// The 8x16 font is the VGA BIOS's own, found in the option ROM at boot.
+// Every glyph is expanded once into a cache of ready-made 32-bit pixel
+// rows in the console colours, so drawing a character is 16 copies of 32
+// bytes: two SSE2 stores per row. fbcon keeps a copy of the cells on
+// screen and only draws cells that differ, so scrolling redraws the text
+// that moved, not the blank space. The framebuffer is write-combining and
+// never read back.
+
+#define FBCON_GLYPH_WIDTH  8
+#define FBCON_GLYPH_HEIGHT 16
+
+// Default mode asked for in the multiboot header (kernel.asm)
+#define FBCON_MODE_WIDTH  1024
+#define FBCON_MODE_HEIGHT 768
+#define FBCON_MODE_DEPTH  32
+
+struct fbcon_stats {
+    unsigned int width, height, pitch, bpp;
+    unsigned int address;
+    unsigned int cols, rows;
+    unsigned int font_address;          // in the video BIOS
+    int simd;                           // SSE2 blits possible
+    unsigned int frames;                // draw calls
+    unsigned long long glyphs;          // cells drawn
+    unsigned long long unchanged;       // cells in a dirty rectangle skipped as identical
+    unsigned long long row_fills;       // rows cleared with one fill
+    unsigned long long cycles;          // TSC cycles spent drawing
+};
+
+// After heap_init (glyph cache) and before paging_init; 0 if there is no
+// usable framebuffer or no font. Clears the screen.
+int fbcon_init(unsigned int magic, const struct multiboot_info *mbi, unsigned int *cols, unsigned int *rows);
+int fbcon_active();
+
+// From paging_init: map the framebuffer write-combining
+void fbcon_map();
+
+// Bring the rectangle [top, bottom) x [left, right) of the screen up to
+// date with 'cells' (a whole screen, console layout) and draw the cursor
+// at (cursor_row, cursor_col), or nowhere if cursor_row is past the last
+// row. Cells outside the rectangle are not read. Callers serialize.
+void fbcon_draw(const unsigned short *cells, unsigned int top, unsigned int left,
+                unsigned int bottom, unsigned int right, unsigned int cursor_row, unsigned int cursor_col);
+
+void fbcon_get_stats(struct fbcon_stats *out);
+
+#endif
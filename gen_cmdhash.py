@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+"""Generate cmd_hash.h: a minimal perfect hash over the names in commands.def.
+
+Searches for a seed such that every command name lands in a distinct slot
+of a power-of-two table, using the same seeded FNV-1a hash as commands.c.
+Dispatch then costs one hash, one table load and one strcmp.
+
+Usage: python3 gen_cmdhash.py commands.def > cmd_hash.h
+"""
+import re
+import sys
+
+
+def command_hash(name, seed):
+    h = (2166136261 ^ seed) & 0xFFFFFFFF
+    for byte in name.encode():
+        h ^= byte
+        h = (h * 16777619) & 0xFFFFFFFF
+    return h ^ (h >> 16)
+
+
+def main():
+    source = open(sys.argv[1]).read()
+    names = re.findall(r'^\s*COMMAND\(\s*"([^"]+)"', source, re.M)
+    if len(set(names)) != len(names):
+        sys.exit("gen_cmdhash: duplicate command name")
+
+    bits = max(1, (2 * len(names) - 1).bit_length())
+    while True:
+        mask = (1 << bits) - 1
+        for seed in range(1 << 20):
+            slots = {command_hash(name, seed) & mask for name in names}
+            if len(slots) == len(names):
+                break
+        else:
+            bits += 1
+            continue
+        break
+
+    table = [0] * (1 << bits)
+    for index, name in enumerate(names):
+        table[command_hash(name, seed) & mask] = index + 1
+
+    print("// Generated by gen_cmdhash.py from commands.def - do not edit.")
+    print("#ifndef CMD_HASH_H")
+    print("#define CMD_HASH_H")
+    print()
+    print("#define CMD_HASH_SEED 0x%08X" % seed)
+    print("#define CMD_HASH_BITS %d" % bits)
+    print()
+    print("// Slot -> command index + 1 (0 = empty)")
+    print("static const unsigned char cmd_hash_slots[%d] = {" % len(table))
+    for i in range(0, len(table), 16):
+        print("    " + ", ".join(str(v) for v in table[i:i + 16]) + ",")
+    print("};")
+    print()
+    print("#endif")
+
+
+if __name__ == "__main__":
+    main()
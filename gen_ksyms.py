@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+"""Generate ksyms.asm: the kernel's function symbols as a .ksyms section.
+
+Reads `nm -n` of a first-pass kernel.bin and emits a sorted address table
+plus a string table. link.ld places .ksyms after .text and .rodata, so
+linking the result in a second pass moves no function: the addresses in
+the table stay correct. ksyms.c looks them up for the profiler and for
+exception reports.
+
+Usage: python3 gen_ksyms.py kernel.bin > ksyms.asm
+"""
+import subprocess
+import sys
+
+KSYMS_MAGIC = 0x4D59534B  # "KSYM"
+LINKER_SYMBOLS = {"_kernel_start", "_text_end"}  # markers from link.ld, not functions
+
+
+def main():
+    nm = subprocess.run(["nm", "-n", sys.argv[1]], capture_output=True, text=True, check=True)
+    symbols = []
+    for line in nm.stdout.splitlines():
+        fields = line.split()
+        if len(fields) != 3 or fields[1] not in "Tt" or fields[2] in LINKER_SYMBOLS:
+            continue
+        address, name = int(fields[0], 16), fields[2]
+        # Aliases at one address keep the first name, preferring globals
+        if symbols and symbols[-1][0] == address:
+            if fields[1] == "T" and symbols[-1][2] == "t":
+                symbols[-1] = (address, name, fields[1])
+            continue
+        symbols.append((address, name, fields[1]))
+
+    names = bytearray()
+    offsets = []
+    base = 8 + 8 * len(symbols)
+    for _, name, _ in symbols:
+        offsets.append(base + len(names))
+        names += name.encode() + b"\0"
+
+    print("; Generated by gen_ksyms.py from %s - do not edit." % sys.argv[1])
+    print("section .ksyms progbits alloc noexec nowrite align=4")
+    print("    dd 0x%08X, %d" % (KSYMS_MAGIC, len(symbols)))
+    for (address, name, _), offset in zip(symbols, offsets):
+        print("    dd 0x%08X, %-6d ; %s" % (address, offset, name))
+    for i in range(0, len(names), 16):
+        print("    db " + ", ".join(str(b) for b in names[i:i + 16]))
+
+
+if __name__ == "__main__":
+    main()
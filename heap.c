@@ -0,0 +1,246 @@
+#include "kernel.h"
+#include "pmm.h"
+#include "heap.h"
+
+#define SLAB_MAGIC  0x51AB51AB
+#define LARGE_MAGIC 0x1A46E000
+
+// Lives at the start of every slab page. The 32-byte size keeps every
+// object naturally aligned up to 32 bytes.
+struct slab {
+    unsigned int magic;
+    struct kmem_cache *cache;
+    void *free;                         // singly linked through the objects
+    unsigned int inuse;
+    struct slab *prev, *next;           // partial list links
+    unsigned int reserved[2];
+};
+
+// Header of a multi-page allocation; the caller's pointer follows it
+struct large_header {
+    unsigned int magic;
+    unsigned int pages;
+    unsigned int reserved[2];
+};
+_Static_assert(sizeof(struct large_header) % HEAP_LARGE_ALIGN == 0, "large blocks must keep HEAP_LARGE_ALIGN");
+
+static struct kmem_cache size_caches[HEAP_MAX_SHIFT - HEAP_MIN_SHIFT + 1];
+static struct kmem_cache *cache_list = 0;
+static struct arena boot_arena;
+static struct spinlock large_lock = SPINLOCK_INIT;
+static unsigned int large_allocs = 0, large_pages = 0;
+
+// ============================================================================
+// SLAB LISTS
+// ============================================================================
+
+static void slab_link(struct slab **head, struct slab *slab) {
+    slab->prev = 0;
+    slab->next = *head;
+    if (*head) (*head)->prev = slab;
+    *head = slab;
+}
+
+static void slab_unlink(struct slab **head, struct slab *slab) {
+    if (slab->prev) slab->prev->next = slab->next;
+    else *head = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+}
+
+static struct slab *cache_grow(struct kmem_cache *cache) {
+    struct slab *slab = cache->empty;
+    if (slab) {
+        cache->empty = 0;
+    } else {
+        slab = (struct slab *)pmm_alloc_frame();
+        if (!slab) return 0;
+        slab->magic = SLAB_MAGIC;
+        slab->cache = cache;
+        slab->inuse = 0;
+
+        // Thread the free list through the objects, lowest address first
+        char *obj = (char *)slab + sizeof(struct slab);
+        slab->free = obj;
+        for (unsigned int i = 1; i < cache->objects_per_slab; i++, obj += cache->object_size)
+            *(void **)obj = obj + cache->object_size;
+        *(void **)obj = 0;
+        cache->slab_count++;
+    }
+    slab_link(&cache->partial, slab);
+    return slab;
+}
+
+// ============================================================================
+// CACHES
+// ============================================================================
+
+static void cache_setup(struct kmem_cache *cache, const char *name, unsigned int object_size) {
+    strlcpy(cache->name, name, HEAP_NAME_LEN);
+    cache->lock.locked = 0;
+
+    if (object_size < sizeof(void *)) object_size = sizeof(void *);
+    cache->object_size = (object_size + 7) & ~7;
+    cache->objects_per_slab = (PAGE_SIZE - sizeof(struct slab)) / cache->object_size;
+    cache->partial = cache->empty = 0;
+    cache->allocs = cache->frees = cache->active_objects = cache->slab_count = 0;
+    cache->next = cache_list;
+    cache_list = cache;
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, unsigned int object_size) {
+    if (object_size > PAGE_SIZE - sizeof(struct slab)) return 0;
+    struct kmem_cache *cache = boot_alloc(sizeof(struct kmem_cache));
+    if (cache) cache_setup(cache, name, object_size);
+    return cache;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache) {
+    unsigned int flags = spin_lock_irqsave(&cache->lock);
+    struct slab *slab = cache->partial;
+    if (!slab && !(slab = cache_grow(cache))) {
+        spin_unlock_irqrestore(&cache->lock, flags);
+        return 0;
+    }
+
+    void **obj = slab->free;
+    slab->free = *obj;
+    if (++slab->inuse == cache->objects_per_slab) slab_unlink(&cache->partial, slab);
+    cache->allocs++;
+    cache->active_objects++;
+    spin_unlock_irqrestore(&cache->lock, flags);
+    return obj;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *ptr) {
+    struct slab *slab = (struct slab *)((unsigned int)ptr & ~(PAGE_SIZE - 1));
+    unsigned int flags = spin_lock_irqsave(&cache->lock);
+
+    *(void **)ptr = slab->free;
+    slab->free = ptr;
+    if (slab->inuse-- == cache->objects_per_slab) slab_link(&cache->partial, slab);
+    cache->frees++;
+    cache->active_objects--;
+
+    // Keep one empty slab around; return any further ones to the frame allocator
+    if (!slab->inuse) {
+        slab_unlink(&cache->partial, slab);
+        if (cache->empty) {
+            pmm_free_frame((unsigned int)slab);
+            cache->slab_count--;
+        } else {
+            cache->empty = slab;
+        }
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+// ============================================================================
+// KMALLOC / KFREE
+// ============================================================================
+
+void *kmalloc(unsigned int size) {
+    if (size <= HEAP_MAX_SMALL) {
+        // Index of the smallest power of two >= size, relative to the first class
+        unsigned int shift = (size <= (1 << HEAP_MIN_SHIFT)) ? HEAP_MIN_SHIFT : 32 - __builtin_clz(size - 1);
+        return kmem_cache_alloc(&size_caches[shift - HEAP_MIN_SHIFT]);
+    }
+
+    unsigned int pages = (size + sizeof(struct large_header) + PAGE_SIZE - 1) / PAGE_SIZE;
+    unsigned int flags = spin_lock_irqsave(&large_lock);
+    struct large_header *header = (struct large_header *)pmm_alloc_frames(pages);
+    if (header) {
+        header->magic = LARGE_MAGIC;
+        header->pages = pages;
+        large_allocs++;
+        large_pages += pages;
+    }
+    spin_unlock_irqrestore(&large_lock, flags);
+    return header ? header + 1 : 0;
+}
+
+void kfree(void *ptr) {
+    if (!ptr) return;
+    unsigned int page = (unsigned int)ptr & ~(PAGE_SIZE - 1);
+
+    // Slab pages start with SLAB_MAGIC and their objects sit at least
+    // sizeof(struct slab) into the page, so this cannot match a slab object.
+    struct large_header *header = (struct large_header *)page;
+    if (header->magic == LARGE_MAGIC && (void *)(header + 1) == ptr) {
+        unsigned int flags = spin_lock_irqsave(&large_lock);
+        large_allocs--;
+        large_pages -= header->pages;
+        header->magic = 0;
+        pmm_free_frames(page, header->pages);
+        spin_unlock_irqrestore(&large_lock, flags);
+        return;
+    }
+
+    struct slab *slab = (struct slab *)page;
+    if (slab->magic == SLAB_MAGIC) kmem_cache_free(slab->cache, ptr);
+}
+
+// ============================================================================
+// ARENAS
+// ============================================================================
+
+void arena_init(struct arena *arena, unsigned int chunk_pages) {
+    arena->lock.locked = 0;
+    arena->base = arena->offset = arena->size = 0;
+    arena->chunk_pages = chunk_pages;
+    arena->total_bytes = arena->used_bytes = 0;
+}
+
+// Bump allocation; a new chunk is taken when the current one runs out and
+// the tail of the old chunk is simply abandoned.
+void *arena_alloc(struct arena *arena, unsigned int size, unsigned int align) {
+    unsigned int flags = spin_lock_irqsave(&arena->lock);
+    unsigned int offset = (arena->offset + align - 1) & ~(align - 1);
+    if (!arena->base || offset + size > arena->size) {
+        unsigned int pages = arena->chunk_pages;
+        if (size > pages * PAGE_SIZE) pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+        unsigned int base = pmm_alloc_frames(pages);
+        if (!base) {
+            spin_unlock_irqrestore(&arena->lock, flags);
+            return 0;
+        }
+        arena->base = base;
+        arena->size = pages * PAGE_SIZE;
+        arena->total_bytes += arena->size;
+        offset = 0;
+    }
+    arena->offset = offset + size;
+    arena->used_bytes += size;
+    spin_unlock_irqrestore(&arena->lock, flags);
+    return (void *)(arena->base + offset);
+}
+
+void *boot_alloc(unsigned int size) {
+    return arena_alloc(&boot_arena, size, 16);
+}
+
+// ============================================================================
+// INITIALIZATION AND STATISTICS
+// ============================================================================
+
+void heap_init() {
+    static const char *names[] = {
+        "kmalloc-8", "kmalloc-16", "kmalloc-32", "kmalloc-64",
+        "kmalloc-128", "kmalloc-256", "kmalloc-512", "kmalloc-1024"
+    };
+    arena_init(&boot_arena, 16);
+    for (int i = HEAP_MAX_SHIFT - HEAP_MIN_SHIFT; i >= 0; i--)
+        cache_setup(&size_caches[i], names[i], 1 << (i + HEAP_MIN_SHIFT));
+}
+
+struct kmem_cache *heap_caches() {
+    return cache_list;
+}
+
+const struct arena *heap_boot_arena() {
+    return &boot_arena;
+}
+
+void heap_large_stats(unsigned int *active_allocs, unsigned int *active_pages) {
+    *active_allocs = large_allocs;
+    *active_pages = large_pages;
+}
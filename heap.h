@@ -0,0 +1,68 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "spinlock.h"
+
+// Kernel heap on top of the frame allocator.
+//
+// kmalloc() serves requests up to HEAP_MAX_SMALL bytes from power-of-two
+// slab caches: each slab is one page with its header at the start, so
+// kfree() finds the owning cache by masking the pointer. Larger requests
+// get whole pages. Subsystems with many objects of one type can create a
+// dedicated cache with kmem_cache_create(). Data that lives forever comes
+// from a bump arena and is never freed.
+
+#define HEAP_MIN_SHIFT 3                // smallest class: 8 bytes
+#define HEAP_MAX_SHIFT 10               // largest class: 1024 bytes
+#define HEAP_MAX_SMALL (1 << HEAP_MAX_SHIFT)
+#define HEAP_NAME_LEN 16
+
+// Alignment of every kmalloc() block larger than HEAP_MAX_SMALL: it starts
+// one 16-byte header into its first page
+#define HEAP_LARGE_ALIGN 16
+
+struct slab;
+
+struct kmem_cache {
+    char name[HEAP_NAME_LEN];
+    struct spinlock lock;
+    unsigned int object_size;
+    unsigned int objects_per_slab;
+    struct slab *partial;               // slabs with at least one free object
+    struct slab *empty;                 // one fully free slab kept to avoid page churn
+    struct kmem_cache *next;            // all caches, for heapstat
+
+    // Statistics
+    unsigned int allocs, frees;
+    unsigned int active_objects;
+    unsigned int slab_count;
+};
+
+struct arena {
+    struct spinlock lock;
+    unsigned int base, offset, size;    // current chunk
+    unsigned int chunk_pages;
+    unsigned int total_bytes, used_bytes;
+};
+
+void heap_init();
+
+void *kmalloc(unsigned int size);
+void kfree(void *ptr);
+
+struct kmem_cache *kmem_cache_create(const char *name, unsigned int object_size);
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *ptr);
+
+void arena_init(struct arena *arena, unsigned int chunk_pages);
+void *arena_alloc(struct arena *arena, unsigned int size, unsigned int align);
+
+// Boot-time data that is never freed (device tables, caches, descriptors)
+void *boot_alloc(unsigned int size);
+
+// Introspection for heapstat
+struct kmem_cache *heap_caches();
+const struct arena *heap_boot_arena();
+void heap_large_stats(unsigned int *active_allocs, unsigned int *active_pages);
+
+#endif
@@ -0,0 +1,452 @@
+#include "kernel.h"
+#include "heap.h"
+#include "vfs.h"
+#include "initrd.h"
+
+#define RAMFS_NONE 0xFFFFFFFF
+#define RAMFS_ROOT_INO 1                // inode numbers are node index + 1
+
+#define TAR_BLOCK 512
+#define CPIO_HEADER 110
+
+#define S_IFMT   0170000
+#define S_IFIFO  0010000
+#define S_IFCHR  0020000
+#define S_IFDIR  0040000
+#define S_IFBLK  0060000
+#define S_IFREG  0100000
+#define S_IFLNK  0120000
+
+struct ramfs_node {
+    const char *name;                   // in module memory, not terminated
+    unsigned int name_len;
+    unsigned int parent;
+    unsigned int first_child, last_child, next_sibling;
+    unsigned int hash_next;
+    unsigned int mode, uid, gid, mtime, links;
+    const unsigned char *data;          // file contents or link target, in the module
+    unsigned int size;
+};
+
+// One archive member as the parsers see it. Tar may split a path in two
+// (prefix and name fields); each part is a run of whole components.
+struct archive_entry {
+    const char *path[2];
+    unsigned int path_len[2];
+    unsigned int mode, uid, gid, mtime;
+    const unsigned char *data;
+    unsigned int size;
+    const char *link;                   // hard link: path of the earlier member
+    unsigned int link_len;
+};
+
+typedef void (*entry_fn)(void *arg, const struct archive_entry *entry);
+
+static struct {
+    struct ramfs_node *nodes;
+    unsigned int count, capacity;
+    unsigned int *buckets;
+    unsigned int bucket_mask;
+} ramfs;
+
+// ============================================================================
+// ARCHIVE FORMATS
+// ============================================================================
+
+static unsigned int parse_number(const char *field, unsigned int len, unsigned int base) {
+    unsigned int value = 0, i = 0;
+    while (i < len && field[i] == ' ') i++;
+    for (; i < len; i++) {
+        char c = field[i];
+        unsigned int digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else break;
+        if (digit >= base) break;
+        value = value * base + digit;
+    }
+    return value;
+}
+
+// The checksum is the byte sum of the header with its own field as spaces
+static int tar_header_valid(const unsigned char *header) {
+    unsigned int sum = 0;
+    for (unsigned int i = 0; i < TAR_BLOCK; i++) sum += (i >= 148 && i < 156) ? ' ' : header[i];
+    return sum == parse_number((const char *)header + 148, 8, 8);
+}
+
+static int is_tar(const unsigned char *start, const unsigned char *end) {
+    return end - start >= TAR_BLOCK && memcmp(start + 257, "ustar", 5) == 0 && tar_header_valid(start);
+}
+
+static int is_cpio(const unsigned char *start, const unsigned char *end) {
+    return end - start >= CPIO_HEADER && memcmp(start, "07070", 5) == 0 && (start[5] == '1' || start[5] == '2');
+}
+
+// ustar with the GNU long-name extension; pax headers are skipped
+static void walk_tar(const unsigned char *start, const unsigned char *end, entry_fn fn, void *arg) {
+    const char *long_name = 0;
+    unsigned int long_len = 0;
+    for (const unsigned char *p = start; end - p >= TAR_BLOCK && p[0] && tar_header_valid(p); ) {
+        const char *h = (const char *)p;
+        unsigned int size = parse_number(h + 124, 12, 8);
+        const unsigned char *data = p + TAR_BLOCK;
+        if ((unsigned int)(end - data) < size) break;
+        p = data + ((size + TAR_BLOCK - 1) & ~(TAR_BLOCK - 1));
+
+        char type = h[156];
+        if (type == 'L') {
+            long_name = (const char *)data;
+            long_len = strnlen(long_name, size);
+            continue;
+        }
+        struct archive_entry e = { { 0, 0 }, { 0, 0 }, parse_number(h + 100, 8, 8) & 07777,
+                                   parse_number(h + 108, 8, 8), parse_number(h + 116, 8, 8),
+                                   parse_number(h + 136, 12, 8), 0, 0, 0, 0 };
+        if (long_name) {
+            e.path[1] = long_name;
+            e.path_len[1] = long_len;
+            long_name = 0;
+        } else {
+            e.path[0] = h + 345;
+            e.path_len[0] = strnlen(h + 345, 155);
+            e.path[1] = h;
+            e.path_len[1] = strnlen(h, 100);
+        }
+        switch (type) {
+        case '0': case '\0': case '7':
+            e.mode |= S_IFREG;
+            e.data = data;
+            e.size = size;
+            break;
+        case '1':
+            e.link = h + 157;
+            e.link_len = strnlen(h + 157, 100);
+            break;
+        case '2':
+            e.mode |= S_IFLNK;
+            e.data = (const unsigned char *)h + 157;
+            e.size = strnlen(h + 157, 100);
+            break;
+        case '3': e.mode |= S_IFCHR; break;
+        case '4': e.mode |= S_IFBLK; break;
+        case '5': e.mode |= S_IFDIR; break;
+        case '6': e.mode |= S_IFIFO; break;
+        default: continue;              // pax headers, GNU long link names, ...
+        }
+        fn(arg, &e);
+    }
+}
+
+// newc ("070701") and newc with checksums ("070702"); names and data are
+// padded to 4 bytes from the start of the archive
+static void walk_cpio(const unsigned char *start, const unsigned char *end, entry_fn fn, void *arg) {
+    for (const unsigned char *p = start; is_cpio(p, end); ) {
+        const char *h = (const char *)p;
+        unsigned int namesize = parse_number(h + 94, 8, 16), size = parse_number(h + 54, 8, 16);
+        const char *name = h + CPIO_HEADER;
+        if (!namesize || (unsigned int)(end - p) - CPIO_HEADER < namesize) break;
+        unsigned int name_len = strnlen(name, namesize);
+        if (name_len == 10 && memcmp(name, "TRAILER!!!", 10) == 0) break;
+        const unsigned char *data = start + ((p - start + CPIO_HEADER + namesize + 3) & ~3);
+        if (data > end || (unsigned int)(end - data) < size) break;
+        p = start + ((data - start + size + 3) & ~3);
+
+        struct archive_entry e = { { 0, name }, { 0, name_len }, parse_number(h + 14, 8, 16),
+                                   parse_number(h + 22, 8, 16), parse_number(h + 30, 8, 16),
+                                   parse_number(h + 46, 8, 16), data, size, 0, 0 };
+        if ((e.mode & S_IFMT) == S_IFDIR) e.size = 0;
+        fn(arg, &e);
+    }
+}
+
+// ============================================================================
+// INDEX
+// ============================================================================
+
+static unsigned int name_hash(unsigned int parent, const char *name, unsigned int len) {
+    unsigned int h = 2166136261u ^ parent;      // FNV-1a
+    for (unsigned int i = 0; i < len; i++) h = (h ^ (unsigned char)name[i]) * 16777619u;
+    return h;
+}
+
+static unsigned int find_child(unsigned int dir, const char *name, unsigned int len) {
+    unsigned int i = ramfs.buckets[name_hash(dir, name, len) & ramfs.bucket_mask];
+    for (; i != RAMFS_NONE; i = ramfs.nodes[i].hash_next) {
+        const struct ramfs_node *node = &ramfs.nodes[i];
+        if (node->parent == dir && node->name_len == len && memcmp(node->name, name, len) == 0) return i;
+    }
+    return RAMFS_NONE;
+}
+
+static unsigned int add_node(unsigned int dir, const char *name, unsigned int len, unsigned int mode) {
+    if (ramfs.count == ramfs.capacity) return RAMFS_NONE;
+    unsigned int i = ramfs.count++;
+    struct ramfs_node *node = &ramfs.nodes[i], *parent = &ramfs.nodes[dir];
+    memset(node, 0, sizeof(*node));
+    node->name = name;
+    node->name_len = len;
+    node->parent = dir;
+    node->first_child = node->last_child = node->next_sibling = RAMFS_NONE;
+    node->mode = mode;
+    node->links = (mode & S_IFMT) == S_IFDIR ? 2 : 1;
+    if ((mode & S_IFMT) == S_IFDIR) parent->links++;
+
+    if (parent->last_child == RAMFS_NONE) parent->first_child = i;
+    else ramfs.nodes[parent->last_child].next_sibling = i;
+    parent->last_child = i;
+    unsigned int *bucket = &ramfs.buckets[name_hash(dir, name, len) & ramfs.bucket_mask];
+    node->hash_next = *bucket;
+    *bucket = i;
+    return i;
+}
+
+// Split the path into components, calling fn on each with a flag telling
+// whether it is the last; "" and "." are skipped. Stops when fn returns 0.
+static int walk_components(const struct archive_entry *e, int (*fn)(void *, const char *, unsigned int, int), void *arg) {
+    const char *pending = 0;
+    unsigned int pending_len = 0;
+    for (int part = 0; part < 2; part++) {
+        const char *p = e->path[part], *end = p + e->path_len[part];
+        while (p < end) {
+            const char *name = p;
+            while (p < end && *p != '/') p++;
+            unsigned int len = p - name;
+            if (p < end) p++;
+            if (!len || (len == 1 && name[0] == '.')) continue;
+            if (pending && !fn(arg, pending, pending_len, 0)) return 0;
+            pending = name;
+            pending_len = len;
+        }
+    }
+    return pending ? fn(arg, pending, pending_len, 1) : 0;
+}
+
+struct walk_state {
+    unsigned int dir;
+    const struct archive_entry *entry;
+};
+
+static int count_component(void *arg, const char *name, unsigned int len, int last) {
+    (void)name; (void)len; (void)last;
+    (*(unsigned int *)arg)++;
+    return 1;
+}
+
+static void count_entry(void *arg, const struct archive_entry *e) {
+    walk_components(e, count_component, arg);
+}
+
+// Hard link targets are looked up from the root like any path
+static int follow_component(void *arg, const char *name, unsigned int len, int last) {
+    (void)last;
+    struct walk_state *w = arg;
+    if (len == 2 && name[0] == '.' && name[1] == '.') return 0;
+    w->dir = find_child(w->dir, name, len);
+    return w->dir != RAMFS_NONE;
+}
+
+static int insert_component(void *arg, const char *name, unsigned int len, int last) {
+    struct walk_state *w = arg;
+    if (len == 2 && name[0] == '.' && name[1] == '.') return 0;
+    unsigned int i = find_child(w->dir, name, len);
+    if (!last) {
+        // Directories missing from the archive are made up on the way
+        if (i == RAMFS_NONE) i = add_node(w->dir, name, len, S_IFDIR | 0755);
+        if (i == RAMFS_NONE || (ramfs.nodes[i].mode & S_IFMT) != S_IFDIR) return 0;
+        w->dir = i;
+        return 1;
+    }
+
+    const struct archive_entry *e = w->entry;
+    unsigned int mode = e->mode, links = 0;
+    const unsigned char *data = e->data;
+    unsigned int size = e->size;
+    if (e->link) {
+        struct walk_state target = { 0, 0 };
+        struct archive_entry path = { { 0, e->link }, { 0, e->link_len }, 0, 0, 0, 0, 0, 0, 0, 0 };
+        if (!walk_components(&path, follow_component, &target)) return 0;
+        struct ramfs_node *t = &ramfs.nodes[target.dir];
+        if ((t->mode & S_IFMT) == S_IFDIR) return 0;
+        mode = (t->mode & S_IFMT) | (e->mode & 07777);
+        data = t->data;
+        size = t->size;
+        links = ++t->links;
+    }
+
+    if (i == RAMFS_NONE) i = add_node(w->dir, name, len, mode);
+    if (i == RAMFS_NONE) return 0;
+    struct ramfs_node *node = &ramfs.nodes[i];
+    // A later member with the same path replaces the earlier one's
+    // contents; a directory keeps its children
+    if ((node->mode & S_IFMT) != S_IFDIR || (mode & S_IFMT) == S_IFDIR) node->mode = mode;
+    node->uid = e->uid;
+    node->gid = e->gid;
+    node->mtime = e->mtime;
+    if ((mode & S_IFMT) != S_IFDIR) {
+        node->data = data;
+        node->size = size;
+    }
+    if (links) node->links = links;
+    return 1;
+}
+
+static void insert_entry(void *arg, const struct archive_entry *e) {
+    (void)arg;
+    struct walk_state w = { 0, e };
+    walk_components(e, insert_component, &w);
+}
+
+// A module that is not an archive becomes one file named after the last
+// path component of the first word of its command line
+static void module_entry(const struct multiboot_module *mod, unsigned int index, struct archive_entry *e) {
+    const char *cmdline = (const char *)mod->cmdline, *name = 0;
+    unsigned int len = 0;
+    if (cmdline) {
+        const char *p = cmdline;
+        while (*p == ' ') p++;
+        name = p;
+        while (*p && *p != ' ') {
+            if (*p == '/') name = p + 1;
+            p++;
+        }
+        len = p - name;
+    }
+    // Names are copied: the fallback is built here, and one longer than
+    // VFS_NAME_MAX is cut short
+    char buffer[VFS_NAME_MAX + 1];
+    if (!len) ksnprintf(buffer, sizeof(buffer), "module%u", index);
+    else ksnprintf(buffer, sizeof(buffer), "%.*s", (int)len, name);
+    len = strlen(buffer);
+    char *copy = boot_alloc(len);
+    if (copy) memcpy(copy, buffer, len);
+
+    memset(e, 0, sizeof(*e));
+    e->path[1] = copy;
+    e->path_len[1] = copy ? len : 0;
+    e->mode = S_IFREG | 0444;
+    e->data = (const unsigned char *)mod->mod_start;
+    e->size = mod->mod_end - mod->mod_start;
+}
+
+// Archives are walked member by member, anything else is one entry
+static void walk_module(const struct multiboot_module *mod, const struct archive_entry *raw, entry_fn fn, void *arg) {
+    const unsigned char *start = (const unsigned char *)mod->mod_start, *end = (const unsigned char *)mod->mod_end;
+    if (is_tar(start, end)) walk_tar(start, end, fn, arg);
+    else if (is_cpio(start, end)) walk_cpio(start, end, fn, arg);
+    else fn(arg, raw);
+}
+
+// Two passes over the archives: the first counts path components, an
+// upper bound on the nodes needed, so the node array and hash table are
+// sized once and never grow
+void initrd_init(unsigned int magic, struct multiboot_info *mbi) {
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC || !(mbi->flags & MULTIBOOT_INFO_MODS) || !mbi->mods_count) return;
+    const struct multiboot_module *mods = (const struct multiboot_module *)mbi->mods_addr;
+    unsigned int count = mbi->mods_count < INITRD_MAX_MODULES ? mbi->mods_count : INITRD_MAX_MODULES;
+
+    struct archive_entry raw[INITRD_MAX_MODULES];
+    unsigned int components = 1;
+    for (unsigned int i = 0; i < count; i++) {
+        module_entry(&mods[i], i, &raw[i]);
+        walk_module(&mods[i], &raw[i], count_entry, &components);
+    }
+
+    unsigned int buckets = 16;
+    while (buckets < components * 2) buckets <<= 1;
+    ramfs.nodes = boot_alloc(components * sizeof(struct ramfs_node));
+    ramfs.buckets = boot_alloc(buckets * sizeof(unsigned int));
+    if (!ramfs.nodes || !ramfs.buckets) return;
+    memset(ramfs.buckets, 0xFF, buckets * sizeof(unsigned int));
+    ramfs.bucket_mask = buckets - 1;
+    ramfs.capacity = components;
+
+    struct ramfs_node *root = &ramfs.nodes[0];
+    memset(root, 0, sizeof(*root));
+    root->first_child = root->last_child = root->next_sibling = root->hash_next = RAMFS_NONE;
+    root->mode = S_IFDIR | 0755;
+    root->links = 2;
+    ramfs.count = 1;
+
+    for (unsigned int i = 0; i < count; i++) walk_module(&mods[i], &raw[i], insert_entry, 0);
+}
+
+// ============================================================================
+// VFS OPERATIONS
+// ============================================================================
+
+static unsigned int node_type(const struct ramfs_node *node) {
+    switch (node->mode & S_IFMT) {
+    case S_IFREG: return VFS_TYPE_FILE;
+    case S_IFDIR: return VFS_TYPE_DIR;
+    case S_IFLNK: return VFS_TYPE_SYMLINK;
+    default: return VFS_TYPE_OTHER;
+    }
+}
+
+static int ramfs_get(struct vfs_mount *mount, unsigned int ino, struct vfs_node *out) {
+    if (!ino || ino > ramfs.count) return -VFS_EINVAL;
+    const struct ramfs_node *node = &ramfs.nodes[ino - 1];
+    out->mount = mount;
+    out->ino = ino;
+    out->type = node_type(node);
+    out->size = node->size;
+    out->data = node;
+    return 0;
+}
+
+static int ramfs_root(struct vfs_mount *mount, struct vfs_node *out) {
+    return ramfs_get(mount, RAMFS_ROOT_INO, out);
+}
+
+static int ramfs_lookup(const struct vfs_node *dir, const char *name, unsigned int len, struct vfs_node *out) {
+    unsigned int index = dir->ino - 1;
+    if (len == 1 && name[0] == '.') return ramfs_get(dir->mount, dir->ino, out);
+    if (len == 2 && name[0] == '.' && name[1] == '.') return ramfs_get(dir->mount, ramfs.nodes[index].parent + 1, out);
+    unsigned int i = find_child(index, name, len);
+    return i == RAMFS_NONE ? -VFS_ENOENT : ramfs_get(dir->mount, i + 1, out);
+}
+
+static int ramfs_read(const struct vfs_node *node, unsigned long long offset, void *buffer, unsigned int len) {
+    const struct ramfs_node *n = node->data;
+    if (offset >= n->size) return 0;
+    if (len > n->size - offset) len = n->size - offset;
+    memcpy(buffer, n->data + offset, len);
+    return len;
+}
+
+static int ramfs_readdir(const struct vfs_node *dir, vfs_dir_fn fn, void *arg) {
+    const struct ramfs_node *d = dir->data;
+    struct vfs_dirent dot = { ".", 1, dir->ino, VFS_TYPE_DIR }, dotdot = { "..", 2, d->parent + 1, VFS_TYPE_DIR };
+    if (fn(arg, &dot) || fn(arg, &dotdot)) return 0;
+    for (unsigned int i = d->first_child; i != RAMFS_NONE; i = ramfs.nodes[i].next_sibling) {
+        const struct ramfs_node *child = &ramfs.nodes[i];
+        struct vfs_dirent entry = { child->name, child->name_len, i + 1, node_type(child) };
+        if (fn(arg, &entry)) break;
+    }
+    return 0;
+}
+
+static int ramfs_stat(const struct vfs_node *node, struct vfs_stat *out) {
+    const struct ramfs_node *n = node->data;
+    out->ino = node->ino;
+    out->type = node->type;
+    out->mode = n->mode;
+    out->links = n->links;
+    out->uid = n->uid;
+    out->gid = n->gid;
+    out->size = n->size;
+    out->blocks = 0;                    // nothing allocated: it is module memory
+    out->atime = out->mtime = out->ctime = n->mtime;
+    return 0;
+}
+
+static const struct vfs_ops ramfs_ops = {
+    ramfs_root, ramfs_get, ramfs_lookup, ramfs_read, ramfs_readdir, ramfs_stat
+};
+
+int initrd_mount(const char *path) {
+    if (!ramfs.count) return 0;
+    return vfs_mount(path, "ramfs", "initrd", &ramfs_ops, 0) == 0;
+}
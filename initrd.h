@@ -0,0 +1,24 @@
+#ifndef INITRD_H
+#define INITRD_H
+
+#include "multiboot.h"
+
+// Read-only ramfs over the multiboot modules GRUB loaded with the kernel.
+// A module that is a ustar or newc cpio archive contributes its files; any
+// other module appears as one file named after its command line. Nothing
+// is copied: file data, names and link targets are used where they lie in
+// module memory (which pmm_init already keeps reserved), and a hash table
+// keyed by (directory, name) built at boot makes each path component an
+// O(1) lookup. Later modules override earlier ones, like a concatenated
+// Linux initramfs.
+
+#define INITRD_MAX_MODULES 16
+
+// Index the modules (right after heap_init, before the bootloader's
+// memory is reused)
+void initrd_init(unsigned int magic, struct multiboot_info *mbi);
+
+// Mount the ramfs at 'path' if any module was loaded; 1 if mounted
+int initrd_mount(const char *path);
+
+#endif
@@ -0,0 +1,52 @@
+bits 32
+
+section .text
+global isr_stub_table
+extern interrupt_dispatch
+
+VECTOR_COUNT equ 0x40                   ; must match interrupts.h
+
+; CPU exceptions that push an error code: 8, 10-14, 17, 21, 29, 30.
+; Every other vector gets a dummy 0 so the frame layout is uniform.
+%assign i 0
+%rep VECTOR_COUNT
+isr_stub_ %+ i:
+%if !(i == 8 || (i >= 10 && i <= 14) || i == 17 || i == 21 || i == 29 || i == 30)
+    push dword 0
+%endif
+    push dword i
+    jmp isr_common
+%assign i i + 1
+%endrep
+
+; Save state in the order struct interrupt_frame (interrupts.h) expects
+isr_common:
+    pusha
+    push ds
+    push es
+    push fs
+    push gs
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    cld
+    push esp                ; struct interrupt_frame *
+    call interrupt_dispatch
+    add esp, 4
+    add esp, 4              ; GS is per-CPU and a thread may resume on
+                            ; another CPU, so the saved selector is dropped
+    pop fs
+    pop es
+    pop ds
+    popa
+    add esp, 8              ; vector number and error code
+    iret
+
+section .data
+align 4
+isr_stub_table:
+%assign i 0
+%rep VECTOR_COUNT
+    dd isr_stub_ %+ i
+%assign i i + 1
+%endrep
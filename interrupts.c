@@ -0,0 +1,307 @@
+#include "kernel.h"
+#include "interrupts.h"
+#include "serial.h"
+#include "paging.h"
+#include "sched.h"
+#include "apic.h"
+#include "ksyms.h"
+#include "trace.h"
+
+// ============================================================================
+// IDT
+// ============================================================================
+
+struct idt_entry {
+    unsigned short offset_low;
+    unsigned short selector;
+    unsigned char zero;
+    unsigned char type_attr;
+    unsigned short offset_high;
+} __attribute__((packed));
+
+struct idt_pointer {
+    unsigned short limit;
+    unsigned int base;
+} __attribute__((packed));
+
+// Stub addresses for vectors 0 to VECTOR_COUNT - 1 (interrupts.asm)
+extern unsigned int isr_stub_table[];
+
+static struct idt_entry idt[256];
+static irq_handler_t irq_handlers[IRQ_COUNT][IRQ_SHARED_MAX];
+static irq_handler_t vector_handlers[VECTOR_COUNT];
+static int apic_mode = 0;
+
+static void idt_set_gate(unsigned char vector, unsigned int handler) {
+    idt[vector].offset_low = handler & 0xFFFF;
+    idt[vector].selector = 0x08;
+    idt[vector].zero = 0;
+    idt[vector].type_attr = 0x8E;       // present, ring 0, 32-bit interrupt gate
+    idt[vector].offset_high = (handler >> 16) & 0xFFFF;
+}
+
+static void idt_set_task_gate(unsigned char vector, unsigned short tss_selector) {
+    idt[vector].offset_low = 0;
+    idt[vector].selector = tss_selector;
+    idt[vector].zero = 0;
+    idt[vector].type_attr = 0x85;       // present, ring 0, task gate
+    idt[vector].offset_high = 0;
+}
+
+// ============================================================================
+// DOUBLE FAULT TASK
+// ============================================================================
+
+// A stack overflow into a guard page faults again while pushing the page
+// fault frame, and that double fault would do the same and reset the CPU.
+// Vector 8 is therefore a task gate: the CPU saves the broken context into
+// its own TSS and switches to a task with its own stack and page directory.
+// The fault task is shared, so only the first CPU to double fault reports.
+
+struct tss {
+    unsigned int link, esp0, ss0, esp1, ss1, esp2, ss2;
+    unsigned int cr3, eip, eflags, eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    unsigned int es, cs, ss, ds, fs, gs, ldt;
+    unsigned short trap, iomap_base;
+} __attribute__((packed));
+
+extern unsigned long long gdt_start[];  // kernel.asm
+
+static struct tss cpu_tss[APIC_MAX_CPUS], fault_tss;
+static unsigned char fault_stack[4096] __attribute__((aligned(16)));
+
+static void gdt_set_descriptor(unsigned short selector, unsigned int base, unsigned int limit, unsigned int access, unsigned int flags) {
+    gdt_start[selector >> 3] = (limit & 0xFFFF) | (((unsigned long long)base & 0xFFFFFF) << 16) |
+                               ((unsigned long long)access << 40) |
+                               ((unsigned long long)((limit >> 16) & 0xF) << 48) |
+                               ((unsigned long long)flags << 52) | ((unsigned long long)(base >> 24) << 56);
+}
+
+static void gdt_set_tss(unsigned short selector, struct tss *tss) {
+    gdt_set_descriptor(selector, (unsigned int)tss, sizeof(struct tss) - 1, 0x89, 0);  // present, available 32-bit TSS
+}
+
+static void cpu_tss_load(unsigned int cpu) {
+    cpu_tss[cpu].iomap_base = sizeof(struct tss);
+    gdt_set_tss(GDT_CPU_TSS(cpu), &cpu_tss[cpu]);
+    asm volatile("ltr %w0" : : "r"(GDT_CPU_TSS(cpu)));
+}
+
+// Byte-granular data segment based at the CPU's struct cpu, so %gs:0
+// reaches it without knowing which CPU is running
+void interrupts_set_percpu(unsigned int cpu, void *base, unsigned int size) {
+    gdt_set_descriptor(GDT_CPU_DATA(cpu), (unsigned int)base, size - 1, 0x92, 0x4);
+    asm volatile("mov %w0, %%gs" : : "r"(GDT_CPU_DATA(cpu)) : "memory");
+}
+
+static void double_fault_task() {
+    char hex_str[11];
+    unsigned int cr2, cpu = (fault_tss.link - GDT_CPU_TSS(0)) / 16;
+    asm volatile("mov %%cr2, %0" : "=r"(cr2));
+    if (cpu >= APIC_MAX_CPUS) cpu = 0;
+    print("\n\n*** CPU EXCEPTION: Double Fault ***");
+    if (paging_is_guard(cr2)) print("\nKernel stack overflow (guard page hit)");
+    print("\nCPU: "); itoa(cpu, hex_str); print(hex_str);
+    print("  EIP: "); uint_to_hex(cpu_tss[cpu].eip, hex_str); print(hex_str);
+    print("  ESP: "); uint_to_hex(cpu_tss[cpu].esp, hex_str); print(hex_str);
+    print("  CR2: "); uint_to_hex(cr2, hex_str); print(hex_str);
+    print("\nSystem halted.");
+    console_flush();
+    serial_flush();
+    while (1) asm volatile("cli\n\thlt");
+}
+
+static void fault_task_init() {
+    fault_tss.eip = (unsigned int)double_fault_task;
+    fault_tss.esp = (unsigned int)(fault_stack + sizeof(fault_stack));
+    fault_tss.eflags = 0x2;             // interrupts off
+    fault_tss.cs = 0x08;
+    fault_tss.ds = fault_tss.es = fault_tss.fs = fault_tss.gs = fault_tss.ss = 0x10;
+    fault_tss.iomap_base = sizeof(struct tss);
+
+    gdt_set_tss(GDT_FAULT_TSS, &fault_tss);
+    cpu_tss_load(0);
+    idt_set_task_gate(8, GDT_FAULT_TSS);
+}
+
+// The task switch loads CR3 from the TSS, so it must follow paging_init
+void interrupts_set_fault_cr3(unsigned int cr3) {
+    fault_tss.cr3 = cr3;
+}
+
+// ============================================================================
+// 8259 PIC
+// ============================================================================
+
+#define PIC1_CMD  0x20
+#define PIC1_DATA 0x21
+#define PIC2_CMD  0xA0
+#define PIC2_DATA 0xA1
+#define PIC_EOI   0x20
+
+static void pic_remap(unsigned char master_offset, unsigned char slave_offset) {
+    outb(PIC1_CMD, 0x11); io_wait();        // ICW1: init, expect ICW4
+    outb(PIC2_CMD, 0x11); io_wait();
+    outb(PIC1_DATA, master_offset); io_wait();  // ICW2: vector offsets
+    outb(PIC2_DATA, slave_offset); io_wait();
+    outb(PIC1_DATA, 0x04); io_wait();       // ICW3: slave on IRQ2
+    outb(PIC2_DATA, 0x02); io_wait();
+    outb(PIC1_DATA, 0x01); io_wait();       // ICW4: 8086 mode
+    outb(PIC2_DATA, 0x01); io_wait();
+
+    // Everything starts masked except the cascade line; drivers unmask
+    // their own IRQ once a handler is registered.
+    outb(PIC1_DATA, (unsigned char)~(1 << IRQ_CASCADE));
+    outb(PIC2_DATA, 0xFF);
+}
+
+void irq_mask(unsigned char irq) {
+    if (apic_mode) {
+        ioapic_set_masked(irq, 1);
+        return;
+    }
+    unsigned short port = (irq < 8) ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) | (1 << (irq & 7)));
+}
+
+void irq_unmask(unsigned char irq) {
+    if (apic_mode) {
+        ioapic_set_masked(irq, 0);
+        return;
+    }
+    unsigned short port = (irq < 8) ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) & ~(1 << (irq & 7)));
+}
+
+// IRQ 7 and 15 can fire spuriously; the in-service register tells us
+// whether the PIC really raised them.
+static int pic_spurious(unsigned char irq) {
+    if (irq == 7) {
+        outb(PIC1_CMD, 0x0B);
+        return !(inb(PIC1_CMD) & 0x80);
+    }
+    if (irq == 15) {
+        outb(PIC2_CMD, 0x0B);
+        if (!(inb(PIC2_CMD) & 0x80)) {
+            outb(PIC1_CMD, PIC_EOI);        // master still saw the cascade
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void pic_eoi(unsigned char irq) {
+    if (irq >= 8) outb(PIC2_CMD, PIC_EOI);
+    outb(PIC1_CMD, PIC_EOI);
+}
+
+void interrupts_use_apic() {
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+    apic_mode = 1;
+    for (unsigned char irq = 0; irq < IRQ_COUNT; irq++)
+        if (irq_handlers[irq][0]) ioapic_set_masked(irq, 0);
+}
+
+// ============================================================================
+// DISPATCH
+// ============================================================================
+
+static const char *exception_names[] = {
+    "Divide Error", "Debug", "NMI", "Breakpoint", "Overflow", "Bound Range",
+    "Invalid Opcode", "Device Not Available", "Double Fault", "Coprocessor Overrun",
+    "Invalid TSS", "Segment Not Present", "Stack Fault", "General Protection",
+    "Page Fault", "Reserved", "x87 FP Error", "Alignment Check", "Machine Check",
+    "SIMD FP Error", "Virtualization", "Control Protection"
+};
+
+static void exception_panic(struct interrupt_frame *frame) {
+    char hex_str[11];
+    print("\n\n*** CPU EXCEPTION: ");
+    print(frame->int_no < sizeof(exception_names) / sizeof(exception_names[0]) ?
+          exception_names[frame->int_no] : "Reserved");
+    print(" ***");
+    print("\nVector: "); uint_to_hex(frame->int_no, hex_str); print(hex_str);
+    print("  Error: "); uint_to_hex(frame->err_code, hex_str); print(hex_str);
+    print("\nEIP: "); uint_to_hex(frame->eip, hex_str); print(hex_str);
+    char symbol[64];
+    if (ksym_format(frame->eip, symbol, sizeof(symbol))) { print(" <"); print(symbol); print(">"); }
+    print("  EFLAGS: "); uint_to_hex(frame->eflags, hex_str); print(hex_str);
+    if (frame->int_no == 14) {
+        unsigned int cr2;
+        asm volatile("mov %%cr2, %0" : "=r"(cr2));
+        print("\nAddress: "); uint_to_hex(cr2, hex_str); print(hex_str);
+        print(frame->err_code & 1 ? " (protection violation" : " (not present");
+        print(frame->err_code & 2 ? ", write)" : ", read)");
+        if (paging_is_guard(cr2)) print(" - stack guard page");
+    }
+    print("\nSystem halted.");
+    serial_flush();
+    while (1) asm volatile("cli\n\thlt");
+}
+
+// Tracepoint names: one static string per line
+static const char *irq_names[IRQ_COUNT] = {
+    "irq0", "irq1", "irq2", "irq3", "irq4", "irq5", "irq6", "irq7",
+    "irq8", "irq9", "irq10", "irq11", "irq12", "irq13", "irq14", "irq15"
+};
+
+void interrupt_dispatch(struct interrupt_frame *frame) {
+    if (frame->int_no < IRQ_BASE) {
+        if (frame->int_no == 7 && sched_fpu_trap()) return;    // lazy FPU switch
+        exception_panic(frame);
+    }
+
+    unsigned long long t = trace_begin();
+    if (frame->int_no >= IRQ_BASE + IRQ_COUNT) {
+        if (frame->int_no == VECTOR_APIC_SPURIOUS) return;     // no EOI for these
+        if (vector_handlers[frame->int_no]) vector_handlers[frame->int_no](frame);
+        trace_end("apic_vector", frame->int_no, t);
+        lapic_eoi();
+    } else {
+        unsigned char irq = frame->int_no - IRQ_BASE;
+        if (!apic_mode && pic_spurious(irq)) return;
+        for (int i = 0; i < IRQ_SHARED_MAX && irq_handlers[irq][i]; i++) irq_handlers[irq][i](frame);
+        trace_end(irq_names[irq], irq, t);
+        if (apic_mode) lapic_eoi();
+        else pic_eoi(irq);
+    }
+
+    // May switch threads; this one resumes here and returns through iret
+    sched_preempt();
+}
+
+// PCI INTx lines are shared, so an IRQ takes several handlers; each one
+// checks its own device and returns if the interrupt was not for it
+void irq_register(unsigned char irq, irq_handler_t handler) {
+    if (irq >= IRQ_COUNT) return;
+    for (int i = 0; i < IRQ_SHARED_MAX; i++) {
+        if (irq_handlers[irq][i] == handler) break;
+        if (irq_handlers[irq][i]) continue;
+        irq_handlers[irq][i] = handler;
+        break;
+    }
+    irq_unmask(irq);
+}
+
+void vector_register(unsigned char vector, irq_handler_t handler) {
+    if (vector >= IRQ_BASE + IRQ_COUNT && vector < VECTOR_COUNT) vector_handlers[vector] = handler;
+}
+
+static void load_idt() {
+    struct idt_pointer idtr = { sizeof(idt) - 1, (unsigned int)idt };
+    asm volatile("lidt %0" : : "m"(idtr));
+}
+
+void interrupts_init_ap(unsigned int cpu) {
+    load_idt();
+    cpu_tss_load(cpu);
+}
+
+void interrupts_init() {
+    for (int i = 0; i < VECTOR_COUNT; i++) idt_set_gate(i, isr_stub_table[i]);
+    fault_task_init();
+    load_idt();
+
+    pic_remap(IRQ_BASE, IRQ_BASE + 8);
+}
@@ -0,0 +1,75 @@
+#ifndef INTERRUPTS_H
+#define INTERRUPTS_H
+
+// Vectors 0-31 are CPU exceptions; the 8259 PICs are remapped so that
+// IRQ 0-15 land on vectors 32-47 instead of overlapping them.
+#define IRQ_BASE 0x20
+#define IRQ_COUNT 16
+#define IRQ_SHARED_MAX 4                // handlers on one line
+
+// Local APIC vectors sit above the legacy range; the stubs in
+// interrupts.asm cover everything below VECTOR_COUNT
+#define VECTOR_APIC_TIMER    0x30
+#define VECTOR_RESCHEDULE    0x31
+#define VECTOR_APIC_SPURIOUS 0x3F
+#define VECTOR_COUNT 0x40
+
+// GDT layout (kernel.asm): a TSS and a per-CPU data segment for each CPU
+#define GDT_FAULT_TSS 0x18
+#define GDT_CPU_TSS(cpu)  (0x20 + (cpu) * 16)
+#define GDT_CPU_DATA(cpu) (0x28 + (cpu) * 16)
+
+#define IRQ_TIMER 0
+#define IRQ_KEYBOARD 1
+#define IRQ_CASCADE 2
+
+// Register state pushed by isr_common in interrupts.asm (last push first)
+struct interrupt_frame {
+    unsigned int gs, fs, es, ds;
+    unsigned int edi, esi, ebp, esp_dummy, ebx, edx, ecx, eax;
+    unsigned int int_no, err_code;
+    unsigned int eip, cs, eflags;
+};
+
+typedef void (*irq_handler_t)(struct interrupt_frame *frame);
+
+void interrupts_init();
+void irq_register(unsigned char irq, irq_handler_t handler);
+void irq_mask(unsigned char irq);
+void irq_unmask(unsigned char irq);
+
+// Local APIC vectors (IPIs, the local timer): never masked, EOI to the LAPIC
+void vector_register(unsigned char vector, irq_handler_t handler);
+
+// Mask the 8259s for good; legacy IRQs now come through the I/O APIC
+void interrupts_use_apic();
+
+// Per-CPU setup: load the shared IDT and the CPU's own TSS (APs only; the
+// boot CPU does this in interrupts_init), and point GS at its data area
+void interrupts_init_ap(unsigned int cpu);
+void interrupts_set_percpu(unsigned int cpu, void *base, unsigned int size);
+
+// Page directory for the double fault task (interrupts.c)
+void interrupts_set_fault_cr3(unsigned int cr3);
+
+static inline void interrupts_enable() { asm volatile("sti" ::: "memory"); }
+static inline void interrupts_disable() { asm volatile("cli" ::: "memory"); }
+
+// Disable interrupts and return the previous EFLAGS, for short critical
+// sections that may also be entered from an IRQ handler.
+static inline unsigned int irq_save() {
+    unsigned int flags;
+    asm volatile("pushfl\n\tpopl %0\n\tcli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(unsigned int flags) {
+    if (flags & 0x200) asm volatile("sti" ::: "memory");
+}
+
+// Sleep until the next interrupt. Interrupts must be disabled by the caller
+// after it has checked there is no pending work; "sti; hlt" is atomic with
+// respect to interrupt delivery, so a wakeup cannot be lost in between.
+static inline void wait_for_interrupt() { asm volatile("sti\n\thlt" ::: "memory"); }
+
+#endif
@@ -1,9 +1,18 @@
 bits 32
 section .text
+MB_FLAGS equ (1 << 0) | (1 << 1) | (1 << 2) ; page-align modules; ask for mem_* fields and the memory map; ask for a video mode
+MAX_CPUS equ 16                         ; must match APIC_MAX_CPUS in apic.h
+FB_WIDTH equ 1024                       ; must match FBCON_MODE_* in fbcon.h
+FB_HEIGHT equ 768
+FB_DEPTH equ 32
+
     align 4
     dd 0x1BADB002
-    dd 0x00
-    dd -(0x1BADB002 + 0x00)
+    dd MB_FLAGS
+    dd -(0x1BADB002 + MB_FLAGS)
+    dd 0, 0, 0, 0, 0            ; load addresses, only used with flag 16
+    dd 0                        ; mode type: linear framebuffer
+    dd FB_WIDTH, FB_HEIGHT, FB_DEPTH
 
     global start
     extern kernelMain
@@ -11,9 +20,46 @@ section .text
 start:
     cli
     mov esp, stack_space
-    call kernelMain
+    mov esi, eax                ; multiboot magic
+    mov edi, ebx                ; struct multiboot_info *
+
+    ; GRUB leaves GDTR pointing at memory we do not own, so install our own
+    ; flat segments before the IDT starts referring to selector 0x08
+    lgdt [gdt_descriptor]
+    jmp 0x08:.reload_cs
+.reload_cs:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    push edi
+    push esi
+    call kernelMain             ; kernelMain(magic, mbi)
+.halt:
     hlt
+    jmp .halt
+
+section .data
+    align 8
+    global gdt_start
+gdt_start:
+    dq 0x0000000000000000       ; null descriptor
+    dq 0x00CF9A000000FFFF       ; 0x08: kernel code, base 0, limit 4 GB
+    dq 0x00CF92000000FFFF       ; 0x10: kernel data, base 0, limit 4 GB
+    dq 0                        ; 0x18: double fault TSS, filled in by interrupts.c
+    times 2 * MAX_CPUS dq 0     ; 0x20 + 16 * cpu: TSS, 0x28 + 16 * cpu: per-CPU data (GS)
+gdt_end:
+
+gdt_descriptor:
+    dw gdt_end - gdt_start - 1
+    dd gdt_start
 
-section .bss
+section .bss align=4096
+    global stack_guard
+stack_guard:
+    resb 4096                   ; left unmapped by paging_init to catch overflow
     resb 8192
-stack_space:
\ No newline at end of file
+stack_space:
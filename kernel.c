@@ -1,30 +1,35 @@
-// VGA text mode base address
-char *videomem = (char *)0xB8000;
-int cursor_pos = 0;
-
-// Port I/O functions (defined in port_io.asm)
-extern unsigned char inb(unsigned short port);
-extern void outb(unsigned short port, unsigned char value);
-
-int shift_pressed = 0;
+#include "kernel.h"
+#include "interrupts.h"
+#include "timer.h"
+#include "multiboot.h"
+#include "pmm.h"
+#include "heap.h"
+#include "acpi.h"
+#include "pci.h"
+#include "commands.h"
+#include "serial.h"
+#include "paging.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "smp.h"
+#include "cpufeature.h"
+#include "block.h"
+#include "bcache.h"
+#include "vfs.h"
+#include "initrd.h"
+#include "net.h"
+#include "fbcon.h"
+#include "trace.h"
+
+int shift_pressed = 0, extended_scancode = 0;
 char command_buffer[80];
 int command_pos = 0;
-unsigned char boot_hour = 0, boot_minute = 0, boot_second = 0;
+int memory_map_valid = 0;
+unsigned int boot_seconds = 0;        // RTC time of day at boot, in seconds
 // ============================================================================
 // UTILITY FUNCTIONS
 // ============================================================================
 
-void strcat_simple(char *dest, const char *src) {
-    while (*dest) dest++;
-    while (*src) *dest++ = *src++;
-    *dest = '\0';
-}
-
-int strcmp(const char *str1, const char *str2) {
-    while (*str1 && *str1 == *str2) { str1++; str2++; }
-    return *str1 - *str2;
-}
-
 int starts_with(const char *str, const char *prefix) {
     while (*prefix) if (*str++ != *prefix++) return 0;
     return 1;
@@ -37,12 +42,12 @@ int atoi(const char *str) {
     return num * sign;
 }
 
+// The magnitude is taken as unsigned: -INT_MIN does not fit in an int
 void itoa(int num, char *str) {
-    int i = 0, is_negative = (num < 0);
-    if (is_negative) num = -num;
-    if (!num) str[i++] = '0';
-    else while (num > 0) { str[i++] = (num % 10) + '0'; num /= 10; }
-    if (is_negative) str[i++] = '-';
+    unsigned int n = num < 0 ? -(unsigned int)num : (unsigned int)num;
+    int i = 0;
+    do { str[i++] = (n % 10) + '0'; n /= 10; } while (n);
+    if (num < 0) str[i++] = '-';
     str[i] = '\0';
     for (int j = 0; j < i / 2; j++) {
         char temp = str[j];
@@ -59,53 +64,65 @@ void uint_to_hex(unsigned int num, char *str) {
 }
 
 // ============================================================================
-// VGA FUNCTIONS
+// KEYBOARD FUNCTIONS
 // ============================================================================
 
-void print(const char *str) {
-    int i = 0;
-    while (str[i]) {
-        if (str[i] == '\n') {
-            cursor_pos = ((cursor_pos / 160) + 1) * 160;
-        } else {
-            videomem[cursor_pos] = str[i];
-            videomem[cursor_pos + 1] = 0x02;
-            cursor_pos += 2;
-        }
-        i++;
-        if (cursor_pos >= 4000) {
-            for (int j = 0; j < 3840; j++) videomem[j] = videomem[j + 160];
-            for (int j = 3840; j < 4000; j += 2) { videomem[j] = ' '; videomem[j + 1] = 0x02; }
-            cursor_pos = 3840;
-        }
-    }
-}
-
-void clear_screen() {
-    for (int i = 0; i < 4000; i += 2) {
-        videomem[i] = ' ';
-        videomem[i + 1] = 0x02;
-    }
-    cursor_pos = 0;
+// Scancodes are queued by the IRQ1 handler and drained by the main loop.
+// Single producer / single consumer: only the IRQ writes kbd_head and only
+// the main loop writes kbd_tail, so no lock is needed. Indices run freely
+// and are masked on access; the size must stay a power of two.
+#define KBD_RING_SIZE 128
+static volatile unsigned char kbd_ring[KBD_RING_SIZE];
+static volatile unsigned int kbd_head = 0, kbd_tail = 0;
+unsigned int kbd_dropped = 0;
+
+// The shell thread sleeps here until a key or a serial byte arrives
+static struct wait_queue input_wait = WAIT_QUEUE_INIT;
+
+static void input_ready() {
+    wait_queue_wake_all(&input_wait);
+}
+
+void keyboard_irq(struct interrupt_frame *frame) {
+    (void)frame;
+    unsigned char sc = inb(0x60);
+    unsigned int head = kbd_head;
+    if (head - kbd_tail >= KBD_RING_SIZE) { kbd_dropped++; return; }
+    kbd_ring[head & (KBD_RING_SIZE - 1)] = sc;
+    asm volatile("" ::: "memory");      // publish the slot before the index
+    kbd_head = head + 1;
+    input_ready();
+}
+
+int read_key(unsigned char *sc) {
+    unsigned int tail = kbd_tail;
+    if (tail == kbd_head) return 0;
+    *sc = kbd_ring[tail & (KBD_RING_SIZE - 1)];
+    asm volatile("" ::: "memory");      // consume the slot before freeing it
+    kbd_tail = tail + 1;
+    return 1;
 }
 
-void backspace() {
-    if (cursor_pos > 0) {
-        cursor_pos -= 2;
-        videomem[cursor_pos] = ' ';
-        videomem[cursor_pos + 1] = 0x02;
-    }
+void keyboard_init() {
+    while (inb(0x64) & 0x01) inb(0x60);     // discard anything typed during boot
+    irq_register(IRQ_KEYBOARD, keyboard_irq);
 }
 
-// ============================================================================
-// KEYBOARD FUNCTIONS
-// ============================================================================
-
-unsigned char read_key() {
-    return (inb(0x64) & 0x01) ? inb(0x60) : 0;
-}
+// Control codes returned for Shift+PgUp / Shift+PgDn
+#define KEY_SCROLL_UP   0x11
+#define KEY_SCROLL_DOWN 0x12
 
 char scancode_to_ascii(unsigned char sc) {
+    // 0xE0 prefixes the grey navigation keys. Keyboards also wrap them in
+    // fake shift press/release codes, which must not touch shift_pressed.
+    if (sc == 0xE0) { extended_scancode = 1; return 0; }
+    if (extended_scancode) {
+        extended_scancode = 0;
+        if (shift_pressed && sc == 0x49) return KEY_SCROLL_UP;
+        if (shift_pressed && sc == 0x51) return KEY_SCROLL_DOWN;
+        return 0;
+    }
+    
     // Handle shift press/release
     if (sc == 0x2A || sc == 0x36) { shift_pressed = 1; return 0; }
     if (sc == 0xAA || sc == 0xB6) { shift_pressed = 0; return 0; }
@@ -129,89 +146,34 @@ char scancode_to_ascii(unsigned char sc) {
     return (sc < sizeof(normal)) ? (shift_pressed ? shifted[sc] : normal[sc]) : 0;
 }
 
-// ============================================================================
-// CPUID FUNCTIONS
-// ============================================================================
-
-int cpuid_supported() {
-    unsigned int before, after;
-    asm volatile(
-        "pushfl\n\t"
-        "popl %0\n\t"
-        "movl %0, %1\n\t"
-        "xorl $0x200000, %0\n\t"
-        "pushl %0\n\t"
-        "popfl\n\t"
-        "pushfl\n\t"
-        "popl %0\n\t"
-        : "=r"(after), "=r"(before)
-    );
-    return ((before ^ after) & 0x200000) != 0;
-}
-
-void cpuid(unsigned int leaf, unsigned int *eax, unsigned int *ebx, unsigned int *ecx, unsigned int *edx) {
-    asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
-}
-
-void get_cpu_vendor(char *vendor) {
-    unsigned int eax, ebx, ecx, edx;
-    cpuid(0, &eax, &ebx, &ecx, &edx);
-    for (int i = 0; i < 4; i++) {
-        vendor[i] = (ebx >> (i * 8)) & 0xFF;
-        vendor[i + 4] = (edx >> (i * 8)) & 0xFF;
-        vendor[i + 8] = (ecx >> (i * 8)) & 0xFF;
-    }
-    vendor[12] = '\0';
-}
-
-void get_cpu_brand(char *brand) {
-    unsigned int eax, ebx, ecx, edx;
-    cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
-    if (eax < 0x80000004) { brand[0] = '\0'; return; }
-    
-    for (int i = 0; i < 3; i++) {
-        cpuid(0x80000002 + i, &eax, &ebx, &ecx, &edx);
-        for (int j = 0; j < 4; j++) {
-            brand[i * 16 + j] = (eax >> (j * 8)) & 0xFF;
-            brand[i * 16 + j + 4] = (ebx >> (j * 8)) & 0xFF;
-            brand[i * 16 + j + 8] = (ecx >> (j * 8)) & 0xFF;
-            brand[i * 16 + j + 12] = (edx >> (j * 8)) & 0xFF;
-        }
-    }
-    brand[48] = '\0';
-}
-
-void get_cpu_features(unsigned int *ecx, unsigned int *edx) {
-    unsigned int eax, ebx;
-    cpuid(1, &eax, &ebx, ecx, edx);
-}
-
-// ============================================================================
-// MEMORY DETECTION
-// ============================================================================
+// Bytes from a serial terminal: CR ends the line (a following LF is
+// dropped so CRLF input works too), DEL and BS erase, and ANSI escape
+// sequences such as arrow keys are swallowed.
+int serial_escape = 0, serial_last_cr = 0;
 
-unsigned int probe_memory() {
-    unsigned int *test_addr, mb_count;
-    unsigned int test_pattern = 0xAA55AA55;
-    
-    for (mb_count = 1; mb_count < 256; mb_count++) {
-        test_addr = (unsigned int *)(0x100000 + (mb_count * 0x100000));
-        unsigned int original = *test_addr;
-        *test_addr = test_pattern;
-        for (int i = 0; i < 100; i++) asm volatile("nop");
-        if (*test_addr != test_pattern) { *test_addr = original; break; }
-        *test_addr = original;
+char serial_to_ascii(unsigned char byte) {
+    int after_cr = serial_last_cr;
+    serial_last_cr = (byte == '\r');
+    if (serial_escape) {
+        if (serial_escape == 1 && byte == '[') serial_escape = 2;
+        else if (serial_escape == 1 || (byte >= 0x40 && byte <= 0x7E)) serial_escape = 0;
+        return 0;
     }
-    return mb_count;
+    if (byte == 0x1B) { serial_escape = 1; return 0; }
+    if (byte == '\r') return '\n';
+    if (byte == '\n') return after_cr ? 0 : '\n';
+    if (byte == 0x7F || byte == 0x08) return '\b';
+    return (byte >= ' ' && byte < 0x7F) ? byte : 0;
 }
 
 // ============================================================================
 // VGA HARDWARE DETECTION
 // ============================================================================
 
+// The console programs the same CRTC index register, so the index/data
+// pair goes through console.c under its lock
 unsigned char read_vga_register(unsigned short index_port, unsigned char index) {
-    outb(index_port, index);
-    return inb(index_port + 1);
+    return console_read_register(index_port, index);
 }
 
 void get_vga_info(unsigned char *mode, unsigned char *width, unsigned char *height) {
@@ -231,24 +193,27 @@ unsigned char get_keyboard_status() {
     return inb(0x64);
 }
 
-void decode_keyboard_status(unsigned char status, char *buffer) {
+// One pass with a running length instead of rescanning the buffer per flag
+void decode_keyboard_status(unsigned char status, char *buffer, unsigned int size) {
+    static const char *flag_names[8] = { "OBF ", "IBF ", "SYS ", "CMD ", 0, "AUXB ", "TIMEOUT ", "PERR " };
+    unsigned int len = 0;
     buffer[0] = '\0';
-    if (status & 0x01) strcat_simple(buffer, "OBF ");
-    if (status & 0x02) strcat_simple(buffer, "IBF ");
-    if (status & 0x04) strcat_simple(buffer, "SYS ");
-    if (status & 0x08) strcat_simple(buffer, "CMD ");
-    if (status & 0x20) strcat_simple(buffer, "AUXB ");
-    if (status & 0x40) strcat_simple(buffer, "TIMEOUT ");
-    if (status & 0x80) strcat_simple(buffer, "PERR ");
+    for (int bit = 0; bit < 8 && len < size; bit++)
+        if ((status & (1 << bit)) && flag_names[bit]) len += strlcpy(buffer + len, flag_names[bit], size - len);
 }
 
 // ============================================================================
 // CMOS/RTC TIME READING
 // ============================================================================
 
+static struct spinlock cmos_lock = SPINLOCK_INIT;
+
 unsigned char read_cmos(unsigned char reg) {
+    unsigned int flags = spin_lock_irqsave(&cmos_lock);
     outb(0x70, reg);
-    return inb(0x71);
+    unsigned char value = inb(0x71);
+    spin_unlock_irqrestore(&cmos_lock, flags);
+    return value;
 }
 
 unsigned char bcd_to_bin(unsigned char bcd) {
@@ -268,292 +233,349 @@ void get_rtc_time(unsigned char *hour, unsigned char *minute, unsigned char *sec
     }
 }
 
+// The RTC is read once at boot; afterwards the wall clock is derived from
+// the monotonic clock, so commands never wait on the update-in-progress bit.
+void get_wall_time(unsigned char *hour, unsigned char *minute, unsigned char *second) {
+    unsigned int now = (boot_seconds + (unsigned int)div_u64_rem(now_ns(), 1000000000, 0)) % 86400;
+    *hour = now / 3600;
+    *minute = (now % 3600) / 60;
+    *second = now % 60;
+}
+
 // ============================================================================
-// PCI DEVICE ENUMERATION
+// COMMAND IMPLEMENTATIONS
 // ============================================================================
 
-unsigned int pci_config_read(unsigned char bus, unsigned char device, unsigned char func, unsigned char offset) {
-    unsigned int address = (((unsigned int)bus) << 16) | (((unsigned int)device) << 11) | 
-                          (((unsigned int)func) << 8) | (offset & 0xFC) | 0x80000000;
-    outb(0xCF8, address & 0xFF);
-    outb(0xCF9, (address >> 8) & 0xFF);
-    outb(0xCFA, (address >> 16) & 0xFF);
-    outb(0xCFB, (address >> 24) & 0xFF);
-    return inb(0xCFC) | ((unsigned int)inb(0xCFD) << 8) | 
-           ((unsigned int)inb(0xCFE) << 16) | ((unsigned int)inb(0xCFF) << 24);
+void cmd_clear(int argc, char **argv) {
+    clear_screen();
 }
 
-int pci_device_exists(unsigned char bus, unsigned char device, unsigned char func) {
-    unsigned int vendor_device = pci_config_read(bus, device, func, 0);
-    return (vendor_device != 0xFFFFFFFF && vendor_device != 0);
+void cmd_echo(int argc, char **argv) {
+    print("\n");
+    for (int i = 1; i < argc; i++) kprintf(i > 1 ? " %s" : "%s", argv[i]);
 }
 
-// ============================================================================
-// COMMAND IMPLEMENTATIONS
-// ============================================================================
+// add, sub, mul and div share one handler keyed on the command name
+void cmd_math(int argc, char **argv) {
+    char op = argv[0][0];
+    int num1 = atoi(argv[1]), num2 = atoi(argv[2]);
+    
+    if (op == 'd' && num2 == 0) {
+        print("\nError: Division by zero!");
+        return;
+    }
+    int result = (op == 'a') ? num1 + num2 : (op == 's') ? num1 - num2 :
+                (op == 'm') ? num1 * num2 : num1 / num2;
+    kprintf("\n%s%d", (op == 'a') ? "Sum: " : (op == 's') ? "Difference: " :
+            (op == 'm') ? "Product: " : "Quotient: ", result);
+}
 
-void cmd_cpuinfo() {
-    if (!cpuid_supported()) { print("\nCPUID not supported!"); return; }
+// Everything comes from the copy cpu_features_init() took at boot; no
+// CPUID here
+void cmd_cpuinfo(int argc, char **argv) {
+    const struct cpu_features *f = &cpu_features;
+    if (!f->cpuid) { print("\nCPUID not supported!"); return; }
     
-    print("\n=== CPU INFORMATION ===");
-    char vendor[13], brand[49], hex_str[11];
-    get_cpu_vendor(vendor);
-    print("\nVendor: "); print(vendor);
+    kprintf("\n=== CPU INFORMATION ===\nVendor: %s", f->vendor);
+    if (f->brand[0]) kprintf("\nBrand: %s", f->brand);
+    kprintf("\nFamily %u, model %u, stepping %u; CPUID leaves up to 0x%X, 0x%X",
+            f->family, f->model, f->stepping, f->max_leaf, f->max_ext_leaf);
+    kprintf("\nFeatures (EDX): 0x%08X\nFeatures (ECX): 0x%08X",
+            f->words[CPU_WORD_1_EDX], f->words[CPU_WORD_1_ECX]);
     
-    get_cpu_brand(brand);
-    if (brand[0]) { print("\nBrand: "); print(brand); }
+    static const struct { unsigned int feature; const char *name; } flags[] = {
+        { CPU_FEATURE_FPU, "FPU" }, { CPU_FEATURE_TSC, "TSC" }, { CPU_FEATURE_MSR, "MSR" },
+        { CPU_FEATURE_APIC, "APIC" }, { CPU_FEATURE_PAT, "PAT" }, { CPU_FEATURE_MMX, "MMX" },
+        { CPU_FEATURE_SSE, "SSE" }, { CPU_FEATURE_SSE2, "SSE2" }, { CPU_FEATURE_SSE3, "SSE3" },
+        { CPU_FEATURE_SSSE3, "SSSE3" }, { CPU_FEATURE_SSE41, "SSE4.1" }, { CPU_FEATURE_SSE42, "SSE4.2" },
+        { CPU_FEATURE_POPCNT, "POPCNT" }, { CPU_FEATURE_AVX, "AVX" }, { CPU_FEATURE_AVX2, "AVX2" },
+        { CPU_FEATURE_AVX512F, "AVX512F" }, { CPU_FEATURE_BMI2, "BMI2" }, { CPU_FEATURE_ADX, "ADX" },
+        { CPU_FEATURE_ERMS, "ERMS" }, { CPU_FEATURE_FSRM, "FSRM" }, { CPU_FEATURE_X2APIC, "X2APIC" },
+        { CPU_FEATURE_TSC_DEADLINE, "TSC-DEADLINE" }, { CPU_FEATURE_RDTSCP, "RDTSCP" }, { CPU_FEATURE_NX, "NX" },
+        { CPU_FEATURE_LM, "LM" }, { CPU_FEATURE_HYPERVISOR, "HYPERVISOR" },
+    };
+    print("\n\nSupported:");
+    for (unsigned int i = 0; i < sizeof(flags) / sizeof(flags[0]); i++)
+        if (cpu_has(flags[i].feature)) kprintf(" %s", flags[i].name);
+
+    static const char *cache_types[] = { "", "d", "i", "" };
+    print("\n\nCaches:");
+    for (unsigned int i = 0; i < f->cache_count; i++) {
+        const struct cpu_cache *c = &f->caches[i];
+        kprintf("\n L%u%-2s %6u KB  %3u B lines", c->level, cache_types[c->type], c->size / 1024, c->line_size);
+        if (c->ways) kprintf("  %2u-way", c->ways);
+        else print("  full  ");
+        if (c->shared_by) kprintf("  shared by %u", c->shared_by);
+    }
+    if (!f->cache_count) print(" not reported");
+    if (f->clflush_size) kprintf("\nCLFLUSH line: %u B", f->clflush_size);
+    if (f->dtlb_entries || f->l2_tlb_entries)
+        kprintf("\nTLB (4 KB pages): L1 %u data / %u instruction, L2 %u",
+                f->dtlb_entries, f->itlb_entries, f->l2_tlb_entries);
+    kprintf("\nLogical CPUs per package: %u", f->logical_per_package);
+
+    struct cpu_binding bindings[8];
+    unsigned int count = cpu_dispatch_bindings(bindings, 8);
+    print("\n\nDispatch:");
+    for (unsigned int i = 0; i < count; i++) kprintf(" %s=%s", bindings[i].routine, bindings[i].impl);
+
+    kprintf("\n\nOnline CPUs: %u", smp_cpu_count());
+    if (!apic_active()) { print(" (no usable APIC, 8259 PIC mode)"); return; }
+    for (unsigned int i = 0; i < smp_cpu_possible(); i++) {
+        struct cpu *cpu = smp_cpu(i);
+        if (!cpu->online) continue;
+        kprintf("\n CPU %2u  APIC ID %3u%s", i, cpu->apic_id, i ? "" : "  (boot)");
+    }
+    struct apic_info apic;
+    apic_get_info(&apic);
+    kprintf("\nLocal APIC: 0x%08X  I/O APIC: 0x%08X (%u inputs, %u ISA overrides)",
+            apic.lapic_base, apic.ioapic_base, apic.ioapic_inputs, apic.overrides);
+    if (apic.lapic_timer_khz) kprintf("\nLocal timer: %u kHz", apic.lapic_timer_khz);
+}
+
+void cmd_meminfo(int argc, char **argv) {
+    struct pmm_stats stats;
+    pmm_get_stats(&stats);
+    kprintf("\n=== MEMORY INFORMATION ===\nTotal RAM detected: %u MB\nSource: %s\n\nMemory Map:",
+            stats.total_frames / 256, memory_map_valid ? "Multiboot memory map" : "None (assumed 1-16 MB)");
     
-    unsigned int ecx, edx;
-    get_cpu_features(&ecx, &edx);
-    print("\nFeatures (EDX): "); uint_to_hex(edx, hex_str); print(hex_str);
-    print("\nFeatures (ECX): "); uint_to_hex(ecx, hex_str); print(hex_str);
+    static const char *type_names[] = { "Unknown", "Available", "Reserved", "ACPI Reclaimable", "ACPI NVS", "Bad RAM" };
+    for (unsigned int i = 0; i < stats.region_count; i++) {
+        const struct pmm_region *r = &stats.regions[i];
+        unsigned long long last = r->base + r->length - 1;
+        // Eight digits unless the address needs the high word
+        kprintf("\n 0x%0*llX - 0x%0*llX  %s", r->base >> 32 ? 16 : 8, r->base, last >> 32 ? 16 : 8, last,
+                type_names[r->type <= MULTIBOOT_MEMORY_BADRAM ? r->type : 0]);
+    }
+}
+
+void cmd_memstat(int argc, char **argv) {
+    struct pmm_stats stats;
+    pmm_get_stats(&stats);
+    unsigned int used = stats.total_frames - stats.free_frames - stats.reserved_frames;
+    kprintf("\n=== MEMORY STATISTICS ===");
+    kprintf("\nTotal: %u KB", stats.total_frames * 4);
+    kprintf("\nReserved: %u KB (kernel, boot data, low memory)", stats.reserved_frames * 4);
+    kprintf("\nAllocated: %u KB", used * 4);
+    kprintf("\nFree: %u KB", stats.free_frames * 4);
+    kprintf("\nFree Frames: %u of %u (4 KB each)", stats.free_frames, stats.total_frames);
     
-    print("\n\nSupported: ");
-    if (edx & (1 << 0)) print("FPU ");
-    if (edx & (1 << 4)) print("TSC ");
-    if (edx & (1 << 5)) print("MSR ");
-    if (edx & (1 << 23)) print("MMX ");
-    if (edx & (1 << 25)) print("SSE ");
-    if (edx & (1 << 26)) print("SSE2 ");
-    if (ecx & (1 << 0)) print("SSE3 ");
-}
-
-void cmd_meminfo() {
-    print("\n=== MEMORY INFORMATION ===");
-    unsigned int total_mb = probe_memory();
-    char mem_str[20];
-    print("\nTotal RAM detected: "); itoa(total_mb, mem_str); print(mem_str); print(" MB");
-    print("\nLower Memory: 640 KB (conventional)");
-    print("\nVideo Memory: 0xA0000-0xBFFFF (VGA)");
-    print("\nExtended Memory: "); itoa(total_mb - 1, mem_str); print(mem_str); print(" MB");
-}
-
-void cmd_memstat() {
-    print("\n=== MEMORY STATISTICS ===");
-    unsigned int total_mb = probe_memory();
-    char stat_str[20];
-    print("\nTotal: "); itoa(total_mb * 1024, stat_str); print(stat_str); print(" KB");
-    print("\nKernel: ~1 MB");
-    print("\nAvailable: ~"); itoa(total_mb * 1024 - 1024, stat_str); print(stat_str); print(" KB");
-}
-
-void cmd_kbdstat() {
-    print("\n=== KEYBOARD STATUS ===");
+    struct paging_stats paging;
+    paging_get_stats(&paging);
+    kprintf("\n\nPaging: %s%s%s", paging.enabled ? "enabled" : "disabled",
+            paging.pse ? ", 4 MB pages" : ", 4 KB pages only",
+            paging.pat ? ", PAT (VGA write-combining)" : ", no PAT");
+    kprintf("\nLarge Pages: %u\nPage Tables: %u\nGuard Pages: %u",
+            paging.large_pages, paging.page_tables, paging.guard_pages);
+}
+
+void cmd_heapstat(int argc, char **argv) {
+    print("\n=== HEAP STATISTICS ===");
+    print("\n\nCache           Size Slabs  Active  Allocs   Frees Frag");
+    for (struct kmem_cache *c = heap_caches(); c; c = c->next) {
+        // Share of slab memory not holding live objects
+        unsigned int slab_bytes = c->slab_count * PAGE_SIZE;
+        unsigned long long live = (unsigned long long)c->active_objects * c->object_size * 100;
+        unsigned int frag = slab_bytes ? 100 - (unsigned int)div_u64_rem(live, slab_bytes, 0) : 0;
+        kprintf("\n%-14s%6u%6u%8u%8u%8u%4u%%", c->name, c->object_size, c->slab_count,
+                c->active_objects, c->allocs, c->frees, frag);
+    }
+    
+    unsigned int large_allocs, large_pages;
+    heap_large_stats(&large_allocs, &large_pages);
+    kprintf("\n\nLarge allocations: %u (%u KB)", large_allocs, large_pages * 4);
+    
+    const struct arena *boot = heap_boot_arena();
+    kprintf("\nBoot arena: %u of %u bytes used", boot->used_bytes, boot->total_bytes);
+}
+
+void cmd_ps(int argc, char **argv) {
+    static const char *state_names[] = { "run", "ready", "sleep", "block", "dead" };
+    static struct thread threads[32];
+    unsigned int count = sched_snapshot(threads, 32);
+    print("\n  ID Name            State Prio CPU  CPU ms  Switches");
+    for (unsigned int i = 0; i < count; i++) {
+        struct thread *t = &threads[i];
+        kprintf("\n%4u %-16s%-5s%5u%4u%8llu%10u", t->id, t->name, state_names[t->state], t->priority,
+                t->cpu, div_u64_rem(t->cpu_ns, 1000000, 0), t->switches);
+    }
+    kprintf("\n\nContext switches: %u", sched_context_switches());
+    for (unsigned int i = 0; i < smp_cpu_possible(); i++) {
+        struct cpu *cpu = smp_cpu(i);
+        if (!cpu->online) continue;
+        kprintf("\n CPU %2u: %8u switches, %u steals", i, cpu->sched.context_switches, cpu->sched.steals);
+    }
+}
+
+void cmd_sleep(int argc, char **argv) {
+    int ms = atoi(argv[1]);
+    if (ms > 0) thread_sleep_ms(ms);
+}
+
+void cmd_kbdstat(int argc, char **argv) {
     unsigned char status = get_keyboard_status();
-    char hex_str[11], status_flags[100];
-    print("\nStatus Register: "); uint_to_hex(status, hex_str); print(hex_str);
-    decode_keyboard_status(status, status_flags);
-    print("\nFlags: "); print(status_flags);
-    print("\n\nBit Details:");
-    print("\n Bit 0 (OBF): "); print((status & 0x01) ? "Output buffer full" : "Empty");
-    print("\n Bit 1 (IBF): "); print((status & 0x02) ? "Input buffer full" : "Empty");
-    print("\n Bit 2 (SYS): "); print((status & 0x04) ? "System flag set" : "Clear");
-}
-
-void cmd_vgainfo() {
-    print("\n=== VGA INFORMATION ===");
+    char status_flags[100];
+    decode_keyboard_status(status, status_flags, sizeof(status_flags));
+    kprintf("\n=== KEYBOARD STATUS ===\nStatus Register: 0x%08X\nFlags: %s", status, status_flags);
+    kprintf("\n\nBit Details:\n Bit 0 (OBF): %s\n Bit 1 (IBF): %s\n Bit 2 (SYS): %s",
+            (status & 0x01) ? "Output buffer full" : "Empty",
+            (status & 0x02) ? "Input buffer full" : "Empty",
+            (status & 0x04) ? "System flag set" : "Clear");
+}
+
+void cmd_serstat(int argc, char **argv) {
+    print("\n=== SERIAL STATUS ===");
+    if (!serial_present()) { print("\nNo UART at COM1"); return; }
+    
+    struct serial_stats stats;
+    serial_get_stats(&stats);
+    kprintf("\nPort: COM1 (0x3F8), IRQ 4, 16550 FIFO\nSpeed: %u baud, 8N1", SERIAL_BAUD);
+    kprintf("\nBytes Sent: %u\nBytes Received: %u", stats.tx_bytes, stats.rx_bytes);
+    kprintf("\nTX Ring Full: %u\nRX Dropped: %u\nLine Errors: %u", stats.tx_stalls, stats.rx_dropped, stats.rx_errors);
+}
+
+void cmd_vgainfo(int argc, char **argv) {
+    if (console_is_framebuffer()) {
+        struct fbcon_stats fb;
+        fbcon_get_stats(&fb);
+        kprintf("\n=== FRAMEBUFFER CONSOLE ===\nMode: %ux%u, %u bpp, pitch %u bytes\nFramebuffer: 0x%08X (write-combining)",
+                fb.width, fb.height, fb.bpp, fb.pitch, fb.address);
+        kprintf("\nText: %ux%u cells, 8x16 font from the video BIOS at 0x%05X\nBlits: %s",
+                fb.cols, fb.rows, fb.font_address, fb.simd ? "SSE2 (REP MOVSD with interrupts off)" : "REP MOVSD");
+        kprintf("\n\nFrames: %u\nGlyphs drawn: %llu\nUnchanged cells skipped: %llu\nRows cleared by fill: %llu",
+                fb.frames, fb.glyphs, fb.unchanged, fb.row_fills);
+        if (fb.frames) kprintf("\nCycles per frame: %llu", div_u64_rem(fb.cycles, fb.frames, 0));
+        kprintf("\n\nScrollback: %u rows (Shift+PgUp/PgDn)", console_scrollback_rows());
+        return;
+    }
     unsigned char mode, width, height;
-    char reg_str[20];
     get_vga_info(&mode, &width, &height);
-    print("\nMode: "); print(mode ? "Color" : "Monochrome");
-    print("\nText Mode: 80x25");
-    print("\nVideo Memory: 0xB8000");
-    print("\n\nCRTC Registers:");
-    print("\n Horizontal Total: "); itoa(read_vga_register(0x3D4, 0x00), reg_str); print(reg_str);
-    print("\n Vertical Total: "); itoa(read_vga_register(0x3D4, 0x06), reg_str); print(reg_str);
-    print("\n\nMisc Output: "); uint_to_hex(inb(0x3CC), reg_str); print(reg_str);
-}
-
-void cmd_devlist() {
-    print("\n=== DETECTED DEVICES ===");
-    print("\n\n[Standard Devices]");
-    print("\n - PIC (8259): IRQ Controller");
-    print("\n - PIT (8253): Timer");
-    print("\n - Keyboard Controller (8042)");
-    print("\n - VGA Controller");
-    print("\n - RTC/CMOS");
-    print("\n\n[PCI Devices]");
-    print("\nScanning PCI bus...");
+    kprintf("\n=== VGA INFORMATION ===\nMode: %s\nText Mode: 80x25\nVideo Memory: 0xB8000",
+            mode ? "Color" : "Monochrome");
+    unsigned int start = (read_vga_register(0x3D4, 0x0C) << 8) | read_vga_register(0x3D4, 0x0D);
+    kprintf("\n\nCRTC Registers:\n Horizontal Total: %u\n Vertical Total: %u\n Start Address: %u",
+            read_vga_register(0x3D4, 0x00), read_vga_register(0x3D4, 0x06), start);
+    kprintf("\n\nScrollback: %u rows (Shift+PgUp/PgDn)\nMisc Output: 0x%08X", console_scrollback_rows(), inb(0x3CC));
+}
+
+void cmd_devlist(int argc, char **argv) {
+    print("\n=== DETECTED DEVICES ===\n\n[Standard Devices]"
+          "\n - PIC (8259): IRQ Controller"
+          "\n - PIT (8253): Timer"
+          "\n - Keyboard Controller (8042)"
+          "\n - VGA Controller"
+          "\n - RTC/CMOS");
     
-    int device_count = 0;
-    for (unsigned char bus = 0; bus < 2; bus++) {
-        for (unsigned char device = 0; device < 32; device++) {
-            if (pci_device_exists(bus, device, 0)) {
-                unsigned int vendor_device = pci_config_read(bus, device, 0, 0);
-                char dev_str[20];
-                print("\n Bus "); itoa(bus, dev_str); print(dev_str);
-                print(", Device "); itoa(device, dev_str); print(dev_str);
-                print(": VID="); uint_to_hex(vendor_device & 0xFFFF, dev_str); print(dev_str);
-                print(", DID="); uint_to_hex((vendor_device >> 16) & 0xFFFF, dev_str); print(dev_str);
-                device_count++;
-            }
+    unsigned int device_count = pci_device_count();
+    kprintf("\n\n[PCI Devices] %u found, config access: ", device_count);
+    if (pci_using_ecam()) kprintf("ECAM @ 0x%08X", pci_ecam_base());
+    else print("ports 0xCF8/0xCFC");
+    
+    // Device table was filled at boot; no configuration cycles here
+    for (unsigned int i = 0; i < device_count; i++) {
+        struct pci_device *dev = pci_get_device(i);
+        kprintf("\n %02X:%02X.%X %04X:%04X %s (%02X%02X%02X)", dev->bus, dev->device, dev->func,
+                dev->vendor_id, dev->device_id, pci_class_name(dev->class_code),
+                dev->class_code, dev->subclass, dev->prog_if);
+        if (dev->irq_pin) kprintf(" IRQ %u", dev->irq_line);
+        if (dev->header_type == 1) kprintf(" -> bus %u", dev->secondary_bus);
+        
+        for (int b = 0; b < PCI_MAX_BARS; b++) {
+            struct pci_bar *bar = &dev->bars[b];
+            if (!bar->size) continue;
+            kprintf("\n    BAR%d %s 0x%08X size 0x%08X%s%s", b, bar->is_io ? "I/O" : "MEM", bar->base, bar->size,
+                    bar->is_64bit ? " 64-bit" : "", bar->prefetchable ? " prefetch" : "");
+        }
+        if (dev->cap_mask) {
+            kprintf("\n    Caps:%s%s%s%s%s",
+                    (dev->cap_mask & (1 << PCI_CAP_PM)) ? " PM" : "",
+                    (dev->cap_mask & (1 << PCI_CAP_MSI)) ? " MSI" : "",
+                    (dev->cap_mask & (1 << PCI_CAP_MSIX)) ? " MSI-X" : "",
+                    (dev->cap_mask & (1 << PCI_CAP_PCIE)) ? " PCIe" : "",
+                    (dev->cap_mask & (1 << PCI_CAP_VENDOR)) ? " Vendor" : "");
         }
     }
     if (!device_count) print("\n No PCI devices detected");
+
+    kprintf("\n\n[Block Devices] %u found", block_device_count());
+    for (unsigned int i = 0; i < block_device_count(); i++) {
+        struct block_device *dev = block_get_device(i);
+        kprintf("\n %-4s %-10s %llu sectors (%llu MB) %s", dev->name, dev->driver,
+                dev->sectors, dev->sectors >> 11, dev->model);
+    }
+
+    kprintf("\n\n[Network Devices] %u found", net_device_count());
+    for (unsigned int i = 0; i < net_device_count(); i++) {
+        struct net_device *dev = net_get_device(i);
+        kprintf("\n %-4s %-10s %02x:%02x:%02x:%02x:%02x:%02x %s", dev->name, dev->driver,
+                dev->mac[0], dev->mac[1], dev->mac[2], dev->mac[3], dev->mac[4], dev->mac[5], dev->model);
+    }
 }
 
-void cmd_uptime() {
-    print("\n=== SYSTEM UPTIME ===");
+void cmd_uptime(int argc, char **argv) {
     unsigned char hour, minute, second;
-    char time_str[20];
-    get_rtc_time(&hour, &minute, &second);
+    get_wall_time(&hour, &minute, &second);
+    kprintf("\n=== SYSTEM UPTIME ===\nCurrent Time: %u:%02u:%02u", hour, minute, second);
     
-    // Display current RTC time
-    print("\nCurrent RTC Time: "); itoa(hour, time_str); print(time_str); print(":");
-    if (minute < 10) print("0"); itoa(minute, time_str); print(time_str); print(":");
-    if (second < 10) print("0"); itoa(second, time_str); print(time_str);
+    // Monotonic clock, so no wall-clock wraparound to correct for
+    unsigned int usecs;
+    unsigned int uptime_seconds = (unsigned int)div_u64_rem(div_u64_rem(now_ns(), 1000, 0), 1000000, &usecs);
     
-    // Calculate uptime (time since boot)
-    int total_seconds_now = (hour * 3600) + (minute * 60) + second;
-    int total_seconds_boot = (boot_hour * 3600) + (boot_minute * 60) + boot_second;
-    int uptime_seconds = total_seconds_now - total_seconds_boot;
+    kprintf("\nSystem Uptime: %u days, %u hours, %u minutes, %u.%06u seconds",
+            uptime_seconds / 86400, (uptime_seconds % 86400) / 3600,
+            (uptime_seconds % 3600) / 60, uptime_seconds % 60, usecs);
     
-    // Handle day wraparound (if current time < boot time, day changed)
-    if (uptime_seconds < 0) {
-        uptime_seconds += 86400; // Add 24 hours in seconds
-    }
-    
-    // Convert to hours, minutes, seconds
-    int up_hours = uptime_seconds / 3600;
-    int up_minutes = (uptime_seconds % 3600) / 60;
-    int up_secs = uptime_seconds % 60;
-    
-    // Display uptime
-    print("\nSystem Uptime: ");
-    itoa(up_hours, time_str); print(time_str); print(" hours, ");
-    itoa(up_minutes, time_str); print(time_str); print(" minutes, ");
-    itoa(up_secs, time_str); print(time_str); print(" seconds");
+    if (timer_has_tsc()) kprintf("\nClock Source: TSC @ %u MHz", timer_tsc_khz() / 1000);
+    else kprintf("\nClock Source: PIT @ %u Hz", TIMER_HZ);
 }
 
-void cmd_sysinfo() {
-    print("\n=== SYSTEM INFORMATION ===");
-    print("\n\nOS: Basic Kernel");
-    print("\nArchitecture: x86 (32-bit)");
+void cmd_sysinfo(int argc, char **argv) {
+    print("\n=== SYSTEM INFORMATION ===\n\nOS: Basic Kernel\nArchitecture: x86 (32-bit)");
     
-    if (cpuid_supported()) {
-        char vendor[13];
-        get_cpu_vendor(vendor);
-        print("\nCPU: "); print(vendor);
-    }
-    
-    char mem_str[20], time_str[20];
-    unsigned int total_mb = probe_memory();
-    print("\nRAM: "); itoa(total_mb, mem_str); print(mem_str); print(" MB");
+    if (cpu_features.cpuid) kprintf("\nCPU: %s", cpu_features.vendor);
     
+    struct pmm_stats stats;
+    pmm_get_stats(&stats);
     unsigned char hour, minute, second;
-    get_rtc_time(&hour, &minute, &second);
-    print("\nTime: "); itoa(hour, time_str); print(time_str); print(":");
-    if (minute < 10) print("0"); itoa(minute, time_str); print(time_str); print(":");
-    if (second < 10) print("0"); itoa(second, time_str); print(time_str);
-}
-
-void cmd_portlist() {
-    print("\n=== I/O PORT MAP ===");
-    print("\n\n[DMA Controller]");
-    print("\n 0x00-0x0F: DMA channels 0-3");
-    print("\n 0xC0-0xDF: DMA channels 4-7");
-    print("\n\n[Interrupt Controllers]");
-    print("\n 0x20-0x21: Master PIC (8259)");
-    print("\n 0xA0-0xA1: Slave PIC (8259)");
-    print("\n\n[Timer]");
-    print("\n 0x40-0x43: PIT (8253)");
-    print("\n\n[Keyboard]");
-    print("\n 0x60: Data port");
-    print("\n 0x64: Command/Status port");
-    print("\n\n[RTC/CMOS]");
-    print("\n 0x70: Index register");
-    print("\n 0x71: Data register");
-    print("\n\n[VGA]");
-    print("\n 0x3C0-0x3CF: VGA registers");
-    print("\n 0x3D4-0x3D5: CRT controller");
-    print("\n\n[PCI]");
-    print("\n 0xCF8: Config address");
-    print("\n 0xCFC: Config data");
+    get_wall_time(&hour, &minute, &second);
+    kprintf("\nRAM: %u MB\nTime: %u:%02u:%02u", stats.total_frames / 256, hour, minute, second);
+}
+
+void cmd_portlist(int argc, char **argv) {
+    print("\n=== I/O PORT MAP ==="
+          "\n\n[DMA Controller]"
+          "\n 0x00-0x0F: DMA channels 0-3"
+          "\n 0xC0-0xDF: DMA channels 4-7"
+          "\n\n[Interrupt Controllers]"
+          "\n 0x20-0x21: Master PIC (8259)"
+          "\n 0xA0-0xA1: Slave PIC (8259)"
+          "\n\n[Timer]"
+          "\n 0x40-0x43: PIT (8253)"
+          "\n\n[Keyboard]"
+          "\n 0x60: Data port"
+          "\n 0x64: Command/Status port"
+          "\n\n[Serial]"
+          "\n 0x3F8-0x3FF: COM1 (16550 UART)"
+          "\n\n[RTC/CMOS]"
+          "\n 0x70: Index register"
+          "\n 0x71: Data register"
+          "\n\n[VGA]"
+          "\n 0x3C0-0x3CF: VGA registers"
+          "\n 0x3D4-0x3D5: CRT controller"
+          "\n\n[PCI]"
+          "\n 0xCF8: Config address"
+          "\n 0xCFC: Config data");
 }
 
 // ============================================================================
 // COMMAND DISPATCHER
 // ============================================================================
 
-void parse_two_numbers(const char *cmd, int start_pos, int *num1, int *num2) {
-    int i = start_pos;
-    while (cmd[i] == ' ') i++;
-    *num1 = atoi(cmd + i);
-    while (cmd[i] != ' ' && cmd[i]) i++;
-    while (cmd[i] == ' ') i++;
-    *num2 = atoi(cmd + i);
-}
-
 void execute_command() {
+    unsigned long long t = trace_begin();
     command_buffer[command_pos] = '\0';
-    
-    // Simple commands
-    if (strcmp(command_buffer, "clear") == 0) { clear_screen(); }
-    else if (starts_with(command_buffer, "echo ")) { print("\n"); print(command_buffer + 5); }
-    
-    // Math commands
-    else if (starts_with(command_buffer, "add ") || starts_with(command_buffer, "sub ") || 
-             starts_with(command_buffer, "mul ") || starts_with(command_buffer, "div ")) {
-        int num1, num2;
-        char op = command_buffer[0];
-        parse_two_numbers(command_buffer, 4, &num1, &num2);
-        
-        if (op == 'd' && num2 == 0) {
-            print("\nError: Division by zero!");
-        } else {
-            int result = (op == 'a') ? num1 + num2 : (op == 's') ? num1 - num2 :
-                        (op == 'm') ? num1 * num2 : num1 / num2;
-            char result_str[20];
-            itoa(result, result_str);
-            print("\n");
-            print((op == 'a') ? "Sum: " : (op == 's') ? "Difference: " :
-                  (op == 'm') ? "Product: " : "Quotient: ");
-            print(result_str);
-        }
-    }
-    
-    // Info command
-    else if (strcmp(command_buffer, "info") == 0) {
-        print("\n=== Available Commands ===");
-        print("\n\n[Basic Commands]");
-        print("\nclear - Clear the screen");
-        print("\necho - Display text");
-        print("\nadd - Add two numbers");
-        print("\nsub - Subtract y from x");
-        print("\nmul - Multiply two numbers");
-        print("\ndiv - Divide x by y");
-        print("\n\n[System Monitoring]");
-        print("\nsysinfo - System overview");
-        print("\nuptime - System uptime");
-        print("\nmemstat - Memory statistics");
-        print("\n\n[Device Management]");
-        print("\nkbdstat - Keyboard status");
-        print("\nvgainfo - VGA information");
-        print("\ndevlist - List devices");
-        print("\n\n[Hardware Detection]");
-        print("\ncpuinfo - CPU information");
-        print("\nmeminfo - Memory map");
-        print("\nportlist - I/O port list");
-    }
-    
-    // System commands - using function pointer approach would add overhead, stick with if-else
-    else if (strcmp(command_buffer, "cpuinfo") == 0) cmd_cpuinfo();
-    else if (strcmp(command_buffer, "meminfo") == 0) cmd_meminfo();
-    else if (strcmp(command_buffer, "memstat") == 0) cmd_memstat();
-    else if (strcmp(command_buffer, "kbdstat") == 0) cmd_kbdstat();
-    else if (strcmp(command_buffer, "vgainfo") == 0) cmd_vgainfo();
-    else if (strcmp(command_buffer, "devlist") == 0) cmd_devlist();
-    else if (strcmp(command_buffer, "uptime") == 0) cmd_uptime();
-    else if (strcmp(command_buffer, "sysinfo") == 0) cmd_sysinfo();
-    else if (strcmp(command_buffer, "portlist") == 0) cmd_portlist();
-    
-    // Unknown command
-    else {
-        print("\nUnknown command: ");
-        print(command_buffer);
-        print("\nType 'info' for available commands");
-    }
-    
+    command_execute(command_buffer);
+    trace_end("execute_command", command_pos, t);
     print("\n> ");
     command_pos = 0;
 }
@@ -562,9 +584,33 @@ void execute_command() {
 // MAIN KERNEL ENTRY POINT
 // ============================================================================
 
-void kernelMain(void) {
-    clear_screen();
-    get_rtc_time(&boot_hour, &boot_minute, &boot_second);
+void kernelMain(unsigned int magic, struct multiboot_info *mbi) {
+    cpu_features_init();
+    console_init();
+    memory_map_valid = pmm_init(magic, mbi);
+    heap_init();
+    console_use_framebuffer(magic, mbi);
+    initrd_init(magic, mbi);
+    acpi_init();
+    pci_init();
+    unsigned char hour, minute, second;
+    get_rtc_time(&hour, &minute, &second);
+    boot_seconds = (hour * 3600) + (minute * 60) + second;
+    interrupts_init();
+    paging_init();
+    smp_init();
+    timer_init();
+    keyboard_init();
+    serial_init();
+    serial_on_receive(input_ready);
+    sched_init();
+    console_start_renderer();
+    block_init();
+    bcache_init();
+    net_init();
+    interrupts_enable();
+    smp_start_aps();
+    vfs_init();
     print("Made by Saksham & Aditi\n");
     print("Welcome to Basic Kernel!\n");
     print("Type 'info' to see available commands\n");
@@ -572,22 +618,34 @@ void kernelMain(void) {
     
     char buffer[2] = {0, 0};
     while (1) {
-        unsigned char scancode = read_key();
-        if (scancode) {
-            char c = scancode_to_ascii(scancode);
-            if (c) {
-                if (c == '\n') {
-                    execute_command();
-                } else if (c == '\b') {
-                    if (command_pos > 0) {
-                        command_pos--;
-                        backspace();
-                    }
-                } else if (command_pos < 79) {
-                    command_buffer[command_pos++] = c;
-                    buffer[0] = c;
-                    print(buffer);
+        unsigned char scancode, byte;
+        char c;
+        unsigned int flags = spin_lock_irqsave(&input_wait.lock);
+        if (read_key(&scancode)) {
+            spin_unlock_irqrestore(&input_wait.lock, flags);
+            c = scancode_to_ascii(scancode);
+        } else if (serial_read(&byte)) {
+            spin_unlock_irqrestore(&input_wait.lock, flags);
+            c = serial_to_ascii(byte);
+        } else {
+            wait_queue_sleep(&input_wait);
+            spin_unlock_irqrestore(&input_wait.lock, flags);
+            continue;
+        }
+        if (c) {
+            if (c == '\n') {
+                execute_command();
+            } else if (c == KEY_SCROLL_UP || c == KEY_SCROLL_DOWN) {
+                console_scroll_view((c == KEY_SCROLL_UP ? -1 : 1) * ((int)console_rows() - 1));
+            } else if (c == '\b') {
+                if (command_pos > 0) {
+                    command_pos--;
+                    backspace();
                 }
+            } else if (command_pos < 79) {
+                command_buffer[command_pos++] = c;
+                buffer[0] = c;
+                print(buffer);
             }
         }
     }
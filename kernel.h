@@ -0,0 +1,37 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+// Shared declarations for the helpers in kernel.c that the other
+// subsystems (interrupts, timers, drivers) call back into.
+
+// Port I/O primitives (inlined)
+#include "port_io.h"
+
+// memcpy/memset/strlen and friends (string.c)
+#include "string.h"
+
+// Utility functions
+int starts_with(const char *str, const char *prefix);
+int atoi(const char *str);
+void itoa(int num, char *str);
+void uint_to_hex(unsigned int num, char *str);
+
+// 64-by-32 division without libgcc's __udivdi3: divide the high word
+// first, then feed its remainder into a single divl for the low word.
+static inline unsigned long long div_u64_rem(unsigned long long n, unsigned int d, unsigned int *rem) {
+    unsigned int hi = n >> 32, lo = (unsigned int)n, q_lo, r;
+    unsigned int q_hi = hi / d;
+    hi %= d;
+    asm("divl %4" : "=a"(q_lo), "=d"(r) : "a"(lo), "d"(hi), "rm"(d));
+    if (rem) *rem = r;
+    return ((unsigned long long)q_hi << 32) | q_lo;
+}
+
+// CMOS real-time clock
+void get_rtc_time(unsigned char *hour, unsigned char *minute, unsigned char *second);
+
+// VGA console (console.c) and formatted output (kprintf.c)
+#include "console.h"
+#include "kprintf.h"
+
+#endif
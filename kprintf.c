@@ -0,0 +1,208 @@
+#include "kernel.h"
+#include "kprintf.h"
+
+// Output goes into a buffer; the console sink flushes it when full, the
+// string sink drops what does not fit but keeps counting
+struct sink {
+    char *buf;
+    size_t size;                        // capacity, excluding ksnprintf's NUL
+    size_t len;                         // bytes in buf
+    size_t total;                       // bytes produced, kept or not
+    int console;
+};
+
+struct spec {
+    int left, zero;
+    int width;
+    int precision;                      // -1 if none given
+};
+
+// ============================================================================
+// SINKS
+// ============================================================================
+
+static void sink_flush(struct sink *s) {
+    if (s->len) console_write(s->buf, s->len);
+    s->len = 0;
+}
+
+static void emit(struct sink *s, const char *str, size_t n) {
+    s->total += n;
+    while (n) {
+        size_t room = s->size - s->len;
+        if (!room) {
+            if (!s->console) return;
+            sink_flush(s);
+            room = s->size;
+        }
+        size_t chunk = n < room ? n : room;
+        memcpy(s->buf + s->len, str, chunk);
+        s->len += chunk;
+        str += chunk;
+        n -= chunk;
+    }
+}
+
+static void emit_fill(struct sink *s, char c, int count) {
+    char fill[16];
+    if (count <= 0) return;
+    memset(fill, c, count < 16 ? count : 16);
+    for (; count > 0; count -= 16) emit(s, fill, count < 16 ? count : 16);
+}
+
+// ============================================================================
+// CONVERSIONS
+// ============================================================================
+
+// Digits are produced backwards, ending just before 'end'. Decimal divides
+// 64 by 32 bits only while the value still needs the high word.
+static char *format_unsigned(char *end, unsigned long long value, unsigned int base, int upper) {
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char *p = end;
+    if (base != 10) {
+        unsigned int shift = base == 16 ? 4 : 3;
+        do { *--p = digits[value & (base - 1)]; value >>= shift; } while (value);
+        return p;
+    }
+    while (value >> 32) {
+        unsigned int rem;
+        value = div_u64_rem(value, 10, &rem);
+        *--p = '0' + rem;
+    }
+    unsigned int v = value;
+    do { *--p = '0' + v % 10; v /= 10; } while (v);
+    return p;
+}
+
+static void emit_padded(struct sink *s, const struct spec *spec, const char *str, size_t len) {
+    if (!spec->left) emit_fill(s, ' ', spec->width - (int)len);
+    emit(s, str, len);
+    if (spec->left) emit_fill(s, ' ', spec->width - (int)len);
+}
+
+// The prefix ("-" or "0x") goes before any zero padding
+static void emit_number(struct sink *s, const struct spec *spec, unsigned long long value,
+                        unsigned int base, int upper, const char *prefix) {
+    char digits[24];                    // 22 octal digits cover 64 bits
+    char *end = digits + sizeof(digits);
+    char *p = format_unsigned(end, value, base, upper);
+    int len = end - p, prefix_len = strlen(prefix);
+    int pad = spec->width - len - prefix_len;
+    if (!spec->left && !spec->zero) emit_fill(s, ' ', pad);
+    emit(s, prefix, prefix_len);
+    if (!spec->left && spec->zero) emit_fill(s, '0', pad);
+    emit(s, p, len);
+    if (spec->left) emit_fill(s, ' ', pad);
+}
+
+static void format(struct sink *s, const char *fmt, va_list ap) {
+    while (*fmt) {
+        // Literal text up to the next conversion goes out as one span
+        const char *start = fmt;
+        while (*fmt && *fmt != '%') fmt++;
+        if (fmt != start) emit(s, start, fmt - start);
+        if (!*fmt) break;
+        const char *conversion = fmt++;
+
+        struct spec spec = { 0, 0, 0, -1 };
+        for (;; fmt++) {
+            if (*fmt == '-') spec.left = 1;
+            else if (*fmt == '0') spec.zero = 1;
+            else break;
+        }
+        if (*fmt == '*') {
+            spec.width = va_arg(ap, int);
+            if (spec.width < 0) { spec.left = 1; spec.width = -spec.width; }
+            fmt++;
+        } else {
+            while (*fmt >= '0' && *fmt <= '9') spec.width = spec.width * 10 + (*fmt++ - '0');
+        }
+        if (*fmt == '.') {
+            spec.precision = 0;
+            if (*++fmt == '*') {
+                spec.precision = va_arg(ap, int);
+                fmt++;
+            } else {
+                while (*fmt >= '0' && *fmt <= '9') spec.precision = spec.precision * 10 + (*fmt++ - '0');
+            }
+        }
+
+        int length = 0;                 // 1 for long and size_t, 2 for long long
+        if (*fmt == 'l') {
+            length = 1;
+            if (*++fmt == 'l') { length = 2; fmt++; }
+        } else if (*fmt == 'z') { length = 1; fmt++; }
+
+        switch (*fmt) {
+        case 'd': case 'i': {
+            long long v = length == 2 ? va_arg(ap, long long) : length ? va_arg(ap, long) : va_arg(ap, int);
+            // Negated as unsigned, so the most negative value survives
+            emit_number(s, &spec, v < 0 ? -(unsigned long long)v : (unsigned long long)v, 10, 0, v < 0 ? "-" : "");
+            break;
+        }
+        case 'u': case 'x': case 'X': case 'o': {
+            unsigned long long v = length == 2 ? va_arg(ap, unsigned long long) :
+                                   length ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+            emit_number(s, &spec, v, *fmt == 'u' ? 10 : *fmt == 'o' ? 8 : 16, *fmt == 'X', "");
+            break;
+        }
+        case 'p': {
+            struct spec pointer = { spec.left, 1, spec.width > 10 ? spec.width : 10, -1 };
+            emit_number(s, &pointer, (unsigned long)va_arg(ap, void *), 16, 1, "0x");
+            break;
+        }
+        case 'c': {
+            char c = va_arg(ap, int);
+            emit_padded(s, &spec, &c, 1);
+            break;
+        }
+        case 's': {
+            const char *str = va_arg(ap, const char *);
+            if (!str) str = "(null)";
+            emit_padded(s, &spec, str, spec.precision >= 0 ? strnlen(str, spec.precision) : strlen(str));
+            break;
+        }
+        case '%':
+            emit(s, "%", 1);
+            break;
+        default:
+            // Unknown conversion: show it as written
+            emit(s, conversion, fmt - conversion + (*fmt != '\0'));
+            if (!*fmt) return;
+        }
+        fmt++;
+    }
+}
+
+// ============================================================================
+// PUBLIC API
+// ============================================================================
+
+void kvprintf(const char *fmt, va_list ap) {
+    char line[KPRINTF_LINE];
+    struct sink s = { line, sizeof(line), 0, 0, 1 };
+    format(&s, fmt, ap);
+    sink_flush(&s);
+}
+
+void kprintf(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    kvprintf(fmt, ap);
+    va_end(ap);
+}
+
+int kvsnprintf(char *buf, size_t size, const char *fmt, va_list ap) {
+    struct sink s = { buf, size ? size - 1 : 0, 0, 0, 0 };
+    format(&s, fmt, ap);
+    if (size) buf[s.len] = '\0';
+    return s.total;
+}
+
+int ksnprintf(char *buf, size_t size, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int len = kvsnprintf(buf, size, fmt, ap);
+    va_end(ap);
+    return len;
+}
@@ -0,0 +1,30 @@
+#ifndef KPRINTF_H
+#define KPRINTF_H
+
+// printf-style formatting for the console and for string buffers.
+//
+// Conversions: %d %i %u %x %X %o %c %s %p %%, with the flags '-' (left
+// align) and '0' (zero pad), a field width (digits or '*'), a precision
+// for %s, and the length modifiers l, ll and z. %p prints 0x and eight
+// hex digits. 64-bit values divide through div_u64_rem, so no libgcc.
+//
+// kprintf formats into a line buffer on the caller's stack and hands it to
+// console_write (VGA plus the serial mirror) when it fills and when the
+// call returns, so a whole line of output costs one console update.
+
+#include <stdarg.h>
+#include "string.h"
+
+// Size of kprintf's buffer: two full rows
+#define KPRINTF_LINE 160
+
+// Formatted output to the console
+void kprintf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void kvprintf(const char *fmt, va_list ap);
+
+// snprintf semantics: always NUL-terminates within 'size' and returns the
+// length the full output would have had, so truncation is 'result >= size'
+int ksnprintf(char *buf, size_t size, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+int kvsnprintf(char *buf, size_t size, const char *fmt, va_list ap);
+
+#endif
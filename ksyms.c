@@ -0,0 +1,67 @@
+#include "kernel.h"
+#include "ksyms.h"
+
+extern char _ksyms_start[], _ksyms_end[], _text_end[];
+
+// Layout written by gen_ksyms.py: the header, 'count' entries sorted by
+// address, then the names; name offsets count from the header
+struct ksym_header {
+    unsigned int magic;
+    unsigned int count;
+};
+
+struct ksym_entry {
+    unsigned int address;
+    unsigned int name;
+};
+
+static const struct ksym_header *table() {
+    const struct ksym_header *header = (const struct ksym_header *)_ksyms_start;
+    unsigned int size = _ksyms_end - _ksyms_start;
+    if (size < sizeof(*header) || header->magic != KSYMS_MAGIC) return 0;
+    if (header->count > (size - sizeof(*header)) / sizeof(struct ksym_entry)) return 0;
+    return header;
+}
+
+static const struct ksym_entry *entries(const struct ksym_header *header) {
+    return (const struct ksym_entry *)(header + 1);
+}
+
+unsigned int ksym_count() {
+    const struct ksym_header *header = table();
+    return header ? header->count : 0;
+}
+
+// Binary search for the last symbol at or below 'addr'; cheap enough for
+// the profiler to call on every timer tick
+int ksym_index(unsigned int addr) {
+    const struct ksym_header *header = table();
+    if (!header || !header->count) return -1;
+    const struct ksym_entry *e = entries(header);
+    if (addr < e[0].address || addr >= (unsigned int)_text_end) return -1;
+    unsigned int lo = 0, hi = header->count - 1;
+    while (lo < hi) {
+        unsigned int mid = (lo + hi + 1) / 2;
+        if (e[mid].address <= addr) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+const char *ksym_name(unsigned int index) {
+    const struct ksym_header *header = table();
+    if (!header || index >= header->count) return "?";
+    return (const char *)header + entries(header)[index].name;
+}
+
+unsigned int ksym_address(unsigned int index) {
+    const struct ksym_header *header = table();
+    return header && index < header->count ? entries(header)[index].address : 0;
+}
+
+int ksym_format(unsigned int addr, char *buffer, unsigned int size) {
+    int index = ksym_index(addr);
+    if (index < 0) return 0;
+    ksnprintf(buffer, size, "%s+0x%x", ksym_name(index), addr - ksym_address(index));
+    return 1;
+}
@@ -0,0 +1,22 @@
+#ifndef KSYMS_H
+#define KSYMS_H
+
+// Kernel function symbols, embedded at build time: gen_ksyms.py turns the
+// `nm` output of a first link into the .ksyms section that link.ld keeps
+// after the code, and the kernel is linked again with it. A kernel linked
+// only once has an empty table and every lookup fails.
+
+#define KSYMS_MAGIC 0x4D59534B          // "KSYM"
+
+unsigned int ksym_count();
+
+// Index of the function containing 'addr', or -1 outside the kernel's code
+int ksym_index(unsigned int addr);
+
+const char *ksym_name(unsigned int index);
+unsigned int ksym_address(unsigned int index);
+
+// "name+0x1c" into 'buffer'; returns 0 (and writes nothing) if unknown
+int ksym_format(unsigned int addr, char *buffer, unsigned int size);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+// Multiboot (version 1) structures handed over by GRUB in EBX.
+// kernel.asm forwards the magic value and this pointer to kernelMain.
+
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+
+// multiboot_info.flags
+#define MULTIBOOT_INFO_MEMORY  (1 << 0)
+#define MULTIBOOT_INFO_MODS    (1 << 3)
+#define MULTIBOOT_INFO_MMAP    (1 << 6)
+#define MULTIBOOT_INFO_FRAMEBUFFER (1 << 12)
+
+// multiboot_info.framebuffer_type
+#define MULTIBOOT_FRAMEBUFFER_INDEXED 0
+#define MULTIBOOT_FRAMEBUFFER_RGB     1
+#define MULTIBOOT_FRAMEBUFFER_TEXT    2
+
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+#define MULTIBOOT_MEMORY_RESERVED  2
+#define MULTIBOOT_MEMORY_ACPI      3
+#define MULTIBOOT_MEMORY_NVS       4
+#define MULTIBOOT_MEMORY_BADRAM    5
+
+struct multiboot_info {
+    unsigned int flags;
+    unsigned int mem_lower;             // KB below 1 MB
+    unsigned int mem_upper;             // KB above 1 MB (up to the first hole)
+    unsigned int boot_device;
+    unsigned int cmdline;
+    unsigned int mods_count;
+    unsigned int mods_addr;
+    unsigned int syms[4];
+    unsigned int mmap_length;
+    unsigned int mmap_addr;
+    unsigned int drives_length;
+    unsigned int drives_addr;
+    unsigned int config_table;
+    unsigned int boot_loader_name;
+    unsigned int apm_table;
+    unsigned int vbe_control_info;
+    unsigned int vbe_mode_info;
+    unsigned short vbe_mode;
+    unsigned short vbe_interface_seg;
+    unsigned short vbe_interface_off;
+    unsigned short vbe_interface_len;
+    unsigned long long framebuffer_addr;
+    unsigned int framebuffer_pitch;
+    unsigned int framebuffer_width;
+    unsigned int framebuffer_height;
+    unsigned char framebuffer_bpp;
+    unsigned char framebuffer_type;
+    unsigned char color_info[6];        // RGB: red position and size, green, blue
+} __attribute__((packed));
+
+// E820-style map entry. 'size' does not count itself, so the next entry
+// starts at (char *)entry + entry->size + 4.
+struct multiboot_mmap_entry {
+    unsigned int size;
+    unsigned long long addr;
+    unsigned long long len;
+    unsigned int type;
+} __attribute__((packed));
+
+struct multiboot_module {
+    unsigned int mod_start;
+    unsigned int mod_end;
+    unsigned int cmdline;
+    unsigned int reserved;
+} __attribute__((packed));
+
+#endif
@@ -0,0 +1,437 @@
+#include "kernel.h"
+#include "pmm.h"
+#include "heap.h"
+#include "timer.h"
+#include "sched.h"
+#include "commands.h"
+#include "net.h"
+#include "e1000.h"
+#include "virtio_net.h"
+
+#define ETH_TYPE_IPV4 0x0800
+#define ETH_TYPE_ARP  0x0806
+#define ARP_REQUEST   1
+#define ARP_REPLY     2
+#define IP_PROTO_ICMP 1
+#define IP_PROTO_UDP  17
+#define ICMP_ECHO_REPLY   0
+#define ICMP_ECHO_REQUEST 8
+#define IP_DEFAULT_TTL 64
+#define IP_FRAGMENT_MASK 0x3FFF         // more-fragments flag and offset
+
+#define NETBENCH_PORT 5555
+#define NETBENCH_SECONDS 10
+
+struct eth_header {
+    unsigned char dst[6], src[6];
+    unsigned short type;
+} __attribute__((packed));
+
+struct arp_packet {
+    unsigned short htype, ptype;
+    unsigned char hlen, plen;
+    unsigned short oper;
+    unsigned char sha[6];
+    unsigned int spa;
+    unsigned char tha[6];
+    unsigned int tpa;
+} __attribute__((packed));
+
+struct ipv4_header {
+    unsigned char version_ihl, tos;
+    unsigned short total_len, id, fragment;
+    unsigned char ttl, protocol;
+    unsigned short checksum;
+    unsigned int src, dst;
+} __attribute__((packed));
+
+struct udp_header {
+    unsigned short src_port, dst_port, len, checksum;
+} __attribute__((packed));
+
+struct icmp_header {
+    unsigned char type, code;
+    unsigned short checksum, id, seq;
+} __attribute__((packed));
+
+enum netbench_mode { NETBENCH_OFF, NETBENCH_ECHO, NETBENCH_SINK };
+
+static struct net_device *devices[NET_MAX_DEVICES];
+static unsigned int device_count = 0;
+
+static struct net_buf *buffers, *free_bufs = 0;
+static unsigned int free_count = 0;
+static struct spinlock pool_lock = SPINLOCK_INIT;
+
+static struct wait_queue net_wait = WAIT_QUEUE_INIT;
+
+// Updated by the net thread only
+static struct {
+    unsigned int arp_replies, icmp_replies, udp_packets;
+    unsigned int bad_headers, bad_checksums, no_port, other;
+} proto_stats;
+
+static volatile int bench_mode = NETBENCH_OFF;
+static volatile unsigned int bench_packets = 0;
+static volatile unsigned long long bench_bytes = 0;
+
+static inline unsigned short swap16(unsigned short x) {
+    return (x >> 8) | (x << 8);
+}
+
+// ============================================================================
+// BUFFERS
+// ============================================================================
+
+struct net_buf *net_buf_alloc() {
+    unsigned int flags = spin_lock_irqsave(&pool_lock);
+    struct net_buf *buf = free_bufs;
+    if (buf) {
+        free_bufs = buf->next;
+        free_count--;
+    }
+    spin_unlock_irqrestore(&pool_lock, flags);
+    if (buf) {
+        buf->data = buf->head + NET_HEADROOM;
+        buf->len = 0;
+    }
+    return buf;
+}
+
+void net_buf_free(struct net_buf *buf) {
+    unsigned int flags = spin_lock_irqsave(&pool_lock);
+    buf->next = free_bufs;
+    free_bufs = buf;
+    free_count++;
+    spin_unlock_irqrestore(&pool_lock, flags);
+}
+
+unsigned int net_buf_available() {
+    return free_count;
+}
+
+// Two buffers per frame; the frames need not be contiguous
+static int pool_init() {
+    buffers = kmalloc(NET_BUF_COUNT * sizeof(struct net_buf));
+    if (!buffers) return 0;
+    for (unsigned int i = 0; i < NET_BUF_COUNT; i += PAGE_SIZE / NET_BUF_SIZE) {
+        unsigned int frame = pmm_alloc_frame();
+        if (!frame) break;
+        for (unsigned int j = 0; j < PAGE_SIZE / NET_BUF_SIZE; j++) {
+            buffers[i + j].head = (unsigned char *)frame + j * NET_BUF_SIZE;
+            net_buf_free(&buffers[i + j]);
+        }
+    }
+    return free_count != 0;
+}
+
+// ============================================================================
+// DEVICES AND POLLING
+// ============================================================================
+
+void net_register(struct net_device *dev) {
+    if (device_count == NET_MAX_DEVICES) return;
+    ksnprintf(dev->name, sizeof(dev->name), "eth%u", device_count);
+    dev->ip = NET_DEFAULT_IP;
+    devices[device_count++] = dev;
+}
+
+unsigned int net_device_count() {
+    return device_count;
+}
+
+struct net_device *net_get_device(unsigned int index) {
+    return index < device_count ? devices[index] : 0;
+}
+
+void net_schedule(struct net_device *dev) {
+    dev->stats.interrupts++;
+    dev->scheduled = 1;
+    wait_queue_wake_all(&net_wait);
+}
+
+static int any_scheduled() {
+    for (unsigned int i = 0; i < device_count; i++)
+        if (devices[i]->scheduled) return 1;
+    return 0;
+}
+
+// A device that used its whole budget stays scheduled with interrupts
+// off; the yield lets the shell (same priority) run between rounds
+static void net_thread(void *arg) {
+    (void)arg;
+    for (;;) {
+        unsigned int flags = spin_lock_irqsave(&net_wait.lock);
+        while (!any_scheduled()) wait_queue_sleep(&net_wait);
+        spin_unlock_irqrestore(&net_wait.lock, flags);
+
+        for (unsigned int i = 0; i < device_count; i++) {
+            struct net_device *dev = devices[i];
+            if (!__atomic_exchange_n(&dev->scheduled, 0, __ATOMIC_ACQ_REL)) continue;
+            dev->stats.polls++;
+            int received = dev->ops->poll(dev, NET_POLL_BUDGET);
+            dev->ops->commit(dev);
+            if (received >= NET_POLL_BUDGET) {
+                dev->stats.busy_polls++;
+                dev->scheduled = 1;
+            } else if (dev->ops->irq_enable(dev)) {
+                dev->scheduled = 1;
+            }
+        }
+        if (any_scheduled()) thread_yield();
+    }
+}
+
+// Probe drivers after the pool exists: they fill their receive rings
+void net_init() {
+    if (!pool_init()) return;
+    e1000_init();
+    virtio_net_init();
+    if (device_count) thread_create("net", net_thread, 0, PRIO_SHELL);
+}
+
+// ============================================================================
+// PROTOCOLS
+// ============================================================================
+
+static void transmit(struct net_device *dev, struct net_buf *buf) {
+    unsigned int len = buf->len;
+    if (dev->ops->transmit(dev, buf) != 0) {
+        dev->stats.tx_dropped++;
+        net_buf_free(buf);
+        return;
+    }
+    dev->stats.tx_packets++;
+    dev->stats.tx_bytes += len;
+}
+
+// Turn the frame around: back to the sender, from this device
+static void eth_reply(struct net_device *dev, struct eth_header *eth) {
+    memcpy(eth->dst, eth->src, 6);
+    memcpy(eth->src, dev->mac, 6);
+}
+
+static void arp_input(struct net_device *dev, struct net_buf *buf, struct eth_header *eth) {
+    struct arp_packet *arp = (struct arp_packet *)(eth + 1);
+    if (buf->len < sizeof(*eth) + sizeof(*arp) || swap16(arp->oper) != ARP_REQUEST || arp->tpa != dev->ip) {
+        net_buf_free(buf);
+        return;
+    }
+    arp->oper = swap16(ARP_REPLY);
+    memcpy(arp->tha, arp->sha, 6);
+    arp->tpa = arp->spa;
+    memcpy(arp->sha, dev->mac, 6);
+    arp->spa = dev->ip;
+    eth_reply(dev, eth);
+    proto_stats.arp_replies++;
+    transmit(dev, buf);
+}
+
+static void ip_reply(struct net_device *dev, struct eth_header *eth, struct ipv4_header *ip) {
+    eth_reply(dev, eth);
+    unsigned int src = ip->src;
+    ip->src = ip->dst;
+    ip->dst = src;
+    ip->ttl = IP_DEFAULT_TTL;
+    ip->checksum = 0;
+    ip->checksum = csum_fold(csum_partial(ip, (ip->version_ihl & 0xF) * 4, 0));
+}
+
+static void icmp_input(struct net_device *dev, struct net_buf *buf, struct eth_header *eth,
+                       struct ipv4_header *ip, void *payload, unsigned int len) {
+    struct icmp_header *icmp = payload;
+    if (len < sizeof(*icmp) || icmp->type != ICMP_ECHO_REQUEST || csum_fold(csum_partial(icmp, len, 0))) {
+        net_buf_free(buf);
+        return;
+    }
+    icmp->type = ICMP_ECHO_REPLY;
+    icmp->checksum = 0;
+    icmp->checksum = csum_fold(csum_partial(icmp, len, 0));
+    ip_reply(dev, eth, ip);
+    proto_stats.icmp_replies++;
+    transmit(dev, buf);
+}
+
+// The checksum covers a pseudo-header of addresses, protocol and length
+static int udp_checksum_ok(const struct ipv4_header *ip, const struct udp_header *udp, unsigned int len) {
+    if (!udp->checksum) return 1;       // sender did not compute one
+    unsigned short pseudo[2] = { swap16(IP_PROTO_UDP), udp->len };
+    unsigned int sum = csum_partial(&ip->src, 8, 0);
+    sum = csum_partial(pseudo, sizeof(pseudo), sum);
+    return csum_fold(csum_partial(udp, len, sum)) == 0;
+}
+
+static void udp_input(struct net_device *dev, struct net_buf *buf, struct eth_header *eth,
+                      struct ipv4_header *ip, void *payload, unsigned int len) {
+    struct udp_header *udp = payload;
+    if (len < sizeof(*udp) || swap16(udp->len) < sizeof(*udp) || swap16(udp->len) > len) {
+        proto_stats.bad_headers++;
+        net_buf_free(buf);
+        return;
+    }
+    len = swap16(udp->len);
+    if (!udp_checksum_ok(ip, udp, len)) {
+        proto_stats.bad_checksums++;
+        net_buf_free(buf);
+        return;
+    }
+    proto_stats.udp_packets++;
+    int mode = bench_mode;
+    if (mode == NETBENCH_OFF || swap16(udp->dst_port) != NETBENCH_PORT) {
+        proto_stats.no_port++;
+        net_buf_free(buf);
+        return;
+    }
+    bench_packets++;
+    bench_bytes += len - sizeof(*udp);
+    if (mode == NETBENCH_SINK) {
+        net_buf_free(buf);
+        return;
+    }
+    // Swapping addresses and ports leaves the UDP checksum valid as is:
+    // the one's complement sum does not depend on the order of its words
+    unsigned short port = udp->src_port;
+    udp->src_port = udp->dst_port;
+    udp->dst_port = port;
+    ip_reply(dev, eth, ip);
+    transmit(dev, buf);
+}
+
+static void ipv4_input(struct net_device *dev, struct net_buf *buf, struct eth_header *eth) {
+    struct ipv4_header *ip = (struct ipv4_header *)(eth + 1);
+    unsigned int available = buf->len - sizeof(*eth);
+    unsigned int header_len = (ip->version_ihl & 0xF) * 4, total = swap16(ip->total_len);
+    if (available < sizeof(*ip) || (ip->version_ihl >> 4) != 4 || header_len < sizeof(*ip) ||
+        total < header_len || total > available || csum_fold(csum_partial(ip, header_len, 0))) {
+        proto_stats.bad_headers++;
+        net_buf_free(buf);
+        return;
+    }
+    if (ip->dst != dev->ip || (swap16(ip->fragment) & IP_FRAGMENT_MASK)) {
+        proto_stats.other++;
+        net_buf_free(buf);
+        return;
+    }
+    buf->len = sizeof(*eth) + total;    // drop Ethernet padding
+    unsigned char *payload = (unsigned char *)ip + header_len;
+    if (ip->protocol == IP_PROTO_UDP) udp_input(dev, buf, eth, ip, payload, total - header_len);
+    else if (ip->protocol == IP_PROTO_ICMP) icmp_input(dev, buf, eth, ip, payload, total - header_len);
+    else {
+        proto_stats.other++;
+        net_buf_free(buf);
+    }
+}
+
+void net_receive(struct net_device *dev, struct net_buf *buf) {
+    dev->stats.rx_packets++;
+    dev->stats.rx_bytes += buf->len;
+    struct eth_header *eth = (struct eth_header *)buf->data;
+    if (buf->len < sizeof(*eth)) {
+        net_buf_free(buf);
+        return;
+    }
+    unsigned short type = swap16(eth->type);
+    if (type == ETH_TYPE_ARP) arp_input(dev, buf, eth);
+    else if (type == ETH_TYPE_IPV4) ipv4_input(dev, buf, eth);
+    else {
+        proto_stats.other++;
+        net_buf_free(buf);
+    }
+}
+
+// ============================================================================
+// COMMANDS
+// ============================================================================
+
+static void print_ip(unsigned int ip) {
+    const unsigned char *b = (const unsigned char *)&ip;
+    kprintf("%u.%u.%u.%u", b[0], b[1], b[2], b[3]);
+}
+
+static void print_mac(const unsigned char *mac) {
+    kprintf("%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+static void totals(unsigned int *interrupts, unsigned int *polls) {
+    *interrupts = *polls = 0;
+    for (unsigned int i = 0; i < device_count; i++) {
+        *interrupts += devices[i]->stats.interrupts;
+        *polls += devices[i]->stats.polls;
+    }
+}
+
+// Mb/s with two decimals from a byte count over 'ns'
+static void print_rate(unsigned int packets, unsigned long long bytes, unsigned long long ns) {
+    unsigned int pps = (unsigned int)div_u64_rem((unsigned long long)packets * 1000000000ULL, ns, 0);
+    unsigned int mbps = (unsigned int)div_u64_rem(bytes * 800000, ns, 0);
+    kprintf("%9u pkt/s %5u.%02u Mb/s", pps, mbps / 100, mbps % 100);
+}
+
+void cmd_netbench(int argc, char **argv) {
+    int mode = NETBENCH_ECHO, seconds = NETBENCH_SECONDS;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "echo") == 0) mode = NETBENCH_ECHO;
+        else if (strcmp(argv[i], "sink") == 0) mode = NETBENCH_SINK;
+        else if ((seconds = atoi(argv[i])) <= 0) { print("\nUsage: netbench [echo|sink] [seconds]"); return; }
+    }
+    if (!device_count) { print("\nNo network devices found"); return; }
+
+    kprintf("\n=== UDP %s SERVER on port %u for %u s ===", mode == NETBENCH_ECHO ? "ECHO" : "SINK",
+            NETBENCH_PORT, seconds);
+    for (unsigned int i = 0; i < device_count; i++) {
+        kprintf("\n%-4s %-10s ", devices[i]->name, devices[i]->driver);
+        print_mac(devices[i]->mac);
+        print("  ");
+        print_ip(devices[i]->ip);
+    }
+    print("\n  time   packets/s   throughput  interrupts   polls");
+
+    unsigned int packets = 0, interrupts, polls;
+    unsigned long long bytes = 0, start = now_ns(), last = start;
+    totals(&interrupts, &polls);
+    bench_packets = 0;
+    bench_bytes = 0;
+    bench_mode = mode;
+    for (int s = 1; s <= seconds; s++) {
+        thread_sleep_ms(1000);
+        unsigned long long now = now_ns();
+        unsigned int p = bench_packets, i, q;
+        unsigned long long b = bench_bytes;
+        totals(&i, &q);
+        kprintf("\n  %3us ", s);
+        print_rate(p - packets, b - bytes, now - last);
+        kprintf(" %10u %7u", i - interrupts, q - polls);
+        packets = p;
+        bytes = b;
+        last = now;
+        interrupts = i;
+        polls = q;
+    }
+    bench_mode = NETBENCH_OFF;
+    print("\n  total ");
+    print_rate(packets, bytes, last - start);
+    kprintf("  %u packets", packets);
+}
+
+void cmd_netstat(int argc, char **argv) {
+    (void)argc; (void)argv;
+    if (!device_count) { print("\nNo network devices found"); return; }
+    print("\n=== NETWORK ===");
+    for (unsigned int i = 0; i < device_count; i++) {
+        struct net_device *dev = devices[i];
+        const struct net_stats *s = &dev->stats;
+        kprintf("\n%-4s %-10s ", dev->name, dev->driver);
+        print_mac(dev->mac);
+        print("  ");
+        print_ip(dev->ip);
+        kprintf("  %s", dev->model);
+        kprintf("\n  RX: %u packets, %llu bytes, %u dropped", s->rx_packets, s->rx_bytes, s->rx_dropped);
+        kprintf("\n  TX: %u packets, %llu bytes, %u dropped", s->tx_packets, s->tx_bytes, s->tx_dropped);
+        kprintf("\n  Interrupts: %u, polls: %u (%u used the whole budget)", s->interrupts, s->polls, s->busy_polls);
+    }
+    kprintf("\nBuffers: %u of %u free", net_buf_available(), NET_BUF_COUNT);
+    kprintf("\nStack: %u ARP replies, %u ICMP echo replies, %u UDP packets (%u to closed ports)",
+            proto_stats.arp_replies, proto_stats.icmp_replies, proto_stats.udp_packets, proto_stats.no_port);
+    kprintf("\n       %u bad headers, %u bad checksums, %u other", proto_stats.bad_headers,
+            proto_stats.bad_checksums, proto_stats.other);
+}
@@ -0,0 +1,90 @@
+#ifndef NET_H
+#define NET_H
+
+#include "spinlock.h"
+
+// Network devices and a minimal ARP/IPv4/UDP/ICMP stack.
+//
+// Packet buffers are 2 KB halves of preallocated pages. Drivers post them
+// straight into their receive rings and hand each filled one to the stack
+// as is; a reply is built in the same buffer and queued on the transmit
+// ring, so an echoed packet is never copied. The buffer goes back to the
+// pool when the transmit completes.
+//
+// Receive work is done NAPI style: a device interrupt only masks the
+// device's interrupts and wakes the "net" thread, which polls each
+// scheduled device for up to NET_POLL_BUDGET packets at a time. A device
+// that still has work stays scheduled and keeps being polled with its
+// interrupts off; one that ran dry gets them back. Under load this turns
+// one interrupt per packet into one per burst. Only the net thread runs
+// the stack, so it takes no locks.
+
+#define NET_BUF_SIZE 2048
+#define NET_BUF_COUNT 1024              // 2 MB
+#define NET_HEADROOM 64                 // before the frame, for driver headers
+#define NET_POLL_BUDGET 64
+#define NET_MAX_DEVICES 4
+#define NET_ETH_MTU 1500
+#define NET_BUSY -1
+
+// Static configuration for QEMU user networking (guest 10.0.2.15/24)
+#define NET_DEFAULT_IP 0x0F02000A       // 10.0.2.15, network byte order
+
+struct net_buf {
+    unsigned char *head;                // start of the 2 KB buffer
+    unsigned char *data;                // Ethernet header
+    unsigned int len;                   // frame length, no CRC
+    struct net_buf *next;               // free list
+};
+
+struct net_device;
+
+struct net_ops {
+    // Queue one frame (the device now owns buf) or return NET_BUSY
+    int (*transmit)(struct net_device *dev, struct net_buf *buf);
+    // Make queued frames visible to the device (one doorbell per batch)
+    void (*commit)(struct net_device *dev);
+    // Reclaim sent buffers, then pass up to 'budget' received frames to
+    // net_receive(); returns how many were received
+    int (*poll)(struct net_device *dev, int budget);
+    // Unmask interrupts; nonzero if work arrived meanwhile (poll again)
+    int (*irq_enable)(struct net_device *dev);
+};
+
+struct net_stats {
+    unsigned int rx_packets, tx_packets;
+    unsigned long long rx_bytes, tx_bytes;
+    unsigned int rx_dropped;            // no buffer to refill the ring with
+    unsigned int tx_dropped;            // transmit ring full
+    unsigned int interrupts;
+    unsigned int polls, busy_polls;     // busy: budget used up, still scheduled
+};
+
+struct net_device {
+    char name[8];
+    const char *driver;
+    char model[40];
+    unsigned char mac[6];
+    unsigned int ip;                    // network byte order
+    const struct net_ops *ops;
+    void *driver_data;
+    volatile int scheduled;
+    struct net_stats stats;
+};
+
+void net_init();                        // after pci_init and sched_init
+void net_register(struct net_device *dev);
+unsigned int net_device_count();
+struct net_device *net_get_device(unsigned int index);
+
+struct net_buf *net_buf_alloc();        // data at head + NET_HEADROOM; 0 if none
+void net_buf_free(struct net_buf *buf);
+unsigned int net_buf_available();
+
+// From a device's interrupt handler, with its interrupts masked
+void net_schedule(struct net_device *dev);
+
+// From a driver's poll(): the stack now owns buf
+void net_receive(struct net_device *dev, struct net_buf *buf);
+
+#endif
@@ -0,0 +1,326 @@
+#include "kernel.h"
+#include "spinlock.h"
+#include "pmm.h"
+#include "acpi.h"
+#include "pci.h"
+#include "paging.h"
+#include "cpufeature.h"
+#include "fbcon.h"
+
+#define LARGE_PAGE_SIZE 0x400000
+#define LARGE_PAGE_MASK (LARGE_PAGE_SIZE - 1)
+#define FOUR_GB 0x100000000ULL
+#define PAT_MSR 0x277
+
+// Bits paging_protect() may change; everything else in an entry is kept
+#define PROTECT_BITS (PAGE_WRITE | PAGE_USER | PAGE_CACHE_MASK)
+
+extern char _kernel_start[], _readonly_end[];  // link.ld
+extern char stack_guard[];                     // kernel.asm
+
+static unsigned int page_directory[1024] __attribute__((aligned(4096)));
+static struct paging_stats stats;
+static struct spinlock paging_lock = SPINLOCK_INIT;
+
+// Bumped by every change that can leave a stale TLB entry. Only the CPU
+// making the change flushes at once; the others catch up in
+// paging_tlb_sync() on their next timer tick, or on leaving idle if their
+// tick has stopped. Nothing removes a mapping that another
+// CPU is still using, so the delay only postpones enforcement (a new
+// guard page, say), never exposes freed memory.
+static volatile unsigned int tlb_generation = 0;
+
+// ============================================================================
+// TABLE MANAGEMENT
+// ============================================================================
+
+static inline void invlpg(unsigned int addr) {
+    asm volatile("invlpg (%0)" : : "r"(addr) : "memory");
+    tlb_generation++;
+}
+
+static inline void flush_tlb() {
+    unsigned int cr3;
+    asm volatile("mov %%cr3, %0\n\tmov %0, %%cr3" : "=r"(cr3) : : "memory");
+    tlb_generation++;
+}
+
+// Page tables come from the frame allocator; all RAM is identity-mapped,
+// so a table's physical address is also where the kernel edits it.
+static unsigned int *new_table() {
+    unsigned int *table = (unsigned int *)pmm_alloc_frame();
+    if (!table) return 0;
+    zero_page(table);
+    stats.page_tables++;
+    return table;
+}
+
+// Replace a 4 MB page by a table of 1024 small pages with the same flags
+static unsigned int *split_large(unsigned int *pde) {
+    unsigned int *table = new_table();
+    if (!table) return 0;
+    unsigned int base = *pde & ~LARGE_PAGE_MASK, flags = *pde & PROTECT_BITS;
+    for (unsigned int i = 0; i < 1024; i++) table[i] = (base + (i << 12)) | flags | PAGE_PRESENT;
+    *pde = (unsigned int)table | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
+    stats.large_pages--;
+    flush_tlb();
+    return table;
+}
+
+// Directory entries for tables allow everything; the table entries decide
+static unsigned int *get_table(unsigned int virt, int create) {
+    unsigned int *pde = &page_directory[virt >> 22];
+    if (*pde & PAGE_PRESENT) {
+        if (!(*pde & PAGE_LARGE)) return (unsigned int *)(*pde & ~0xFFF);
+        return create ? split_large(pde) : 0;
+    }
+    if (!create) return 0;
+    unsigned int *table = new_table();
+    if (table) *pde = (unsigned int)table | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
+    return table;
+}
+
+static int set_pte(unsigned int virt, unsigned int value) {
+    unsigned int *table = get_table(virt, 1);
+    if (!table) return 0;
+    table[(virt >> 12) & 1023] = value;
+    invlpg(virt);
+    return 1;
+}
+
+// Map [base, end) onto itself, leaving anything already mapped alone.
+// Whole 4 MB blocks become large pages when 'large' is set and PSE exists.
+static int identity_map(unsigned long long base, unsigned long long end, unsigned int flags, int large) {
+    unsigned long long addr = base & ~0xFFFULL;
+    if (end > FOUR_GB) end = FOUR_GB;
+    while (addr < end) {
+        unsigned int *pde = &page_directory[addr >> 22];
+        if (!(*pde & PAGE_PRESENT) && large && stats.pse && !(addr & LARGE_PAGE_MASK) && end - addr >= LARGE_PAGE_SIZE) {
+            *pde = (unsigned int)addr | flags | PAGE_LARGE | PAGE_PRESENT;
+            stats.large_pages++;
+            invlpg(addr);
+            addr += LARGE_PAGE_SIZE;
+            continue;
+        }
+        if ((*pde & PAGE_PRESENT) && (*pde & PAGE_LARGE)) {
+            addr = (addr | LARGE_PAGE_MASK) + 1;
+            continue;
+        }
+        unsigned int *table = get_table(addr, 1);
+        if (!table) return 0;
+        unsigned int *pte = &table[(addr >> 12) & 1023];
+        if (!(*pte & (PAGE_PRESENT | PAGE_GUARD))) {
+            *pte = (unsigned int)addr | flags | PAGE_PRESENT;
+            invlpg(addr);
+        }
+        addr += PAGE_SIZE;
+    }
+    return 1;
+}
+
+// ============================================================================
+// PUBLIC MAPPING API
+// ============================================================================
+
+// The public calls below take paging_lock; the static helpers above
+// expect it held.
+
+int paging_map(unsigned int virt, unsigned int phys, unsigned int flags) {
+    unsigned int irq = spin_lock_irqsave(&paging_lock);
+    int ok = set_pte(virt, (phys & ~0xFFF) | (flags & 0xFFF & ~PAGE_LARGE) | PAGE_PRESENT);
+    spin_unlock_irqrestore(&paging_lock, irq);
+    return ok;
+}
+
+int paging_unmap(unsigned int virt) {
+    unsigned int irq = spin_lock_irqsave(&paging_lock);
+    int ok = !(page_directory[virt >> 22] & PAGE_PRESENT) || set_pte(virt, 0);
+    spin_unlock_irqrestore(&paging_lock, irq);
+    return ok;
+}
+
+static int protect_range(unsigned int virt, unsigned int size, unsigned int flags) {
+    unsigned long long addr = virt & ~0xFFF, end = (unsigned long long)virt + size;
+    flags &= PROTECT_BITS;
+    while (addr < end) {
+        unsigned int *pde = &page_directory[addr >> 22];
+        if (!(*pde & PAGE_PRESENT)) {
+            addr = (addr | LARGE_PAGE_MASK) + 1;
+            continue;
+        }
+        if (*pde & PAGE_LARGE) {
+            // Leave a large page whole when it already has the right bits
+            // or the range covers all of it
+            int whole = !(addr & LARGE_PAGE_MASK) && end - addr >= LARGE_PAGE_SIZE;
+            if ((*pde & PROTECT_BITS) == flags || whole) {
+                *pde = (*pde & ~PROTECT_BITS) | flags;
+                invlpg(addr);
+                addr = (addr | LARGE_PAGE_MASK) + 1;
+                continue;
+            }
+        }
+        unsigned int *table = get_table(addr, 1);
+        if (!table) return 0;
+        unsigned int *pte = &table[(addr >> 12) & 1023];
+        if (*pte & PAGE_PRESENT) {
+            *pte = (*pte & ~PROTECT_BITS) | flags;
+            invlpg(addr);
+        }
+        addr += PAGE_SIZE;
+    }
+    return 1;
+}
+
+int paging_protect(unsigned int virt, unsigned int size, unsigned int flags) {
+    unsigned int irq = spin_lock_irqsave(&paging_lock);
+    int ok = protect_range(virt, size, flags);
+    spin_unlock_irqrestore(&paging_lock, irq);
+    return ok;
+}
+
+int paging_translate(unsigned int virt, unsigned int *phys) {
+    unsigned int pde = page_directory[virt >> 22];
+    if (!(pde & PAGE_PRESENT)) return 0;
+    if (pde & PAGE_LARGE) {
+        *phys = (pde & ~LARGE_PAGE_MASK) | (virt & LARGE_PAGE_MASK);
+        return 1;
+    }
+    unsigned int pte = ((unsigned int *)(pde & ~0xFFF))[(virt >> 12) & 1023];
+    if (!(pte & PAGE_PRESENT)) return 0;
+    *phys = (pte & ~0xFFF) | (virt & 0xFFF);
+    return 1;
+}
+
+int paging_is_guard(unsigned int virt) {
+    unsigned int pde = page_directory[virt >> 22];
+    if (!(pde & PAGE_PRESENT) || (pde & PAGE_LARGE)) return 0;
+    unsigned int pte = ((unsigned int *)(pde & ~0xFFF))[(virt >> 12) & 1023];
+    return !(pte & PAGE_PRESENT) && (pte & PAGE_GUARD);
+}
+
+void *paging_map_identity(unsigned int phys, unsigned int size, unsigned int cache) {
+    unsigned int flags = PAGE_WRITE | (cache & PAGE_CACHE_MASK);
+    unsigned int irq = spin_lock_irqsave(&paging_lock);
+    int ok = identity_map(phys, (unsigned long long)phys + size, flags, 1) && protect_range(phys, size, flags);
+    spin_unlock_irqrestore(&paging_lock, irq);
+    return ok ? (void *)phys : 0;
+}
+
+// ============================================================================
+// KERNEL STACKS
+// ============================================================================
+
+unsigned int kstack_alloc(unsigned int pages) {
+    unsigned int flags = spin_lock_irqsave(&paging_lock);
+    unsigned int base = pmm_alloc_frames(pages + 1);
+    if (base && !set_pte(base, PAGE_GUARD)) {
+        pmm_free_frames(base, pages + 1);
+        base = 0;
+    }
+    if (base) stats.guard_pages++;
+    spin_unlock_irqrestore(&paging_lock, flags);
+    return base ? base + (pages + 1) * PAGE_SIZE : 0;
+}
+
+void kstack_free(unsigned int top, unsigned int pages) {
+    unsigned int base = top - (pages + 1) * PAGE_SIZE;
+    unsigned int flags = spin_lock_irqsave(&paging_lock);
+    set_pte(base, base | PAGE_WRITE | PAGE_PRESENT);
+    stats.guard_pages--;
+    pmm_free_frames(base, pages + 1);
+    spin_unlock_irqrestore(&paging_lock, flags);
+}
+
+// ============================================================================
+// INITIALIZATION
+// ============================================================================
+
+// Power-on PAT is WB, WT, UC-, UC repeated. Entry 1 (PWT set, PCD clear)
+// becomes write-combining; nothing uses write-through.
+static void pat_init() {
+    unsigned int lo, hi;
+    asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(PAT_MSR));
+    lo = (lo & ~0xFF00) | (0x01 << 8);
+    asm volatile("wrmsr" : : "a"(lo), "d"(hi), "c"(PAT_MSR));
+}
+
+static unsigned int saved_cr4 = 0;
+
+static int is_ram(unsigned int type) {
+    return type == MULTIBOOT_MEMORY_AVAILABLE || type == MULTIBOOT_MEMORY_ACPI || type == MULTIBOOT_MEMORY_NVS;
+}
+
+void paging_init() {
+    stats.pse = cpu_has(CPU_FEATURE_PSE);
+    stats.pat = cpu_has(CPU_FEATURE_PAT);
+    if (stats.pat) pat_init();
+
+    // First 4 MB in small pages so it can be carved up below
+    identity_map(0, LARGE_PAGE_SIZE, PAGE_WRITE, 0);
+
+    // RAM write-back, rounded out to whole large pages; then whatever the
+    // firmware reserved, uncached and exact. Inside a write-back page the
+    // MTRRs still keep device ranges uncached, so rounding is safe.
+    struct pmm_stats pmm;
+    pmm_get_stats(&pmm);
+    for (int pass = 0; pass < 2; pass++) {
+        for (unsigned int i = 0; i < pmm.region_count; i++) {
+            const struct pmm_region *r = &pmm.regions[i];
+            if (r->type == MULTIBOOT_MEMORY_BADRAM || is_ram(r->type) != !pass || r->base >= FOUR_GB) continue;
+            unsigned long long base = r->base, end = r->base + r->length;
+            if (!pass) {
+                base &= ~(unsigned long long)LARGE_PAGE_MASK;
+                end = (end + LARGE_PAGE_MASK) & ~(unsigned long long)LARGE_PAGE_MASK;
+            }
+            identity_map(base, end, PAGE_WRITE | (pass ? PAGE_CACHE_UC : PAGE_CACHE_WB), 1);
+        }
+    }
+
+    acpi_map_tables();
+    if (pci_using_ecam()) paging_map_identity(pci_ecam_base(), pci_ecam_size(), PAGE_CACHE_UC);
+    fbcon_map();
+
+    paging_unmap(0);                                            // null pointers fault
+    paging_protect(0xA0000, 0x20000, PAGE_WRITE | PAGE_CACHE_WC);   // VGA memory
+    paging_protect((unsigned int)_kernel_start, _readonly_end - _kernel_start, PAGE_CACHE_WB);
+    set_pte((unsigned int)stack_guard, PAGE_GUARD);
+    stats.guard_pages++;
+
+    // CR4.PSE, then CR0.PG with CR0.WP so read-only pages bind the kernel too
+    asm volatile("mov %0, %%cr3" : : "r"(page_directory) : "memory");
+    if (stats.pse) {
+        asm volatile("mov %%cr4, %0" : "=r"(saved_cr4));
+        saved_cr4 |= 0x10;
+        asm volatile("mov %0, %%cr4" : : "r"(saved_cr4));
+    }
+    unsigned int cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    asm volatile("mov %0, %%cr0" : : "r"(cr0 | 0x80010000) : "memory");
+    stats.enabled = 1;
+
+    interrupts_set_fault_cr3((unsigned int)page_directory);
+}
+
+// Application processors arrive with CR3/CR4 already loaded by the SMP
+// trampoline (paging_boot_state); PAT is per-CPU and needs the same
+// write-combining entry as the boot CPU.
+void paging_init_ap() {
+    if (stats.pat) pat_init();
+}
+
+void paging_boot_state(unsigned int *cr3, unsigned int *cr4) {
+    *cr3 = (unsigned int)page_directory;
+    *cr4 = saved_cr4;
+}
+
+void paging_tlb_sync(unsigned int *seen) {
+    unsigned int generation = tlb_generation;
+    if (*seen == generation) return;
+    unsigned int cr3;
+    asm volatile("mov %%cr3, %0\n\tmov %0, %%cr3" : "=r"(cr3) : : "memory");
+    *seen = generation;
+}
+
+void paging_get_stats(struct paging_stats *out) {
+    *out = stats;
+}
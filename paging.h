@@ -0,0 +1,67 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+// 32-bit paging (no PAE). Every region in the memory map is identity-
+// mapped, with 4 MB pages where the CPU has PSE. The first 4 MB use a
+// 4 KB table so that page 0 can stay unmapped, VGA memory can be
+// write-combining and the kernel image can be read-only. The map/unmap
+// calls take any virtual address, so windows outside the identity range
+// (a higher-half kernel, per-thread mappings) use the same code.
+
+#define PAGE_PRESENT  0x001
+#define PAGE_WRITE    0x002
+#define PAGE_USER     0x004
+#define PAGE_PWT      0x008
+#define PAGE_PCD      0x010
+#define PAGE_LARGE    0x080             // 4 MB page (directory entries only)
+#define PAGE_GUARD    0x200             // software bit on a non-present guard page
+
+// Memory types. paging_init reprograms PAT entry 1 from write-through to
+// write-combining, so these only need the PWT/PCD bits.
+#define PAGE_CACHE_WB 0
+#define PAGE_CACHE_WC PAGE_PWT
+#define PAGE_CACHE_UC (PAGE_PWT | PAGE_PCD)
+#define PAGE_CACHE_MASK (PAGE_PWT | PAGE_PCD)
+
+void paging_init();
+
+// SMP: page directory and CR4 for the AP trampoline, per-CPU setup once an
+// AP runs with paging on, and the lazy cross-CPU TLB flush ('seen' is the
+// caller's per-CPU generation; called from the timer tick and when a
+// CPU leaves idle)
+void paging_boot_state(unsigned int *cr3, unsigned int *cr4);
+void paging_init_ap();
+void paging_tlb_sync(unsigned int *seen);
+
+// 4 KB mappings; a 4 MB page in the way is split first. Return 0 when out
+// of memory for a page table.
+int paging_map(unsigned int virt, unsigned int phys, unsigned int flags);
+int paging_unmap(unsigned int virt);
+
+// Replace the PAGE_WRITE/PAGE_USER/cache bits on every page in the range
+int paging_protect(unsigned int virt, unsigned int size, unsigned int flags);
+
+// Returns 0 if 'virt' is not mapped
+int paging_translate(unsigned int virt, unsigned int *phys);
+
+// Identity-map device memory or firmware tables with the given
+// PAGE_CACHE_* type, overriding the type of any existing mapping
+void *paging_map_identity(unsigned int phys, unsigned int size, unsigned int cache);
+
+// Kernel stacks with an unmapped guard page below the lowest stack page.
+// Returns the initial stack pointer (top of the stack), or 0.
+unsigned int kstack_alloc(unsigned int pages);
+void kstack_free(unsigned int top, unsigned int pages);
+
+int paging_is_guard(unsigned int virt);
+
+struct paging_stats {
+    int enabled, pse, pat;
+    unsigned int large_pages;           // 4 MB directory entries
+    unsigned int page_tables;
+    unsigned int guard_pages;
+};
+
+void paging_get_stats(struct paging_stats *stats);
+
+#endif
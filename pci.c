@@ -0,0 +1,288 @@
+#include "kernel.h"
+#include "spinlock.h"
+#include "heap.h"
+#include "acpi.h"
+#include "pci.h"
+#include "trace.h"
+
+static unsigned int ecam_base = 0;      // 0 when using port I/O
+static unsigned char ecam_start_bus = 0, ecam_end_bus = 0;
+
+static struct pci_device *device_list = 0, *device_tail = 0;
+static struct pci_device **device_table = 0;
+static unsigned int device_count = 0;
+static unsigned int scanned_buses[256 / 32];
+static struct spinlock config_lock = SPINLOCK_INIT;
+
+// ============================================================================
+// CONFIGURATION SPACE ACCESS
+// ============================================================================
+
+// ECAM: each function has a 4 KB window at base + (bus << 20 | dev << 15 | func << 12)
+static inline volatile unsigned int *ecam_address(unsigned char bus, unsigned char device, unsigned char func, unsigned short offset) {
+    return (volatile unsigned int *)(ecam_base + ((unsigned int)(bus - ecam_start_bus) << 20) +
+                                     ((unsigned int)device << 15) + ((unsigned int)func << 12) + (offset & 0xFFC));
+}
+
+static inline int ecam_covers(unsigned char bus) {
+    return ecam_base && bus >= ecam_start_bus && bus <= ecam_end_bus;
+}
+
+// Configuration mechanism #1: one dword write selects bus/device/function/
+// register at 0xCF8, one dword read or write at 0xCFC moves the data.
+// The pair must not be split by another CPU or a thread switch, so it
+// runs under config_lock.
+static inline unsigned int legacy_address(unsigned char bus, unsigned char device, unsigned char func, unsigned short offset) {
+    return (((unsigned int)bus) << 16) | (((unsigned int)device) << 11) |
+           (((unsigned int)func) << 8) | (offset & 0xFC) | 0x80000000;
+}
+
+// The trace argument is the ECAM-style address: bus, device, function, offset
+unsigned int pci_config_read(unsigned char bus, unsigned char device, unsigned char func, unsigned short offset) {
+    unsigned long long t = trace_begin();
+    unsigned int value;
+    if (ecam_covers(bus)) value = *ecam_address(bus, device, func, offset);
+    else if (offset > 0xFF) value = 0xFFFFFFFF;
+    else {
+        unsigned int flags = spin_lock_irqsave(&config_lock);
+        outl(0xCF8, legacy_address(bus, device, func, offset));
+        value = inl(0xCFC);
+        spin_unlock_irqrestore(&config_lock, flags);
+    }
+    trace_end("pci_config_read", ((unsigned int)bus << 20) | ((unsigned int)device << 15) | ((unsigned int)func << 12) | offset, t);
+    return value;
+}
+
+void pci_config_write(unsigned char bus, unsigned char device, unsigned char func, unsigned short offset, unsigned int value) {
+    if (ecam_covers(bus)) {
+        *ecam_address(bus, device, func, offset) = value;
+        return;
+    }
+    if (offset > 0xFF) return;
+    unsigned int flags = spin_lock_irqsave(&config_lock);
+    outl(0xCF8, legacy_address(bus, device, func, offset));
+    outl(0xCFC, value);
+    spin_unlock_irqrestore(&config_lock, flags);
+}
+
+unsigned int pci_read(const struct pci_device *dev, unsigned short offset) {
+    return pci_config_read(dev->bus, dev->device, dev->func, offset);
+}
+
+void pci_write(const struct pci_device *dev, unsigned short offset, unsigned int value) {
+    pci_config_write(dev->bus, dev->device, dev->func, offset, value);
+}
+
+// ============================================================================
+// FUNCTION PROBING
+// ============================================================================
+
+// Size each BAR by writing all ones and reading back the address mask.
+// Decoding is switched off meanwhile so the device never claims a bogus range.
+static void probe_bars(struct pci_device *dev, int count) {
+    unsigned int command = pci_read(dev, PCI_COMMAND) & 0xFFFF;     // status bits are write-1-to-clear
+    pci_write(dev, PCI_COMMAND, command & ~(PCI_COMMAND_IO | PCI_COMMAND_MEMORY));
+
+    for (int i = 0; i < count; i++) {
+        unsigned short offset = PCI_BAR0 + i * 4;
+        struct pci_bar *bar = &dev->bars[i];
+        unsigned int original = pci_read(dev, offset);
+        pci_write(dev, offset, 0xFFFFFFFF);
+        unsigned int mask = pci_read(dev, offset);
+        pci_write(dev, offset, original);
+        if (!mask) continue;
+
+        if (original & 1) {
+            unsigned int io_mask = mask & ~3;
+            if (!(io_mask >> 16)) io_mask |= 0xFFFF0000;    // 16-bit I/O decoders
+            bar->is_io = 1;
+            bar->base = original & ~3;
+            bar->size = ~io_mask + 1;
+            continue;
+        }
+
+        bar->prefetchable = (original >> 3) & 1;
+        bar->base = original & ~0xF;
+        bar->size = (mask & ~0xF) ? ~(mask & ~0xF) + 1 : 0;
+        if (((original >> 1) & 3) == 2 && i + 1 < count) {
+            // 64-bit BAR: the upper half lives in the next slot
+            unsigned int original_high = pci_read(dev, offset + 4);
+            bar->is_64bit = 1;
+            if (original_high) bar->base = 0;                // not reachable without PAE
+            i++;
+        }
+    }
+    pci_write(dev, PCI_COMMAND, command);
+}
+
+static void probe_capabilities(struct pci_device *dev) {
+    if (!((pci_read(dev, PCI_COMMAND) >> 16) & 0x10)) return;     // status: capability list
+
+    unsigned char pointer = pci_read(dev, PCI_CAP_POINTER) & 0xFC;
+    for (int guard = 0; pointer && guard < 48; guard++) {
+        unsigned int header = pci_read(dev, pointer);
+        unsigned char id = header & 0xFF;
+        if (id < 32) dev->cap_mask |= 1u << id;
+        dev->cap_count++;
+        pointer = (header >> 8) & 0xFC;
+    }
+}
+
+static void scan_bus(unsigned char bus, struct pci_device *parent);
+
+static void scan_function(unsigned char bus, unsigned char device, unsigned char func, struct pci_device *parent) {
+    unsigned int id = pci_config_read(bus, device, func, 0);
+    if ((id & 0xFFFF) == 0xFFFF || !id) return;
+
+    struct pci_device *dev = boot_alloc(sizeof(struct pci_device));
+    if (!dev) return;
+    memset(dev, 0, sizeof(*dev));
+
+    dev->bus = bus;
+    dev->device = device;
+    dev->func = func;
+    dev->vendor_id = id & 0xFFFF;
+    dev->device_id = id >> 16;
+    unsigned int class_reg = pci_read(dev, 0x08);
+    dev->revision = class_reg & 0xFF;
+    dev->prog_if = (class_reg >> 8) & 0xFF;
+    dev->subclass = (class_reg >> 16) & 0xFF;
+    dev->class_code = class_reg >> 24;
+    dev->header_type = (pci_read(dev, 0x0C) >> 16) & 0x7F;
+    unsigned int interrupt = pci_read(dev, PCI_INTERRUPT);
+    dev->irq_line = interrupt & 0xFF;
+    dev->irq_pin = (interrupt >> 8) & 0xFF;
+    dev->parent = parent;
+
+    if (dev->header_type == 0) probe_bars(dev, 6);
+    else if (dev->header_type == 1) probe_bars(dev, 2);
+    probe_capabilities(dev);
+
+    if (device_tail) device_tail->next = dev;
+    else device_list = dev;
+    device_tail = dev;
+    device_count++;
+
+    // PCI-to-PCI bridge: descend into the secondary bus the firmware assigned
+    if (dev->header_type == 1) {
+        dev->secondary_bus = (pci_read(dev, 0x18) >> 8) & 0xFF;
+        if (dev->secondary_bus) scan_bus(dev->secondary_bus, dev);
+    }
+}
+
+static void scan_bus(unsigned char bus, struct pci_device *parent) {
+    if (scanned_buses[bus >> 5] & (1u << (bus & 31))) return;
+    scanned_buses[bus >> 5] |= 1u << (bus & 31);
+
+    for (unsigned char device = 0; device < 32; device++) {
+        unsigned int id = pci_config_read(bus, device, 0, 0);
+        if ((id & 0xFFFF) == 0xFFFF || !id) continue;
+
+        scan_function(bus, device, 0, parent);
+        if (!((pci_config_read(bus, device, 0, 0x0C) >> 16) & 0x80)) continue;
+        for (unsigned char func = 1; func < 8; func++) scan_function(bus, device, func, parent);
+    }
+}
+
+// ============================================================================
+// INITIALIZATION
+// ============================================================================
+
+static void ecam_init() {
+    struct acpi_mcfg *mcfg = (struct acpi_mcfg *)acpi_find_table("MCFG");
+    if (!mcfg) return;
+
+    unsigned int count = (mcfg->header.length - sizeof(struct acpi_mcfg)) / sizeof(struct acpi_mcfg_entry);
+    for (unsigned int i = 0; i < count; i++) {
+        struct acpi_mcfg_entry *entry = &mcfg->entries[i];
+        if (entry->segment != 0 || (entry->base >> 32)) continue;
+        ecam_base = (unsigned int)entry->base;
+        ecam_start_bus = entry->start_bus;
+        ecam_end_bus = entry->end_bus;
+        return;
+    }
+}
+
+void pci_init() {
+    ecam_init();
+
+    // A multi-function host bridge at 00:00.0 means one root bus per function
+    unsigned int header = pci_config_read(0, 0, 0, 0x0C);
+    if ((header >> 16) & 0x80) {
+        for (unsigned char func = 0; func < 8; func++) {
+            unsigned int id = pci_config_read(0, 0, func, 0);
+            if ((id & 0xFFFF) != 0xFFFF) scan_bus(func, 0);
+        }
+    } else {
+        scan_bus(0, 0);
+    }
+
+    if (!device_count) return;
+    device_table = boot_alloc(device_count * sizeof(struct pci_device *));
+    if (!device_table) return;
+    unsigned int i = 0;
+    for (struct pci_device *dev = device_list; dev; dev = dev->next) device_table[i++] = dev;
+}
+
+// ============================================================================
+// DEVICE TABLE QUERIES
+// ============================================================================
+
+unsigned int pci_device_count() {
+    return device_table ? device_count : 0;
+}
+
+struct pci_device *pci_get_device(unsigned int index) {
+    return (device_table && index < device_count) ? device_table[index] : 0;
+}
+
+struct pci_device *pci_find_device(unsigned short vendor_id, unsigned short device_id) {
+    for (struct pci_device *dev = device_list; dev; dev = dev->next)
+        if (dev->vendor_id == vendor_id && dev->device_id == device_id) return dev;
+    return 0;
+}
+
+// Pass the previous match as 'from' to continue the search after it
+struct pci_device *pci_find_class(unsigned char class_code, unsigned char subclass, struct pci_device *from) {
+    for (struct pci_device *dev = from ? from->next : device_list; dev; dev = dev->next)
+        if (dev->class_code == class_code && dev->subclass == subclass) return dev;
+    return 0;
+}
+
+unsigned char pci_find_capability(const struct pci_device *dev, unsigned char cap_id) {
+    if (cap_id >= 32 || !(dev->cap_mask & (1u << cap_id))) return 0;
+    unsigned char pointer = pci_read(dev, PCI_CAP_POINTER) & 0xFC;
+    for (int guard = 0; pointer && guard < 48; guard++) {
+        unsigned int header = pci_read(dev, pointer);
+        if ((header & 0xFF) == cap_id) return pointer;
+        pointer = (header >> 8) & 0xFC;
+    }
+    return 0;
+}
+
+void pci_enable(const struct pci_device *dev, unsigned int command_bits) {
+    unsigned int command = pci_read(dev, PCI_COMMAND) & 0xFFFF;
+    pci_write(dev, PCI_COMMAND, command | command_bits);
+}
+
+const char *pci_class_name(unsigned char class_code) {
+    static const char *names[] = {
+        "Unclassified", "Mass Storage", "Network", "Display", "Multimedia",
+        "Memory", "Bridge", "Communication", "System Peripheral", "Input",
+        "Docking Station", "Processor", "Serial Bus", "Wireless", "Intelligent I/O",
+        "Satellite", "Encryption", "Signal Processing"
+    };
+    return class_code < sizeof(names) / sizeof(names[0]) ? names[class_code] : "Other";
+}
+
+int pci_using_ecam() {
+    return ecam_base != 0;
+}
+
+unsigned int pci_ecam_base() {
+    return ecam_base;
+}
+
+unsigned int pci_ecam_size() {
+    return ecam_base ? (unsigned int)(ecam_end_bus - ecam_start_bus + 1) << 20 : 0;
+}
@@ -0,0 +1,76 @@
+#ifndef PCI_H
+#define PCI_H
+
+// PCI subsystem. The whole bus tree is walked once at boot (every
+// function, descending through PCI-to-PCI bridges) and the results are
+// kept in a device table that commands and drivers query without I/O.
+// Configuration space goes through ECAM when ACPI provides an MCFG table
+// and through ports 0xCF8/0xCFC otherwise.
+
+#define PCI_MAX_BARS 6
+
+// Configuration space offsets
+#define PCI_COMMAND       0x04
+#define PCI_STATUS        0x06
+#define PCI_BAR0          0x10
+#define PCI_CAP_POINTER   0x34
+#define PCI_INTERRUPT     0x3C
+
+#define PCI_COMMAND_IO         (1 << 0)
+#define PCI_COMMAND_MEMORY     (1 << 1)
+#define PCI_COMMAND_BUS_MASTER (1 << 2)
+
+// Capability IDs
+#define PCI_CAP_PM     0x01
+#define PCI_CAP_MSI    0x05
+#define PCI_CAP_VENDOR 0x09
+#define PCI_CAP_PCIE   0x10
+#define PCI_CAP_MSIX   0x11
+
+struct pci_bar {
+    unsigned int base;                  // 0 when unimplemented or above 4 GB
+    unsigned int size;
+    unsigned char is_io;
+    unsigned char is_64bit;
+    unsigned char prefetchable;
+};
+
+struct pci_device {
+    unsigned char bus, device, func;
+    unsigned char header_type;          // 0 = endpoint, 1 = PCI bridge, 2 = CardBus
+    unsigned short vendor_id, device_id;
+    unsigned char class_code, subclass, prog_if, revision;
+    unsigned char irq_line, irq_pin;
+    unsigned char secondary_bus;        // bridges only
+    unsigned char cap_count;
+    unsigned int cap_mask;              // bit n set if capability ID n (< 32) is present
+    struct pci_bar bars[PCI_MAX_BARS];
+    struct pci_device *parent;          // upstream bridge, 0 on the root bus
+    struct pci_device *next;
+};
+
+void pci_init();
+
+unsigned int pci_config_read(unsigned char bus, unsigned char device, unsigned char func, unsigned short offset);
+void pci_config_write(unsigned char bus, unsigned char device, unsigned char func, unsigned short offset, unsigned int value);
+
+// Device table
+unsigned int pci_device_count();
+struct pci_device *pci_get_device(unsigned int index);
+struct pci_device *pci_find_device(unsigned short vendor_id, unsigned short device_id);
+struct pci_device *pci_find_class(unsigned char class_code, unsigned char subclass, struct pci_device *from);
+
+// Per-device helpers
+unsigned int pci_read(const struct pci_device *dev, unsigned short offset);
+void pci_write(const struct pci_device *dev, unsigned short offset, unsigned int value);
+unsigned char pci_find_capability(const struct pci_device *dev, unsigned char cap_id);
+void pci_enable(const struct pci_device *dev, unsigned int command_bits);
+
+const char *pci_class_name(unsigned char class_code);
+
+// Configuration access method in use
+int pci_using_ecam();
+unsigned int pci_ecam_base();
+unsigned int pci_ecam_size();
+
+#endif
@@ -0,0 +1,253 @@
+#include "kernel.h"
+#include "spinlock.h"
+#include "pmm.h"
+
+// Linker-provided bounds of the kernel image (link.ld)
+extern char _kernel_start[], _kernel_end[];
+
+static struct pmm_region regions[PMM_MAX_REGIONS];
+static unsigned int region_count = 0;
+
+static unsigned int *frame_bitmap;
+static unsigned int bitmap_words;
+static unsigned int max_frame;          // one past the highest usable frame
+static unsigned int search_hint;        // first bitmap word that may have a free bit
+
+static unsigned int total_frames, free_frames, reserved_frames;
+static struct spinlock pmm_lock = SPINLOCK_INIT;
+
+// Recently freed / pre-claimed frames. Their bitmap bits stay set so the
+// bitmap scan never hands them out twice; free_frames still counts them.
+#define FRAME_CACHE_SIZE 64
+static unsigned int frame_cache[FRAME_CACHE_SIZE];
+static unsigned int frame_cache_count = 0;
+
+#define FRAME_BIT(f) (1u << ((f) & 31))
+
+// ============================================================================
+// MEMORY MAP PARSING
+// ============================================================================
+
+static void add_region(unsigned long long base, unsigned long long length, unsigned int type) {
+    if (region_count == PMM_MAX_REGIONS || !length) return;
+    regions[region_count].base = base;
+    regions[region_count].length = length;
+    regions[region_count].type = type;
+    region_count++;
+}
+
+static int parse_memory_map(unsigned int magic, struct multiboot_info *mbi) {
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC) return 0;
+
+    if (mbi->flags & MULTIBOOT_INFO_MMAP) {
+        unsigned int addr = mbi->mmap_addr;
+        while (addr < mbi->mmap_addr + mbi->mmap_length) {
+            struct multiboot_mmap_entry *entry = (struct multiboot_mmap_entry *)addr;
+            add_region(entry->addr, entry->len, entry->type);
+            addr += entry->size + 4;
+        }
+        return 1;
+    }
+    if (mbi->flags & MULTIBOOT_INFO_MEMORY) {
+        add_region(0, mbi->mem_lower * 1024ULL, MULTIBOOT_MEMORY_AVAILABLE);
+        add_region(0x100000, mbi->mem_upper * 1024ULL, MULTIBOOT_MEMORY_AVAILABLE);
+        return 1;
+    }
+    return 0;
+}
+
+// Usable part of a region below 4 GB, shrunk inward to whole frames
+static int region_frames(const struct pmm_region *r, unsigned int *first, unsigned int *end) {
+    if (r->type != MULTIBOOT_MEMORY_AVAILABLE || r->base >= 0x100000000ULL) return 0;
+    unsigned long long top = r->base + r->length;
+    if (top > 0x100000000ULL) top = 0x100000000ULL;
+    *first = (unsigned int)((r->base + PAGE_SIZE - 1) >> PAGE_SHIFT);
+    *end = (unsigned int)(top >> PAGE_SHIFT);
+    return *end > *first;
+}
+
+// ============================================================================
+// BITMAP HELPERS
+// ============================================================================
+
+static void release_frames(unsigned int first, unsigned int end) {
+    for (unsigned int f = first; f < end; f++) {
+        if (frame_bitmap[f >> 5] & FRAME_BIT(f)) {
+            frame_bitmap[f >> 5] &= ~FRAME_BIT(f);
+            free_frames++;
+        }
+    }
+}
+
+// Mark [start, end) in use; only frames that were free count as reserved
+static void reserve_range(unsigned int start, unsigned int end) {
+    unsigned int first = start >> PAGE_SHIFT;
+    unsigned int last = (end + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    if (last > max_frame) last = max_frame;
+    for (unsigned int f = first; f < last; f++) {
+        if (!(frame_bitmap[f >> 5] & FRAME_BIT(f))) {
+            frame_bitmap[f >> 5] |= FRAME_BIT(f);
+            free_frames--;
+            reserved_frames++;
+        }
+    }
+}
+
+// Pull up to FRAME_CACHE_SIZE free frames out of the first bitmap word
+// that has any, starting at the search hint.
+static int refill_cache() {
+    for (unsigned int n = 0; n < bitmap_words; n++) {
+        unsigned int w = search_hint + n;
+        if (w >= bitmap_words) w -= bitmap_words;
+        unsigned int free_bits = ~frame_bitmap[w];
+        if (!free_bits) continue;
+
+        search_hint = w;
+        while (free_bits && frame_cache_count < FRAME_CACHE_SIZE) {
+            unsigned int bit = __builtin_ctz(free_bits);
+            free_bits &= free_bits - 1;
+            frame_bitmap[w] |= 1u << bit;
+            frame_cache[frame_cache_count++] = w * 32 + bit;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// ============================================================================
+// INITIALIZATION
+// ============================================================================
+
+int pmm_init(unsigned int magic, struct multiboot_info *mbi) {
+    int from_firmware = parse_memory_map(magic, mbi);
+    if (!from_firmware) add_region(0x100000, 15 * 0x100000, MULTIBOOT_MEMORY_AVAILABLE);
+
+    // Everything the bootloader handed us must survive: the kernel image,
+    // the info structure, the memory map and any modules with their
+    // command lines (initrd names files after them).
+    unsigned int placement = (unsigned int)_kernel_end;
+    if (from_firmware) {
+        if ((unsigned int)mbi + sizeof(*mbi) > placement) placement = (unsigned int)mbi + sizeof(*mbi);
+        if ((mbi->flags & MULTIBOOT_INFO_MMAP) && mbi->mmap_addr + mbi->mmap_length > placement)
+            placement = mbi->mmap_addr + mbi->mmap_length;
+        if (mbi->flags & MULTIBOOT_INFO_MODS) {
+            struct multiboot_module *mods = (struct multiboot_module *)mbi->mods_addr;
+            if (mbi->mods_addr + mbi->mods_count * sizeof(*mods) > placement)
+                placement = mbi->mods_addr + mbi->mods_count * sizeof(*mods);
+            for (unsigned int i = 0; i < mbi->mods_count; i++) {
+                if (mods[i].mod_end > placement) placement = mods[i].mod_end;
+                unsigned int cmdline_end = mods[i].cmdline ? mods[i].cmdline + strlen((const char *)mods[i].cmdline) + 1 : 0;
+                if (cmdline_end > placement) placement = cmdline_end;
+            }
+        }
+    }
+    placement = (placement + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    unsigned int first, end;
+    max_frame = 0;
+    for (unsigned int i = 0; i < region_count; i++)
+        if (region_frames(&regions[i], &first, &end) && end > max_frame) max_frame = end;
+
+    // Put the bitmap in the first usable gap at or above the placement point
+    bitmap_words = (max_frame + 31) / 32;
+    unsigned int bitmap_bytes = bitmap_words * 4;
+    frame_bitmap = 0;
+    for (unsigned int i = 0; i < region_count && !frame_bitmap; i++) {
+        if (!region_frames(&regions[i], &first, &end)) continue;
+        unsigned int candidate = first << PAGE_SHIFT;
+        if (candidate < placement) candidate = placement;
+        if (candidate < (end << PAGE_SHIFT) && (end << PAGE_SHIFT) - candidate >= bitmap_bytes)
+            frame_bitmap = (unsigned int *)candidate;
+    }
+    if (!frame_bitmap) {
+        bitmap_words = max_frame = 0;
+        return from_firmware;
+    }
+
+    for (unsigned int w = 0; w < bitmap_words; w++) frame_bitmap[w] = 0xFFFFFFFF;
+    free_frames = 0;
+    for (unsigned int i = 0; i < region_count; i++) {
+        if (!region_frames(&regions[i], &first, &end)) continue;
+        total_frames += end - first;
+        release_frames(first, end);
+    }
+
+    reserve_range(0, 0x100000);         // real-mode IVT, BDA, EBDA, VGA, BIOS
+    reserve_range((unsigned int)_kernel_start, placement);
+    reserve_range((unsigned int)frame_bitmap, (unsigned int)frame_bitmap + bitmap_bytes);
+    search_hint = 0;
+    return from_firmware;
+}
+
+// ============================================================================
+// ALLOCATION
+// ============================================================================
+
+// Callers may be threads on any CPU or IRQ handlers, so every entry point
+// takes pmm_lock with interrupts off.
+unsigned int pmm_alloc_frame() {
+    unsigned int flags = spin_lock_irqsave(&pmm_lock);
+    if (!frame_cache_count && !refill_cache()) {
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return 0;
+    }
+    free_frames--;
+    unsigned int frame = frame_cache[--frame_cache_count];
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return frame << PAGE_SHIFT;
+}
+
+void pmm_free_frame(unsigned int addr) {
+    unsigned int frame = addr >> PAGE_SHIFT;
+    unsigned int flags = spin_lock_irqsave(&pmm_lock);
+    if (frame_cache_count < FRAME_CACHE_SIZE) {
+        frame_cache[frame_cache_count++] = frame;
+    } else {
+        frame_bitmap[frame >> 5] &= ~FRAME_BIT(frame);
+        if ((frame >> 5) < search_hint) search_hint = frame >> 5;
+    }
+    free_frames++;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+// First-fit scan for a run of clear bits; whole words of used frames are
+// skipped at once. Frames parked in the cache are not considered.
+unsigned int pmm_alloc_frames(unsigned int count) {
+    if (count == 1) return pmm_alloc_frame();
+
+    unsigned int run = 0, flags = spin_lock_irqsave(&pmm_lock);
+    for (unsigned int f = 0; f < max_frame; f++) {
+        if (!(f & 31) && frame_bitmap[f >> 5] == 0xFFFFFFFF) {
+            run = 0;
+            f += 31;
+            continue;
+        }
+        if (frame_bitmap[f >> 5] & FRAME_BIT(f)) { run = 0; continue; }
+        if (++run < count) continue;
+
+        unsigned int start = f + 1 - count;
+        for (unsigned int g = start; g <= f; g++) frame_bitmap[g >> 5] |= FRAME_BIT(g);
+        free_frames -= count;
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return start << PAGE_SHIFT;
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return 0;
+}
+
+void pmm_free_frames(unsigned int addr, unsigned int count) {
+    unsigned int first = addr >> PAGE_SHIFT;
+    unsigned int flags = spin_lock_irqsave(&pmm_lock);
+    for (unsigned int f = first; f < first + count; f++) frame_bitmap[f >> 5] &= ~FRAME_BIT(f);
+    if ((first >> 5) < search_hint) search_hint = first >> 5;
+    free_frames += count;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+void pmm_get_stats(struct pmm_stats *stats) {
+    stats->total_frames = total_frames;
+    stats->free_frames = free_frames;
+    stats->reserved_frames = reserved_frames;
+    stats->region_count = region_count;
+    stats->regions = regions;
+}
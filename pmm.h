@@ -0,0 +1,44 @@
+#ifndef PMM_H
+#define PMM_H
+
+#include "multiboot.h"
+
+// Physical frame allocator built once from the multiboot memory map.
+// One bit per 4 KB frame (1 = in use), fronted by a small stack of free
+// frames so the common single-frame alloc/free path is O(1).
+
+#define PAGE_SIZE 4096
+#define PAGE_SHIFT 12
+
+#define PMM_MAX_REGIONS 32
+
+struct pmm_region {
+    unsigned long long base;
+    unsigned long long length;
+    unsigned int type;                  // MULTIBOOT_MEMORY_*
+};
+
+struct pmm_stats {
+    unsigned int total_frames;          // usable frames reported by firmware
+    unsigned int free_frames;
+    unsigned int reserved_frames;       // usable frames held by kernel, modules, bitmap
+    unsigned int region_count;
+    const struct pmm_region *regions;
+};
+
+// Returns 0 if the bootloader gave no memory information and a
+// conservative 1-16 MB map was assumed instead.
+int pmm_init(unsigned int magic, struct multiboot_info *mbi);
+
+// Return a physical address, or 0 when memory is exhausted (frame 0 is
+// never handed out, so 0 is unambiguous).
+unsigned int pmm_alloc_frame();
+void pmm_free_frame(unsigned int addr);
+
+// Physically contiguous runs, for DMA buffers and large heap blocks
+unsigned int pmm_alloc_frames(unsigned int count);
+void pmm_free_frames(unsigned int addr, unsigned int count);
+
+void pmm_get_stats(struct pmm_stats *stats);
+
+#endif
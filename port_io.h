@@ -0,0 +1,60 @@
+#ifndef PORT_IO_H
+#define PORT_IO_H
+
+// x86 port I/O. Always inlined so each access is a single in/out
+// instruction with the port in DX (or an immediate when constant).
+
+static inline __attribute__((always_inline)) unsigned char inb(unsigned short port) {
+    unsigned char value;
+    asm volatile("inb %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static inline __attribute__((always_inline)) unsigned short inw(unsigned short port) {
+    unsigned short value;
+    asm volatile("inw %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static inline __attribute__((always_inline)) unsigned int inl(unsigned short port) {
+    unsigned int value;
+    asm volatile("inl %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static inline __attribute__((always_inline)) void outb(unsigned short port, unsigned char value) {
+    asm volatile("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline __attribute__((always_inline)) void outw(unsigned short port, unsigned short value) {
+    asm volatile("outw %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline __attribute__((always_inline)) void outl(unsigned short port, unsigned int value) {
+    asm volatile("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
+// String variants: transfer 'count' words/dwords between a port and memory
+// with a single rep-prefixed instruction (ATA PIO data, etc.)
+static inline __attribute__((always_inline)) void insw(unsigned short port, void *buffer, unsigned int count) {
+    asm volatile("rep insw" : "+D"(buffer), "+c"(count) : "d"(port) : "memory");
+}
+
+static inline __attribute__((always_inline)) void outsw(unsigned short port, const void *buffer, unsigned int count) {
+    asm volatile("rep outsw" : "+S"(buffer), "+c"(count) : "d"(port) : "memory");
+}
+
+static inline __attribute__((always_inline)) void insl(unsigned short port, void *buffer, unsigned int count) {
+    asm volatile("rep insl" : "+D"(buffer), "+c"(count) : "d"(port) : "memory");
+}
+
+static inline __attribute__((always_inline)) void outsl(unsigned short port, const void *buffer, unsigned int count) {
+    asm volatile("rep outsl" : "+S"(buffer), "+c"(count) : "d"(port) : "memory");
+}
+
+// A write to the unused POST port takes ~1us; gives slow devices (8259) time to settle
+static inline __attribute__((always_inline)) void io_wait() {
+    outb(0x80, 0);
+}
+
+#endif
@@ -0,0 +1,89 @@
+#include "kernel.h"
+#include "heap.h"
+#include "timer.h"
+#include "commands.h"
+#include "smp.h"
+#include "ksyms.h"
+#include "bench.h"
+#include "prof.h"
+
+// One counter per symbol plus a last one for samples outside kernel code
+static unsigned int *counts = 0;
+static unsigned int count_slots = 0;
+static volatile int running = 0;
+static unsigned int cpu_samples[MAX_CPUS];
+static unsigned long long start_ns = 0, elapsed_ns = 0;
+
+void prof_sample(const struct interrupt_frame *frame) {
+    if (!running) return;
+    int index = ksym_index(frame->eip);
+    __atomic_fetch_add(&counts[index < 0 ? count_slots - 1 : (unsigned int)index], 1, __ATOMIC_RELAXED);
+    cpu_samples[this_cpu()->index]++;
+}
+
+static void prof_start() {
+    if (running) { print("\nProfiler already running"); return; }
+    if (!ksym_count()) { print("\nNo symbol table in this kernel (see gen_ksyms.py)"); return; }
+    if (!counts) {
+        count_slots = ksym_count() + 1;
+        counts = kmalloc(count_slots * sizeof(unsigned int));
+        if (!counts) { print("\nOut of memory"); return; }
+    }
+    memset(counts, 0, count_slots * sizeof(unsigned int));
+    memset(cpu_samples, 0, sizeof(cpu_samples));
+    elapsed_ns = 0;
+    start_ns = now_ns();
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    kprintf("\nProfiling %u functions at %u Hz per busy CPU", count_slots - 1, TIMER_HZ);
+}
+
+static void prof_stop() {
+    if (!running) { print("\nProfiler not running"); return; }
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    elapsed_ns = now_ns() - start_ns;
+    print("\nProfiler stopped; 'prof report' shows the results");
+}
+
+// Top functions: every slot index sorted by its count, read from the end.
+// Counts keep moving while the profiler runs, so all of it works on a copy.
+static void prof_report(unsigned int top) {
+    if (!counts) { print("\nNo profile yet; run 'prof start'"); return; }
+    unsigned int *order = kmalloc(2 * count_slots * sizeof(unsigned int));
+    if (!order) { print("\nOut of memory"); return; }
+    unsigned int *snapshot = order + count_slots;
+    unsigned int total = 0, cpus = 0;
+    for (unsigned int i = 0; i < count_slots; i++) {
+        order[i] = i;
+        snapshot[i] = counts[i];
+        total += snapshot[i];
+    }
+    for (unsigned int i = 0; i < MAX_CPUS; i++) cpus += cpu_samples[i] != 0;
+    unsigned long long ns = running ? now_ns() - start_ns : elapsed_ns;
+    unsigned int ms = (unsigned int)div_u64_rem(ns, 1000000, 0);
+    kprintf("\n=== PROFILE: %u samples over %u.%03u s on %u CPU%s%s ===", total, ms / 1000, ms % 1000,
+            cpus, cpus == 1 ? "" : "s", running ? " (running)" : "");
+
+    if (total) {
+        bench_sort_by(order, count_slots, snapshot);
+        if (top > count_slots) top = count_slots;
+        print("\n samples       %  function");
+        for (unsigned int n = 0; n < top; n++) {
+            unsigned int slot = order[count_slots - 1 - n], count = snapshot[slot];
+            if (!count) break;
+            unsigned int pct = (unsigned int)div_u64_rem((unsigned long long)count * 10000, total, 0);
+            kprintf("\n%8u %3u.%02u%%  %s", count, pct / 100, pct % 100,
+                    slot == count_slots - 1 ? "(outside kernel code)" : ksym_name(slot));
+        }
+    }
+    kfree(order);
+}
+
+void cmd_prof(int argc, char **argv) {
+    if (strcmp(argv[1], "start") == 0) prof_start();
+    else if (strcmp(argv[1], "stop") == 0) prof_stop();
+    else if (strcmp(argv[1], "report") == 0) {
+        int top = argc == 3 ? atoi(argv[2]) : PROF_TOP_DEFAULT;
+        if (top <= 0 || top > PROF_TOP_MAX) { kprintf("\nUsage: prof report [1-%u]", PROF_TOP_MAX); return; }
+        prof_report(top);
+    } else print("\nUsage: prof start|stop|report [count]");
+}
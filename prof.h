@@ -0,0 +1,19 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include "interrupts.h"
+
+// Sampling profiler. While running, every scheduler tick (TIMER_HZ on
+// each CPU that has threads to run; see timer.h) counts the interrupted
+// EIP against the function that contains it, looked up in the embedded
+// symbol table (ksyms.h). An idle CPU stops ticking, so idle time goes
+// unsampled. Code running with interrupts off is charged to wherever they
+// are turned back on.
+
+#define PROF_TOP_DEFAULT 15
+#define PROF_TOP_MAX 1000
+
+// Called from timer_event() on every tick
+void prof_sample(const struct interrupt_frame *frame);
+
+#endif
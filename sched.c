@@ -0,0 +1,520 @@
+#include "kernel.h"
+#include "interrupts.h"
+#include "timer.h"
+#include "heap.h"
+#include "pmm.h"
+#include "paging.h"
+#include "smp.h"
+#include "sched.h"
+#include "cpufeature.h"
+
+#define FPU_STATE_SIZE 512
+
+// switch.asm
+void context_switch(unsigned int *save_esp, unsigned int load_esp);
+
+static struct thread boot_thread;
+
+// Every live thread, for ps
+static struct spinlock threads_lock = SPINLOCK_INIT;
+static struct thread *all_threads = 0;
+
+static int running = 0;
+static int has_fxsr = 0;
+static unsigned int next_id = 0;
+
+// ============================================================================
+// RUN QUEUES
+// ============================================================================
+
+// Callers hold rq->lock
+
+static void enqueue(struct sched_cpu *rq, struct thread *t) {
+    t->next = 0;
+    if (rq->tail[t->priority]) rq->tail[t->priority]->next = t;
+    else rq->head[t->priority] = t;
+    rq->tail[t->priority] = t;
+    rq->ready_mask |= 1u << t->priority;
+    rq->nr_ready++;
+}
+
+// Lowest set bit is the highest priority
+static struct thread *dequeue_highest(struct sched_cpu *rq) {
+    if (!rq->ready_mask) return 0;
+    int prio = __builtin_ctz(rq->ready_mask);
+    struct thread *t = rq->head[prio];
+    rq->head[prio] = t->next;
+    if (!rq->head[prio]) {
+        rq->tail[prio] = 0;
+        rq->ready_mask &= ~(1u << prio);
+    }
+    rq->nr_ready--;
+    t->next = 0;
+    return t;
+}
+
+// Take the best ready thread of the first other CPU that has one. Only
+// trylock: two CPUs stealing from each other must not deadlock, and a busy
+// queue is about to be served by its owner anyway.
+static struct thread *steal(struct cpu *self) {
+    unsigned int count = smp_cpu_possible();
+    for (unsigned int i = 1; i < count; i++) {
+        struct cpu *victim = smp_cpu((self->index + i) % count);
+        if (!victim->online || !victim->sched.nr_ready) continue;
+        if (!spin_trylock(&victim->sched.lock)) continue;
+        struct thread *t = dequeue_highest(&victim->sched);
+        spin_unlock(&victim->sched.lock);
+        if (t) {
+            self->sched.steals++;
+            return t;
+        }
+    }
+    return 0;
+}
+
+// Send one idle CPU looking for work
+static void kick_idle_cpu(struct cpu *self) {
+    unsigned int count = smp_cpu_possible();
+    for (unsigned int i = 1; i < count; i++) {
+        struct cpu *cpu = smp_cpu((self->index + i) % count);
+        if (!cpu->online || cpu->sched.current != cpu->sched.idle) continue;
+        cpu->sched.need_resched = 1;
+        lapic_send_ipi(cpu->apic_id, VECTOR_RESCHEDULE);
+        return;
+    }
+}
+
+// Queue 't' on the CPU it last ran on. If it outranks what that CPU is
+// running, preempt it (by IPI when remote); otherwise wake an idle CPU to
+// steal it.
+static void make_ready(struct thread *t) {
+    unsigned int flags = irq_save();
+    struct cpu *self = this_cpu(), *target = smp_cpu(t->cpu);
+    struct sched_cpu *rq = &target->sched;
+    spin_lock(&rq->lock);
+    t->state = THREAD_READY;
+    enqueue(rq, t);
+    int preempt = t->priority < rq->current->priority;
+    if (preempt) rq->need_resched = 1;
+    spin_unlock(&rq->lock);
+
+    if (!preempt) kick_idle_cpu(self);
+    else if (target != self) lapic_send_ipi(target->apic_id, VECTOR_RESCHEDULE);
+    irq_restore(flags);
+}
+
+// ============================================================================
+// LAZY FPU
+// ============================================================================
+
+static inline void set_task_switched(int on) {
+    if (!on) {
+        asm volatile("clts");
+        return;
+    }
+    unsigned int cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    asm volatile("mov %0, %%cr0" : : "r"(cr0 | 0x8));
+}
+
+static void fpu_save(struct thread *t) {
+    if (has_fxsr) asm volatile("fxsave (%0)" : : "r"(t->fpu_state) : "memory");
+    else asm volatile("fnsave (%0)" : : "r"(t->fpu_state) : "memory");
+}
+
+// Once per CPU: CR0 and CR4 are not shared
+static void fpu_init() {
+    unsigned int cr0, cr4;
+    has_fxsr = cpu_has(CPU_FEATURE_FXSR);
+
+    // CR0: MP so WAIT honours TS, NE for native FPU errors, EM off
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    asm volatile("mov %0, %%cr0" : : "r"((cr0 | 0x22) & ~0x4));
+    if (has_fxsr) {
+        // CR4: OSFXSR, plus OSXMMEXCPT when SSE is there, so SSE is usable
+        asm volatile("mov %%cr4, %0" : "=r"(cr4));
+        cr4 |= 1 << 9;
+        if (cpu_has(CPU_FEATURE_SSE)) cr4 |= 1 << 10;
+        asm volatile("mov %0, %%cr4" : : "r"(cr4));
+    }
+    asm volatile("fninit");
+}
+
+// #NM: the current thread used the FPU while its registers were not live
+// on this CPU. Load its saved state (or create it on first use).
+int sched_fpu_trap() {
+    if (!running) return 0;
+    struct cpu *cpu = this_cpu();
+    struct sched_cpu *rq = &cpu->sched;
+    struct thread *t = rq->current;
+    set_task_switched(0);
+
+    if (rq->fpu_owner != t || t->fpu_cpu != cpu->index) {
+        if (t->fpu_state) {
+            if (has_fxsr) asm volatile("fxrstor (%0)" : : "r"(t->fpu_state) : "memory");
+            else asm volatile("frstor (%0)" : : "r"(t->fpu_state) : "memory");
+        } else {
+            t->fpu_state = kmalloc(FPU_STATE_SIZE);     // slab objects are 32-byte aligned
+            if (!t->fpu_state) return 0;
+            asm volatile("fninit");
+            if (has_fxsr) {
+                unsigned int mxcsr = 0x1F80;            // all SIMD exceptions masked
+                asm volatile("ldmxcsr %0" : : "m"(mxcsr));
+            }
+        }
+        rq->fpu_owner = t;
+        t->fpu_cpu = cpu->index;
+    }
+    rq->fpu_live = 1;
+    return 1;
+}
+
+// ============================================================================
+// SWITCHING
+// ============================================================================
+
+static void reap(struct thread *t) {
+    unsigned int flags = spin_lock_irqsave(&threads_lock);
+    for (struct thread **p = &all_threads; *p; p = &(*p)->all_next)
+        if (*p == t) { *p = t->all_next; break; }
+    spin_unlock_irqrestore(&threads_lock, flags);
+    if (t->fpu_state) kfree(t->fpu_state);
+    kstack_free(t->stack_top, THREAD_STACK_PAGES);
+    kfree(t);
+}
+
+// First thing the incoming thread does: publish that the outgoing one is
+// fully saved, release the run queue lock schedule() took, and free the
+// outgoing thread if it exited
+static void finish_switch() {
+    struct sched_cpu *rq = &this_cpu()->sched;
+    struct thread *last = rq->last;
+    __atomic_store_n(&last->on_cpu, 0, __ATOMIC_RELEASE);
+    spin_unlock(&rq->lock);
+    if (last->state == THREAD_DEAD) reap(last);
+}
+
+// Called holding rq->lock; the thread resumes later, possibly on another CPU
+static void switch_to(struct cpu *cpu, struct thread *prev, struct thread *next) {
+    struct sched_cpu *rq = &cpu->sched;
+    unsigned long long now = now_ns();
+    prev->cpu_ns += now - prev->run_start_ns;
+    next->run_start_ns = now;
+    next->switches++;
+    rq->context_switches++;
+
+    // Save eagerly so 'prev' can resume anywhere; restore lazily, and not
+    // at all if 'next' still has its registers loaded here
+    if (rq->fpu_live) fpu_save(prev);
+    rq->fpu_live = rq->fpu_owner == next && next->fpu_cpu == cpu->index;
+    set_task_switched(!rq->fpu_live);
+
+    // A thread woken while still switching out elsewhere is not runnable yet
+    while (__atomic_load_n(&next->on_cpu, __ATOMIC_ACQUIRE)) asm volatile("pause");
+    next->on_cpu = 1;
+    next->cpu = cpu->index;
+    rq->current = next;
+    rq->last = prev;
+
+    // Leaving idle: the tick stopped while nothing ran, and with it the
+    // TLB catch-up it does
+    if (prev == rq->idle) {
+        timer_resume_tick();
+        paging_tlb_sync(&cpu->tlb_generation);
+    }
+    context_switch(&prev->esp, next->esp);
+    finish_switch();
+}
+
+static void schedule() {
+    unsigned int flags = irq_save();
+    struct cpu *cpu = this_cpu();
+    struct sched_cpu *rq = &cpu->sched;
+    spin_lock(&rq->lock);
+    rq->need_resched = 0;
+
+    // The idle thread is never queued; it is what runs when nothing is
+    struct thread *prev = rq->current;
+    if (prev->state == THREAD_RUNNING) {
+        prev->state = THREAD_READY;
+        if (prev != rq->idle) enqueue(rq, prev);
+    }
+    struct thread *next = dequeue_highest(rq);
+    if (!next) next = steal(cpu);
+    if (!next) next = rq->idle;
+    next->state = THREAD_RUNNING;
+    next->slice = SCHED_SLICE_TICKS;
+
+    if (next != prev) switch_to(cpu, prev, next);
+    else spin_unlock(&rq->lock);
+    irq_restore(flags);
+}
+
+// First code a new thread runs, entered by context_switch's ret
+static void thread_bootstrap() {
+    finish_switch();
+    interrupts_enable();
+    struct thread *self = thread_current();
+    self->entry(self->arg);
+    thread_exit();
+}
+
+// ============================================================================
+// THREAD API
+// ============================================================================
+
+static struct thread *thread_alloc(const char *name, thread_entry_t entry, void *arg, int priority) {
+    struct thread *t = kmalloc(sizeof(struct thread));
+    if (!t) return 0;
+    unsigned int top = kstack_alloc(THREAD_STACK_PAGES);
+    if (!top) {
+        kfree(t);
+        return 0;
+    }
+
+    memset(t, 0, sizeof(*t));
+    strlcpy(t->name, name, THREAD_NAME_LEN);
+    t->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    t->priority = (priority < 0) ? 0 : (priority > PRIO_IDLE) ? PRIO_IDLE : priority;
+    t->state = THREAD_READY;
+    t->entry = entry;
+    t->arg = arg;
+    t->stack_top = top;
+    t->fpu_cpu = NO_CPU;
+
+    // The frame context_switch pops: edi, esi, ebx, ebp, then the return
+    // address, with a dummy return address above it for thread_bootstrap
+    unsigned int *sp = (unsigned int *)top;
+    *--sp = 0;
+    *--sp = (unsigned int)thread_bootstrap;
+    for (int r = 0; r < 4; r++) *--sp = 0;
+    t->esp = (unsigned int)sp;
+
+    unsigned int flags = spin_lock_irqsave(&threads_lock);
+    t->all_next = all_threads;
+    all_threads = t;
+    spin_unlock_irqrestore(&threads_lock, flags);
+    return t;
+}
+
+// New threads start on the creating CPU's queue; idle CPUs steal from there
+struct thread *thread_create(const char *name, thread_entry_t entry, void *arg, int priority) {
+    struct thread *t = thread_alloc(name, entry, arg, priority);
+    if (!t) return 0;
+    unsigned int flags = irq_save();
+    t->cpu = this_cpu()->index;
+    make_ready(t);
+    irq_restore(flags);
+    return t;
+}
+
+struct thread *thread_current() {
+    unsigned int flags = irq_save();
+    struct thread *t = this_cpu()->sched.current;
+    irq_restore(flags);
+    return t;
+}
+
+void thread_exit() {
+    interrupts_disable();
+    struct sched_cpu *rq = &this_cpu()->sched;
+    if (rq->fpu_owner == rq->current) {
+        rq->fpu_owner = 0;
+        rq->fpu_live = 0;
+    }
+    rq->current->state = THREAD_DEAD;
+    schedule();
+    while (1) asm volatile("hlt");      // not reached
+}
+
+void thread_yield() {
+    schedule();
+}
+
+static void wake_sleeper(void *arg) {
+    make_ready(arg);
+}
+
+// The timer goes on this CPU's wheel with interrupts off, so it cannot
+// fire here before schedule() has switched away. Where it lands on
+// another CPU's wheel, a wakeup that comes first is the same race
+// wait_queue_sleep() has, and on_cpu covers it the same way.
+static void sleep_ns(unsigned long long ns) {
+    struct timer timer;
+    memset(&timer, 0, sizeof(timer));
+    unsigned int flags = irq_save();
+    struct thread *self = this_cpu()->sched.current;
+    self->state = THREAD_SLEEPING;
+    timer_add(&timer, ns, wake_sleeper, self);
+    schedule();
+    irq_restore(flags);
+}
+
+void thread_sleep_ms(unsigned int ms) {
+    sleep_ns(ms * 1000000ULL);
+}
+
+void ksleep_us(unsigned int us) {
+    sleep_ns(us * 1000ULL);
+}
+
+// ============================================================================
+// WAIT QUEUES
+// ============================================================================
+
+// A waker may queue us again before schedule() runs; on_cpu keeps any
+// other CPU from resuming us until we are switched out
+void wait_queue_sleep(struct wait_queue *wq) {
+    struct thread *self = this_cpu()->sched.current;
+    self->state = THREAD_BLOCKED;
+    self->next = 0;
+    if (wq->tail) wq->tail->next = self;
+    else wq->head = self;
+    wq->tail = self;
+    spin_unlock(&wq->lock);
+    schedule();
+    spin_lock(&wq->lock);
+}
+
+void wait_queue_wake_one(struct wait_queue *wq) {
+    unsigned int flags = spin_lock_irqsave(&wq->lock);
+    struct thread *t = wq->head;
+    if (t) {
+        wq->head = t->next;
+        if (!wq->head) wq->tail = 0;
+        make_ready(t);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void wait_queue_wake_all(struct wait_queue *wq) {
+    unsigned int flags = spin_lock_irqsave(&wq->lock);
+    struct thread *t = wq->head;
+    wq->head = wq->tail = 0;
+    while (t) {
+        struct thread *next = t->next;
+        make_ready(t);
+        t = next;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+// ============================================================================
+// TIMER AND INTERRUPT HOOKS
+// ============================================================================
+
+static int work_elsewhere(struct cpu *self) {
+    for (unsigned int i = 0; i < smp_cpu_possible(); i++) {
+        struct cpu *cpu = smp_cpu(i);
+        if (cpu != self && cpu->online && cpu->sched.nr_ready) return 1;
+    }
+    return 0;
+}
+
+// Runs in every CPU's timer tick: charge the time slice, and send an idle
+// CPU to steal if any queue has work
+void sched_tick() {
+    if (!running) return;
+    struct cpu *cpu = this_cpu();
+    struct sched_cpu *rq = &cpu->sched;
+    cpu->ticks++;
+    paging_tlb_sync(&cpu->tlb_generation);
+
+    struct thread *t = rq->current;
+    if (t == rq->idle) {
+        if (rq->nr_ready || work_elsewhere(cpu)) rq->need_resched = 1;
+    } else if (t->slice && !--t->slice) {
+        rq->need_resched = 1;
+    }
+}
+
+// An idle CPU with no work in sight can stop ticking: whatever makes a
+// thread ready next (a timer, an IRQ, another CPU's kick_idle_cpu())
+// interrupts it anyway
+int sched_needs_tick() {
+    if (!running) return 1;
+    struct cpu *cpu = this_cpu();
+    struct sched_cpu *rq = &cpu->sched;
+    return rq->current != rq->idle || rq->nr_ready || work_elsewhere(cpu);
+}
+
+// Last step of every IRQ, after the EOI
+void sched_preempt() {
+    if (running && this_cpu()->sched.need_resched) schedule();
+}
+
+static void idle_thread(void *arg) {
+    while (1) wait_for_interrupt();
+}
+
+void sched_init() {
+    fpu_init();
+    struct sched_cpu *rq = &this_cpu()->sched;
+
+    // The boot stack (kernel.asm) becomes the shell thread's stack
+    strlcpy(boot_thread.name, "shell", THREAD_NAME_LEN);
+    boot_thread.id = next_id++;
+    boot_thread.priority = PRIO_SHELL;
+    boot_thread.state = THREAD_RUNNING;
+    boot_thread.slice = SCHED_SLICE_TICKS;
+    boot_thread.run_start_ns = now_ns();
+    boot_thread.fpu_cpu = NO_CPU;
+    boot_thread.on_cpu = 1;
+    all_threads = rq->current = &boot_thread;
+
+    rq->idle = thread_alloc("idle", idle_thread, 0, PRIO_IDLE);
+    running = 1;
+}
+
+// The AP's boot flow, on the stack smp_start_aps() gave it, becomes its
+// idle thread
+void sched_start_ap() {
+    fpu_init();
+    struct cpu *cpu = this_cpu();
+    struct thread *idle = kmalloc(sizeof(struct thread));
+    if (!idle) while (1) asm volatile("cli; hlt");
+
+    memset(idle, 0, sizeof(*idle));
+    strlcpy(idle->name, "idle", THREAD_NAME_LEN);
+    idle->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    idle->priority = PRIO_IDLE;
+    idle->state = THREAD_RUNNING;
+    idle->run_start_ns = now_ns();
+    idle->cpu = cpu->index;
+    idle->fpu_cpu = NO_CPU;
+    idle->on_cpu = 1;
+    cpu->sched.current = cpu->sched.idle = idle;
+
+    unsigned int flags = spin_lock_irqsave(&threads_lock);
+    idle->all_next = all_threads;
+    all_threads = idle;
+    spin_unlock_irqrestore(&threads_lock, flags);
+
+    // Only now may other CPUs queue work here or steal from here
+    __atomic_store_n(&cpu->online, 1, __ATOMIC_RELEASE);
+    interrupts_enable();
+    idle_thread(0);
+}
+
+// ============================================================================
+// STATISTICS
+// ============================================================================
+
+unsigned int sched_snapshot(struct thread *out, unsigned int max) {
+    unsigned int flags = spin_lock_irqsave(&threads_lock);
+    unsigned long long now = now_ns();
+    unsigned int count = 0;
+    for (struct thread *t = all_threads; t && count < max; t = t->all_next) {
+        out[count] = *t;
+        if (t->state == THREAD_RUNNING) out[count].cpu_ns += now - t->run_start_ns;
+        count++;
+    }
+    spin_unlock_irqrestore(&threads_lock, flags);
+    return count;
+}
+
+unsigned int sched_context_switches() {
+    unsigned int total = 0;
+    for (unsigned int i = 0; i < smp_cpu_possible(); i++) total += smp_cpu(i)->sched.context_switches;
+    return total;
+}
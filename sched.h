@@ -0,0 +1,120 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "spinlock.h"
+
+// Preemptive kernel threads. Every CPU has its own run queues: each
+// priority level (0 = highest) is a FIFO with one bit in a ready mask, so
+// picking the next thread is a single bit scan whatever the thread count.
+// A CPU whose queues are empty steals the best ready thread from another
+// CPU before going idle. The timer tick ends time slices; the switch
+// itself happens on the way out of the interrupt, or in schedule() when a
+// thread blocks. Sleeping is a kernel timer (timer.h) that readies the
+// thread again, and a CPU left with only its idle thread stops ticking.
+//
+// FPU/SSE state is restored lazily: CR0.TS is set whenever the incoming
+// thread's registers are not already loaded on this CPU, and its first FPU
+// instruction traps (#NM) so the state can be loaded then. A thread that
+// used the FPU has it saved when switched out, so it can resume on any
+// CPU. Threads that never touch the FPU never pay for it.
+
+#define SCHED_PRIORITIES 32
+#define PRIO_SHELL 8
+#define PRIO_JOB 16
+#define PRIO_IDLE (SCHED_PRIORITIES - 1)
+
+#define SCHED_SLICE_TICKS 10            // 10 ms at TIMER_HZ 1000
+#define THREAD_STACK_PAGES 4
+#define THREAD_NAME_LEN 16
+#define NO_CPU 0xFFFFFFFF
+
+enum thread_state {
+    THREAD_RUNNING,
+    THREAD_READY,
+    THREAD_SLEEPING,
+    THREAD_BLOCKED,
+    THREAD_DEAD
+};
+
+typedef void (*thread_entry_t)(void *arg);
+
+struct thread {
+    unsigned int esp;                   // saved by context_switch; must stay first
+    unsigned int id;
+    char name[THREAD_NAME_LEN];
+    unsigned char priority;
+    unsigned char state;
+    unsigned int slice;                 // ticks left before preemption
+    unsigned int stack_top;             // 0 for the boot thread
+    thread_entry_t entry;
+    void *arg;
+    void *fpu_state;                    // 512-byte FXSAVE area, allocated on first FPU use
+
+    unsigned long long cpu_ns;          // time spent running
+    unsigned long long run_start_ns;    // when it was last switched in
+    unsigned int switches;              // times switched in
+
+    unsigned int cpu;                   // CPU it runs on, or whose queue holds it
+    unsigned int fpu_cpu;               // CPU whose FPU registers hold its state
+    volatile unsigned int on_cpu;       // set until its context is fully saved
+
+    struct thread *next;                // run queue, sleep list or wait queue
+    struct thread *all_next;            // every live thread, for ps
+};
+
+// Per-CPU scheduler state (embedded in struct cpu, smp.h). The lock
+// covers the queues and 'current'; it is held across a context switch and
+// released by the incoming thread.
+struct sched_cpu {
+    struct spinlock lock;
+    struct thread *head[SCHED_PRIORITIES], *tail[SCHED_PRIORITIES];
+    unsigned int ready_mask;            // bit n set if queue n is non-empty
+    volatile unsigned int nr_ready;
+    struct thread *current, *idle;
+    struct thread *last;                // switched away from; finished by the next thread
+    struct thread *fpu_owner;           // whose registers the FPU holds
+    int fpu_live;                       // CR0.TS clear for the current thread
+    volatile int need_resched;
+    unsigned int context_switches, steals;
+};
+
+struct wait_queue {
+    struct spinlock lock;
+    struct thread *head, *tail;
+};
+
+#define WAIT_QUEUE_INIT { SPINLOCK_INIT, 0, 0 }
+
+// Boot CPU: turns the boot flow into the "shell" thread and creates the
+// idle thread. Needs smp_init() first (for this_cpu()).
+void sched_init();
+
+// Application processor: its boot flow becomes its idle thread; never returns
+void sched_start_ap();
+
+struct thread *thread_create(const char *name, thread_entry_t entry, void *arg, int priority);
+struct thread *thread_current();
+void thread_exit();
+void thread_yield();
+void thread_sleep_ms(unsigned int ms);
+void ksleep_us(unsigned int us);
+
+// Block until woken. Call holding wq->lock (spin_lock_irqsave), after
+// checking the condition being waited for, so a wakeup from another CPU
+// cannot slip in between. The lock is dropped while asleep and held again
+// on return.
+void wait_queue_sleep(struct wait_queue *wq);
+void wait_queue_wake_one(struct wait_queue *wq);
+void wait_queue_wake_all(struct wait_queue *wq);
+
+// Hooks for the timer IRQ and the interrupt dispatcher
+void sched_tick();
+int sched_needs_tick();
+void sched_preempt();
+int sched_fpu_trap();
+
+// Copy up to 'max' threads into 'out' (CPU time brought up to date); for ps
+unsigned int sched_snapshot(struct thread *out, unsigned int max);
+unsigned int sched_context_switches();
+
+#endif
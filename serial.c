@@ -0,0 +1,202 @@
+#include "kernel.h"
+#include "spinlock.h"
+#include "serial.h"
+
+// Register offsets from the base port
+#define UART_DATA 0                     // RBR/THR, divisor low with DLAB
+#define UART_IER  1                     // divisor high with DLAB
+#define UART_IIR  2                     // read: interrupt identification
+#define UART_FCR  2                     // write: FIFO control
+#define UART_LCR  3
+#define UART_MCR  4
+#define UART_LSR  5
+#define UART_SCR  7
+
+#define IER_RX    0x01
+#define IER_TX    0x02
+#define IER_LINE  0x04
+#define LSR_DR    0x01
+#define LSR_ERR   0x1E                  // overrun, parity, framing, break
+#define LSR_THRE  0x20
+#define FIFO_SIZE 16
+
+// Transmit ring: print() produces (serialized by the console lock), the
+// IRQ or a polled drain consumes under tx_lock.
+// Receive ring: the IRQ produces, the main loop consumes. Indices run
+// freely and are masked on access; sizes must stay powers of two.
+#define TX_RING_SIZE 8192
+#define RX_RING_SIZE 256
+
+static volatile unsigned char tx_ring[TX_RING_SIZE];
+static volatile unsigned int tx_head = 0, tx_tail = 0;
+static volatile unsigned char rx_ring[RX_RING_SIZE];
+static volatile unsigned int rx_head = 0, rx_tail = 0;
+
+static int present = 0;
+static unsigned char ier = 0;
+static struct spinlock tx_lock = SPINLOCK_INIT;
+static struct serial_stats stats;
+static void (*rx_notify)() = 0;
+
+// ============================================================================
+// TRANSMIT
+// ============================================================================
+
+// Caller holds tx_lock. Fills the FIFO only if the THR is empty,
+// so a full FIFO's worth never overruns it.
+static void tx_fill() {
+    if (!(inb(SERIAL_COM1 + UART_LSR) & LSR_THRE)) return;
+    unsigned int tail = tx_tail;
+    for (int i = 0; i < FIFO_SIZE && tail != tx_head; i++, tail++)
+        outb(SERIAL_COM1 + UART_DATA, tx_ring[tail & (TX_RING_SIZE - 1)]);
+    stats.tx_bytes += tail - tx_tail;
+    tx_tail = tail;
+}
+
+static void tx_set_interrupt(int enable) {
+    unsigned char want = enable ? (ier | IER_TX) : (ier & ~IER_TX);
+    if (want == ier) return;
+    ier = want;
+    outb(SERIAL_COM1 + UART_IER, ier);
+}
+
+static void tx_put(unsigned char c) {
+    while (tx_head - tx_tail >= TX_RING_SIZE) {
+        // Ring full: make room by feeding the FIFO by hand
+        unsigned int flags = spin_lock_irqsave(&tx_lock);
+        stats.tx_stalls++;
+        while (!(inb(SERIAL_COM1 + UART_LSR) & LSR_THRE)) asm volatile("pause");
+        tx_fill();
+        spin_unlock_irqrestore(&tx_lock, flags);
+    }
+    tx_ring[tx_head & (TX_RING_SIZE - 1)] = c;
+    asm volatile("" ::: "memory");      // publish the slot before the index
+    tx_head++;
+}
+
+void serial_write(const char *str) {
+    serial_write_len(str, strlen(str));
+}
+
+void serial_write_len(const char *buf, unsigned int len) {
+    if (!present) return;
+    for (; len; len--, buf++) {
+        if (*buf == '\n') tx_put('\r');
+        tx_put(*buf);
+    }
+
+    // Enabling the THR-empty interrupt while the THR is already empty
+    // raises it at once, which starts the drain.
+    unsigned int flags = spin_lock_irqsave(&tx_lock);
+    tx_set_interrupt(tx_head != tx_tail);
+    spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+void serial_flush() {
+    if (!present) return;
+    unsigned int flags = spin_lock_irqsave(&tx_lock);
+    while (tx_head != tx_tail) {
+        while (!(inb(SERIAL_COM1 + UART_LSR) & LSR_THRE)) asm volatile("pause");
+        tx_fill();
+    }
+    tx_set_interrupt(0);
+    spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+// ============================================================================
+// RECEIVE AND IRQ
+// ============================================================================
+
+static void rx_drain() {
+    unsigned char lsr;
+    while ((lsr = inb(SERIAL_COM1 + UART_LSR)) & LSR_DR) {
+        if (lsr & LSR_ERR) stats.rx_errors++;
+        unsigned char byte = inb(SERIAL_COM1 + UART_DATA);
+        unsigned int head = rx_head;
+        if (head - rx_tail >= RX_RING_SIZE) { stats.rx_dropped++; continue; }
+        rx_ring[head & (RX_RING_SIZE - 1)] = byte;
+        asm volatile("" ::: "memory");
+        rx_head = head + 1;
+        stats.rx_bytes++;
+    }
+}
+
+int serial_read(unsigned char *byte) {
+    unsigned int tail = rx_tail;
+    if (tail == rx_head) return 0;
+    *byte = rx_ring[tail & (RX_RING_SIZE - 1)];
+    asm volatile("" ::: "memory");      // consume the slot before freeing it
+    rx_tail = tail + 1;
+    return 1;
+}
+
+void serial_on_receive(void (*notify)()) {
+    rx_notify = notify;
+}
+
+static void serial_irq(struct interrupt_frame *frame) {
+    (void)frame;
+    unsigned char iir;
+    while (!((iir = inb(SERIAL_COM1 + UART_IIR)) & 0x01)) {
+        switch ((iir >> 1) & 0x07) {
+        case 3:                         // line status
+            if (inb(SERIAL_COM1 + UART_LSR) & LSR_ERR) stats.rx_errors++;
+            break;
+        case 2:                         // data available
+        case 6:                         // FIFO timeout
+            rx_drain();
+            if (rx_notify) rx_notify();
+            break;
+        case 1:                         // THR empty
+            spin_lock(&tx_lock);
+            tx_fill();
+            if (tx_head == tx_tail) tx_set_interrupt(0);
+            spin_unlock(&tx_lock);
+            break;
+        default:                        // modem status, unused
+            inb(SERIAL_COM1 + 6);
+            break;
+        }
+    }
+}
+
+// ============================================================================
+// INITIALIZATION
+// ============================================================================
+
+int serial_init() {
+    outb(SERIAL_COM1 + UART_IER, 0);
+
+    // Nothing decodes the port if the scratch register does not hold a value
+    outb(SERIAL_COM1 + UART_SCR, 0x5A);
+    if (inb(SERIAL_COM1 + UART_SCR) != 0x5A) return 0;
+
+    unsigned int divisor = 115200 / SERIAL_BAUD;
+    outb(SERIAL_COM1 + UART_LCR, 0x80);             // DLAB on
+    outb(SERIAL_COM1 + UART_DATA, divisor & 0xFF);
+    outb(SERIAL_COM1 + UART_IER, (divisor >> 8) & 0xFF);
+    outb(SERIAL_COM1 + UART_LCR, 0x03);             // 8N1, DLAB off
+    outb(SERIAL_COM1 + UART_FCR, 0xC7);             // enable + clear FIFOs, RX trigger at 14
+
+    // Loopback self-test, then DTR/RTS with OUT2 to route the IRQ to the PIC
+    outb(SERIAL_COM1 + UART_MCR, 0x1E);
+    outb(SERIAL_COM1 + UART_DATA, 0xAE);
+    if (inb(SERIAL_COM1 + UART_DATA) != 0xAE) return 0;
+    outb(SERIAL_COM1 + UART_MCR, 0x0B);
+    if ((inb(SERIAL_COM1 + UART_IIR) & 0xC0) != 0xC0) return 0;   // 8250/16450: no FIFO
+
+    while (inb(SERIAL_COM1 + UART_LSR) & LSR_DR) inb(SERIAL_COM1 + UART_DATA);
+    present = 1;
+    irq_register(IRQ_COM1, serial_irq);
+    ier = IER_RX | IER_LINE;
+    outb(SERIAL_COM1 + UART_IER, ier);
+    return 1;
+}
+
+int serial_present() {
+    return present;
+}
+
+void serial_get_stats(struct serial_stats *out) {
+    *out = stats;
+}
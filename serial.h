@@ -0,0 +1,39 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+// 16550 UART on COM1, mirrored from print() so the kernel can be driven
+// headless (qemu -serial stdio / -nographic). Output goes into a transmit
+// ring that the THR-empty interrupt drains 16 bytes at a time; received
+// bytes are queued by the same IRQ and read by the main loop.
+
+#define SERIAL_COM1 0x3F8
+#define SERIAL_BAUD 115200
+#define IRQ_COM1 4
+
+// Returns 0 if no UART answered at COM1; everything else is then a no-op
+int serial_init();
+
+// Queue a string, sending "\r\n" for "\n". Only blocks when the ring is full.
+void serial_write(const char *str);
+void serial_write_len(const char *buf, unsigned int len);
+
+// Push everything still queued out by polling; for panics with interrupts off
+void serial_flush();
+
+// Returns 1 and the next received byte, or 0 if none is waiting
+int serial_read(unsigned char *byte);
+
+// Called from the IRQ after received bytes were queued, to wake a reader
+void serial_on_receive(void (*notify)());
+
+struct serial_stats {
+    unsigned int tx_bytes, rx_bytes;
+    unsigned int tx_stalls;             // writes that found the ring full
+    unsigned int rx_dropped;            // bytes lost to a full receive ring
+    unsigned int rx_errors;             // overrun, parity, framing
+};
+
+int serial_present();
+void serial_get_stats(struct serial_stats *stats);
+
+#endif
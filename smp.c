@@ -0,0 +1,240 @@
+#include "kernel.h"
+#include "interrupts.h"
+#include "timer.h"
+#include "pmm.h"
+#include "heap.h"
+#include "paging.h"
+#include "smp.h"
+
+#define AP_START_TIMEOUT_MS 100
+
+// trampoline.asm
+extern unsigned char trampoline_start[], trampoline_end[];
+extern unsigned char trampoline_gdtr[], trampoline_cr3[], trampoline_cr4[];
+extern unsigned char trampoline_stack[], trampoline_cpu[];
+
+static struct cpu cpus[MAX_CPUS];
+static unsigned int possible = 1;
+
+// Trampoline parameters are written into the copy, not the linked original
+static inline unsigned int *trampoline_param(unsigned char *symbol) {
+    return (unsigned int *)(SMP_TRAMPOLINE + (symbol - trampoline_start));
+}
+
+// ============================================================================
+// BRING-UP
+// ============================================================================
+
+// Nothing to do: the dispatcher's sched_preempt() on the way out sees the
+// need_resched flag the sender set
+static void reschedule_ipi(struct interrupt_frame *frame) {
+    (void)frame;
+}
+
+void smp_init() {
+    cpus[0].self = &cpus[0];
+    cpus[0].online = 1;
+    interrupts_set_percpu(0, &cpus[0], sizeof(struct cpu));
+
+    if (!apic_init()) return;
+    interrupts_use_apic();
+    cpus[0].apic_id = lapic_id();
+    possible = apic_cpu_count();
+    vector_register(VECTOR_APIC_TIMER, timer_event);
+    vector_register(VECTOR_RESCHEDULE, reschedule_ipi);
+}
+
+// Entered from the trampoline with paging on, on the stack the boot CPU
+// allocated, and interrupts off
+void ap_main(unsigned int index) {
+    struct cpu *cpu = &cpus[index];
+    interrupts_init_ap(index);
+    interrupts_set_percpu(index, cpu, sizeof(struct cpu));
+    paging_init_ap();
+    lapic_init_ap();
+
+    // Local timer, calibrated by the boot CPU; one-shot or periodic as
+    // timer_init() chose
+    timer_init_ap();
+    sched_start_ap();
+}
+
+void smp_start_aps() {
+    if (possible < 2) return;
+    lapic_timer_calibrate();
+
+    memcpy((void *)SMP_TRAMPOLINE, trampoline_start, trampoline_end - trampoline_start);
+    asm volatile("sgdt (%0)" : : "r"(trampoline_param(trampoline_gdtr)) : "memory");
+    paging_boot_state(trampoline_param(trampoline_cr3), trampoline_param(trampoline_cr4));
+
+    // One at a time: the trampoline's parameters are shared
+    for (unsigned int i = 1; i < possible; i++) {
+        struct cpu *cpu = &cpus[i];
+        cpu->self = cpu;
+        cpu->index = i;
+        cpu->apic_id = apic_cpu_apic_id(i);
+        unsigned int stack = kstack_alloc(THREAD_STACK_PAGES);
+        if (!stack) break;
+        *trampoline_param(trampoline_stack) = stack;
+        *trampoline_param(trampoline_cpu) = i;
+
+        lapic_start_ap(cpu->apic_id, SMP_TRAMPOLINE);
+        unsigned long long deadline = now_ns() + AP_START_TIMEOUT_MS * 1000000ULL;
+        while (!__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE) && now_ns() < deadline) asm volatile("pause");
+        if (!cpu->online) {
+            kprintf("\nSMP: CPU with APIC ID %u did not start", cpu->apic_id);
+            kstack_free(stack, THREAD_STACK_PAGES);
+        }
+    }
+}
+
+unsigned int smp_cpu_count() {
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < possible; i++) count += cpus[i].online ? 1 : 0;
+    return count;
+}
+
+unsigned int smp_cpu_possible() {
+    return possible;
+}
+
+struct cpu *smp_cpu(unsigned int index) {
+    return &cpus[index];
+}
+
+// ============================================================================
+// PARALLEL WORK
+// ============================================================================
+
+// Shared by the caller and its helpers; freed by whichever drops the last
+// reference, since a helper may still be waking the caller as it returns
+struct parallel_job {
+    void (*fn)(void *arg, unsigned int index);
+    void *arg;
+    unsigned int count;
+    unsigned int next_index;
+    unsigned int helpers_left;
+    unsigned int refs;
+    struct wait_queue done;
+};
+
+static void parallel_run(struct parallel_job *job) {
+    unsigned int index;
+    while ((index = __atomic_fetch_add(&job->next_index, 1, __ATOMIC_RELAXED)) < job->count)
+        job->fn(job->arg, index);
+}
+
+static void parallel_put(struct parallel_job *job) {
+    if (!__atomic_sub_fetch(&job->refs, 1, __ATOMIC_ACQ_REL)) kfree(job);
+}
+
+static void parallel_helper(void *arg) {
+    struct parallel_job *job = arg;
+    parallel_run(job);
+    if (!__atomic_sub_fetch(&job->helpers_left, 1, __ATOMIC_ACQ_REL)) wait_queue_wake_all(&job->done);
+    parallel_put(job);
+}
+
+void smp_parallel(void (*fn)(void *arg, unsigned int index), void *arg, unsigned int count) {
+    unsigned int helpers = smp_cpu_count() - 1;
+    if (helpers > count - 1) helpers = count - 1;
+    struct parallel_job *job = helpers ? kmalloc(sizeof(struct parallel_job)) : 0;
+    if (!job) {
+        for (unsigned int i = 0; i < count; i++) fn(arg, i);
+        return;
+    }
+
+    struct wait_queue done = WAIT_QUEUE_INIT;
+    job->fn = fn;
+    job->arg = arg;
+    job->count = count;
+    job->next_index = 0;
+    job->helpers_left = helpers;
+    job->refs = helpers + 1;
+    job->done = done;
+
+    int priority = thread_current()->priority;
+    for (unsigned int i = 0; i < helpers; i++) {
+        if (thread_create("parallel", parallel_helper, job, priority)) continue;
+        __atomic_sub_fetch(&job->helpers_left, 1, __ATOMIC_ACQ_REL);
+        __atomic_sub_fetch(&job->refs, 1, __ATOMIC_ACQ_REL);
+    }
+    parallel_run(job);
+
+    unsigned int flags = spin_lock_irqsave(&job->done.lock);
+    while (__atomic_load_n(&job->helpers_left, __ATOMIC_ACQUIRE)) wait_queue_sleep(&job->done);
+    spin_unlock_irqrestore(&job->done.lock, flags);
+    parallel_put(job);
+}
+
+// ============================================================================
+// SMPBENCH COMMAND
+// ============================================================================
+
+#define SMPBENCH_CHUNK_FRAMES 16        // 64 KB per work item
+#define SMPBENCH_MAX_MB 256
+
+struct zero_work {
+    unsigned int *frames;
+    unsigned int frame_count;
+};
+
+static void zero_chunk(void *arg, unsigned int index) {
+    struct zero_work *work = arg;
+    unsigned int first = index * SMPBENCH_CHUNK_FRAMES;
+    for (unsigned int i = first; i < first + SMPBENCH_CHUNK_FRAMES && i < work->frame_count; i++)
+        zero_page((void *)work->frames[i]);
+}
+
+static void print_rate(unsigned int cpus, unsigned int mb, unsigned int us) {
+    kprintf("\n%2u %s%8u us  ", cpus, cpus == 1 ? "CPU:  " : "CPUs: ", us);
+    if (us) kprintf("%llu MB/s", div_u64_rem((unsigned long long)mb * 1000000, us, 0));
+}
+
+// Zero the same frames on one CPU and then on all of them. RAM is identity
+// mapped, so frames are written through their physical addresses.
+void cmd_smpbench(int argc, char **argv) {
+    unsigned int mb = 16;
+    if (argc == 2) {
+        int n = atoi(argv[1]);
+        if (n <= 0 || n > SMPBENCH_MAX_MB) { print("\nSize must be 1-256 MB"); return; }
+        mb = n;
+    }
+
+    struct zero_work work;
+    work.frame_count = mb * 256;
+    work.frames = kmalloc(work.frame_count * sizeof(unsigned int));
+    if (!work.frames) { print("\nOut of memory"); return; }
+    unsigned int got = 0;
+    while (got < work.frame_count && (work.frames[got] = pmm_alloc_frame())) got++;
+    if (got < work.frame_count) {
+        print("\nNot enough free memory");
+        while (got) pmm_free_frame(work.frames[--got]);
+        kfree(work.frames);
+        return;
+    }
+    unsigned int chunks = (work.frame_count + SMPBENCH_CHUNK_FRAMES - 1) / SMPBENCH_CHUNK_FRAMES;
+
+    kprintf("\n=== SMP PAGE ZEROING (%u MB) ===", mb);
+
+    // Warm the TLB and caches the same way for both runs
+    for (unsigned int i = 0; i < chunks; i++) zero_chunk(&work, i);
+
+    unsigned long long start = now_ns();
+    for (unsigned int i = 0; i < chunks; i++) zero_chunk(&work, i);
+    unsigned int one_us = (unsigned int)div_u64_rem(now_ns() - start, 1000, 0);
+
+    start = now_ns();
+    smp_parallel(zero_chunk, &work, chunks);
+    unsigned int all_us = (unsigned int)div_u64_rem(now_ns() - start, 1000, 0);
+
+    print_rate(1, mb, one_us);
+    print_rate(smp_cpu_count(), mb, all_us);
+    if (all_us) {
+        unsigned int speedup = (unsigned int)div_u64_rem((unsigned long long)one_us * 100, all_us, 0);
+        kprintf("\nSpeedup: %u.%02ux", speedup / 100, speedup % 100);
+    }
+
+    for (unsigned int i = 0; i < work.frame_count; i++) pmm_free_frame(work.frames[i]);
+    kfree(work.frames);
+}
@@ -0,0 +1,54 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "apic.h"
+#include "sched.h"
+
+// Multiprocessor bring-up. The boot CPU finds the others in the ACPI MADT
+// and wakes each one with INIT/STARTUP IPIs into a real-mode trampoline
+// copied to SMP_TRAMPOLINE (trampoline.asm). The trampoline switches to
+// protected mode with paging on and calls ap_main() on a fresh guarded
+// stack, which becomes that CPU's idle thread.
+//
+// Each CPU has a struct cpu reached through GS: every CPU's GS selector
+// points at its own GDT data segment, based at its own struct cpu, so
+// this_cpu() is a single load. Threads never save or restore GS, so one
+// that migrates simply sees the new CPU's data.
+
+#define MAX_CPUS APIC_MAX_CPUS
+#define SMP_TRAMPOLINE 0x8000           // real-mode page; must match trampoline.asm
+
+struct cpu {
+    struct cpu *self;                   // %gs:0; must stay first
+    unsigned int index;
+    unsigned int apic_id;
+    volatile int online;
+    unsigned int ticks;                 // local timer ticks
+    unsigned int tlb_generation;        // see paging_tlb_sync()
+    struct sched_cpu sched;
+};
+
+// Interrupts must be off (or the thread pinned) for the result to stay
+// the calling CPU
+static inline struct cpu *this_cpu() {
+    struct cpu *cpu;
+    asm volatile("mov %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+// Boot CPU: APIC setup and per-CPU data for CPU 0 (before sched_init)
+void smp_init();
+
+// Start the application processors (after sched_init, interrupts on)
+void smp_start_aps();
+
+unsigned int smp_cpu_count();           // online CPUs
+unsigned int smp_cpu_possible();        // CPUs in the MADT
+struct cpu *smp_cpu(unsigned int index);
+
+// Run fn(arg, 0) .. fn(arg, count - 1) on up to one thread per online CPU,
+// the caller included; returns once every index has run. Indices are
+// handed out one at a time, so uneven items balance themselves.
+void smp_parallel(void (*fn)(void *arg, unsigned int index), void *arg, unsigned int count);
+
+#endif
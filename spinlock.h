@@ -0,0 +1,43 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "interrupts.h"
+
+// Test-and-test-and-set spinlocks. Waiters spin on a plain read with PAUSE
+// and only retry the locked XCHG once the lock looks free, so a contended
+// line is not bounced between cores on every iteration.
+//
+// Anything an IRQ handler can also take must use the _irqsave variants;
+// otherwise the handler could spin on a lock its own CPU already holds.
+
+struct spinlock {
+    volatile unsigned int locked;
+};
+
+#define SPINLOCK_INIT { 0 }
+
+static inline int spin_trylock(struct spinlock *lock) {
+    return __atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE) == 0;
+}
+
+static inline void spin_lock(struct spinlock *lock) {
+    while (!spin_trylock(lock))
+        while (lock->locked) asm volatile("pause");
+}
+
+static inline void spin_unlock(struct spinlock *lock) {
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+static inline unsigned int spin_lock_irqsave(struct spinlock *lock) {
+    unsigned int flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(struct spinlock *lock, unsigned int flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif
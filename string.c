@@ -0,0 +1,364 @@
+#include "string.h"
+
+// Word-sized loads that may alias any type; the _u variant may be unaligned
+typedef unsigned long __attribute__((may_alias)) word_t;
+typedef unsigned long __attribute__((may_alias, aligned(1))) word_u;
+typedef unsigned int __attribute__((may_alias, aligned(1))) u32_u;
+typedef unsigned short __attribute__((may_alias, aligned(1))) u16_u;
+
+#define WORD_SIZE sizeof(unsigned long)
+#define ONES (~0UL / 0xFF)              // 0x01 in every byte
+#define HIGHS (ONES * 0x80)             // 0x80 in every byte
+
+// Nonzero iff some byte of w is zero
+static inline unsigned long has_zero(unsigned long w) {
+    return (w - ONES) & ~w & HIGHS;
+}
+
+// ============================================================================
+// DISPATCH
+// ============================================================================
+
+// Bound at boot by cpu_features_init() (cpufeature.c). Until then, and in
+// hosted builds, the integer paths are used.
+void (*memcpy_bulk)(void *dest, const void *src, size_t n) = memcpy_rep;
+void (*memset_bulk)(void *dest, int c, size_t n) = memset_rep;
+void (*zero_page_bulk)(void *page) = zero_page_rep;
+unsigned int (*csum_bulk)(const void *data, size_t len, unsigned int sum) = csum_partial_adc;
+
+// The bound routine may use XMM registers, which only a thread with
+// interrupts on may touch: IRQ handlers run with IF clear, and so does
+// anything holding a spinlock
+static inline int bulk_allowed() {
+#if __STDC_HOSTED__
+    return 1;
+#else
+    unsigned int flags;
+    asm volatile("pushfl\n\tpopl %0" : "=r"(flags));
+    return flags & 0x200;
+#endif
+}
+
+// ============================================================================
+// INTEGER PATHS
+// ============================================================================
+
+static inline void copy_forward(void *dest, const void *src, size_t n) {
+    size_t words = n >> 2;
+    asm volatile("rep movsl\n\tmov %3, %2\n\trep movsb"
+                 : "+D"(dest), "+S"(src), "+c"(words) : "r"(n & 3) : "memory");
+}
+
+// Odd bytes at the top first, then the words below them, with DF set
+static inline void copy_backward(void *dest, const void *src, size_t n) {
+    unsigned char *d = (unsigned char *)dest + n - 1;
+    const unsigned char *s = (const unsigned char *)src + n - 1;
+    size_t bytes = n & 3;
+    asm volatile("std\n\trep movsb\n\t"
+                 "sub $3, %0\n\tsub $3, %1\n\t"
+                 "mov %3, %2\n\trep movsl\n\tcld"
+                 : "+D"(d), "+S"(s), "+c"(bytes) : "r"(n >> 2) : "memory");
+}
+
+static inline void fill(void *dest, unsigned int pattern, size_t n) {
+    size_t words = n >> 2;
+    asm volatile("rep stosl\n\tmov %3, %1\n\trep stosb"
+                 : "+D"(dest), "+c"(words) : "a"(pattern), "r"(n & 3) : "memory");
+}
+
+void memcpy_rep(void *dest, const void *src, size_t n) {
+    copy_forward(dest, src, n);
+}
+
+void memset_rep(void *dest, int c, size_t n) {
+    fill(dest, (unsigned char)c * 0x01010101u, n);
+}
+
+void memset32(void *dest, unsigned int value, size_t count) {
+    asm volatile("rep stosl" : "+D"(dest), "+c"(count) : "a"(value) : "memory");
+}
+
+// With ERMS (enhanced REP MOVSB/STOSB) the microcode moves whole cache
+// lines, so a plain byte count beats the word-plus-tail split and SSE2
+void memcpy_erms(void *dest, const void *src, size_t n) {
+    asm volatile("rep movsb" : "+D"(dest), "+S"(src), "+c"(n) : : "memory");
+}
+
+void memset_erms(void *dest, int c, size_t n) {
+    asm volatile("rep stosb" : "+D"(dest), "+c"(n) : "a"(c) : "memory");
+}
+
+void zero_page_rep(void *page) {
+    memset32(page, 0, STRING_PAGE_SIZE / 4);
+}
+
+void zero_page_erms(void *page) {
+    memset_erms(page, 0, STRING_PAGE_SIZE);
+}
+
+// ============================================================================
+// SSE2 PATHS
+// ============================================================================
+
+// Past this, stores bypass the cache: the block would evict everything
+// else and is unlikely to be read back soon
+#define STRING_NT_MIN (256 * 1024)
+
+// The kernel is built without -msse; the target attribute lets these
+// functions name XMM registers.
+#define SSE2_FN __attribute__((target("sse2")))
+
+// Destination aligned first, so stores are aligned and loads may not be.
+// 64 bytes per iteration through four XMM registers.
+SSE2_FN void memcpy_sse2(void *dest, const void *src, size_t n) {
+    unsigned char *d = dest;
+    const unsigned char *s = src;
+    size_t head = -(unsigned long)d & 15;
+    if (head > n) head = n;
+    copy_forward(d, s, head);
+    d += head; s += head; n -= head;
+
+    size_t blocks = n >> 6;
+    if (blocks && n >= STRING_NT_MIN) {
+        asm volatile("1:\n\t"
+                     "movdqu (%1), %%xmm0\n\tmovdqu 16(%1), %%xmm1\n\t"
+                     "movdqu 32(%1), %%xmm2\n\tmovdqu 48(%1), %%xmm3\n\t"
+                     "movntdq %%xmm0, (%0)\n\tmovntdq %%xmm1, 16(%0)\n\t"
+                     "movntdq %%xmm2, 32(%0)\n\tmovntdq %%xmm3, 48(%0)\n\t"
+                     "add $64, %0\n\tadd $64, %1\n\tdec %2\n\tjnz 1b\n\t"
+                     "sfence"
+                     : "+r"(d), "+r"(s), "+r"(blocks) : : "xmm0", "xmm1", "xmm2", "xmm3", "memory");
+    } else if (blocks) {
+        asm volatile("1:\n\t"
+                     "movdqu (%1), %%xmm0\n\tmovdqu 16(%1), %%xmm1\n\t"
+                     "movdqu 32(%1), %%xmm2\n\tmovdqu 48(%1), %%xmm3\n\t"
+                     "movdqa %%xmm0, (%0)\n\tmovdqa %%xmm1, 16(%0)\n\t"
+                     "movdqa %%xmm2, 32(%0)\n\tmovdqa %%xmm3, 48(%0)\n\t"
+                     "add $64, %0\n\tadd $64, %1\n\tdec %2\n\tjnz 1b"
+                     : "+r"(d), "+r"(s), "+r"(blocks) : : "xmm0", "xmm1", "xmm2", "xmm3", "memory");
+    }
+    copy_forward(d, s, n & 63);
+}
+
+SSE2_FN void memset_sse2(void *dest, int c, size_t n) {
+    unsigned char *d = dest;
+    unsigned int pattern = (unsigned char)c * 0x01010101u;
+    size_t head = -(unsigned long)d & 15;
+    if (head > n) head = n;
+    fill(d, pattern, head);
+    d += head; n -= head;
+
+    // Broadcast in the same asm statement as the loop: nothing guarantees
+    // XMM0 survives between two
+    size_t blocks = n >> 6;
+    if (blocks && n >= STRING_NT_MIN) {
+        asm volatile("movd %2, %%xmm0\n\tpshufd $0, %%xmm0, %%xmm0\n"
+                     "1:\n\t"
+                     "movntdq %%xmm0, (%0)\n\tmovntdq %%xmm0, 16(%0)\n\t"
+                     "movntdq %%xmm0, 32(%0)\n\tmovntdq %%xmm0, 48(%0)\n\t"
+                     "add $64, %0\n\tdec %1\n\tjnz 1b\n\tsfence"
+                     : "+r"(d), "+r"(blocks) : "r"(pattern) : "xmm0", "memory");
+    } else if (blocks) {
+        asm volatile("movd %2, %%xmm0\n\tpshufd $0, %%xmm0, %%xmm0\n"
+                     "1:\n\t"
+                     "movdqa %%xmm0, (%0)\n\tmovdqa %%xmm0, 16(%0)\n\t"
+                     "movdqa %%xmm0, 32(%0)\n\tmovdqa %%xmm0, 48(%0)\n\t"
+                     "add $64, %0\n\tdec %1\n\tjnz 1b"
+                     : "+r"(d), "+r"(blocks) : "r"(pattern) : "xmm0", "memory");
+    }
+    fill(d, pattern, n & 63);
+}
+
+// Page tables and fresh frames are used right after zeroing, so these are
+// ordinary cached stores
+SSE2_FN void zero_page_sse2(void *page) {
+    size_t blocks = STRING_PAGE_SIZE / 64;
+    asm volatile("pxor %%xmm0, %%xmm0\n"
+                 "1:\n\t"
+                 "movdqa %%xmm0, (%0)\n\tmovdqa %%xmm0, 16(%0)\n\t"
+                 "movdqa %%xmm0, 32(%0)\n\tmovdqa %%xmm0, 48(%0)\n\t"
+                 "add $64, %0\n\tdec %1\n\tjnz 1b"
+                 : "+r"(page), "+r"(blocks) : : "xmm0", "memory");
+}
+
+// ============================================================================
+// MEMORY
+// ============================================================================
+
+void *memcpy(void *dest, const void *src, size_t n) {
+    if (n >= STRING_BULK_MIN && bulk_allowed()) memcpy_bulk(dest, src, n);
+    else copy_forward(dest, src, n);
+    return dest;
+}
+
+// Copying forward is safe whenever the destination starts below the
+// source, SSE2 blocks included: each block is loaded before it is stored
+void *memmove(void *dest, const void *src, size_t n) {
+    if ((unsigned long)dest - (unsigned long)src >= n) return memcpy(dest, src, n);
+    if (n) copy_backward(dest, src, n);
+    return dest;
+}
+
+void *memset(void *dest, int c, size_t n) {
+    if (n >= STRING_BULK_MIN && bulk_allowed()) memset_bulk(dest, c, n);
+    else fill(dest, (unsigned char)c * 0x01010101u, n);
+    return dest;
+}
+
+void zero_page(void *page) {
+    if (bulk_allowed()) zero_page_bulk(page);
+    else zero_page_rep(page);
+}
+
+int memcmp(const void *a, const void *b, size_t n) {
+    const unsigned char *p = a, *q = b;
+    while (n >= WORD_SIZE && *(const word_u *)p == *(const word_u *)q) {
+        p += WORD_SIZE; q += WORD_SIZE; n -= WORD_SIZE;
+    }
+    for (; n; n--, p++, q++)
+        if (*p != *q) return *p - *q;
+    return 0;
+}
+
+// ============================================================================
+// STRINGS
+// ============================================================================
+
+// Aligned word loads never cross into an unmapped page, so reading a few
+// bytes past the terminator is harmless
+size_t strlen(const char *str) {
+    const char *p = str;
+    for (; (unsigned long)p & (WORD_SIZE - 1); p++)
+        if (!*p) return p - str;
+    const word_t *w = (const word_t *)p;
+    while (!has_zero(*w)) w++;
+    for (p = (const char *)w; *p; p++);
+    return p - str;
+}
+
+size_t strnlen(const char *str, size_t max) {
+    size_t len = 0;
+    while (len < max && str[len]) len++;
+    return len;
+}
+
+// Word at a time when both strings share an alignment, which is the usual
+// case for names in tables and token buffers
+int strcmp(const char *a, const char *b) {
+    if (!(((unsigned long)a ^ (unsigned long)b) & (WORD_SIZE - 1))) {
+        for (; (unsigned long)a & (WORD_SIZE - 1); a++, b++)
+            if (*a != *b || !*a) return (unsigned char)*a - (unsigned char)*b;
+        const word_t *wa = (const word_t *)a, *wb = (const word_t *)b;
+        while (*wa == *wb && !has_zero(*wa)) { wa++; wb++; }
+        a = (const char *)wa;
+        b = (const char *)wb;
+    }
+    while (*a && *a == *b) { a++; b++; }
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+int strncmp(const char *a, const char *b, size_t n) {
+    for (; n; n--, a++, b++)
+        if (*a != *b || !*a) return (unsigned char)*a - (unsigned char)*b;
+    return 0;
+}
+
+size_t strlcpy(char *dest, const char *src, size_t size) {
+    size_t len = strlen(src);
+    if (size) {
+        size_t copy = len < size ? len : size - 1;
+        copy_forward(dest, src, copy);
+        dest[copy] = '\0';
+    }
+    return len;
+}
+
+size_t strlcat(char *dest, const char *src, size_t size) {
+    size_t len = strnlen(dest, size);
+    if (len == size) return size + strlen(src);
+    return len + strlcpy(dest + len, src, size - len);
+}
+
+// ============================================================================
+// CHECKSUM
+// ============================================================================
+
+// The one's complement sum does not depend on byte order or word size as
+// long as every carry is added back in, so the paths below add 32-bit
+// words (or 64-bit lanes) and csum_fold() reduces the result to 16 bits
+
+static inline unsigned int add_carry(unsigned int sum, unsigned int x) {
+    sum += x;
+    return sum + (sum < x);
+}
+
+// A trailing odd byte is the low half of a little-endian word padded with zero
+static unsigned int csum_tail(const unsigned char *p, size_t len, unsigned int sum) {
+    for (; len >= 4; p += 4, len -= 4) sum = add_carry(sum, *(const u32_u *)p);
+    if (len >= 2) {
+        sum = add_carry(sum, *(const u16_u *)p);
+        p += 2;
+        len -= 2;
+    }
+    if (len) sum = add_carry(sum, *p);
+    return sum;
+}
+
+// One carry chain through ADC, 16 bytes per iteration; LEA and DEC leave
+// the carry flag alone
+unsigned int csum_partial_adc(const void *data, size_t len, unsigned int sum) {
+    const unsigned char *p = data;
+    size_t blocks = len >> 4;
+    if (blocks) {
+        asm("clc\n"
+            "1:\n\t"
+            "adcl (%1), %0\n\tadcl 4(%1), %0\n\t"
+            "adcl 8(%1), %0\n\tadcl 12(%1), %0\n\t"
+            "lea 16(%1), %1\n\tdec %2\n\tjnz 1b\n\t"
+            "adcl $0, %0"
+            : "+r"(sum), "+r"(p), "+r"(blocks) : "m"(*(const char (*)[len])data) : "cc");
+    }
+    return csum_tail(p, len & 15, sum);
+}
+
+// 32-bit words zero-extended into 64-bit lanes, so carries pile up in the
+// high halves instead of being lost; 64 bytes per iteration
+SSE2_FN unsigned int csum_partial_sse2(const void *data, size_t len, unsigned int sum) {
+    const unsigned char *p = data;
+    size_t blocks = len >> 6;
+    if (blocks) {
+        unsigned long long lanes[2];
+        asm volatile("pxor %%xmm4, %%xmm4\n\tpxor %%xmm5, %%xmm5\n\tpxor %%xmm6, %%xmm6\n"
+                     "1:\n\t"
+                     "movdqu (%1), %%xmm0\n\tmovdqu 16(%1), %%xmm1\n\t"
+                     "movdqu 32(%1), %%xmm2\n\tmovdqu 48(%1), %%xmm3\n\t"
+                     "movdqa %%xmm0, %%xmm7\n\tpunpckldq %%xmm6, %%xmm0\n\tpunpckhdq %%xmm6, %%xmm7\n\t"
+                     "paddq %%xmm0, %%xmm4\n\tpaddq %%xmm7, %%xmm5\n\t"
+                     "movdqa %%xmm1, %%xmm7\n\tpunpckldq %%xmm6, %%xmm1\n\tpunpckhdq %%xmm6, %%xmm7\n\t"
+                     "paddq %%xmm1, %%xmm4\n\tpaddq %%xmm7, %%xmm5\n\t"
+                     "movdqa %%xmm2, %%xmm7\n\tpunpckldq %%xmm6, %%xmm2\n\tpunpckhdq %%xmm6, %%xmm7\n\t"
+                     "paddq %%xmm2, %%xmm4\n\tpaddq %%xmm7, %%xmm5\n\t"
+                     "movdqa %%xmm3, %%xmm7\n\tpunpckldq %%xmm6, %%xmm3\n\tpunpckhdq %%xmm6, %%xmm7\n\t"
+                     "paddq %%xmm3, %%xmm4\n\tpaddq %%xmm7, %%xmm5\n\t"
+                     "add $64, %1\n\tdec %2\n\tjnz 1b\n\t"
+                     "paddq %%xmm5, %%xmm4\n\tmovdqu %%xmm4, %0"
+                     : "=m"(lanes), "+r"(p), "+r"(blocks) : "m"(*(const char (*)[len])data)
+                     : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7");
+        unsigned long long total = lanes[0] + lanes[1];
+        total = (total & 0xFFFFFFFF) + (total >> 32);
+        total = (total & 0xFFFFFFFF) + (total >> 32);
+        sum = add_carry(sum, (unsigned int)total);
+    }
+    return csum_partial_adc(p, len & 63, sum);
+}
+
+unsigned int csum_partial(const void *data, size_t len, unsigned int sum) {
+    if (len >= STRING_BULK_MIN && bulk_allowed()) return csum_bulk(data, len, sum);
+    return csum_partial_adc(data, len, sum);
+}
+
+unsigned short csum_fold(unsigned int sum) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum += sum >> 16;
+    return (unsigned short)~sum;
+}
@@ -0,0 +1,77 @@
+#ifndef STRING_H
+#define STRING_H
+
+// Freestanding string and memory routines. GCC may emit calls to memcpy,
+// memset, memmove and memcmp for struct copies and loops even with
+// -ffreestanding, so these must exist and must not recurse into
+// themselves; the bulk paths are inline assembly.
+//
+// memcpy/memset/memmove use REP MOVSD/STOSD for small blocks. Large ones
+// go through a bulk routine that cpu_features_init() (cpufeature.c) binds
+// at boot to the best variant for the CPU: REP MOVSB/STOSB with ERMS,
+// else SSE2, else REP MOVSD. XMM registers are per-thread state saved by
+// the lazy FPU switch (sched.c), so IRQ handlers and code holding a
+// spinlock with interrupts off always take the integer path.
+//
+// Nothing here depends on the rest of the kernel, so string.c also builds
+// as a hosted object (gcc -O2 -c string.c) for testing under Linux; there
+// the bulk routines stay on their integer defaults unless the test binds
+// them.
+
+typedef __SIZE_TYPE__ size_t;
+
+// Blocks at least this large take the bulk path
+#define STRING_BULK_MIN 512
+
+#define STRING_PAGE_SIZE 4096
+
+void *memcpy(void *dest, const void *src, size_t n);
+void *memmove(void *dest, const void *src, size_t n);
+void *memset(void *dest, int c, size_t n);
+int memcmp(const void *a, const void *b, size_t n);
+
+// Fill 'count' 32-bit words, for VGA cells and other repeated patterns
+void memset32(void *dest, unsigned int value, size_t count);
+
+// Zero one 4 KB-aligned page
+void zero_page(void *page);
+
+// The individual paths, for dispatch, benchmarks and tests. The SSE2 ones
+// need SSE2 and thread context, the ERMS ones only make sense with ERMS,
+// and all of them are only fast for large blocks.
+void memcpy_rep(void *dest, const void *src, size_t n);
+void memcpy_erms(void *dest, const void *src, size_t n);
+void memcpy_sse2(void *dest, const void *src, size_t n);
+void memset_rep(void *dest, int c, size_t n);
+void memset_erms(void *dest, int c, size_t n);
+void memset_sse2(void *dest, int c, size_t n);
+void zero_page_rep(void *page);
+void zero_page_erms(void *page);
+void zero_page_sse2(void *page);
+
+// Bound bulk routines (see above)
+extern void (*memcpy_bulk)(void *dest, const void *src, size_t n);
+extern void (*memset_bulk)(void *dest, int c, size_t n);
+extern void (*zero_page_bulk)(void *page);
+extern unsigned int (*csum_bulk)(const void *data, size_t len, unsigned int sum);
+
+size_t strlen(const char *str);
+size_t strnlen(const char *str, size_t max);
+int strcmp(const char *a, const char *b);
+int strncmp(const char *a, const char *b, size_t n);
+
+// BSD semantics: always NUL-terminate within 'size' and return the length
+// of the string they tried to create, so truncation is 'result >= size'
+size_t strlcpy(char *dest, const char *src, size_t size);
+size_t strlcat(char *dest, const char *src, size_t size);
+
+// Internet checksum (RFC 1071). csum_partial adds 'len' bytes into a
+// running 32-bit sum, so a header and payload can be summed separately;
+// csum_fold turns the sum into the 16-bit checksum, in memory byte order
+// (store it into the packet as is).
+unsigned int csum_partial(const void *data, size_t len, unsigned int sum);
+unsigned short csum_fold(unsigned int sum);
+unsigned int csum_partial_adc(const void *data, size_t len, unsigned int sum);
+unsigned int csum_partial_sse2(const void *data, size_t len, unsigned int sum);
+
+#endif
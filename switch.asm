@@ -0,0 +1,26 @@
+bits 32
+
+section .text
+global context_switch
+
+; void context_switch(unsigned int *save_esp, unsigned int load_esp)
+;
+; Called from schedule() with interrupts off. Only the callee-saved
+; registers need to survive: the C caller already expects eax/ecx/edx to
+; be clobbered, and EFLAGS is the same (IF clear) at every switch point.
+; A new thread's stack is built by thread_create() to look like one that
+; was switched out here, with thread_bootstrap as the return address.
+context_switch:
+    mov eax, [esp + 4]
+    mov edx, [esp + 8]
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov [eax], esp
+    mov esp, edx
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
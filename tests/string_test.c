@@ -0,0 +1,370 @@
+// Host-side tests and throughput numbers for string.c. Build and run from
+// the repository root:
+//
+//   gcc -O2 -Wall -o string_test tests/string_test.c && ./string_test
+//
+// string.c is included directly with its public names prefixed, so the
+// kernel routines are tested next to the C library's rather than in place
+// of them. Exits non-zero on the first mismatch.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cpuid.h>
+
+#define memcpy  k_memcpy
+#define memmove k_memmove
+#define memset  k_memset
+#define memcmp  k_memcmp
+#define strlen  k_strlen
+#define strnlen k_strnlen
+#define strcmp  k_strcmp
+#define strncmp k_strncmp
+#define strlcpy k_strlcpy
+#define strlcat k_strlcat
+#include "../string.c"
+#undef memcpy
+#undef memmove
+#undef memset
+#undef memcmp
+#undef strlen
+#undef strnlen
+#undef strcmp
+#undef strncmp
+#undef strlcpy
+#undef strlcat
+
+#define BUF_SIZE   (2 * 1024 * 1024)
+#define MAX_ALIGN  16
+#define GUARD      64
+
+static unsigned char *src, *dst, *ref;
+
+#define CHECK(cond, ...) do {                                       \
+    if (!(cond)) {                                                  \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__);                 \
+        printf(__VA_ARGS__);                                        \
+        printf("\n");                                               \
+        exit(1);                                                    \
+    }                                                               \
+} while (0)
+
+static unsigned int rng = 0x2545F491;
+
+// xorshift32, as blkbench uses
+static unsigned int next_random() {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static void fill_random(unsigned char *p, size_t n) {
+    for (size_t i = 0; i < n; i++) p[i] = next_random();
+}
+
+// Lengths around every boundary the routines care about: word tails, the
+// 16-byte SSE2 head, 64-byte blocks and STRING_BULK_MIN
+static const size_t lengths[] = {
+    0, 1, 2, 3, 4, 5, 7, 8, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 128, 129,
+    255, 256, 511, 512, 513, 1023, 1024, 1025, 4095, 4096, 4097, 65535, 65536,
+    STRING_NT_MIN - 1, STRING_NT_MIN, STRING_NT_MIN + 65
+};
+#define LENGTH_COUNT (sizeof(lengths) / sizeof(lengths[0]))
+
+// ============================================================================
+// MEMORY
+// ============================================================================
+
+typedef void (*copy_fn)(void *dest, const void *src, size_t n);
+typedef void (*set_fn)(void *dest, int c, size_t n);
+
+static void copy_wrapper(void *dest, const void *src, size_t n) {
+    k_memcpy(dest, src, n);
+}
+
+static void set_wrapper(void *dest, int c, size_t n) {
+    k_memset(dest, c, n);
+}
+
+static void test_copy(const char *name, copy_fn fn) {
+    for (size_t l = 0; l < LENGTH_COUNT; l++) {
+        size_t n = lengths[l];
+        for (int sa = 0; sa < MAX_ALIGN; sa++) {
+            for (int da = 0; da < MAX_ALIGN; da += (n > 65536 ? 5 : 1)) {
+                fill_random(dst, n + 2 * GUARD + MAX_ALIGN);
+                for (size_t i = 0; i < n + 2 * GUARD + MAX_ALIGN; i++) ref[i] = dst[i];
+                for (size_t i = 0; i < n; i++) ref[GUARD + da + i] = src[sa + i];
+                fn(dst + GUARD + da, src + sa, n);
+                for (size_t i = 0; i < n + 2 * GUARD + MAX_ALIGN; i++)
+                    CHECK(dst[i] == ref[i], "%s n=%zu src+%d dst+%d: byte %zd", name, n, sa, da, (ssize_t)i - GUARD - da);
+            }
+            if (n > 65536) sa += 4;
+        }
+    }
+    printf("ok  %s\n", name);
+}
+
+static void test_set(const char *name, set_fn fn) {
+    for (size_t l = 0; l < LENGTH_COUNT; l++) {
+        size_t n = lengths[l];
+        for (int da = 0; da < MAX_ALIGN; da++) {
+            int c = next_random() & 0xFF;
+            fill_random(dst, n + 2 * GUARD + MAX_ALIGN);
+            for (size_t i = 0; i < n + 2 * GUARD + MAX_ALIGN; i++) ref[i] = dst[i];
+            for (size_t i = 0; i < n; i++) ref[GUARD + da + i] = c;
+            fn(dst + GUARD + da, c | 0x5A00, n);       // only the low byte counts
+            for (size_t i = 0; i < n + 2 * GUARD + MAX_ALIGN; i++)
+                CHECK(dst[i] == ref[i], "%s n=%zu dst+%d: byte %zd", name, n, da, (ssize_t)i - GUARD - da);
+        }
+    }
+    printf("ok  %s\n", name);
+}
+
+// Every shift in both directions, so both copy_forward and copy_backward
+// run over overlapping ranges
+static void test_memmove() {
+    static const size_t sizes[] = { 0, 1, 3, 4, 5, 15, 16, 17, 63, 64, 100, 511, 512, 513, 4096, 70000 };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t n = sizes[s];
+        for (int shift = -33; shift <= 33; shift++) {
+            size_t base = GUARD + 40;
+            fill_random(dst, n + 2 * base);
+            for (size_t i = 0; i < n + 2 * base; i++) ref[i] = dst[i];
+            for (size_t i = 0; i < n; i++) ref[base + shift + i] = dst[base + i];
+            k_memmove(dst + base + shift, dst + base, n);
+            for (size_t i = 0; i < n + 2 * base; i++)
+                CHECK(dst[i] == ref[i], "memmove n=%zu shift=%d: byte %zu", n, shift, i);
+        }
+    }
+    printf("ok  memmove (overlap both ways)\n");
+}
+
+static void test_memcmp() {
+    for (size_t n = 0; n < 80; n++) {
+        for (int a = 0; a < 8; a++) {
+            fill_random(src + a, n);
+            for (size_t i = 0; i < n; i++) dst[i] = src[a + i];
+            CHECK(k_memcmp(src + a, dst, n) == 0, "memcmp equal n=%zu", n);
+            if (!n) continue;
+            size_t at = next_random() % n;
+            dst[at] = src[a + at] + 1;
+            int r = k_memcmp(src + a, dst, n);
+            CHECK((r < 0) == (src[a + at] < dst[at]) && r, "memcmp n=%zu diff at %zu", n, at);
+        }
+    }
+    printf("ok  memcmp\n");
+}
+
+// ============================================================================
+// STRINGS
+// ============================================================================
+
+static size_t ref_strlen(const char *s) {
+    size_t n = 0;
+    while (s[n]) n++;
+    return n;
+}
+
+static int sign(int x) {
+    return (x > 0) - (x < 0);
+}
+
+// Every alignment and length; also with the terminator on the last byte
+// of a page followed by an unmapped one, which catches word reads that
+// stray across the end
+static void test_strings() {
+    for (int a = 0; a < MAX_ALIGN; a++) {
+        for (size_t n = 0; n < 100; n++) {
+            char *s = (char *)src + a;
+            for (size_t i = 0; i < n; i++) s[i] = 1 + next_random() % 255;
+            s[n] = 0;
+            CHECK(k_strlen(s) == n, "strlen align %d len %zu", a, n);
+            CHECK(k_strnlen(s, n / 2) == n / 2, "strnlen align %d len %zu", a, n);
+            CHECK(k_strnlen(s, n + 5) == n, "strnlen align %d len %zu", a, n);
+
+            for (int b = 0; b < MAX_ALIGN; b += 3) {
+                char *t = (char *)dst + b;
+                for (size_t i = 0; i <= n; i++) t[i] = s[i];
+                CHECK(k_strcmp(s, t) == 0, "strcmp equal align %d/%d len %zu", a, b, n);
+                CHECK(k_strncmp(s, t, n + 3) == 0, "strncmp equal align %d/%d len %zu", a, b, n);
+                if (!n) continue;
+                size_t at = next_random() % n;
+                t[at] = (unsigned char)s[at] == 255 ? 1 : s[at] + 1;
+                int expect = (unsigned char)s[at] < (unsigned char)t[at] ? -1 : 1;
+                CHECK(sign(k_strcmp(s, t)) == expect, "strcmp diff align %d/%d len %zu at %zu", a, b, n, at);
+                CHECK(k_strncmp(s, t, at) == 0, "strncmp prefix align %d/%d len %zu", a, b, n);
+                t[at] = 0;
+                CHECK(k_strcmp(s, t) > 0, "strcmp shorter align %d/%d len %zu", a, b, n);
+            }
+        }
+    }
+
+    long page = sysconf(_SC_PAGESIZE);
+    char *pages = mmap(0, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK(pages != MAP_FAILED, "mmap");
+    CHECK(mprotect(pages + page, page, PROT_NONE) == 0, "mprotect");
+    for (size_t n = 0; n < 40; n++) {
+        char *s = pages + page - 1 - n;
+        for (size_t i = 0; i < n; i++) s[i] = 'a' + i % 26;
+        s[n] = 0;
+        CHECK(k_strlen(s) == n, "strlen at page end len %zu", n);
+        CHECK(k_strcmp(s, s) == 0, "strcmp at page end len %zu", n);
+    }
+    munmap(pages, 2 * page);
+    printf("ok  strlen/strnlen/strcmp/strncmp (every alignment, page end)\n");
+}
+
+static void test_strlcpy() {
+    char buf[16];
+    const char *text = "0123456789abcdefghij";     // 20 characters
+    for (size_t size = 0; size <= sizeof(buf); size++) {
+        for (size_t i = 0; i < sizeof(buf); i++) buf[i] = 'X';
+        size_t r = k_strlcpy(buf, text, size);
+        CHECK(r == 20, "strlcpy size %zu returned %zu", size, r);
+        if (size) {
+            CHECK(buf[size - 1] == 0 && ref_strlen(buf) == size - 1, "strlcpy size %zu not terminated", size);
+            for (size_t i = 0; i < size - 1; i++) CHECK(buf[i] == text[i], "strlcpy size %zu byte %zu", size, i);
+        }
+        for (size_t i = size; i < sizeof(buf); i++) CHECK(buf[i] == 'X', "strlcpy size %zu wrote past", size);
+    }
+
+    // A prefix of p characters; when it does not end inside 'size' the
+    // buffer is left alone and the result is size + strlen(src)
+    for (size_t size = 0; size <= sizeof(buf); size++) {
+        for (size_t p = 0; p < 8; p++) {
+            for (size_t i = 0; i < sizeof(buf); i++) buf[i] = 'X';
+            for (size_t i = 0; i < p; i++) buf[i] = 'a' + i;
+            buf[p] = 0;
+            size_t r = k_strlcat(buf, text, size);
+            if (p >= size) {
+                CHECK(r == size + 20, "strlcat size %zu prefix %zu returned %zu", size, p, r);
+                CHECK(buf[p] == 0 && (p + 1 >= sizeof(buf) || buf[p + 1] == 'X'), "strlcat size %zu prefix %zu wrote", size, p);
+                continue;
+            }
+            CHECK(r == p + 20, "strlcat size %zu prefix %zu returned %zu", size, p, r);
+            size_t len = p + 20 < size ? p + 20 : size - 1;
+            CHECK(ref_strlen(buf) == len, "strlcat size %zu prefix %zu length", size, p);
+            for (size_t i = p; i < len; i++) CHECK(buf[i] == text[i - p], "strlcat size %zu byte %zu", size, i);
+            for (size_t i = size; i < sizeof(buf); i++) CHECK(buf[i] == 'X', "strlcat size %zu wrote past", size);
+        }
+    }
+    printf("ok  strlcpy/strlcat truncation\n");
+}
+
+// ============================================================================
+// CHECKSUM
+// ============================================================================
+
+// RFC 1071 the slow way: 16-bit little-endian words, carries folded at the end
+static unsigned short ref_csum(const unsigned char *p, size_t len, unsigned int start) {
+    unsigned long long sum = start;
+    for (size_t i = 0; i + 1 < len; i += 2) sum += p[i] | (p[i + 1] << 8);
+    if (len & 1) sum += p[len - 1];
+    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+    return (unsigned short)~sum;
+}
+
+static void test_csum() {
+    for (size_t len = 0; len <= 2100; len += (len < 200 ? 1 : 37)) {
+        for (int a = 0; a < 8; a++) {
+            fill_random(src + a, len);
+            // All-ones data drives every carry chain as hard as it goes
+            if (a == 7) for (size_t i = 0; i < len; i++) src[a + i] = 0xFF;
+            unsigned int start = next_random();
+            unsigned short want = ref_csum(src + a, len, start);
+            unsigned short adc = csum_fold(csum_partial_adc(src + a, len, start));
+            unsigned short sse2 = csum_fold(csum_partial_sse2(src + a, len, start));
+            unsigned short any = csum_fold(csum_partial(src + a, len, start));
+            CHECK(adc == want, "csum adc len %zu align %d: %04x != %04x", len, a, adc, want);
+            CHECK(sse2 == want, "csum sse2 len %zu align %d: %04x != %04x", len, a, sse2, want);
+            CHECK(any == want, "csum_partial len %zu align %d: %04x != %04x", len, a, any, want);
+        }
+    }
+
+    // A header and payload summed separately add up to the whole
+    fill_random(src, 1500);
+    unsigned int split = csum_partial_adc(src + 20, 1480, csum_partial_adc(src, 20, 0));
+    CHECK(csum_fold(split) == ref_csum(src, 1500, 0), "csum split at 20");
+    printf("ok  csum (ADC, SSE2, byte reference)\n");
+}
+
+// ============================================================================
+// THROUGHPUT
+// ============================================================================
+
+static double seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Enough repetitions for about 64 MB through each routine
+static double copy_rate(copy_fn fn, size_t n) {
+    unsigned int reps = (64u << 20) / n;
+    fn(dst, src, n);
+    double start = seconds();
+    for (unsigned int i = 0; i < reps; i++) fn(dst, src, n);
+    return (double)n * reps / (seconds() - start) / 1e9;
+}
+
+static double set_rate(set_fn fn, size_t n) {
+    unsigned int reps = (64u << 20) / n;
+    fn(dst, 0, n);
+    double start = seconds();
+    for (unsigned int i = 0; i < reps; i++) fn(dst, i, n);
+    return (double)n * reps / (seconds() - start) / 1e9;
+}
+
+static int has_erms() {
+    unsigned int a, b, c, d;
+    return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1 << 9));
+}
+
+static void benchmark() {
+    static const size_t sizes[] = { 512, 4096, 65536, STRING_NT_MIN, 2 * 1024 * 1024 - 4096 };
+    printf("\nThroughput in GB/s (ERMS %s on this CPU)\n", has_erms() ? "present" : "absent");
+    printf("%10s %8s %8s %8s %8s %8s %8s\n", "bytes", "cpy rep", "cpy erms", "cpy sse2", "set rep", "set erms", "set sse2");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t n = sizes[s];
+        printf("%10zu %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f\n", n,
+               copy_rate(memcpy_rep, n), copy_rate(memcpy_erms, n), copy_rate(memcpy_sse2, n),
+               set_rate(memset_rep, n), set_rate(memset_erms, n), set_rate(memset_sse2, n));
+    }
+}
+
+int main(int argc, char **argv) {
+    src = aligned_alloc(4096, BUF_SIZE);
+    dst = aligned_alloc(4096, BUF_SIZE);
+    ref = aligned_alloc(4096, BUF_SIZE);
+    CHECK(src && dst && ref, "out of memory");
+    fill_random(src, BUF_SIZE);
+
+    test_copy("memcpy", copy_wrapper);
+    test_copy("memcpy_rep", memcpy_rep);
+    test_copy("memcpy_erms", memcpy_erms);
+    test_copy("memcpy_sse2", memcpy_sse2);
+    test_set("memset", set_wrapper);
+    test_set("memset_rep", memset_rep);
+    test_set("memset_erms", memset_erms);
+    test_set("memset_sse2", memset_sse2);
+    // Hosted builds leave the bulk pointers on the integer paths; rerun the
+    // dispatching entry points the way cpu_features_init() binds them
+    memcpy_bulk = memcpy_sse2;
+    memset_bulk = memset_sse2;
+    test_copy("memcpy (sse2 bulk)", copy_wrapper);
+    test_set("memset (sse2 bulk)", set_wrapper);
+    memcpy_bulk = memcpy_rep;
+    memset_bulk = memset_rep;
+    test_memmove();
+    test_memcmp();
+    test_strings();
+    test_strlcpy();
+    test_csum();
+    printf("All string tests passed\n");
+
+    if (argc < 2 || argv[1][0] != '-' || argv[1][1] != 'q') benchmark();
+    return 0;
+}
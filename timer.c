@@ -0,0 +1,488 @@
+#include "kernel.h"
+#include "interrupts.h"
+#include "timer.h"
+#include "apic.h"
+#include "smp.h"
+#include "sched.h"
+#include "heap.h"
+#include "cpufeature.h"
+#include "bench.h"
+#include "prof.h"
+
+static volatile unsigned long long ticks = 0;
+
+// TSC to nanoseconds: ns = (cycles * tsc_mult) >> tsc_shift, with the
+// factors chosen at calibration so that tsc_mult fits in 32 bits.
+static int tsc_usable = 0;
+static unsigned int tsc_khz = 0;
+static unsigned int tsc_mult = 0, tsc_shift = 0;
+static unsigned long long tsc_base = 0;
+
+// How every CPU's timer interrupt is driven
+enum event_mode {
+    EVENT_PERIODIC,                     // no TSC: PIT and local timers at TIMER_HZ
+    EVENT_PIT,                          // PIT channel 0, mode 0 (no APIC, one CPU)
+    EVENT_LAPIC,                        // local timer countdown
+    EVENT_TSC_DEADLINE                  // local timer in TSC-deadline mode
+};
+
+static const char *event_names[] = {
+    "periodic", "PIT one-shot", "local APIC one-shot", "local APIC TSC-deadline"
+};
+
+static enum event_mode event_mode = EVENT_PERIODIC;
+
+// ============================================================================
+// PIT
+// ============================================================================
+
+#define PIT_CH0      0x40
+#define PIT_CH2      0x42
+#define PIT_CMD      0x43
+#define PIT_GATE     0x61
+#define PIT_MAX_NS   54000000           // under the 16-bit counter's 54.9 ms
+#define CALIBRATE_MS 50
+
+static void timer_irq(struct interrupt_frame *frame) {
+    ticks++;
+    timer_event(frame);
+}
+
+static void pit_set_periodic(unsigned int hz) {
+    unsigned int divisor = PIT_FREQUENCY / hz;
+    outb(PIT_CMD, 0x34);                    // channel 0, lo/hi byte, mode 2 (rate generator)
+    outb(PIT_CH0, divisor & 0xFF);
+    outb(PIT_CH0, (divisor >> 8) & 0xFF);
+}
+
+// Writing the mode drops OUT until the count is loaded, so an unloaded
+// channel stays quiet
+static void pit_arm(unsigned int ns) {
+    unsigned int count = (unsigned int)div_u64_rem((unsigned long long)ns * PIT_FREQUENCY, 1000000000, 0);
+    outb(PIT_CMD, 0x30);                    // channel 0, lo/hi byte, mode 0 (interrupt on terminal count)
+    outb(PIT_CH0, count ? count & 0xFF : 1);
+    outb(PIT_CH0, (count >> 8) & 0xFF);
+}
+
+// The IRQ handler updates the 64-bit count in two halves; re-read until the
+// high word is stable so we never observe a torn value.
+unsigned long long timer_ticks() {
+    unsigned int hi, lo;
+    do {
+        hi = ticks >> 32;
+        lo = (unsigned int)ticks;
+    } while (hi != (unsigned int)(ticks >> 32));
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+// ============================================================================
+// TSC CALIBRATION
+// ============================================================================
+
+// Count TSC cycles across a CALIBRATE_MS one-shot on PIT channel 2. The
+// channel's OUT pin is readable through bit 5 of port 0x61, so this needs
+// no interrupts and runs before the IDT is live.
+static unsigned int calibrate_tsc_khz() {
+    unsigned int latch = PIT_FREQUENCY / (1000 / CALIBRATE_MS);
+
+    outb(PIT_GATE, (inb(PIT_GATE) & ~0x02) | 0x01);    // gate on, speaker off
+    outb(PIT_CMD, 0xB0);                    // channel 2, lo/hi byte, mode 0
+    outb(PIT_CH2, latch & 0xFF);
+    outb(PIT_CH2, (latch >> 8) & 0xFF);
+
+    unsigned long long start = rdtsc();
+    while (!(inb(PIT_GATE) & 0x20));
+    unsigned long long cycles = rdtsc() - start;
+
+    return (unsigned int)div_u64_rem(cycles, CALIBRATE_MS, 0);
+}
+
+static void tsc_set_scale(unsigned int khz) {
+    // Largest shift that keeps mult = (10^6 << shift) / khz below 2^32
+    for (tsc_shift = 32; tsc_shift > 0; tsc_shift--) {
+        unsigned long long mult = div_u64_rem(1000000ULL << tsc_shift, khz, 0);
+        if (!(mult >> 32)) { tsc_mult = (unsigned int)mult; break; }
+    }
+}
+
+// 64x32 multiply keeping the high bits, without a 128-bit intermediate
+static inline unsigned long long mul_u64_u32_shr(unsigned long long a, unsigned int mul, unsigned int shift) {
+    unsigned int ah = a >> 32, al = (unsigned int)a;
+    unsigned long long ret = ((unsigned long long)al * mul) >> shift;
+    if (ah) ret += ((unsigned long long)ah * mul) << (32 - shift);
+    return ret;
+}
+
+// ============================================================================
+// TIMING WHEEL
+// ============================================================================
+
+#define WHEEL_SLOT_BITS  6
+#define WHEEL_SLOTS      (1 << WHEEL_SLOT_BITS)
+#define WHEEL_SLOT_MASK  (WHEEL_SLOTS - 1)
+#define WHEEL_UNIT_SHIFT 10                 // 1024 ns
+#define WHEEL_EXPIRED    0xFF               // level of a timer waiting to run
+
+#define EVENT_MIN_NS     2000               // closest a one-shot is armed
+#define EVENT_MAX_NS     1000000000         // longest a CPU goes without an interrupt
+#define TICK_SLACK_NS    (TIMER_TICK_NS / 8) // a tick this close is taken early
+#define LATENESS_SAMPLES 256
+
+// One per CPU. The lock covers the wheel and the counters; 'armed' and
+// 'next_tick' belong to the CPU itself and change only with interrupts off.
+struct timer_base {
+    struct spinlock lock;
+    unsigned long long clk;             // wheel units; everything up to here has been handled
+    unsigned long long occupied[WHEEL_LEVELS];      // bit per non-empty slot
+    struct timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    struct timer *expired;              // due, waiting for their callbacks
+    int has_event;                      // this CPU takes timer interrupts
+    unsigned long long armed;           // when the one-shot fires
+    unsigned long long next_tick;       // when the scheduler is due a tick
+    unsigned long long start_ns;        // clock events started
+    unsigned int events, ticks, fired, cancelled;
+    unsigned int lateness[LATENESS_SAMPLES];        // ns past the deadline, a ring
+    unsigned int lateness_count;
+};
+
+static struct timer_base bases[MAX_CPUS];
+
+// Rounded up, so a timer never runs before its deadline
+static inline unsigned long long to_units(unsigned long long ns) {
+    return (ns + (1 << WHEEL_UNIT_SHIFT) - 1) >> WHEEL_UNIT_SHIFT;
+}
+
+// Callers hold base->lock
+
+static void link(struct timer **head, struct timer *t) {
+    t->next = *head;
+    if (*head) (*head)->pprev = &t->next;
+    *head = t;
+    t->pprev = head;
+}
+
+static void unlink(struct timer_base *base, struct timer *t) {
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    t->pprev = 0;
+    if (t->level != WHEEL_EXPIRED && !base->slots[t->level][t->slot])
+        base->occupied[t->level] &= ~(1ULL << t->slot);
+}
+
+static void link_expired(struct timer_base *base, struct timer *t) {
+    t->level = WHEEL_EXPIRED;
+    link(&base->expired, t);
+}
+
+// The lowest level whose 64 slots, counted from the wheel clock, reach the
+// expiry; level n slot i next comes up at the first multiple of 64^n after
+// the clock whose index is i. Beyond the top level it waits in the last
+// slot and is placed again from there.
+static void enqueue(struct timer_base *base, struct timer *t) {
+    unsigned long long when = to_units(t->expires);
+    if (when <= base->clk) { link_expired(base, t); return; }
+    unsigned int level = 0, shift = 0;
+    unsigned long long slot;
+    for (;; level++, shift += WHEEL_SLOT_BITS) {
+        if ((when >> shift) - (base->clk >> shift) < WHEEL_SLOTS) { slot = when >> shift; break; }
+        if (level == WHEEL_LEVELS - 1) { slot = (base->clk >> shift) + WHEEL_SLOTS - 1; break; }
+    }
+    t->level = level;
+    t->slot = slot & WHEEL_SLOT_MASK;
+    link(&base->slots[level][t->slot], t);
+    base->occupied[level] |= 1ULL << t->slot;
+}
+
+// __builtin_ctzll would call into libgcc on i386
+static inline unsigned int ctz64(unsigned long long v) {
+    unsigned int lo = (unsigned int)v;
+    return lo ? __builtin_ctz(lo) : 32 + __builtin_ctz((unsigned int)(v >> 32));
+}
+
+// Wheel time at which 'level' next needs attention: its first occupied
+// slot after the current one, going round. ~0 if the level is empty.
+static unsigned long long level_due(struct timer_base *base, unsigned int level) {
+    unsigned long long bits = base->occupied[level];
+    if (!bits) return ~0ULL;
+    unsigned int shift = level * WHEEL_SLOT_BITS;
+    unsigned long long pos = base->clk >> shift;
+    unsigned int start = (pos + 1) & WHEEL_SLOT_MASK;
+    if (start) bits = (bits >> start) | (bits << (WHEEL_SLOTS - start));
+    return (pos + 1 + ctz64(bits)) << shift;
+}
+
+// Bring the wheel up to 'now' (units). Each pass jumps straight to the
+// next slot that comes up, so a CPU back from a long idle pays for the
+// slots it has to empty, not for the time that went by. A higher level's
+// slot is emptied into the lower ones before level 0 is looked at.
+static void advance(struct timer_base *base, unsigned long long now) {
+    while (1) {
+        unsigned long long due[WHEEL_LEVELS], next = ~0ULL;
+        for (unsigned int level = 0; level < WHEEL_LEVELS; level++) {
+            due[level] = level_due(base, level);
+            if (due[level] < next) next = due[level];
+        }
+        if (next > now) break;
+        base->clk = next;
+
+        for (unsigned int level = WHEEL_LEVELS - 1; level > 0; level--) {
+            if (due[level] != next) continue;
+            unsigned int slot = (next >> (level * WHEEL_SLOT_BITS)) & WHEEL_SLOT_MASK;
+            struct timer *t = base->slots[level][slot];
+            base->slots[level][slot] = 0;
+            base->occupied[level] &= ~(1ULL << slot);
+            while (t) {
+                struct timer *following = t->next;
+                enqueue(base, t);
+                t = following;
+            }
+        }
+        if (due[0] == next) {
+            unsigned int slot = next & WHEEL_SLOT_MASK;
+            struct timer *t = base->slots[0][slot];
+            base->slots[0][slot] = 0;
+            base->occupied[0] &= ~(1ULL << slot);
+            while (t) {
+                struct timer *following = t->next;
+                link_expired(base, t);
+                t = following;
+            }
+        }
+    }
+    if (now > base->clk) base->clk = now;
+}
+
+// In ns; 0 if something is already due, ~0 if the wheel is empty
+static unsigned long long next_expiry(struct timer_base *base) {
+    if (base->expired) return 0;
+    unsigned long long next = ~0ULL;
+    for (unsigned int level = 0; level < WHEEL_LEVELS; level++) {
+        unsigned long long due = level_due(base, level);
+        if (due < next) next = due;
+    }
+    return next == ~0ULL ? next : next << WHEEL_UNIT_SHIFT;
+}
+
+// Callbacks run without the lock, one timer taken off the list at a time,
+// so they may add or cancel timers (themselves included)
+static void run_timers(struct timer_base *base, unsigned long long now) {
+    spin_lock(&base->lock);
+    advance(base, now >> WHEEL_UNIT_SHIFT);
+    while (base->expired) {
+        struct timer *t = base->expired;
+        unlink(base, t);
+        timer_fn_t fn = t->fn;
+        void *arg = t->arg;
+        unsigned long long late = now > t->expires ? now - t->expires : 0;
+        base->lateness[base->lateness_count++ % LATENESS_SAMPLES] = (late >> 32) ? 0xFFFFFFFF : (unsigned int)late;
+        base->fired++;
+        spin_unlock(&base->lock);
+        fn(arg);
+        spin_lock(&base->lock);
+    }
+    spin_unlock(&base->lock);
+}
+
+// A CPU without timer interrupts of its own (a periodic system whose
+// local timers never calibrated) leaves its timers to the boot CPU
+static struct timer_base *local_base() {
+    struct timer_base *base = &bases[this_cpu()->index];
+    return base->has_event ? base : &bases[0];
+}
+
+// ============================================================================
+// CLOCK EVENTS
+// ============================================================================
+
+// Calling CPU, interrupts off
+static void arm(struct timer_base *base, unsigned long long when, unsigned long long now) {
+    unsigned long long max = event_mode == EVENT_PIT ? PIT_MAX_NS : EVENT_MAX_NS;
+    if (when < now + EVENT_MIN_NS) when = now + EVENT_MIN_NS;
+    if (when > now + max) when = now + max;
+    unsigned int delta = (unsigned int)(when - now);
+    base->armed = when;
+    if (event_mode == EVENT_TSC_DEADLINE)
+        lapic_timer_arm_deadline(rdtsc() + div_u64_rem((unsigned long long)delta * tsc_khz, 1000000, 0));
+    else if (event_mode == EVENT_LAPIC) lapic_timer_arm(delta);
+    else if (event_mode == EVENT_PIT) pit_arm(delta);
+}
+
+// The next timer, and the next tick unless the scheduler can do without
+static void rearm(struct timer_base *base) {
+    unsigned long long now = now_ns();
+    spin_lock(&base->lock);
+    unsigned long long when = next_expiry(base);
+    spin_unlock(&base->lock);
+    if (base->next_tick < when && sched_needs_tick()) when = base->next_tick;
+    arm(base, when, now);
+}
+
+static void start_events(struct timer_base *base) {
+    unsigned long long now = now_ns();
+    base->clk = now >> WHEEL_UNIT_SHIFT;
+    base->start_ns = now;
+    base->next_tick = now + TIMER_TICK_NS;
+    base->has_event = 1;
+    if (event_mode == EVENT_LAPIC || event_mode == EVENT_TSC_DEADLINE)
+        lapic_timer_oneshot(event_mode == EVENT_TSC_DEADLINE);
+    if (event_mode != EVENT_PERIODIC) arm(base, base->next_tick, now);
+}
+
+void timer_event(struct interrupt_frame *frame) {
+    struct timer_base *base = &bases[this_cpu()->index];
+    unsigned long long now = now_ns();
+    base->events++;
+    run_timers(base, now);
+    if (event_mode == EVENT_PERIODIC || now + TICK_SLACK_NS >= base->next_tick) {
+        base->next_tick = now + TIMER_TICK_NS;
+        base->ticks++;
+        prof_sample(frame);
+        sched_tick();
+    }
+    if (event_mode != EVENT_PERIODIC) rearm(base);
+}
+
+void timer_resume_tick() {
+    if (event_mode == EVENT_PERIODIC) return;
+    struct timer_base *base = &bases[this_cpu()->index];
+    unsigned long long now = now_ns();
+    base->next_tick = now + TIMER_TICK_NS;
+    if (base->armed > base->next_tick) arm(base, base->next_tick, now);
+}
+
+// ============================================================================
+// PUBLIC API
+// ============================================================================
+
+unsigned long long now_ns() {
+    if (tsc_usable) return mul_u64_u32_shr(rdtsc() - tsc_base, tsc_mult, tsc_shift);
+    return timer_ticks() * (1000000000ULL / TIMER_HZ);
+}
+
+int timer_has_tsc() {
+    return tsc_usable;
+}
+
+unsigned int timer_tsc_khz() {
+    return tsc_khz;
+}
+
+// An earlier deadline than the one armed re-arms at once; otherwise the
+// interrupt already on its way picks the timer up
+void timer_add(struct timer *t, unsigned long long delay_ns, timer_fn_t fn, void *arg) {
+    timer_cancel(t);
+    unsigned int flags = irq_save();
+    struct timer_base *base = local_base();
+    unsigned long long now = now_ns();
+    spin_lock(&base->lock);
+    t->expires = now + delay_ns;
+    t->fn = fn;
+    t->arg = arg;
+    t->cpu = base - bases;
+    enqueue(base, t);
+    spin_unlock(&base->lock);
+    if (event_mode != EVENT_PERIODIC && t->expires < base->armed) arm(base, t->expires, now);
+    irq_restore(flags);
+}
+
+int timer_cancel(struct timer *t) {
+    if (!t->pprev) return 0;
+    struct timer_base *base = &bases[t->cpu];
+    unsigned int flags = spin_lock_irqsave(&base->lock);
+    int pending = t->pprev != 0;
+    if (pending) {
+        unlink(base, t);
+        base->cancelled++;
+    }
+    spin_unlock_irqrestore(&base->lock, flags);
+    return pending;
+}
+
+// Whatever the mode, every CPU ticks at TIMER_HZ until the scheduler is
+// running: sched_needs_tick() says yes before then
+void timer_init() {
+    if (cpu_has(CPU_FEATURE_TSC)) {
+        tsc_khz = calibrate_tsc_khz();
+        if (tsc_khz) {
+            tsc_set_scale(tsc_khz);
+            tsc_base = rdtsc();
+            tsc_usable = 1;
+        }
+    }
+
+    // One-shot needs a clock that runs between interrupts
+    if (tsc_usable && !apic_active()) event_mode = EVENT_PIT;
+    else if (tsc_usable) {
+        struct apic_info apic;
+        lapic_timer_calibrate();
+        apic_get_info(&apic);
+        if (cpu_has(CPU_FEATURE_TSC_DEADLINE)) event_mode = EVENT_TSC_DEADLINE;
+        else if (apic.lapic_timer_khz) event_mode = EVENT_LAPIC;
+    }
+
+    // The local timer's vector is wired up by smp_init(); the PIT only
+    // drives the boot CPU when there is no local timer to use
+    if (event_mode == EVENT_PERIODIC || event_mode == EVENT_PIT) irq_register(IRQ_TIMER, timer_irq);
+    else outb(PIT_CMD, 0x30);
+    if (event_mode == EVENT_PERIODIC) pit_set_periodic(TIMER_HZ);
+    start_events(&bases[0]);
+}
+
+void timer_init_ap() {
+    struct timer_base *base = &bases[this_cpu()->index];
+    if (event_mode == EVENT_PERIODIC && !lapic_timer_start(TIMER_HZ)) return;
+    start_events(base);
+}
+
+// ============================================================================
+// COMMANDS
+// ============================================================================
+
+static void print_lateness() {
+    unsigned int *samples = kmalloc(MAX_CPUS * LATENESS_SAMPLES * sizeof(unsigned int)), count = 0;
+    if (!samples) { print("\nOut of memory"); return; }
+    for (unsigned int i = 0; i < smp_cpu_possible(); i++) {
+        struct timer_base *base = &bases[i];
+        unsigned int flags = spin_lock_irqsave(&base->lock);
+        unsigned int n = base->lateness_count < LATENESS_SAMPLES ? base->lateness_count : LATENESS_SAMPLES;
+        memcpy(samples + count, base->lateness, n * sizeof(unsigned int));
+        spin_unlock_irqrestore(&base->lock, flags);
+        count += n;
+    }
+    if (!count) {
+        print("\nNo timers have fired yet");
+        kfree(samples);
+        return;
+    }
+
+    bench_sort(samples, count);
+    static const unsigned int percentiles[] = { 50, 90, 99 };
+    kprintf("\nLateness of the last %u timers (us): min %u.%03u", count, samples[0] / 1000, samples[0] % 1000);
+    for (unsigned int i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+        unsigned int v = samples[count * percentiles[i] / 100];
+        kprintf("  p%u %u.%03u", percentiles[i], v / 1000, v % 1000);
+    }
+    kprintf("  max %u.%03u", samples[count - 1] / 1000, samples[count - 1] % 1000);
+    kfree(samples);
+}
+
+// A periodic tick would have interrupted each CPU TIMER_HZ times a second
+// since its clock events started; what it did not take is what was avoided
+void cmd_timerstat(int argc, char **argv) {
+    kprintf("\n=== TIMERS ===\nClock events: %s", event_names[event_mode]);
+    if (event_mode == EVENT_PERIODIC) kprintf(" at %u Hz", TIMER_HZ);
+    kprintf("\nWheel: %u levels of %u slots, %u ns units", WHEEL_LEVELS, WHEEL_SLOTS, 1 << WHEEL_UNIT_SHIFT);
+
+    print("\n\n CPU  Interrupts      Ticks   Periodic     Avoided      Fired  Cancelled");
+    unsigned long long now = now_ns();
+    for (unsigned int i = 0; i < smp_cpu_possible(); i++) {
+        struct timer_base *base = &bases[i];
+        if (!base->has_event) continue;
+        unsigned int periodic = (unsigned int)div_u64_rem(now - base->start_ns, TIMER_TICK_NS, 0);
+        unsigned int avoided = periodic > base->events ? periodic - base->events : 0;
+        unsigned int pct = periodic ? (unsigned int)div_u64_rem((unsigned long long)avoided * 100, periodic, 0) : 0;
+        kprintf("\n%4u %11u %10u %10u %10u %3u%% %9u %10u", i, base->events, base->ticks, periodic, avoided, pct,
+                base->fired, base->cancelled);
+    }
+    print_lateness();
+}
@@ -0,0 +1,73 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "interrupts.h"
+
+// Clock: when the CPU has a TSC it is calibrated against PIT channel 2 at
+// boot and becomes the monotonic clock source; otherwise now_ns() falls
+// back to counting PIT ticks.
+//
+// Clock events: with a TSC, each CPU's timer interrupt is one-shot, armed
+// for the earlier of its next kernel timer and, while it has threads to
+// run, its next scheduler tick (TIMER_HZ). The local APIC timer is used in
+// TSC-deadline mode where the CPU has it, else counting down; without an
+// APIC (one CPU) PIT channel 0 runs in mode 0. A CPU with nothing to run
+// stops ticking and sleeps in hlt until a timer is due. Without a TSC the
+// PIT (boot CPU) and local timers (the others) stay periodic at TIMER_HZ.
+//
+// Kernel timers sit in a per-CPU hierarchical timing wheel: WHEEL_LEVELS
+// levels of 64 slots, a level-n slot spanning 64^n units of 1024 ns. Adding
+// or cancelling is a list insert or unlink and one bitmap bit. A far timer
+// waits in a coarse slot and drops a level whenever that slot comes up, so
+// it moves at most WHEEL_LEVELS - 1 times before it runs.
+#define TIMER_HZ 1000
+#define TIMER_TICK_NS (1000000000 / TIMER_HZ)
+#define PIT_FREQUENCY 1193182
+
+#define WHEEL_LEVELS 6
+
+static inline unsigned long long rdtsc() {
+    unsigned int lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+typedef void (*timer_fn_t)(void *arg);
+
+struct timer {
+    struct timer *next, **pprev;        // slot or expired list; pprev is 0 unless pending
+    unsigned long long expires;         // now_ns() deadline
+    timer_fn_t fn;
+    void *arg;
+    unsigned int cpu;                   // whose wheel holds it
+    unsigned char level, slot;
+};
+
+void timer_init();
+unsigned long long timer_ticks();
+unsigned long long now_ns();
+
+// Application processor, before it enables interrupts: start its clock events
+void timer_init_ap();
+
+// Run fn(arg) once, at least 'delay_ns' from now, in the calling CPU's
+// timer interrupt (interrupts off, so keep it short). Start from a zeroed
+// struct timer; adding a pending timer moves it. The struct stays the
+// caller's and must not go away while pending.
+void timer_add(struct timer *t, unsigned long long delay_ns, timer_fn_t fn, void *arg);
+
+// 1 if the timer was pending; 0 if it has run or is running elsewhere
+int timer_cancel(struct timer *t);
+
+// Every CPU's timer interrupt: run due timers, tick the scheduler, re-arm
+void timer_event(struct interrupt_frame *frame);
+
+// From the scheduler, interrupts off: this CPU is leaving idle, so its
+// tick (stopped while idle) starts again
+void timer_resume_tick();
+
+// Clock source details for uptime/sysinfo
+int timer_has_tsc();
+unsigned int timer_tsc_khz();
+
+#endif
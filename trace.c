@@ -0,0 +1,126 @@
+#include "kernel.h"
+#include "heap.h"
+#include "serial.h"
+#include "commands.h"
+#include "smp.h"
+#include "trace.h"
+
+#define TRACE_LINE 192
+
+// One cache line per ring header so CPUs never share a written line
+struct trace_ring {
+    struct trace_event *events;
+    unsigned int head;                  // total events ever claimed
+} __attribute__((aligned(64)));
+
+volatile int trace_enabled = 0;
+static struct trace_ring rings[MAX_CPUS];
+
+// ============================================================================
+// RECORDING
+// ============================================================================
+
+// A thread preempted between reading this_cpu() and claiming its slot may
+// finish on another CPU; the atomic add keeps the two writers apart
+void trace_record(const char *name, unsigned int arg, unsigned long long start) {
+    unsigned long long end = rdtsc();
+    struct trace_ring *ring = &rings[this_cpu()->index];
+    if (!ring->events) return;
+    unsigned int slot = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED) & (TRACE_RING_EVENTS - 1);
+    struct trace_event *event = &ring->events[slot];
+    event->start = start;
+    event->cycles = end - start > 0xFFFFFFFF ? 0xFFFFFFFF : (unsigned int)(end - start);
+    event->name = name;
+    event->arg = arg;
+}
+
+static int trace_start() {
+    if (!timer_has_tsc()) { print("\nTracing needs a TSC"); return 0; }
+    for (unsigned int i = 0; i < smp_cpu_possible() && i < MAX_CPUS; i++) {
+        if (rings[i].events) continue;
+        rings[i].events = kmalloc(TRACE_RING_EVENTS * sizeof(struct trace_event));
+        if (!rings[i].events) { print("\nOut of memory"); return 0; }
+    }
+    __atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static void trace_clear() {
+    for (unsigned int i = 0; i < MAX_CPUS; i++) rings[i].head = 0;
+}
+
+// ============================================================================
+// CHROME TRACE OUTPUT
+// ============================================================================
+
+// Microseconds with three decimals, from TSC cycles. Whole milliseconds
+// first: cycles * 1000000 would overflow after about an hour at 5 GHz.
+static void format_us(char *out, unsigned int size, unsigned long long cycles) {
+    unsigned int khz = timer_tsc_khz(), rem;
+    unsigned long long ms = div_u64_rem(cycles, khz, &rem);
+    unsigned int ns = div_u64_rem((unsigned long long)rem * 1000000, khz, 0);
+    ksnprintf(out, size, "%llu.%03u", ms * 1000 + ns / 1000, ns % 1000);
+}
+
+// Serial only: a full trace would scroll the whole history off the
+// screen. The JSON starts and ends on its own lines so it can be cut out
+// of a captured log with sed.
+static unsigned int trace_dump() {
+    char line[TRACE_LINE], ts[24], dur[24];
+    unsigned long long base = 0;
+    unsigned int written = 0;
+
+    // Timestamps count from the oldest event still held
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct trace_ring *ring = &rings[cpu];
+        if (!ring->events || !ring->head) continue;
+        unsigned int first = ring->head > TRACE_RING_EVENTS ? ring->head - TRACE_RING_EVENTS : 0;
+        unsigned long long start = ring->events[first & (TRACE_RING_EVENTS - 1)].start;
+        if (!base || start < base) base = start;
+    }
+
+    serial_write("\n{\"traceEvents\":[\n");
+    serial_write("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"kernel\"}}");
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct trace_ring *ring = &rings[cpu];
+        if (!ring->events || !ring->head) continue;
+        ksnprintf(line, sizeof(line), ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,"
+                  "\"args\":{\"name\":\"CPU %u\"}}", cpu, cpu);
+        serial_write(line);
+        unsigned int first = ring->head > TRACE_RING_EVENTS ? ring->head - TRACE_RING_EVENTS : 0;
+        for (unsigned int i = first; i != ring->head; i++) {
+            const struct trace_event *e = &ring->events[i & (TRACE_RING_EVENTS - 1)];
+            format_us(ts, sizeof(ts), e->start - base);
+            format_us(dur, sizeof(dur), e->cycles);
+            ksnprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,"
+                      "\"ts\":%s,\"dur\":%s,\"args\":{\"arg\":%u}}", e->name, cpu, ts, dur, e->arg);
+            serial_write(line);
+            written++;
+        }
+    }
+    serial_write("\n],\"displayTimeUnit\":\"ns\"}\n");
+    serial_flush();
+    return written;
+}
+
+void cmd_trace(int argc, char **argv) {
+    (void)argc;
+    if (strcmp(argv[1], "start") == 0) {
+        if (trace_start()) kprintf("\nTracing on %u CPUs, %u events each", smp_cpu_count(), TRACE_RING_EVENTS);
+    } else if (strcmp(argv[1], "stop") == 0) {
+        __atomic_store_n(&trace_enabled, 0, __ATOMIC_RELEASE);
+        print("\nTracing stopped");
+    } else if (strcmp(argv[1], "clear") == 0) {
+        trace_clear();
+        print("\nTrace cleared");
+    } else if (strcmp(argv[1], "dump") == 0) {
+        if (!serial_present()) { print("\nNo serial port"); return; }
+        // Stop first so the rings hold still, and so print() (itself a
+        // tracepoint) does not add to them while they are written out
+        int was_enabled = trace_enabled;
+        __atomic_store_n(&trace_enabled, 0, __ATOMIC_RELEASE);
+        unsigned int written = trace_dump();
+        kprintf("\n%u events written to COM1 as Chrome trace JSON", written);
+        if (was_enabled) trace_start();
+    } else print("\nUsage: trace start|stop|clear|dump");
+}
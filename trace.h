@@ -0,0 +1,41 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "timer.h"
+
+// Event tracer. Static tracepoints record spans (a name, one argument,
+// start TSC and length) into a ring per CPU; a full ring overwrites its
+// oldest events, so the rings always hold the most recent history. A slot
+// is claimed with one atomic add on the ring's head and no lock is taken
+// anywhere, so tracepoints are safe in interrupt handlers. `trace dump`
+// writes the rings to COM1 as Chrome trace JSON (chrome://tracing,
+// Perfetto).
+//
+// Instrumenting a span:
+//     unsigned long long t = trace_begin();
+//     ...
+//     trace_end("name", arg, t);
+// While tracing is off, trace_begin() is one load and a branch.
+
+#define TRACE_RING_EVENTS 4096          // per CPU, power of two
+
+struct trace_event {
+    unsigned long long start;           // TSC
+    unsigned int cycles;
+    const char *name;                   // static string
+    unsigned int arg;
+};
+
+extern volatile int trace_enabled;
+
+static inline unsigned long long trace_begin() {
+    return trace_enabled ? rdtsc() : 0;
+}
+
+void trace_record(const char *name, unsigned int arg, unsigned long long start);
+
+static inline void trace_end(const char *name, unsigned int arg, unsigned long long start) {
+    if (start) trace_record(name, arg, start);
+}
+
+#endif
@@ -0,0 +1,70 @@
+bits 16
+section .text
+
+; Application processor entry. smp_start_aps() copies trampoline_start ..
+; trampoline_end to SMP_TRAMPOLINE (0x8000) and fills in the parameters
+; below; a STARTUP IPI then starts the CPU in real mode at 0x0800:0000.
+; The code runs at the copy, so addresses are taken relative to it.
+
+TRAMPOLINE equ 0x8000                   ; must match SMP_TRAMPOLINE in smp.h
+%define REL(x) ((x) - trampoline_start)
+%define ABS(x) (TRAMPOLINE + REL(x))
+
+    global trampoline_start
+    global trampoline_end
+    global trampoline_gdtr
+    global trampoline_cr3
+    global trampoline_cr4
+    global trampoline_stack
+    global trampoline_cpu
+    extern ap_main
+
+trampoline_start:
+    cli
+    cld
+    mov ax, cs
+    mov ds, ax
+    o32 lgdt [REL(trampoline_gdtr)]     ; the kernel's GDT, 32-bit base
+    mov eax, cr0
+    or eax, 1                           ; PE
+    mov cr0, eax
+    jmp dword 0x08:ABS(.protected)
+
+bits 32
+.protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; Same paging setup as the boot CPU: CR4 (PSE) before CR3, then PG and
+    ; WP with the caches on
+    mov eax, [ABS(trampoline_cr4)]
+    mov cr4, eax
+    mov eax, [ABS(trampoline_cr3)]
+    mov cr3, eax
+    mov eax, cr0
+    or eax, 0x80010000
+    and eax, 0x9FFFFFFF                 ; clear CD and NW
+    mov cr0, eax
+
+    mov esp, [ABS(trampoline_stack)]
+    push dword [ABS(trampoline_cpu)]
+    mov eax, ap_main                    ; absolute: the copy is not where we were linked
+    call eax                            ; ap_main(cpu index); never returns
+.halt:
+    hlt
+    jmp .halt
+
+    align 4
+trampoline_gdtr:
+    dw 0
+    dd 0
+    align 4
+trampoline_cr3:     dd 0
+trampoline_cr4:     dd 0
+trampoline_stack:   dd 0
+trampoline_cpu:     dd 0
+trampoline_end:
@@ -0,0 +1,278 @@
+#include "kernel.h"
+#include "heap.h"
+#include "commands.h"
+#include "block.h"
+#include "vfs.h"
+#include "ext2.h"
+#include "initrd.h"
+
+#define CAT_CHUNK 512
+
+static struct vfs_mount *mounts = 0, *mounts_tail = 0;
+
+// ============================================================================
+// MOUNTS
+// ============================================================================
+
+int vfs_mount(const char *path, const char *fs_name, const char *source, const struct vfs_ops *ops, void *fs) {
+    if (path[0] != '/' || strlen(path) >= VFS_MOUNT_PATH) return -VFS_EINVAL;
+    struct vfs_mount *mount = kmalloc(sizeof(struct vfs_mount));
+    if (!mount) return -VFS_ENOMEM;
+    strlcpy(mount->path, path, sizeof(mount->path));
+    size_t len = strlen(mount->path);
+    while (len > 1 && mount->path[len - 1] == '/') mount->path[--len] = '\0';
+    mount->fs_name = fs_name;
+    strlcpy(mount->source, source, sizeof(mount->source));
+    mount->ops = ops;
+    mount->fs = fs;
+    mount->next = 0;
+    if (mounts_tail) mounts_tail->next = mount;
+    else mounts = mount;
+    mounts_tail = mount;
+    return 0;
+}
+
+struct vfs_mount *vfs_mounts() {
+    return mounts;
+}
+
+// The mount with the longest path that is 'path' or a directory above it;
+// '*rest' is set to what is left of the path below the mount point
+static struct vfs_mount *find_mount(const char *path, const char **rest) {
+    struct vfs_mount *best = 0;
+    size_t best_len = 0;
+    for (struct vfs_mount *mount = mounts; mount; mount = mount->next) {
+        size_t len = strlen(mount->path);
+        if (len == 1) len = 0;          // "/" matches everything
+        if (strncmp(path, mount->path, len) != 0 || (path[len] != '/' && path[len] != '\0')) continue;
+        if (!best || len > best_len) {
+            best = mount;
+            best_len = len;
+        }
+    }
+    *rest = path + best_len;
+    return best;
+}
+
+// Each symlink met rewrites the path (target plus the unresolved rest)
+// into the other buffer and the walk starts over from the top
+int vfs_resolve(const char *path, int follow, struct vfs_node *out) {
+    char buffers[2][VFS_PATH_MAX], target[VFS_PATH_MAX];
+    if (strlcpy(buffers[0], path, VFS_PATH_MAX) >= VFS_PATH_MAX) return -VFS_ENAMETOOLONG;
+    char *current = buffers[0];
+
+    for (int depth = 0; ; depth++) {
+        if (current[0] != '/') return -VFS_EINVAL;
+        const char *p;
+        struct vfs_mount *mount = find_mount(current, &p);
+        if (!mount) return -VFS_ENOENT;
+        struct vfs_node node;
+        int err = mount->ops->root(mount, &node);
+        if (err) return err;
+
+        int restarted = 0;
+        while (!restarted) {
+            while (*p == '/') p++;
+            if (!*p) break;
+            const char *name = p;
+            while (*p && *p != '/') p++;
+            if (p - name > VFS_NAME_MAX) return -VFS_ENAMETOOLONG;
+            if (node.type != VFS_TYPE_DIR) return -VFS_ENOTDIR;
+            struct vfs_node next;
+            err = mount->ops->lookup(&node, name, p - name, &next);
+            if (err) return err;
+
+            const char *after = p;
+            while (*after == '/') after++;
+            if (next.type == VFS_TYPE_SYMLINK && (*after || follow)) {
+                if (depth == VFS_SYMLINK_DEPTH) return -VFS_ELOOP;
+                int len = mount->ops->read(&next, 0, target, VFS_PATH_MAX - 1);
+                if (len < 0) return len;
+                target[len] = '\0';
+                char *other = current == buffers[0] ? buffers[1] : buffers[0];
+                // An absolute target replaces everything before it; a
+                // relative one is taken from the link's directory
+                int prefix = target[0] == '/' ? 0 : name - current;
+                if (ksnprintf(other, VFS_PATH_MAX, "%.*s%s%s", prefix, current, target, p) >= VFS_PATH_MAX)
+                    return -VFS_ENAMETOOLONG;
+                current = other;
+                restarted = 1;
+                break;
+            }
+            node = next;
+        }
+        if (!restarted) {
+            *out = node;
+            return 0;
+        }
+    }
+}
+
+int vfs_get(struct vfs_mount *mount, unsigned int ino, struct vfs_node *out) {
+    return mount->ops->get(mount, ino, out);
+}
+
+int vfs_read(const struct vfs_node *node, unsigned long long offset, void *buffer, unsigned int len) {
+    if (node->type == VFS_TYPE_DIR) return -VFS_EISDIR;
+    return node->mount->ops->read(node, offset, buffer, len);
+}
+
+int vfs_readdir(const struct vfs_node *dir, vfs_dir_fn fn, void *arg) {
+    if (dir->type != VFS_TYPE_DIR) return -VFS_ENOTDIR;
+    return dir->mount->ops->readdir(dir, fn, arg);
+}
+
+int vfs_stat(const struct vfs_node *node, struct vfs_stat *out) {
+    return node->mount->ops->stat(node, out);
+}
+
+const char *vfs_strerror(int error) {
+    switch (-error) {
+    case VFS_ENOENT: return "No such file or directory";
+    case VFS_EIO: return "I/O error";
+    case VFS_ENOMEM: return "Out of memory";
+    case VFS_ENOTDIR: return "Not a directory";
+    case VFS_EISDIR: return "Is a directory";
+    case VFS_EINVAL: return "Invalid argument";
+    case VFS_ENAMETOOLONG: return "Name too long";
+    case VFS_ELOOP: return "Too many levels of symbolic links";
+    default: return "Unknown error";
+    }
+}
+
+// The first ext2 volume becomes the root; any others appear under
+// /<device>. The initrd goes at /initrd, or at the root without a disk.
+void vfs_init() {
+    char path[VFS_MOUNT_PATH];
+    for (unsigned int i = 0; i < block_device_count(); i++) {
+        struct block_device *dev = block_get_device(i);
+        if (mounts) ksnprintf(path, sizeof(path), "/%s", dev->name);
+        else strlcpy(path, "/", sizeof(path));
+        ext2_mount(dev, path);
+    }
+    initrd_mount(mounts ? "/initrd" : "/");
+}
+
+// ============================================================================
+// COMMANDS
+// ============================================================================
+
+// Paths without a leading slash are taken from the root
+static int resolve_arg(const char *arg, int follow, struct vfs_node *node, char *path) {
+    if (ksnprintf(path, VFS_PATH_MAX, "%s%s", arg[0] == '/' ? "" : "/", arg) >= VFS_PATH_MAX) {
+        print("\nPath too long");
+        return 0;
+    }
+    if (!mounts) {
+        print("\nNo filesystem mounted");
+        return 0;
+    }
+    int err = vfs_resolve(path, follow, node);
+    if (err) {
+        kprintf("\n%s: %s", path, vfs_strerror(err));
+        return 0;
+    }
+    return 1;
+}
+
+static void mode_string(unsigned int mode, char *out) {
+    static const char types[] = "?pc?d?b?-?l?s???";
+    static const char rwx[] = "rwx";
+    out[0] = types[(mode >> 12) & 0xF];
+    for (int i = 0; i < 9; i++) out[1 + i] = (mode & (0400 >> i)) ? rwx[i % 3] : '-';
+    out[10] = '\0';
+}
+
+// Days since 1970-01-01 to a civil date (proleptic Gregorian)
+static void format_time(char *out, unsigned int size, unsigned int seconds) {
+    unsigned int days = seconds / 86400, rem = seconds % 86400;
+    unsigned int z = days + 719468, era = z / 146097, doe = z - era * 146097;
+    unsigned int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned int doy = doe - (365 * yoe + yoe / 4 - yoe / 100), mp = (5 * doy + 2) / 153;
+    unsigned int day = doy - (153 * mp + 2) / 5 + 1, month = mp < 10 ? mp + 3 : mp - 9;
+    unsigned int year = yoe + era * 400 + (month <= 2);
+    ksnprintf(out, size, "%u-%02u-%02u %02u:%02u:%02u", year, month, day, rem / 3600, rem / 60 % 60, rem % 60);
+}
+
+static void print_entry(const struct vfs_node *node, const char *name, unsigned int name_len) {
+    struct vfs_stat st;
+    char mode[11];
+    if (vfs_stat(node, &st)) {
+        kprintf("\n?????????? %.*s", (int)name_len, name);
+        return;
+    }
+    mode_string(st.mode, mode);
+    kprintf("\n%s %3u %10llu  %.*s", mode, st.links, st.size, (int)name_len, name);
+    if (st.type == VFS_TYPE_SYMLINK) {
+        char target[VFS_PATH_MAX];
+        int len = vfs_read(node, 0, target, sizeof(target) - 1);
+        if (len >= 0) kprintf(" -> %.*s", len, target);
+    }
+}
+
+static int ls_entry(void *arg, const struct vfs_dirent *entry) {
+    const struct vfs_node *dir = arg;
+    struct vfs_node node;
+    if (vfs_get(dir->mount, entry->ino, &node)) kprintf("\n?????????? %.*s", (int)entry->name_len, entry->name);
+    else print_entry(&node, entry->name, entry->name_len);
+    return 0;
+}
+
+void cmd_ls(int argc, char **argv) {
+    char path[VFS_PATH_MAX];
+    struct vfs_node node;
+    if (!resolve_arg(argc == 2 ? argv[1] : "/", 1, &node, path)) return;
+    if (node.type != VFS_TYPE_DIR) {
+        const char *name = path + strlen(path);
+        while (name > path && name[-1] != '/') name--;
+        print_entry(&node, name, strlen(name));
+        return;
+    }
+    int err = vfs_readdir(&node, ls_entry, &node);
+    if (err) kprintf("\n%s: %s", path, vfs_strerror(err));
+}
+
+void cmd_cat(int argc, char **argv) {
+    char path[VFS_PATH_MAX];
+    struct vfs_node node;
+    if (!resolve_arg(argv[1], 1, &node, path)) return;
+    if (node.type == VFS_TYPE_DIR) { kprintf("\n%s: %s", path, vfs_strerror(-VFS_EISDIR)); return; }
+
+    char chunk[CAT_CHUNK];
+    unsigned long long offset = 0;
+    print("\n");
+    for (;;) {
+        int len = vfs_read(&node, offset, chunk, sizeof(chunk));
+        if (len < 0) { kprintf("\n%s: %s", path, vfs_strerror(len)); return; }
+        if (!len) break;
+        console_write(chunk, len);
+        offset += len;
+    }
+}
+
+void cmd_stat(int argc, char **argv) {
+    char path[VFS_PATH_MAX];
+    struct vfs_node node;
+    if (!resolve_arg(argv[1], 0, &node, path)) return;
+    struct vfs_stat st;
+    int err = vfs_stat(&node, &st);
+    if (err) { kprintf("\n%s: %s", path, vfs_strerror(err)); return; }
+
+    static const char *type_names[] = { "unknown", "regular file", "directory", "symbolic link", "special file" };
+    char mode[11], atime[24], mtime[24], ctime[24];
+    mode_string(st.mode, mode);
+    format_time(atime, sizeof(atime), st.atime);
+    format_time(mtime, sizeof(mtime), st.mtime);
+    format_time(ctime, sizeof(ctime), st.ctime);
+    kprintf("\n  File: %s", path);
+    if (st.type == VFS_TYPE_SYMLINK) {
+        char target[VFS_PATH_MAX];
+        int len = vfs_read(&node, 0, target, sizeof(target) - 1);
+        if (len >= 0) kprintf(" -> %.*s", len, target);
+    }
+    kprintf("\n  Size: %-12llu Blocks: %-8u %s", st.size, st.blocks, type_names[st.type <= 4 ? st.type : 0]);
+    kprintf("\nDevice: %s (%s at %s)  Inode: %u  Links: %u", node.mount->source, node.mount->fs_name,
+            node.mount->path, st.ino, st.links);
+    kprintf("\nAccess: (%04o/%s)  Uid: %u  Gid: %u", st.mode & 07777, mode, st.uid, st.gid);
+    kprintf("\nAccess: %s\nModify: %s\nChange: %s", atime, mtime, ctime);
+}
@@ -0,0 +1,98 @@
+#ifndef VFS_H
+#define VFS_H
+
+// Virtual filesystem switch. Filesystems are mounted at absolute paths;
+// a path is resolved against the mount with the longest matching prefix
+// and then walked one component at a time through that filesystem's
+// lookup(), following symbolic links. Nodes are small value handles
+// filled in by the filesystem, so nothing is reference counted or
+// cached here; the page cache underneath makes repeated walks cheap.
+// Everything is read-only.
+
+#define VFS_NAME_MAX 255
+#define VFS_PATH_MAX 256
+#define VFS_MOUNT_PATH 32
+#define VFS_SYMLINK_DEPTH 8
+
+#define VFS_TYPE_FILE    1
+#define VFS_TYPE_DIR     2
+#define VFS_TYPE_SYMLINK 3
+#define VFS_TYPE_OTHER   4
+
+// Errors, returned negated
+#define VFS_ENOENT  2
+#define VFS_EIO     5
+#define VFS_ENOMEM  12
+#define VFS_ENOTDIR 20
+#define VFS_EISDIR  21
+#define VFS_EINVAL  22
+#define VFS_ENAMETOOLONG 36
+#define VFS_ELOOP   40
+
+struct vfs_mount;
+
+struct vfs_node {
+    struct vfs_mount *mount;
+    unsigned int ino;
+    unsigned int type;                  // VFS_TYPE_*
+    unsigned long long size;
+    const void *data;                   // filesystem's own use
+};
+
+struct vfs_stat {
+    unsigned int ino, type;
+    unsigned int mode;                  // permission bits and file type, as in ext2
+    unsigned int links, uid, gid;
+    unsigned long long size;
+    unsigned int blocks;                // 512-byte units allocated
+    unsigned int atime, mtime, ctime;   // seconds since 1970
+};
+
+struct vfs_dirent {
+    const char *name;                   // not terminated
+    unsigned int name_len;
+    unsigned int ino;
+    unsigned int type;                  // VFS_TYPE_*, 0 if the directory does not say
+};
+
+// Return nonzero to stop the walk
+typedef int (*vfs_dir_fn)(void *arg, const struct vfs_dirent *entry);
+
+struct vfs_ops {
+    int (*root)(struct vfs_mount *mount, struct vfs_node *out);
+    int (*get)(struct vfs_mount *mount, unsigned int ino, struct vfs_node *out);
+    int (*lookup)(const struct vfs_node *dir, const char *name, unsigned int len, struct vfs_node *out);
+    // Bytes read, 0 at the end, or a negative error. On a symlink: the target.
+    int (*read)(const struct vfs_node *node, unsigned long long offset, void *buffer, unsigned int len);
+    int (*readdir)(const struct vfs_node *dir, vfs_dir_fn fn, void *arg);
+    int (*stat)(const struct vfs_node *node, struct vfs_stat *out);
+};
+
+struct vfs_mount {
+    char path[VFS_MOUNT_PATH];
+    const char *fs_name;
+    char source[16];
+    const struct vfs_ops *ops;
+    void *fs;
+    struct vfs_mount *next;
+};
+
+// Mount every filesystem found (after block_init, bcache_init and
+// initrd_init, with interrupts on: probing reads the disks)
+void vfs_init();
+
+int vfs_mount(const char *path, const char *fs_name, const char *source, const struct vfs_ops *ops, void *fs);
+struct vfs_mount *vfs_mounts();
+
+// Resolve an absolute path; the last component is followed if it is a
+// symlink and 'follow' is set. 0 or a negative error.
+int vfs_resolve(const char *path, int follow, struct vfs_node *out);
+
+int vfs_get(struct vfs_mount *mount, unsigned int ino, struct vfs_node *out);
+int vfs_read(const struct vfs_node *node, unsigned long long offset, void *buffer, unsigned int len);
+int vfs_readdir(const struct vfs_node *dir, vfs_dir_fn fn, void *arg);
+int vfs_stat(const struct vfs_node *node, struct vfs_stat *out);
+
+const char *vfs_strerror(int error);
+
+#endif
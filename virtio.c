@@ -0,0 +1,75 @@
+#include "kernel.h"
+#include "pmm.h"
+#include "virtio.h"
+
+unsigned int virtio_begin(unsigned short io, unsigned int wanted) {
+    outb(io + VIRTIO_STATUS, 0);        // reset
+    outb(io + VIRTIO_STATUS, VIRTIO_ST_ACKNOWLEDGE);
+    outb(io + VIRTIO_STATUS, VIRTIO_ST_ACKNOWLEDGE | VIRTIO_ST_DRIVER);
+    unsigned int features = inl(io + VIRTIO_HOST_FEATURES) & wanted;
+    outl(io + VIRTIO_GUEST_FEATURES, features);
+    return features;
+}
+
+void virtio_driver_ok(unsigned short io) {
+    outb(io + VIRTIO_STATUS, VIRTIO_ST_ACKNOWLEDGE | VIRTIO_ST_DRIVER | VIRTIO_ST_DRIVER_OK);
+}
+
+static unsigned int ring_bytes(unsigned int size, unsigned int *used_offset) {
+    unsigned int bytes = size * sizeof(struct vring_desc) + 6 + size * 2;
+    *used_offset = (bytes + VRING_ALIGN - 1) & ~(VRING_ALIGN - 1);
+    return *used_offset + 6 + size * sizeof(struct vring_used_elem);
+}
+
+int virtqueue_setup(struct virtqueue *vq, unsigned short io, unsigned short index) {
+    outw(io + VIRTIO_QUEUE_SELECT, index);
+    vq->io = io;
+    vq->index = index;
+    vq->size = inw(io + VIRTIO_QUEUE_SIZE);
+    if (!vq->size || (vq->size & (vq->size - 1))) return 0;
+
+    unsigned int used_offset, pages = (ring_bytes(vq->size, &used_offset) + PAGE_SIZE - 1) / PAGE_SIZE;
+    unsigned int ring = pmm_alloc_frames(pages);
+    if (!ring) return 0;
+    memset((void *)ring, 0, pages * PAGE_SIZE);
+    vq->desc = (struct vring_desc *)ring;
+    vq->avail = (struct vring_avail *)(ring + vq->size * sizeof(struct vring_desc));
+    vq->used = (struct vring_used *)(ring + used_offset);
+    for (unsigned int i = 0; i < vq->size; i++) vq->desc[i].next = i + 1;
+    vq->free_head = 0;
+    vq->free_count = vq->size;
+    vq->last_used = 0;
+    outl(io + VIRTIO_QUEUE_PFN, ring / PAGE_SIZE);
+    return 1;
+}
+
+void virtqueue_release(struct virtqueue *vq) {
+    if (!vq->desc) return;
+    unsigned int used_offset, pages = (ring_bytes(vq->size, &used_offset) + PAGE_SIZE - 1) / PAGE_SIZE;
+    outw(vq->io + VIRTIO_QUEUE_SELECT, vq->index);
+    outl(vq->io + VIRTIO_QUEUE_PFN, 0);
+    pmm_free_frames((unsigned int)vq->desc, pages);
+    vq->desc = 0;
+}
+
+unsigned int virtqueue_pop_used(struct virtqueue *vq, unsigned short *head) {
+    asm volatile("" ::: "memory");
+    volatile struct vring_used_elem *elem = &vq->used->ring[vq->last_used & (vq->size - 1)];
+    unsigned short d = elem->id, count = 1;
+    unsigned int len = elem->len;
+    vq->last_used++;
+    *head = d;
+    while (vq->desc[d].flags & VRING_DESC_F_NEXT) {
+        d = vq->desc[d].next;
+        count++;
+    }
+    vq->desc[d].next = vq->free_head;
+    vq->free_head = *head;
+    vq->free_count += count;
+    return len;
+}
+
+void virtqueue_kick(struct virtqueue *vq) {
+    asm volatile("lock; addl $0, (%%esp)" ::: "memory");
+    if (!(vq->used->flags & VRING_USED_F_NO_NOTIFY)) outw(vq->io + VIRTIO_QUEUE_NOTIFY, vq->index);
+}
@@ -0,0 +1,113 @@
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+// Legacy (transitional) virtio over PCI, shared by virtio-blk and
+// virtio-net: registers in the I/O BAR0, and split virtqueues whose
+// descriptor table, available ring and used ring sit in contiguous frames
+// given to the device by page number. Free descriptors are linked through
+// 'next', so a chain is built in place along the free list.
+
+#define VIRTIO_VENDOR 0x1AF4
+
+// Legacy PCI registers (offsets from BAR0)
+#define VIRTIO_HOST_FEATURES  0x00
+#define VIRTIO_GUEST_FEATURES 0x04
+#define VIRTIO_QUEUE_PFN      0x08
+#define VIRTIO_QUEUE_SIZE     0x0C
+#define VIRTIO_QUEUE_SELECT   0x0E
+#define VIRTIO_QUEUE_NOTIFY   0x10
+#define VIRTIO_STATUS         0x12
+#define VIRTIO_ISR            0x13
+#define VIRTIO_CONFIG         0x14      // device config, with MSI-X off
+
+#define VIRTIO_ST_ACKNOWLEDGE 0x01
+#define VIRTIO_ST_DRIVER      0x02
+#define VIRTIO_ST_DRIVER_OK   0x04
+#define VIRTIO_ST_FAILED      0x80
+
+#define VIRTIO_ISR_QUEUE      0x01
+
+#define VRING_DESC_F_NEXT         1
+#define VRING_DESC_F_WRITE        2     // device writes this buffer
+#define VRING_AVAIL_F_NO_INTERRUPT 1    // driver: no interrupts wanted for now
+#define VRING_USED_F_NO_NOTIFY    1     // device: no doorbell needed for now
+#define VRING_ALIGN               4096  // legacy: used ring starts on a page
+
+struct vring_desc {
+    unsigned long long addr;
+    unsigned int len;
+    unsigned short flags;
+    unsigned short next;
+};
+
+struct vring_avail {
+    unsigned short flags;
+    unsigned short idx;
+    unsigned short ring[];
+};
+
+struct vring_used_elem {
+    unsigned int id;                    // head of the finished chain
+    unsigned int len;                   // bytes the device wrote
+};
+
+struct vring_used {
+    unsigned short flags;
+    unsigned short idx;
+    struct vring_used_elem ring[];
+};
+
+struct virtqueue {
+    unsigned short io;                  // device's BAR0
+    unsigned short index;
+    unsigned int size;                  // descriptors; a power of two
+    struct vring_desc *desc;
+    struct vring_avail *avail;
+    volatile struct vring_used *used;
+    unsigned short free_head, free_count;
+    unsigned short last_used;
+};
+
+// Reset the device and acknowledge it; returns the features both sides
+// support out of 'wanted'
+unsigned int virtio_begin(unsigned short io, unsigned int wanted);
+void virtio_driver_ok(unsigned short io);
+
+// Allocate queue 'index' at the size the device reports and hand it over;
+// 0 if the queue does not exist or memory ran out
+int virtqueue_setup(struct virtqueue *vq, unsigned short io, unsigned short index);
+
+// Take a queue back from a device that never went live and free its ring;
+// a queue that was never set up is left alone
+void virtqueue_release(struct virtqueue *vq);
+
+// Fill descriptor d and return the next free one
+static inline unsigned short virtqueue_fill(struct virtqueue *vq, unsigned short d, const void *buffer,
+                                            unsigned int len, unsigned short flags) {
+    vq->desc[d].addr = (unsigned int)buffer;
+    vq->desc[d].len = len;
+    vq->desc[d].flags = flags;
+    return vq->desc[d].next;
+}
+
+// Put the chain starting at 'head' on the available ring. The slot must
+// be visible before the index that publishes it.
+static inline void virtqueue_publish(struct virtqueue *vq, unsigned short head) {
+    vq->avail->ring[vq->avail->idx & (vq->size - 1)] = head;
+    asm volatile("" ::: "memory");
+    vq->avail->idx++;
+}
+
+static inline int virtqueue_has_used(const struct virtqueue *vq) {
+    return vq->last_used != vq->used->idx;
+}
+
+// Take the next finished chain off the used ring and return its
+// descriptors to the free list; the head comes back in 'head'
+unsigned int virtqueue_pop_used(struct virtqueue *vq, unsigned short *head);
+
+// Doorbell, skipped while the device has NO_NOTIFY set. The full barrier
+// orders the idx store against the flags load.
+void virtqueue_kick(struct virtqueue *vq);
+
+#endif
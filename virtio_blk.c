@@ -0,0 +1,183 @@
+#include "kernel.h"
+#include "interrupts.h"
+#include "heap.h"
+#include "pci.h"
+#include "block.h"
+#include "virtio.h"
+#include "virtio_blk.h"
+
+#define VIRTIO_BLK_DEVICE 0x1001        // transitional device ID
+
+// virtio-blk config space and features
+#define VIRTIO_BLK_CAPACITY   0x00      // 64-bit, in 512-byte sectors
+#define VIRTIO_BLK_SEG_MAX    0x0C
+#define VIRTIO_BLK_F_SEG_MAX  (1 << 2)
+
+#define VIRTIO_BLK_T_IN   0
+#define VIRTIO_BLK_T_OUT  1
+#define VIRTIO_BLK_S_OK   0
+
+#define VIRTIO_BLK_MAX_SECTORS  256
+#define VIRTIO_BLK_MAX_SEGMENTS 16
+
+struct virtio_blk_header {
+    unsigned int type;
+    unsigned int reserved;
+    unsigned long long sector;
+};
+
+struct virtio_blk {
+    struct block_device dev;
+    unsigned short io;
+    unsigned char irq;
+    struct spinlock lock;               // queue and chain state below
+    struct virtqueue vq;
+    // Per chain, indexed by its head descriptor
+    struct virtio_blk_header *headers;
+    unsigned char *status;
+    struct block_request **owner;
+};
+
+static struct virtio_blk *disks[VIRTIO_BLK_MAX_DEVICES];
+static unsigned int disk_count = 0;
+
+// ============================================================================
+// VIRTQUEUE
+// ============================================================================
+
+// Called by the block layer with the device lock held, interrupts off
+static int virtio_blk_start(struct block_device *dev, struct block_request *req) {
+    struct virtio_blk *vb = dev->driver_data;
+    unsigned int segments = 0;
+    for (const struct block_request *r = req; r; r = r->merged) segments++;
+
+    struct virtqueue *vq = &vb->vq;
+    spin_lock(&vb->lock);
+    if (vq->free_count < segments + 2) {
+        spin_unlock(&vb->lock);
+        return BLOCK_BUSY;
+    }
+    unsigned short head = vq->free_head, d = head;
+    struct virtio_blk_header *header = &vb->headers[head];
+    header->type = req->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    header->reserved = 0;
+    header->sector = req->lba;
+    d = virtqueue_fill(vq, d, header, sizeof(*header), VRING_DESC_F_NEXT);
+    unsigned short data_flags = VRING_DESC_F_NEXT | (req->write ? 0 : VRING_DESC_F_WRITE);
+    for (const struct block_request *r = req; r; r = r->merged)
+        d = virtqueue_fill(vq, d, r->buffer, r->count * BLOCK_SECTOR_SIZE, data_flags);
+    vb->status[head] = 0xFF;
+    vq->free_head = virtqueue_fill(vq, d, &vb->status[head], 1, VRING_DESC_F_WRITE);
+    vq->free_count -= segments + 2;
+    vb->owner[head] = req;
+    virtqueue_publish(vq, head);
+    spin_unlock(&vb->lock);
+    return 0;
+}
+
+// One doorbell per dispatch batch, skipped while the device says it is
+// still working through the ring
+static void virtio_blk_commit(struct block_device *dev) {
+    struct virtio_blk *vb = dev->driver_data;
+    virtqueue_kick(&vb->vq);
+}
+
+static const struct block_ops virtio_blk_ops = { virtio_blk_start, virtio_blk_commit };
+
+// Reading the ISR acknowledges and deasserts the interrupt, so it comes
+// first; the used ring is then drained completely
+static void virtio_blk_poll_used(struct virtio_blk *vb) {
+    if (!(inb(vb->io + VIRTIO_ISR) & VIRTIO_ISR_QUEUE)) return;
+    spin_lock(&vb->lock);
+    while (virtqueue_has_used(&vb->vq)) {
+        unsigned short head;
+        virtqueue_pop_used(&vb->vq, &head);
+        struct block_request *req = vb->owner[head];
+        int status = vb->status[head] == VIRTIO_BLK_S_OK ? BLOCK_OK : BLOCK_ERROR;
+
+        // block_complete may start the next command, which takes the lock
+        spin_unlock(&vb->lock);
+        block_complete(req, status);
+        spin_lock(&vb->lock);
+    }
+    spin_unlock(&vb->lock);
+}
+
+static void virtio_blk_irq(struct interrupt_frame *frame) {
+    for (unsigned int i = 0; i < disk_count; i++)
+        if (disks[i]->irq == frame->int_no - IRQ_BASE) virtio_blk_poll_used(disks[i]);
+}
+
+// ============================================================================
+// PROBE
+// ============================================================================
+
+static int setup_queue(struct virtio_blk *vb) {
+    if (!virtqueue_setup(&vb->vq, vb->io, 0)) return 0;
+    unsigned int size = vb->vq.size;
+    vb->headers = kmalloc(size * sizeof(struct virtio_blk_header));
+    vb->status = kmalloc(size);
+    vb->owner = kmalloc(size * sizeof(struct block_request *));
+    if (!vb->headers || !vb->status || !vb->owner) {
+        kfree(vb->headers);
+        kfree(vb->status);
+        kfree(vb->owner);
+        return 0;
+    }
+    return 1;
+}
+
+static void probe_device(struct pci_device *pci) {
+    if (disk_count == VIRTIO_BLK_MAX_DEVICES || !pci->bars[0].is_io || !pci->bars[0].base) return;
+    if (!pci->irq_pin || pci->irq_line >= IRQ_COUNT) return;
+    struct virtio_blk *vb = kmalloc(sizeof(struct virtio_blk));
+    if (!vb) return;
+    memset(vb, 0, sizeof(*vb));
+    vb->io = pci->bars[0].base;
+    vb->irq = pci->irq_line;
+    vb->lock = (struct spinlock)SPINLOCK_INIT;
+    pci_enable(pci, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+    unsigned int features = virtio_begin(vb->io, VIRTIO_BLK_F_SEG_MAX);
+    if (!setup_queue(vb)) {
+        outb(vb->io + VIRTIO_STATUS, VIRTIO_ST_FAILED);
+        virtqueue_release(&vb->vq);
+        kfree(vb);
+        return;
+    }
+
+    struct block_device *dev = &vb->dev;
+    unsigned short config = vb->io + VIRTIO_CONFIG;
+    dev->sectors = inl(config + VIRTIO_BLK_CAPACITY) |
+                   ((unsigned long long)inl(config + VIRTIO_BLK_CAPACITY + 4) << 32);
+    dev->max_segments = VIRTIO_BLK_MAX_SEGMENTS;
+    if (features & VIRTIO_BLK_F_SEG_MAX) {
+        unsigned int seg_max = inl(config + VIRTIO_BLK_SEG_MAX);
+        if (seg_max && seg_max < dev->max_segments) dev->max_segments = seg_max;
+    }
+    dev->max_sectors = VIRTIO_BLK_MAX_SECTORS;
+    // Room for this many single-buffer commands; merged ones take more
+    // descriptors and start() turns them away once the ring is short
+    dev->queue_depth = vb->vq.size / 3;
+    dev->name[0] = 'v';
+    dev->name[1] = 'd';
+    dev->name[2] = 'a' + disk_count;
+    dev->name[3] = '\0';
+    dev->driver = "virtio-blk";
+    ksnprintf(dev->model, sizeof(dev->model), "virtio %02X:%02X.%X, %u descriptors",
+              pci->bus, pci->device, pci->func, vb->vq.size);
+    dev->ops = &virtio_blk_ops;
+    dev->driver_data = vb;
+
+    disks[disk_count++] = vb;
+    block_register(dev);
+    irq_register(vb->irq, virtio_blk_irq);
+    virtio_driver_ok(vb->io);
+}
+
+void virtio_blk_init() {
+    for (unsigned int i = 0; i < pci_device_count(); i++) {
+        struct pci_device *pci = pci_get_device(i);
+        if (pci->vendor_id == VIRTIO_VENDOR && pci->device_id == VIRTIO_BLK_DEVICE) probe_device(pci);
+    }
+}
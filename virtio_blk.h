@@ -0,0 +1,14 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+// virtio-blk over the legacy (transitional) PCI interface (virtio.h):
+// device 1AF4:1001 with one split virtqueue. Each command is a descriptor
+// chain of header, data buffers and status byte; the device interrupts
+// (INTx) after placing finished chains on the used ring. Disks are
+// registered as vda, vdb, ...
+
+#define VIRTIO_BLK_MAX_DEVICES 4
+
+void virtio_blk_init();
+
+#endif
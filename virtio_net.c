@@ -0,0 +1,212 @@
+#include "kernel.h"
+#include "interrupts.h"
+#include "heap.h"
+#include "pci.h"
+#include "net.h"
+#include "virtio.h"
+#include "virtio_net.h"
+
+#define VIRTIO_NET_DEVICE 0x1000        // transitional device ID
+
+// virtio-net config space and features
+#define VIRTIO_NET_MAC    0x00
+#define VIRTIO_NET_F_MAC  (1 << 5)
+
+#define VIRTIO_NET_RX_QUEUE 0
+#define VIRTIO_NET_TX_QUEUE 1
+
+// Legacy header without mergeable buffers; all zero means no offloads
+struct virtio_net_header {
+    unsigned char flags;
+    unsigned char gso_type;
+    unsigned short header_len;
+    unsigned short gso_size;
+    unsigned short csum_start;
+    unsigned short csum_offset;
+} __attribute__((packed));
+
+#define HEADER_SIZE sizeof(struct virtio_net_header)
+
+struct virtio_net {
+    struct net_device dev;
+    unsigned short io;
+    unsigned char irq;
+    struct virtqueue rx, tx;
+    // Per chain, indexed by its head descriptor
+    struct net_buf **rx_owner, **tx_owner;
+    int tx_pending;                     // published since the last kick
+};
+
+static struct virtio_net *nics[VIRTIO_NET_MAX_DEVICES];
+static unsigned int nic_count = 0;
+
+// The header goes in the headroom, right in front of the frame
+static inline struct virtio_net_header *header_of(struct net_buf *buf) {
+    return (struct virtio_net_header *)(buf->data - HEADER_SIZE);
+}
+
+static void post_rx(struct virtio_net *vn, struct net_buf *buf) {
+    struct virtqueue *vq = &vn->rx;
+    unsigned short head = vq->free_head;
+    unsigned short d = virtqueue_fill(vq, head, header_of(buf), HEADER_SIZE, VRING_DESC_F_NEXT | VRING_DESC_F_WRITE);
+    vq->free_head = virtqueue_fill(vq, d, buf->data, NET_BUF_SIZE - NET_HEADROOM, VRING_DESC_F_WRITE);
+    vq->free_count -= 2;
+    vn->rx_owner[head] = buf;
+    virtqueue_publish(vq, head);
+}
+
+// ============================================================================
+// NET OPS
+// ============================================================================
+
+static int virtio_net_transmit(struct net_device *dev, struct net_buf *buf) {
+    struct virtio_net *vn = dev->driver_data;
+    struct virtqueue *vq = &vn->tx;
+    if (vq->free_count < 2) return NET_BUSY;
+    struct virtio_net_header *header = header_of(buf);
+    memset(header, 0, HEADER_SIZE);
+    unsigned short head = vq->free_head;
+    unsigned short d = virtqueue_fill(vq, head, header, HEADER_SIZE, VRING_DESC_F_NEXT);
+    vq->free_head = virtqueue_fill(vq, d, buf->data, buf->len, 0);
+    vq->free_count -= 2;
+    vn->tx_owner[head] = buf;
+    virtqueue_publish(vq, head);
+    vn->tx_pending = 1;
+    return 0;
+}
+
+static void virtio_net_commit(struct net_device *dev) {
+    struct virtio_net *vn = dev->driver_data;
+    if (!vn->tx_pending) return;
+    vn->tx_pending = 0;
+    virtqueue_kick(&vn->tx);
+}
+
+// Same buffer policy as e1000: a frame goes up only when a fresh buffer
+// can replace it on the ring
+static int virtio_net_poll(struct net_device *dev, int budget) {
+    struct virtio_net *vn = dev->driver_data;
+    unsigned short head;
+    while (virtqueue_has_used(&vn->tx)) {
+        virtqueue_pop_used(&vn->tx, &head);
+        net_buf_free(vn->tx_owner[head]);
+    }
+
+    int received = 0;
+    while (received < budget && virtqueue_has_used(&vn->rx)) {
+        unsigned int len = virtqueue_pop_used(&vn->rx, &head);
+        struct net_buf *buf = vn->rx_owner[head];
+        struct net_buf *fresh = net_buf_alloc();
+        if (!fresh || len <= HEADER_SIZE) {
+            dev->stats.rx_dropped++;
+            if (fresh) net_buf_free(fresh);
+            post_rx(vn, buf);
+        } else {
+            buf->len = len - HEADER_SIZE;
+            post_rx(vn, fresh);
+            net_receive(dev, buf);
+        }
+        received++;
+    }
+    if (received) virtqueue_kick(&vn->rx);
+    return received;
+}
+
+// The full barrier orders the flag store against the used index load, so
+// a frame that arrived just before is seen here or raises an interrupt
+static int virtio_net_irq_enable(struct net_device *dev) {
+    struct virtio_net *vn = dev->driver_data;
+    vn->rx.avail->flags = 0;
+    asm volatile("lock; addl $0, (%%esp)" ::: "memory");
+    return virtqueue_has_used(&vn->rx);
+}
+
+static const struct net_ops virtio_net_ops = {
+    virtio_net_transmit, virtio_net_commit, virtio_net_poll, virtio_net_irq_enable
+};
+
+// Reading the ISR acknowledges the interrupt
+static void virtio_net_irq(struct interrupt_frame *frame) {
+    for (unsigned int i = 0; i < nic_count; i++) {
+        struct virtio_net *vn = nics[i];
+        if (vn->irq != frame->int_no - IRQ_BASE || !(inb(vn->io + VIRTIO_ISR) & VIRTIO_ISR_QUEUE)) continue;
+        vn->rx.avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+        net_schedule(&vn->dev);
+    }
+}
+
+// ============================================================================
+// PROBE
+// ============================================================================
+
+static int setup_queues(struct virtio_net *vn) {
+    if (!virtqueue_setup(&vn->rx, vn->io, VIRTIO_NET_RX_QUEUE) ||
+        !virtqueue_setup(&vn->tx, vn->io, VIRTIO_NET_TX_QUEUE))
+        return 0;
+    vn->rx_owner = kmalloc(vn->rx.size * sizeof(struct net_buf *));
+    vn->tx_owner = kmalloc(vn->tx.size * sizeof(struct net_buf *));
+    if (!vn->rx_owner || !vn->tx_owner) return 0;
+    memset(vn->rx_owner, 0, vn->rx.size * sizeof(struct net_buf *));
+    vn->tx.avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+    while (vn->rx.free_count >= 2) {
+        struct net_buf *buf = net_buf_alloc();
+        if (!buf) return 0;
+        post_rx(vn, buf);
+    }
+    return 1;
+}
+
+static void probe_device(struct pci_device *pci) {
+    if (nic_count == VIRTIO_NET_MAX_DEVICES || !pci->bars[0].is_io || !pci->bars[0].base) return;
+    if (!pci->irq_pin || pci->irq_line >= IRQ_COUNT) return;
+    struct virtio_net *vn = kmalloc(sizeof(struct virtio_net));
+    if (!vn) return;
+    memset(vn, 0, sizeof(*vn));
+    vn->io = pci->bars[0].base;
+    vn->irq = pci->irq_line;
+    pci_enable(pci, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+    // The receive queue is never kicked before DRIVER_OK, so on failure
+    // the device has not touched the posted buffers
+    unsigned int features = virtio_begin(vn->io, VIRTIO_NET_F_MAC);
+    if (!setup_queues(vn)) {
+        outb(vn->io + VIRTIO_STATUS, VIRTIO_ST_FAILED);
+        for (unsigned int i = 0; vn->rx_owner && i < vn->rx.size; i++)
+            if (vn->rx_owner[i]) net_buf_free(vn->rx_owner[i]);
+        kfree(vn->rx_owner);
+        kfree(vn->tx_owner);
+        virtqueue_release(&vn->rx);
+        virtqueue_release(&vn->tx);
+        kfree(vn);
+        return;
+    }
+
+    struct net_device *dev = &vn->dev;
+    if (features & VIRTIO_NET_F_MAC) {
+        for (int i = 0; i < 6; i++) dev->mac[i] = inb(vn->io + VIRTIO_CONFIG + VIRTIO_NET_MAC + i);
+    } else {
+        // Locally administered address derived from the PCI location
+        static const unsigned char base[6] = { 0x52, 0x54, 0x00, 0x00, 0x00, 0x00 };
+        memcpy(dev->mac, base, 6);
+        dev->mac[4] = pci->bus;
+        dev->mac[5] = (pci->device << 3) | pci->func;
+    }
+    dev->driver = "virtio-net";
+    ksnprintf(dev->model, sizeof(dev->model), "virtio %02X:%02X.%X, %u/%u descriptors",
+              pci->bus, pci->device, pci->func, vn->rx.size, vn->tx.size);
+    dev->ops = &virtio_net_ops;
+    dev->driver_data = vn;
+
+    nics[nic_count++] = vn;
+    net_register(dev);
+    irq_register(vn->irq, virtio_net_irq);
+    virtio_driver_ok(vn->io);
+    virtqueue_kick(&vn->rx);
+}
+
+void virtio_net_init() {
+    for (unsigned int i = 0; i < pci_device_count(); i++) {
+        struct pci_device *pci = pci_get_device(i);
+        if (pci->vendor_id == VIRTIO_VENDOR && pci->device_id == VIRTIO_NET_DEVICE) probe_device(pci);
+    }
+}
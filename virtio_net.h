@@ -0,0 +1,15 @@
+#ifndef VIRTIO_NET_H
+#define VIRTIO_NET_H
+
+// virtio-net over the legacy PCI interface (virtio.h): device 1AF4:1000
+// with a receive queue (0) and a transmit queue (1). Every packet is a
+// two-descriptor chain, the 10-byte virtio-net header in the buffer's
+// headroom followed by the frame, so frames need no copying. Transmit
+// completions never interrupt; the receive queue's interrupt is
+// suppressed through the available ring flags while the device is polled.
+
+#define VIRTIO_NET_MAX_DEVICES 2
+
+void virtio_net_init();
+
+#endif